@@ -13,6 +13,8 @@
 #include <Math/Matrix.h>
 #include <Math/Vector.h>
 #include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
 #include <Logging/Logger.h>
 #include <Renderers/IRenderer.h>
 
@@ -21,6 +23,8 @@ namespace Display {
 namespace OpenGL {
     using Math::Matrix;
     using Math::Vector;
+    using Renderers::OpenGL::TextureUnitCache;
+    using Renderers::OpenGL::GLStateCache;
 
 BlendCanvas::BlendCanvas(ICanvasBackend* backend)
     : ICanvas(backend)
@@ -69,7 +73,7 @@ void BlendCanvas::Handle(Display::ProcessEventArg arg) {
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     
     Vector<4,int> d(0, 0, arg.canvas.GetWidth(), arg.canvas.GetHeight());
-    glViewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
+    GLStateCache::Viewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
     OrthogonalViewingVolume volume(-1, 1, 0, arg.canvas.GetWidth(), 0, arg.canvas.GetHeight());
 
     // Select The Projection Matrix
@@ -104,21 +108,19 @@ void BlendCanvas::Handle(Display::ProcessEventArg arg) {
     glMultMatrixf(f);
     CHECK_FOR_GL_ERROR();
         
-    GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
-    GLboolean lighting = glIsEnabled(GL_LIGHTING);
-    GLboolean blending = glIsEnabled(GL_BLEND);
-    GLboolean texture = glIsEnabled(GL_TEXTURE_2D);
-    GLint texenv;
-    glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &texenv);
+    // save the state changed below
+    GLStateCache::Push();
+    // fixed function texturing uses unit 0.
+    TextureUnitCache::Active(0);
     // glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_BLEND);
-    glEnable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_DEPTH_TEST);
+    GLStateCache::Disable(GL_LIGHTING);
+    GLStateCache::Disable(GL_BLEND);
+    GLStateCache::Enable(GL_TEXTURE_2D);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLStateCache::Enable(GL_BLEND);
+    GLStateCache::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         
     list<Element>::iterator itr = elements.begin();
     for (; itr != elements.end(); ++itr) {
@@ -130,7 +132,7 @@ void BlendCanvas::Handle(Display::ProcessEventArg arg) {
         int w = tex->GetWidth();
         int h = tex->GetHeight();
             
-        glBindTexture(GL_TEXTURE_2D, tex->GetID());
+        TextureUnitCache::Bind(GL_TEXTURE_2D, tex->GetID());
         CHECK_FOR_GL_ERROR();
         glColor4f(e.color[0],e.color[1], e.color[2], e.color[3]);
         glBegin(GL_QUADS);
@@ -145,7 +147,7 @@ void BlendCanvas::Handle(Display::ProcessEventArg arg) {
         glEnd();
     }
 
-    glDisable(GL_BLEND);
+    GLStateCache::Disable(GL_BLEND);
  
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
@@ -153,11 +155,7 @@ void BlendCanvas::Handle(Display::ProcessEventArg arg) {
     glMatrixMode(GL_MODELVIEW);
     glPopMatrix();
     CHECK_FOR_GL_ERROR();
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, texenv);
-    if (depth)    glEnable(GL_DEPTH_TEST);
-    if (lighting) glEnable(GL_LIGHTING);
-    if (blending) glEnable(GL_BLEND);
-    if (!texture) glDisable(GL_TEXTURE_2D);
+    GLStateCache::Pop();
 
     backend->Post();
 }
@@ -13,11 +13,16 @@
 #include <Display/ViewingVolume.h>
 #include <Display/OrthogonalViewingVolume.h>
 #include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
 
 namespace OpenEngine {
 namespace Display {
 namespace OpenGL {
 
+using Renderers::OpenGL::TextureUnitCache;
+using Renderers::OpenGL::GLStateCache;
+
 ColorStereoCanvas::ColorStereoCanvas(ICanvasBackend* backend)
     : IRenderCanvas(backend)
     , dummyCam(new ViewingVolume())
@@ -55,7 +60,7 @@ void ColorStereoCanvas::Handle(Display::ProcessEventArg arg) {
     unsigned int height = GetHeight();
 
     Vector<4,int> d(0, 0, width, height);
-    glViewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
+    GLStateCache::Viewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
     OrthogonalViewingVolume volume(-1, 1, 0, width, 0, height);
 
     // Select The Projection Matrix
@@ -90,29 +95,27 @@ void ColorStereoCanvas::Handle(Display::ProcessEventArg arg) {
     glMultMatrixf(f);
     CHECK_FOR_GL_ERROR();
         
-    bool depth = glIsEnabled(GL_DEPTH_TEST);
-    GLboolean lighting = glIsEnabled(GL_LIGHTING);
-    GLboolean blending = glIsEnabled(GL_BLEND);
-    GLboolean texture = glIsEnabled(GL_TEXTURE_2D);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_BLEND);
-    glEnable(GL_TEXTURE_2D);
-    GLint texenv;
-    glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &texenv);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    // save the state changed below
+    GLStateCache::Push();
+    // fixed function texturing uses unit 0.
+    TextureUnitCache::Active(0);
+    GLStateCache::Disable(GL_DEPTH_TEST);
+    GLStateCache::Disable(GL_LIGHTING);
+    GLStateCache::Disable(GL_BLEND);
+    GLStateCache::Enable(GL_TEXTURE_2D);
+    GLStateCache::TexEnvMode(GL_REPLACE);
 
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     const float z = 0.0;
-    glColorMask (GL_TRUE, GL_FALSE, GL_FALSE, GL_FALSE);
+    GLStateCache::ColorMask(true, false, false, false);
 
     // glEnable(GL_BLEND);
     // glBlendColor(1.0,0.0,0.0,1.0);
     // glBlendFunc(GL_ZERO, GL_CONSTANT_COLOR);
 
-    glBindTexture(GL_TEXTURE_2D, left->GetTexture()->GetID());
+    TextureUnitCache::Bind(GL_TEXTURE_2D, left->GetTexture()->GetID());
     CHECK_FOR_GL_ERROR();
     glBegin(GL_QUADS);
     // glColor4f(1.0,.0,0.0,.5);
@@ -131,8 +134,8 @@ void ColorStereoCanvas::Handle(Display::ProcessEventArg arg) {
     // glEnable(GL_BLEND);
     // glBlendFunc(GL_SRC_ALPHA, GL_SRC_ALPHA);
     // glBlendEquation(GL_FUNC_ADD);
-    glColorMask (GL_FALSE, GL_TRUE, GL_TRUE, GL_FALSE);
-    glBindTexture(GL_TEXTURE_2D, right->GetTexture()->GetID());
+    GLStateCache::ColorMask(false, true, true, false);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, right->GetTexture()->GetID());
     CHECK_FOR_GL_ERROR();
     glBegin(GL_QUADS);
       //glColor4f(0.0,1.0,1.0,1.0);
@@ -146,8 +149,8 @@ void ColorStereoCanvas::Handle(Display::ProcessEventArg arg) {
       glVertex3f(width, height, z);
     glEnd();
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    GLStateCache::ColorMask(true, true, true, true);
 
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
@@ -156,11 +159,7 @@ void ColorStereoCanvas::Handle(Display::ProcessEventArg arg) {
     glPopMatrix();
     CHECK_FOR_GL_ERROR();
         
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, texenv);
-    if (depth)    glEnable(GL_DEPTH_TEST);
-    if (lighting) glEnable(GL_LIGHTING);
-    if (blending) glEnable(GL_BLEND);
-    if (!texture) glDisable(GL_TEXTURE_2D);
+    GLStateCache::Pop();
 
     backend->Post();
 }
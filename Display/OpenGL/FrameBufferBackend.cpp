@@ -9,6 +9,8 @@
 
 #include <Display/OpenGL/FrameBufferBackend.h>
 #include <Renderers/IRenderer.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Renderers/OpenGL/Renderer.h>
 #include <Resources/FrameBuffer.h>
 #include <Logging/Logger.h>
 
@@ -19,6 +21,8 @@ namespace OpenEngine {
 namespace Display {
 namespace OpenGL {
 
+    using Renderers::OpenGL::GLStateCache;
+
     FrameBufferBackend::FrameBufferBackend(IRenderer* renderer, FrameBuffer* fb)
         : renderer(renderer), prevFb(0), fb(fb) {}
 
@@ -37,19 +41,22 @@ namespace OpenGL {
     }
 
     void FrameBufferBackend::Deinit(){
-
+        // Free the frame buffer object while the context is current.
+        Renderers::OpenGL::Renderer* glRenderer = 
+            dynamic_cast<Renderers::OpenGL::Renderer*>(renderer);
+        if (glRenderer && fb) glRenderer->UnbindFrameBuffer(fb);
     }
 
     void FrameBufferBackend::Pre(){
-        glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prevFb);
-        glGetIntegerv(GL_VIEWPORT, prevDims.ToArray());
+        prevFb = GLStateCache::GetFramebuffer();
+        prevDims = GLStateCache::GetViewport();
 
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fb->GetID());
+        GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, fb->GetID());
         CHECK_FOR_GL_ERROR();
     }
 
     void FrameBufferBackend::Post(){
-        glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, prevFb);
+        GLStateCache::BindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, prevFb);
 
         Vector<2, int> dims = fb->GetDimension();
         glBlitFramebufferEXT(prevDims[0], prevDims[1], prevDims[2], prevDims[3], 
@@ -59,7 +66,7 @@ namespace OpenGL {
 			     0, 0, dims[0], dims[1], 
 			     GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prevFb);
+        GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFb);
         CHECK_FOR_GL_ERROR();
     }
 
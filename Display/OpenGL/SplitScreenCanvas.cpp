@@ -13,6 +13,8 @@
 #include <Math/Matrix.h>
 #include <Math/Vector.h>
 #include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
 #include <Logging/Logger.h>
 
 namespace OpenEngine {
@@ -20,6 +22,8 @@ namespace Display {
 namespace OpenGL {
     using Math::Matrix;
     using Math::Vector;
+    using Renderers::OpenGL::TextureUnitCache;
+    using Renderers::OpenGL::GLStateCache;
 
     SplitScreenCanvas::SplitScreenCanvas(ICanvasBackend* backend, ICanvas& first, ICanvas& second, Split split, float firstPercentage)
         : ICanvas(backend)
@@ -89,7 +93,7 @@ namespace OpenGL {
 
         backend->Pre();
         Vector<4,int> d(0, 0, arg.canvas.GetWidth(), arg.canvas.GetHeight());
-        glViewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
+        GLStateCache::Viewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
         OrthogonalViewingVolume volume(-1, 1, 0, arg.canvas.GetWidth(), 0, arg.canvas.GetHeight());
 
         // Select The Projection Matrix
@@ -124,20 +128,18 @@ namespace OpenGL {
         glMultMatrixf(f);
         CHECK_FOR_GL_ERROR();
         
-        GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
-        GLboolean lighting = glIsEnabled(GL_LIGHTING);
-        GLboolean blending = glIsEnabled(GL_BLEND);
-        GLboolean texture = glIsEnabled(GL_TEXTURE_2D);
-        GLint texenv;
-        glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &texenv);
-        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_LIGHTING);
-        glDisable(GL_BLEND);
-        glEnable(GL_TEXTURE_2D);
-
-        glBindTexture(GL_TEXTURE_2D, first.GetTexture()->GetID());
+        // save the state changed below
+        GLStateCache::Push();
+        // fixed function texturing uses unit 0.
+        TextureUnitCache::Active(0);
+        GLStateCache::TexEnvMode(GL_REPLACE);
+
+        GLStateCache::Disable(GL_DEPTH_TEST);
+        GLStateCache::Disable(GL_LIGHTING);
+        GLStateCache::Disable(GL_BLEND);
+        GLStateCache::Enable(GL_TEXTURE_2D);
+
+        TextureUnitCache::Bind(GL_TEXTURE_2D, first.GetTexture()->GetID());
         CHECK_FOR_GL_ERROR();
         const unsigned int z = 0;
         glBegin(GL_QUADS);
@@ -151,7 +153,7 @@ namespace OpenGL {
         glVertex3i(first.GetWidth(), first.GetHeight(), z);
         glEnd();
 
-        glBindTexture(GL_TEXTURE_2D, second.GetTexture()->GetID());
+        TextureUnitCache::Bind(GL_TEXTURE_2D, second.GetTexture()->GetID());
         CHECK_FOR_GL_ERROR();
         glBegin(GL_QUADS);
         glTexCoord2f(0.0, 0.0);
@@ -164,7 +166,7 @@ namespace OpenGL {
         glVertex3i(GetWidth(), GetHeight(), z);
         glEnd();
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
  
         glMatrixMode(GL_PROJECTION);
         glPopMatrix();
@@ -172,11 +174,7 @@ namespace OpenGL {
         glMatrixMode(GL_MODELVIEW);
         glPopMatrix();
         CHECK_FOR_GL_ERROR();
-        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, texenv);
-        if (depth)    glEnable(GL_DEPTH_TEST);
-        if (lighting) glEnable(GL_LIGHTING);
-        if (blending) glEnable(GL_BLEND);
-        if (!texture) glDisable(GL_TEXTURE_2D);
+        GLStateCache::Pop();
 
         backend->Post();
     }
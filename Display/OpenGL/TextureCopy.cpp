@@ -9,6 +9,7 @@
 
 #include <Display/OpenGL/TextureCopy.h>
 #include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
 
 #include <Logging/Logger.h>
 
@@ -16,6 +17,8 @@ namespace OpenEngine {
 namespace Display {
 namespace OpenGL {
 
+using Renderers::OpenGL::TextureUnitCache;
+
 using namespace Resources;
 
 GLint GLInternalColorFormat(ColorFormat f){
@@ -102,7 +105,7 @@ void TextureCopy::Init(const unsigned int width, const unsigned int height) {
     ctex->height = height;
     glGenTextures(1, &ctex->id);
     CHECK_FOR_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, ctex->id);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, ctex->id);
     CHECK_FOR_GL_ERROR();
     GLenum colorFormat = GLColorFormat(ctex->GetColorFormat());
     GLenum internalFormat = GLInternalColorFormat(ctex->GetColorFormat());
@@ -114,7 +117,7 @@ void TextureCopy::Init(const unsigned int width, const unsigned int height) {
                  ctex->width, ctex->height, 0, colorFormat, 
                  ctex->GetType(), NULL);
     CHECK_FOR_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
 }
 
 void TextureCopy::Deinit() {
@@ -127,11 +130,11 @@ void TextureCopy::Pre() {
 
 void TextureCopy::Post() {
     GLenum colorFormat = GLColorFormat(ctex->GetColorFormat());
-    glBindTexture(GL_TEXTURE_2D, ctex->id);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, ctex->id);
     CHECK_FOR_GL_ERROR();
     glCopyTexImage2D(GL_TEXTURE_2D, 0, colorFormat, 0, 0, ctex->width, ctex->height, 0);
     CHECK_FOR_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
     CHECK_FOR_GL_ERROR();
 }
     
@@ -140,7 +143,7 @@ void TextureCopy::SetDimensions(const unsigned int width, const unsigned int hei
     ctex->height = height;
     if (ctex->id == (unsigned int)-1) return;
     //! @todo: update the texture
-    glBindTexture(GL_TEXTURE_2D, ctex->id);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, ctex->id);
     CHECK_FOR_GL_ERROR();
     GLenum colorFormat = GLColorFormat(ctex->GetColorFormat());
     GLenum internalFormat = GLInternalColorFormat(ctex->GetColorFormat());
@@ -148,7 +151,7 @@ void TextureCopy::SetDimensions(const unsigned int width, const unsigned int hei
                  ctex->width, ctex->height, 0, colorFormat, 
                  ctex->GetType(), NULL);
     CHECK_FOR_GL_ERROR();
-    glBindTexture(GL_TEXTURE_2D, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
 }
 
 ICanvasBackend* TextureCopy::Clone() {
@@ -0,0 +1,414 @@
+// DXT1/DXT5 block compressor.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/DXTCompressor.h>
+#include <Core/Thread.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OE_DXT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+static inline unsigned short To565(int r, int g, int b) {
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+static inline void From565(unsigned short c, int e[3]) {
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    e[0] = (r << 3) | (r >> 2);
+    e[1] = (g << 2) | (g >> 4);
+    e[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * Find the per channel minimum and maximum of the 16 pixels.
+ */
+static inline void BlockBounds(const unsigned char* p,
+                               unsigned char mn[4],
+                               unsigned char mx[4]) {
+#ifdef OE_DXT_SSE2
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(p + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*)(p + 48));
+    __m128i lo = _mm_min_epu8(_mm_min_epu8(a, b), _mm_min_epu8(c, d));
+    __m128i hi = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(c, d));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1,0,3,2)));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1,0,3,2)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+    int l = _mm_cvtsi128_si32(lo), h = _mm_cvtsi128_si32(hi);
+    memcpy(mn, &l, 4);
+    memcpy(mx, &h, 4);
+#else
+    for (unsigned int c = 0; c < 4; ++c)
+        mn[c] = mx[c] = p[c];
+    for (unsigned int i = 1; i < 16; ++i)
+        for (unsigned int c = 0; c < 4; ++c) {
+            unsigned char v = p[i * 4 + c];
+            if (v < mn[c]) mn[c] = v;
+            if (v > mx[c]) mx[c] = v;
+        }
+#endif
+}
+
+/**
+ * Project the colors of the 16 pixels onto a line.
+ *
+ * @param base Start of the line.
+ * @param dir Direction of the line.
+ * @param out Dot products of (pixel - base) and dir.
+ */
+static inline void Project(const unsigned char* p,
+                           const int base[3],
+                           const int dir[3],
+                           int out[16]) {
+#ifdef OE_DXT_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vb = _mm_setr_epi16(base[0], base[1], base[2], 0,
+                                      base[0], base[1], base[2], 0);
+    const __m128i vd = _mm_setr_epi16(dir[0], dir[1], dir[2], 0,
+                                      dir[0], dir[1], dir[2], 0);
+    for (unsigned int i = 0; i < 4; ++i) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(p + i * 16));
+        __m128i l = _mm_sub_epi16(_mm_unpacklo_epi8(px, zero), vb);
+        __m128i h = _mm_sub_epi16(_mm_unpackhi_epi8(px, zero), vb);
+        // rg and b products of each pixel, summed pairwise.
+        l = _mm_madd_epi16(l, vd);
+        h = _mm_madd_epi16(h, vd);
+        l = _mm_add_epi32(l, _mm_srli_epi64(l, 32));
+        h = _mm_add_epi32(h, _mm_srli_epi64(h, 32));
+        __m128i r = _mm_unpacklo_epi64(_mm_shuffle_epi32(l, _MM_SHUFFLE(3,1,2,0)),
+                                       _mm_shuffle_epi32(h, _MM_SHUFFLE(3,1,2,0)));
+        _mm_storeu_si128((__m128i*)(out + i * 4), r);
+    }
+#else
+    for (unsigned int i = 0; i < 16; ++i) {
+        const unsigned char* c = p + i * 4;
+        out[i] = (c[0] - base[0]) * dir[0]
+            + (c[1] - base[1]) * dir[1]
+            + (c[2] - base[2]) * dir[2];
+    }
+#endif
+}
+
+/**
+ * Write the color part of a block. Always uses four color mode.
+ */
+static void ColorBlock(const unsigned char* p,
+                       const unsigned char mn[4],
+                       const unsigned char mx[4],
+                       unsigned char* dest) {
+    // Inset the bounding box to reduce the error of the end points.
+    int lo[3], hi[3];
+    for (unsigned int c = 0; c < 3; ++c) {
+        int inset = (mx[c] - mn[c]) >> 4;
+        lo[c] = mn[c] + inset;
+        hi[c] = mx[c] - inset;
+    }
+    unsigned short c0 = To565(hi[0], hi[1], hi[2]);
+    unsigned short c1 = To565(lo[0], lo[1], lo[2]);
+    if (c0 < c1) {
+        unsigned short t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    unsigned int indices = 0;
+    if (c0 != c1) {
+        int e0[3], e1[3], dir[3];
+        From565(c0, e0);
+        From565(c1, e1);
+        for (unsigned int c = 0; c < 3; ++c)
+            dir[c] = e0[c] - e1[c];
+        const int dd = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+
+        int t[16];
+        Project(p, e1, dir, t);
+        // Map the position along the line to the DXT index order.
+        static const unsigned int order[4] = {1, 3, 2, 0};
+        for (unsigned int i = 0; i < 16; ++i) {
+            int s = t[i] <= 0 ? 0 : (t[i] * 6 + dd) / (2 * dd);
+            if (s > 3) s = 3;
+            indices |= order[s] << (i * 2);
+        }
+    }
+
+    dest[0] = c0 & 0xff;
+    dest[1] = c0 >> 8;
+    dest[2] = c1 & 0xff;
+    dest[3] = c1 >> 8;
+    dest[4] = indices & 0xff;
+    dest[5] = (indices >> 8) & 0xff;
+    dest[6] = (indices >> 16) & 0xff;
+    dest[7] = indices >> 24;
+}
+
+/**
+ * Write the alpha part of a DXT5 block using eight alpha mode.
+ */
+static void AlphaBlock(const unsigned char* p,
+                       unsigned char amin,
+                       unsigned char amax,
+                       unsigned char* dest) {
+    dest[0] = amax;
+    dest[1] = amin;
+    unsigned long long indices = 0;
+    const int range = amax - amin;
+    if (range > 0) {
+        for (unsigned int i = 0; i < 16; ++i) {
+            int s = ((p[i * 4 + 3] - amin) * 14 + range) / (2 * range);
+            unsigned long long idx = s == 7 ? 0 : (s == 0 ? 1 : 8 - s);
+            indices |= idx << (i * 3);
+        }
+    }
+    for (unsigned int i = 0; i < 6; ++i)
+        dest[2 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+/**
+ * Compress a block of 4x4 RGBA pixels to DXT1.
+ */
+void DXTCompressor::CompressDXT1Block(const unsigned char rgba[64],
+                                      unsigned char dest[8]) {
+    unsigned char mn[4], mx[4];
+    BlockBounds(rgba, mn, mx);
+    ColorBlock(rgba, mn, mx, dest);
+}
+
+/**
+ * Compress a block of 4x4 RGBA pixels to DXT5.
+ */
+void DXTCompressor::CompressDXT5Block(const unsigned char rgba[64],
+                                      unsigned char dest[16]) {
+    unsigned char mn[4], mx[4];
+    BlockBounds(rgba, mn, mx);
+    AlphaBlock(rgba, mn[3], mx[3], dest);
+    ColorBlock(rgba, mn, mx, dest + 8);
+}
+
+/**
+ * Copy a block to RGBA order, clamping at the image edges.
+ */
+static inline void ExtractBlock(const unsigned char* src,
+                                unsigned int width, unsigned int height,
+                                unsigned int channels, bool bgr,
+                                unsigned int bx, unsigned int by,
+                                unsigned char out[64]) {
+    const unsigned int r = bgr ? 2 : 0, b = bgr ? 0 : 2;
+    for (unsigned int y = 0; y < 4; ++y) {
+        unsigned int sy = by * 4 + y;
+        if (sy >= height) sy = height - 1;
+        for (unsigned int x = 0; x < 4; ++x) {
+            unsigned int sx = bx * 4 + x;
+            if (sx >= width) sx = width - 1;
+            const unsigned char* p = src + (sy * width + sx) * channels;
+            unsigned char* o = out + (y * 4 + x) * 4;
+            o[0] = p[r];
+            o[1] = p[1];
+            o[2] = p[b];
+            o[3] = channels == 4 ? p[3] : 255;
+        }
+    }
+}
+
+/**
+ * Compresses a range of block rows.
+ */
+class DXTWorker : public Core::Thread {
+public:
+    const unsigned char* src;
+    unsigned int width, height, channels;
+    bool bgr;
+    unsigned char* dest;
+    unsigned int first, last;
+
+    void Run() {
+        const unsigned int blocksX = (width + 3) / 4;
+        const unsigned int blockSize = channels == 4 ? 16 : 8;
+        unsigned char block[64];
+        for (unsigned int by = first; by < last; ++by) {
+            unsigned char* out = dest + by * blocksX * blockSize;
+            for (unsigned int bx = 0; bx < blocksX; ++bx, out += blockSize) {
+                ExtractBlock(src, width, height, channels, bgr, bx, by, block);
+                if (channels == 4)
+                    DXTCompressor::CompressDXT5Block(block, out);
+                else
+                    DXTCompressor::CompressDXT1Block(block, out);
+            }
+        }
+    }
+};
+
+/**
+ * Get the size of a compressed image.
+ *
+ * @return Size in bytes.
+ */
+unsigned int DXTCompressor::CompressedSize(unsigned int width,
+                                           unsigned int height,
+                                           unsigned int channels) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * (channels == 4 ? 16 : 8);
+}
+
+/**
+ * Compress an image. Three channel images become DXT1, four channel
+ * images DXT5.
+ *
+ * @param src Pixels with three or four byte channels.
+ * @param bgr True if the red and blue channels are swapped.
+ * @param dest Destination of CompressedSize bytes.
+ * @param threads Number of threads, zero for one per processor.
+ * @return Number of bytes written.
+ */
+unsigned int DXTCompressor::Compress(const unsigned char* src,
+                                     unsigned int width,
+                                     unsigned int height,
+                                     unsigned int channels,
+                                     bool bgr,
+                                     unsigned char* dest,
+                                     unsigned int threads) {
+    if (width == 0 || height == 0) return 0;
+    const unsigned int blocksY = (height + 3) / 4;
+    if (threads == 0) threads = DefaultThreads();
+    if (threads > blocksY) threads = blocksY;
+
+    std::vector<DXTWorker*> workers(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        DXTWorker* w = workers[i] = new DXTWorker();
+        w->src = src;
+        w->width = width;
+        w->height = height;
+        w->channels = channels;
+        w->bgr = bgr;
+        w->dest = dest;
+        w->first = blocksY * i / threads;
+        w->last = blocksY * (i + 1) / threads;
+    }
+    // The calling thread takes the first share.
+    for (unsigned int i = 1; i < threads; ++i)
+        workers[i]->Start();
+    workers[0]->Run();
+    for (unsigned int i = 1; i < threads; ++i)
+        workers[i]->Wait();
+    for (unsigned int i = 0; i < threads; ++i)
+        delete workers[i];
+
+    return CompressedSize(width, height, channels);
+}
+
+/**
+ * Halve an image with a box filter. Dimensions of one are kept. The
+ * last pixel of an odd row or column is averaged into the last
+ * destination pixel, so no source pixel is dropped.
+ *
+ * @param dest Destination of max(width/2,1) x max(height/2,1) pixels.
+ */
+void DXTCompressor::Downsample(const unsigned char* src,
+                               unsigned int width,
+                               unsigned int height,
+                               unsigned int channels,
+                               unsigned char* dest) {
+    const unsigned int nw = width > 1 ? width / 2 : 1;
+    const unsigned int nh = height > 1 ? height / 2 : 1;
+    for (unsigned int y = 0; y < nh; ++y) {
+        const unsigned int y0 = y * height / nh;
+        const unsigned int y1 = (y + 1) * height / nh;
+        for (unsigned int x = 0; x < nw; ++x) {
+            const unsigned int x0 = x * width / nw;
+            const unsigned int x1 = (x + 1) * width / nw;
+            const unsigned int count = (y1 - y0) * (x1 - x0);
+            for (unsigned int c = 0; c < channels; ++c) {
+                unsigned int sum = 0;
+                for (unsigned int sy = y0; sy < y1; ++sy)
+                    for (unsigned int sx = x0; sx < x1; ++sx)
+                        sum += src[(sy * width + sx) * channels + c];
+                dest[(y * nw + x) * channels + c] = (sum + count / 2) / count;
+            }
+        }
+    }
+}
+
+/**
+ * Get the number of processors.
+ */
+unsigned int DXTCompressor::DefaultThreads() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count < 1) return 1;
+    if (count > 16) return 16;
+    return count;
+}
+
+/**
+ * Measure the compression speed on a synthetic image and log it.
+ *
+ * @param channels Three for DXT1, four for DXT5.
+ * @param threads Number of threads, zero for one per processor.
+ * @param iterations Number of times the image is compressed.
+ * @return Megapixels per second.
+ */
+float DXTCompressor::Benchmark(unsigned int width,
+                               unsigned int height,
+                               unsigned int channels,
+                               unsigned int threads,
+                               unsigned int iterations) {
+    std::vector<unsigned char> image(width * height * channels);
+    std::vector<unsigned char> blocks(CompressedSize(width, height, channels));
+    // Gradients with some noise.
+    unsigned int seed = 1;
+    for (unsigned int y = 0; y < height; ++y)
+        for (unsigned int x = 0; x < width; ++x) {
+            unsigned char* p = &image[(y * width + x) * channels];
+            seed = seed * 1103515245 + 12345;
+            unsigned int noise = (seed >> 16) & 15;
+            p[0] = (x * 255 / width + noise) & 0xff;
+            p[1] = (y * 255 / height + noise) & 0xff;
+            p[2] = ((x + y) * 127 / (width + height) + noise) & 0xff;
+            if (channels == 4) p[3] = (x ^ y) & 0xff;
+        }
+
+    Utils::Timer timer;
+    timer.Start();
+    for (unsigned int i = 0; i < iterations; ++i)
+        Compress(&image[0], width, height, channels, false, &blocks[0], threads);
+    double usecs = (double)timer.GetElapsedTime().AsInt();
+    if (usecs <= 0.0) usecs = 1.0;
+    float mps = (float)(width * height * (double)iterations / usecs);
+
+    logger.info << "DXT" << (channels == 4 ? 5 : 1) << " compression: "
+                << width << "x" << height << " with "
+                << (threads == 0 ? DefaultThreads() : threads)
+                << " threads, " << mps << " megapixels/s" << logger.end;
+    return mps;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,69 @@
+// DXT1/DXT5 block compressor.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_DXT_COMPRESSOR_H_
+#define _OPENGL_DXT_COMPRESSOR_H_
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Compresses RGB and RGBA images to DXT1 (BC1) and DXT5 (BC3)
+ * blocks on the cpu.
+ *
+ * Endpoints are taken from the inset bounding box of the block
+ * colors and every pixel is projected onto the line between them.
+ * The block bounds and projections use SSE2 when available. Images
+ * are split into rows of blocks compressed by a number of threads.
+ *
+ * Images with three channels are compressed to DXT1, images with
+ * four channels to DXT5.
+ *
+ * @class DXTCompressor DXTCompressor.h Renderers/OpenGL/DXTCompressor.h
+ */
+class DXTCompressor {
+public:
+    static unsigned int CompressedSize(unsigned int width,
+                                       unsigned int height,
+                                       unsigned int channels);
+
+    static unsigned int Compress(const unsigned char* src,
+                                 unsigned int width,
+                                 unsigned int height,
+                                 unsigned int channels,
+                                 bool bgr,
+                                 unsigned char* dest,
+                                 unsigned int threads = 0);
+
+    static void CompressDXT1Block(const unsigned char rgba[64],
+                                  unsigned char dest[8]);
+    static void CompressDXT5Block(const unsigned char rgba[64],
+                                  unsigned char dest[16]);
+
+    static void Downsample(const unsigned char* src,
+                           unsigned int width,
+                           unsigned int height,
+                           unsigned int channels,
+                           unsigned char* dest);
+
+    static unsigned int DefaultThreads();
+
+    static float Benchmark(unsigned int width = 2048,
+                           unsigned int height = 2048,
+                           unsigned int channels = 4,
+                           unsigned int threads = 0,
+                           unsigned int iterations = 4);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_DXT_COMPRESSOR_H_
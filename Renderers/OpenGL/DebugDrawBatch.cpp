@@ -0,0 +1,189 @@
+// Batched debug geometry.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/DebugDrawBatch.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Math/Math.h>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+// Tessellation matching the immediate mode gluSphere.
+static const unsigned int SPHERE_SLICES = 10;
+static const unsigned int SPHERE_STACKS = 10;
+
+DebugDrawBatch::DebugDrawBatch()
+    : open(false)
+    , buffer(0) {
+    for (unsigned int i = 0; i < 16; ++i)
+        modelView[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+}
+
+DebugDrawBatch::~DebugDrawBatch() {}
+
+/**
+ * Drop the collected geometry and delete the vertex buffer. Must be
+ * called while the OpenGL context is current.
+ */
+void DebugDrawBatch::Clear() {
+    lines.clear();
+    points.clear();
+    open = false;
+    if (buffer != 0) {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+}
+
+/**
+ * Open the batch. Geometry added is collected until End is called.
+ *
+ * @param modelView Modelview matrix of the following geometry.
+ */
+void DebugDrawBatch::Begin(Matrix<4,4,float> modelView) {
+    open = true;
+    SetTransform(modelView);
+}
+
+bool DebugDrawBatch::IsOpen() {
+    return open;
+}
+
+/**
+ * Set the modelview matrix used to transform the geometry added
+ * from now on.
+ *
+ * @param modelView Modelview matrix.
+ */
+void DebugDrawBatch::SetTransform(Matrix<4,4,float> modelView) {
+    modelView.ToArray(this->modelView);
+}
+
+void DebugDrawBatch::Add(VertexList& list, const Vector<3,float>& p,
+                         const Vector<3,float>& color) {
+    // column major transformation to eye space.
+    const float* m = modelView;
+    Vertex v;
+    v.pos[0] = m[0] * p[0] + m[4] * p[1] + m[8]  * p[2] + m[12];
+    v.pos[1] = m[1] * p[0] + m[5] * p[1] + m[9]  * p[2] + m[13];
+    v.pos[2] = m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14];
+    v.color[0] = color[0];
+    v.color[1] = color[1];
+    v.color[2] = color[2];
+    list.push_back(v);
+}
+
+void DebugDrawBatch::AddLine(Vector<3,float> p1, Vector<3,float> p2,
+                             Vector<3,float> color, float width) {
+    VertexList& list = lines[width];
+    Add(list, p1, color);
+    Add(list, p2, color);
+}
+
+void DebugDrawBatch::AddPoint(Vector<3,float> point, Vector<3,float> color, float size) {
+    Add(points[size], point, color);
+}
+
+/**
+ * Add a wire frame sphere as line segments along its meridians and
+ * parallels.
+ */
+void DebugDrawBatch::AddSphere(Vector<3,float> center, float radius, Vector<3,float> color) {
+    VertexList& list = lines[1.0f];
+    Vector<3,float> ring[SPHERE_STACKS + 1][SPHERE_SLICES];
+    for (unsigned int i = 0; i <= SPHERE_STACKS; ++i) {
+        float phi = Math::PI * i / SPHERE_STACKS;
+        float z = cos(phi) * radius, r = sin(phi) * radius;
+        for (unsigned int j = 0; j < SPHERE_SLICES; ++j) {
+            float theta = 2 * Math::PI * j / SPHERE_SLICES;
+            ring[i][j] = center + Vector<3,float>(sin(theta) * r, cos(theta) * r, z);
+        }
+    }
+    for (unsigned int i = 0; i < SPHERE_STACKS; ++i) {
+        for (unsigned int j = 0; j < SPHERE_SLICES; ++j) {
+            // meridian segment
+            Add(list, ring[i][j], color);
+            Add(list, ring[i+1][j], color);
+            // parallel segment, the poles collapse to a point.
+            if (i == 0) continue;
+            Add(list, ring[i][j], color);
+            Add(list, ring[i][(j+1) % SPHERE_SLICES], color);
+        }
+    }
+}
+
+void DebugDrawBatch::Draw(Batches& batches, GLenum mode, bool useBuffer) {
+    for (Batches::iterator itr = batches.begin(); itr != batches.end(); ++itr) {
+        VertexList& list = itr->second;
+        if (list.empty()) continue;
+
+        if (mode == GL_POINTS) glPointSize(itr->first);
+        else glLineWidth(itr->first);
+
+        const GLsizei stride = sizeof(Vertex);
+        const char* base = (const char*)&list[0];
+        if (useBuffer) {
+            glBufferData(GL_ARRAY_BUFFER, list.size() * stride, base, GL_STREAM_DRAW);
+            base = NULL;
+        }
+        glVertexPointer(3, GL_FLOAT, stride, base);
+        glColorPointer(3, GL_FLOAT, stride, base + 3 * sizeof(float));
+        glDrawArrays(mode, 0, list.size());
+        CHECK_FOR_GL_ERROR();
+
+        // keep the capacity for the next frame.
+        list.clear();
+    }
+}
+
+/**
+ * Draw the collected geometry and close the batch.
+ *
+ * @param useBuffer Stream the vertices through a vertex buffer
+ *                  object instead of client memory.
+ */
+void DebugDrawBatch::End(bool useBuffer) {
+    open = false;
+
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_LIGHTING);
+
+    // the vertices are in eye space.
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    CHECK_FOR_GL_ERROR();
+
+    if (useBuffer) {
+        if (buffer == 0) glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    }
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    CHECK_FOR_GL_ERROR();
+
+    Draw(lines, GL_LINES, useBuffer);
+    Draw(points, GL_POINTS, useBuffer);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    if (useBuffer) glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopMatrix();
+    CHECK_FOR_GL_ERROR();
+
+    GLStateCache::Pop();
+    CHECK_FOR_GL_ERROR();
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,83 @@
+// Batched debug geometry.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_DEBUG_DRAW_BATCH_H_
+#define _OPENGL_DEBUG_DRAW_BATCH_H_
+
+#include <Meta/OpenGL.h>
+#include <Math/Vector.h>
+#include <Math/Matrix.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+using Math::Matrix;
+
+/**
+ * Accumulates debug lines and points for the frame.
+ *
+ * The rendering view appends its normal, tangent and binormal lines
+ * here instead of drawing them one glBegin/glEnd at a time. The
+ * vertices are transformed to eye space with the modelview matrix
+ * set by SetTransform, which the rendering view keeps up to date
+ * during traversal. End draws everything with one glDrawArrays per
+ * primitive type and line width or point size.
+ *
+ * The rendering view ends the batch in the frame buffer of the scene
+ * the geometry belongs to, so lines inside a post process node are
+ * depth tested and processed with its scene. The DrawLine, DrawPoint,
+ * DrawSphere and DrawFace methods of the renderer draw immediately.
+ *
+ * @class DebugDrawBatch DebugDrawBatch.h Renderers/OpenGL/DebugDrawBatch.h
+ */
+class DebugDrawBatch {
+private:
+    struct Vertex {
+        float pos[3];
+        float color[3];
+    };
+    typedef std::vector<Vertex> VertexList;
+    // vertex lists keyed by line width or point size.
+    typedef std::map<float, VertexList> Batches;
+
+    Batches lines, points;
+    float modelView[16];
+    bool open;
+    GLuint buffer;
+
+    inline void Add(VertexList& list, const Vector<3,float>& p,
+                    const Vector<3,float>& color);
+    void Draw(Batches& batches, GLenum mode, bool useBuffer);
+
+public:
+    DebugDrawBatch();
+    ~DebugDrawBatch();
+
+    void Clear();
+
+    void Begin(Matrix<4,4,float> modelView);
+    void End(bool useBuffer);
+    bool IsOpen();
+    void SetTransform(Matrix<4,4,float> modelView);
+
+    void AddLine(Vector<3,float> p1, Vector<3,float> p2,
+                 Vector<3,float> color, float width);
+    void AddPoint(Vector<3,float> point, Vector<3,float> color, float size);
+    void AddSphere(Vector<3,float> center, float radius, Vector<3,float> color);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_DEBUG_DRAW_BATCH_H_
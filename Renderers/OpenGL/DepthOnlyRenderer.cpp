@@ -0,0 +1,266 @@
+// Depth only mesh renderer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/DepthOnlyRenderer.h>
+#include <Renderers/OpenGL/MeshLOD.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/MeshNode.h>
+#include <Scene/StaticBatchNode.h>
+#include <Scene/RenderStateNode.h>
+#include <Geometry/Mesh.h>
+#include <Geometry/GeometrySet.h>
+#include <Resources/IDataBlock.h>
+#include <Resources/Indices.h>
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Scene;
+using Geometry::Mesh;
+using Resources::IDataBlock;
+using Resources::Indices;
+
+// Frames a vertex array object is kept after its mesh was last drawn.
+static const unsigned int KEEP_FRAMES = 30;
+
+bool DepthOnlyRenderer::Draw::operator<(const Draw& d) const {
+    if (vertices != d.vertices) return vertices < d.vertices;
+    return indices < d.indices;
+}
+
+DepthOnlyRenderer::DepthOnlyRenderer()
+    : lod(NULL)
+    , projScale(1.0f)
+    , bufferSupport(false)
+    , vaoSupport(false)
+    , binds(0)
+    , frame(0) {}
+
+/**
+ * Destructor. The vertex array objects are not deleted, as the
+ * context may be gone, use Clear while it is current.
+ */
+DepthOnlyRenderer::~DepthOnlyRenderer() {}
+
+/**
+ * Check for vertex array object support. Called by the renderer
+ * when the context is ready.
+ */
+void DepthOnlyRenderer::Initialize(bool bufferSupport) {
+    this->bufferSupport = bufferSupport;
+    vaoSupport = bufferSupport &&
+        (glewIsSupported("GL_VERSION_3_0") ||
+         glewGetExtension("GL_ARB_vertex_array_object") == GL_TRUE);
+}
+
+/**
+ * Start a new frame, deleting the vertex array objects of the meshes
+ * that have not been drawn for a while. Their blocks may be gone and
+ * the addresses reused.
+ */
+void DepthOnlyRenderer::NewFrame() {
+    ++frame;
+    std::map<ArrayKey, Array>::iterator itr = arrays.begin();
+    while (itr != arrays.end()) {
+        if (frame - itr->second.seen > KEEP_FRAMES) {
+            glDeleteVertexArrays(1, &itr->second.vao);
+            arrays.erase(itr++);
+        } else ++itr;
+    }
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Delete the vertex array objects.
+ */
+void DepthOnlyRenderer::Clear() {
+    for (std::map<ArrayKey, Array>::iterator itr = arrays.begin();
+         itr != arrays.end(); ++itr)
+        glDeleteVertexArrays(1, &itr->second.vao);
+    CHECK_FOR_GL_ERROR();
+    arrays.clear();
+    draws.clear();
+}
+
+/**
+ * Add a mesh to draw on the next flush.
+ *
+ * @param mesh Mesh to draw.
+ * @param modelView Column major modelview matrix of the mesh.
+ */
+void DepthOnlyRenderer::Add(Mesh* mesh, const float modelView[16]) {
+    Draw draw;
+    draw.mesh = mesh;
+    draw.vertices = mesh->GetGeometrySet()->GetVertices().get();
+    draw.indices = mesh->GetIndices().get();
+    std::copy(modelView, modelView + 16, draw.modelView);
+    draws.push_back(draw);
+}
+
+/**
+ * Set the modelview matrix at the root of the scene visited next.
+ */
+void DepthOnlyRenderer::Begin(Matrix<4,4,float> modelView) {
+    this->modelView = modelView;
+}
+
+/**
+ * Set the level of detail selection used when visiting a scene.
+ *
+ * @param lod Level of detail selection, NULL for full detail.
+ * @param projScale Projection scale times half the viewport height.
+ */
+void DepthOnlyRenderer::SetMeshLOD(MeshLOD* lod, float projScale) {
+    this->lod = lod;
+    this->projScale = projScale;
+}
+
+/**
+ * Get the vertex array object of a mesh, zero if it has no buffer
+ * objects.
+ */
+GLuint DepthOnlyRenderer::GetArray(const Draw& draw) {
+    GLuint vertexId = draw.vertices->GetID(), indexId = draw.indices->GetID();
+    if (!vaoSupport || vertexId == 0 || indexId == 0) return 0;
+
+    Array& a = arrays[ArrayKey(draw.vertices, draw.indices)];
+    a.seen = frame;
+    if (a.vao != 0 && a.vertexId == vertexId && a.indexId == indexId)
+        return a.vao;
+
+    if (a.vao == 0) glGenVertexArrays(1, &a.vao);
+    a.vertexId = vertexId;
+    a.indexId = indexId;
+    glBindVertexArray(a.vao);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexId);
+    glVertexPointer(draw.vertices->GetDimension(), GL_FLOAT, 0, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexId);
+    CHECK_FOR_GL_ERROR();
+    return a.vao;
+}
+
+/**
+ * Draw the added meshes and forget them.
+ */
+void DepthOnlyRenderer::Flush() {
+    binds = 0;
+    if (draws.empty()) return;
+    std::sort(draws.begin(), draws.end());
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+
+    GLuint vao = 0;
+    bool client = false;
+    IDataBlock* vertices = NULL;
+    Indices* indices = NULL;
+    for (unsigned int i = 0; i < draws.size(); ++i) {
+        Draw& draw = draws[i];
+        if (draw.vertices != vertices || draw.indices != indices) {
+            GLuint next = GetArray(draw);
+            if (next != 0)
+                glBindVertexArray(next);
+            else {
+                if (vao != 0)
+                    glBindVertexArray(0);
+                if (!client) {
+                    glEnableClientState(GL_VERTEX_ARRAY);
+                    client = true;
+                }
+                // Only bind buffers if they are supported
+                GLuint vertexId = draw.vertices->GetID();
+                if (bufferSupport) glBindBuffer(GL_ARRAY_BUFFER, vertexId);
+                glVertexPointer(draw.vertices->GetDimension(), GL_FLOAT, 0,
+                                vertexId != 0 ? 0 : draw.vertices->GetVoidDataPtr());
+                if (bufferSupport) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, draw.indices->GetID());
+            }
+            CHECK_FOR_GL_ERROR();
+            vao = next;
+            vertices = draw.vertices;
+            indices = draw.indices;
+            ++binds;
+        }
+
+        Mesh* mesh = draw.mesh;
+        unsigned int offset = mesh->GetIndexOffset();
+        const GLvoid* data = (indices->GetID() != 0) ?
+            (GLvoid*)(offset * sizeof(GLuint)) :
+            (GLvoid*)(indices->GetData() + offset);
+        glLoadMatrixf(draw.modelView);
+        glDrawElements(mesh->GetType(), mesh->GetDrawingRange(), GL_UNSIGNED_INT, data);
+    }
+    CHECK_FOR_GL_ERROR();
+
+    if (vaoSupport) glBindVertexArray(0);
+    if (client) glDisableClientState(GL_VERTEX_ARRAY);
+    if (bufferSupport) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    glPopMatrix();
+    CHECK_FOR_GL_ERROR();
+    draws.clear();
+}
+
+/**
+ * Get the number of vertex and index buffer changes in the last
+ * flush.
+ */
+unsigned int DepthOnlyRenderer::GetBindCount() {
+    return binds;
+}
+
+void DepthOnlyRenderer::VisitTransformationNode(TransformationNode* node) {
+    Matrix<4,4,float> old = modelView;
+    modelView = node->GetTransformationMatrix() * modelView;
+    node->VisitSubNodes(*this);
+    modelView = old;
+}
+
+void DepthOnlyRenderer::VisitMeshNode(MeshNode* node) {
+    float f[16];
+    modelView.ToArray(f);
+    Add(lod ? lod->Select(node, f, projScale) : node->GetMesh().get(), f);
+    node->VisitSubNodes(*this);
+}
+
+void DepthOnlyRenderer::VisitStaticBatchNode(StaticBatchNode* node) {
+    float f[16];
+    modelView.ToArray(f);
+    const std::vector<Geometry::MeshPtr>& meshes = node->GetMeshes();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+        Mesh* mesh = meshes[i].get();
+        Add(lod ? lod->Select(node, mesh, node->GetBounds(), f, projScale) : mesh, f);
+    }
+    node->VisitSubNodes(*this);
+}
+
+// Wire frames and meshes drawn without depth testing must not hide
+// what is behind them.
+void DepthOnlyRenderer::VisitRenderStateNode(RenderStateNode* node) {
+    if (node->IsOptionEnabled(RenderStateNode::WIREFRAME) ||
+        node->IsOptionDisabled(RenderStateNode::DEPTH_TEST))
+        return;
+    node->VisitSubNodes(*this);
+}
+
+// Transparent meshes must not hide what is behind them.
+void DepthOnlyRenderer::VisitBlendingNode(BlendingNode* node) {}
+
+// Post process nodes render their scenes to their own frame buffers.
+void DepthOnlyRenderer::VisitPostProcessNode(PostProcessNode* node) {}
+
+void DepthOnlyRenderer::VisitRenderNode(RenderNode* node) {}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
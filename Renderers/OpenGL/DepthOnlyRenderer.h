@@ -0,0 +1,111 @@
+// Depth only mesh renderer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_DEPTH_ONLY_RENDERER_H_
+#define _OPENGL_DEPTH_ONLY_RENDERER_H_
+
+#include <Meta/OpenGL.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Math/Matrix.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class Mesh;
+    }
+    namespace Resources {
+        class IDataBlock;
+        class Indices;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+class MeshLOD;
+
+using Math::Matrix;
+
+/**
+ * Draws meshes to the depth buffer only.
+ *
+ * Meshes are added with their modelview matrix and drawn by Flush,
+ * sorted by vertex and index buffer so each is bound once. Only the
+ * vertex positions are used. Meshes whose vertices and indices are
+ * in buffer objects get a vertex array object holding the position
+ * pointer and the index buffer, so drawing them is one bind. Other
+ * meshes point the vertex array into client memory. The vertex array
+ * object of a mesh is built again if its buffer ids change, and
+ * deleted by NewFrame once the mesh has not been drawn for a while.
+ *
+ * The renderer is also a scene visitor collecting the meshes and
+ * static batches of a scene, for a depth pre-pass. The traversal
+ * skips blending and post process nodes, custom render nodes and
+ * render state nodes enabling wire frames or disabling the depth
+ * test, which are drawn as usual in the following pass. Given the
+ * level of detail selection of that pass, it draws the same levels
+ * of the meshes.
+ *
+ * The caller sets the projection, viewport, frame buffer, color mask
+ * and depth state. The modelview matrix is restored by Flush.
+ *
+ * @class DepthOnlyRenderer DepthOnlyRenderer.h Renderers/OpenGL/DepthOnlyRenderer.h
+ */
+class DepthOnlyRenderer : public Scene::ISceneNodeVisitor {
+private:
+    struct Draw {
+        Geometry::Mesh* mesh;
+        Resources::IDataBlock* vertices;
+        Resources::Indices* indices;
+        float modelView[16];
+        bool operator<(const Draw& d) const;
+    };
+    struct Array {
+        GLuint vao, vertexId, indexId;
+        unsigned int seen;
+        Array() : vao(0), vertexId(0), indexId(0), seen(0) {}
+    };
+    typedef std::pair<Resources::IDataBlock*, Resources::Indices*> ArrayKey;
+
+    std::vector<Draw> draws;
+    std::map<ArrayKey, Array> arrays;
+    Matrix<4,4,float> modelView;
+    MeshLOD* lod;
+    float projScale;
+    bool bufferSupport, vaoSupport;
+    unsigned int binds, frame;
+
+    GLuint GetArray(const Draw& draw);
+public:
+    DepthOnlyRenderer();
+    ~DepthOnlyRenderer();
+
+    void Initialize(bool bufferSupport);
+    void NewFrame();
+    void Clear();
+
+    void Add(Geometry::Mesh* mesh, const float modelView[16]);
+    void Begin(Matrix<4,4,float> modelView);
+    void SetMeshLOD(MeshLOD* lod, float projScale);
+    void Flush();
+    unsigned int GetBindCount();
+
+    void VisitTransformationNode(Scene::TransformationNode* node);
+    void VisitMeshNode(Scene::MeshNode* node);
+    void VisitStaticBatchNode(Scene::StaticBatchNode* node);
+    void VisitRenderStateNode(Scene::RenderStateNode* node);
+    void VisitBlendingNode(Scene::BlendingNode* node);
+    void VisitPostProcessNode(Scene::PostProcessNode* node);
+    void VisitRenderNode(Scene::RenderNode* node);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_DEPTH_ONLY_RENDERER_H_
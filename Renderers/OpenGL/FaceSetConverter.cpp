@@ -0,0 +1,245 @@
+// Face set to mesh conversion.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/FaceSetConverter.h>
+
+#include <Renderers/IRenderer.h>
+#include <Meta/OpenGL.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/GeometrySet.h>
+#include <Geometry/Material.h>
+#include <Resources/DataBlock.h>
+#include <Resources/Indices.h>
+#include <cstring>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace OpenEngine::Geometry;
+using namespace OpenEngine::Resources;
+
+// Floats per welded vertex: position, normal, texture coordinate
+// and color.
+static const unsigned int STRIDE = 3 + 3 + 2 + 4;
+
+// FNV-1a over the raw bits of a vertex.
+static unsigned int Hash(const float* v) {
+    const unsigned char* b = (const unsigned char*)v;
+    unsigned int h = 2166136261u;
+    for (unsigned int i = 0; i < STRIDE * sizeof(float); ++i)
+        h = (h ^ b[i]) * 16777619u;
+    return h;
+}
+
+// Frames a face set is kept after it was last drawn.
+static const unsigned int KEEP_FRAMES = 30;
+
+FaceSetConverter::FaceSetConverter()
+    : frame(0) {}
+
+FaceSetConverter::~FaceSetConverter() {}
+
+/**
+ * Start a new frame, forgetting the face sets that have not been
+ * drawn for a while. Must be called while the OpenGL context is
+ * current.
+ */
+void FaceSetConverter::NewFrame() {
+    ++frame;
+    std::map<FaceSet*, Entry>::iterator itr = cache.begin();
+    while (itr != cache.end()) {
+        if (frame - itr->second.seen > KEEP_FRAMES) {
+            Release(itr->second);
+            cache.erase(itr++);
+        } else ++itr;
+    }
+}
+
+/**
+ * Get the meshes of a face set, converting it if it has not been
+ * seen before or its number of faces or its first face changed.
+ *
+ * @param faces Face set to draw.
+ * @param renderer Renderer binding the buffers of new meshes.
+ * @return Meshes, one per material.
+ */
+const std::vector<MeshPtr>& FaceSetConverter::GetMeshes(FaceSet* faces, IRenderer& renderer) {
+    FacePtr first = faces->Size() > 0 ? *faces->begin() : FacePtr();
+    std::map<FaceSet*, Entry>::iterator itr = cache.find(faces);
+    if (itr != cache.end()) {
+        itr->second.seen = frame;
+        if (itr->second.faces == (unsigned int)faces->Size() &&
+            itr->second.first == first)
+            return itr->second.meshes;
+        Release(itr->second);
+    }
+
+    Entry& entry = cache[faces];
+    entry.faces = faces->Size();
+    entry.seen = frame;
+    entry.first = first;
+    entry.meshes = Convert(faces);
+    if (entry.meshes.empty()) return entry.meshes;
+
+    // All meshes share the geometry set and the index block.
+    MeshPtr mesh = entry.meshes.front();
+    GeometrySetPtr geom = mesh->GetGeometrySet();
+    renderer.BindDataBlock(geom->GetVertices().get());
+    renderer.BindDataBlock(geom->GetNormals().get());
+    renderer.BindDataBlock(geom->GetColors().get());
+    IDataBlockList tcs = geom->GetTexCoords();
+    for (IDataBlockList::iterator tc = tcs.begin(); tc != tcs.end(); ++tc)
+        renderer.BindDataBlock(tc->get());
+    renderer.BindDataBlock(mesh->GetIndices().get());
+    return entry.meshes;
+}
+
+/**
+ * Drop the meshes of a face set, it is converted again the next time
+ * it is drawn. Must be called while the OpenGL context is current.
+ */
+void FaceSetConverter::Forget(FaceSet* faces) {
+    std::map<FaceSet*, Entry>::iterator itr = cache.find(faces);
+    if (itr == cache.end()) return;
+    Release(itr->second);
+    cache.erase(itr);
+}
+
+/**
+ * Drop the meshes of all face sets and free their buffers. Must be
+ * called while the OpenGL context is current.
+ */
+void FaceSetConverter::Clear() {
+    std::map<FaceSet*, Entry>::iterator itr;
+    for (itr = cache.begin(); itr != cache.end(); ++itr)
+        Release(itr->second);
+    cache.clear();
+}
+
+// Delete the buffers of the blocks shared by the meshes of an entry.
+void FaceSetConverter::Release(Entry& entry) {
+    if (entry.meshes.empty()) return;
+    MeshPtr mesh = entry.meshes.front();
+    GeometrySetPtr geom = mesh->GetGeometrySet();
+    IDataBlockList blocks = geom->GetTexCoords();
+    blocks.push_back(geom->GetVertices());
+    blocks.push_back(geom->GetNormals());
+    blocks.push_back(geom->GetColors());
+    blocks.push_back(mesh->GetIndices());
+    for (IDataBlockList::iterator itr = blocks.begin(); itr != blocks.end(); ++itr) {
+        GLuint id = *itr ? (*itr)->GetID() : 0;
+        if (id == 0) continue;
+        glDeleteBuffers(1, &id);
+        (*itr)->SetID(0);
+    }
+    entry.meshes.clear();
+}
+
+/**
+ * Convert a face set into meshes, one per material, sharing a
+ * geometry set of welded vertices and an index block.
+ *
+ * @param faces Face set to convert.
+ * @return Meshes in the order their materials first appear.
+ */
+std::vector<MeshPtr> FaceSetConverter::Convert(FaceSet* faces) {
+    std::vector<MeshPtr> meshes;
+    const unsigned int count = faces->Size();
+    if (count == 0) return meshes;
+
+    // Index lists by material, in order of appearance.
+    std::vector<MaterialPtr> materials;
+    std::vector<std::vector<unsigned int> > groups;
+    std::map<Material*, unsigned int> slots;
+
+    // Hash table of the welded vertices, chained through next.
+    unsigned int buckets = 1;
+    while (buckets < count * 3) buckets <<= 1;
+    std::vector<int> head(buckets, -1);
+    std::vector<int> next;
+    std::vector<float> verts;
+    next.reserve(count * 3);
+    verts.reserve(count * 3 * STRIDE);
+
+    for (FaceList::iterator itr = faces->begin(); itr != faces->end(); ++itr) {
+        FacePtr f = *itr;
+        std::map<Material*, unsigned int>::iterator s = slots.find(f->mat.get());
+        unsigned int slot;
+        if (s == slots.end()) {
+            slot = materials.size();
+            slots[f->mat.get()] = slot;
+            materials.push_back(f->mat);
+            groups.push_back(std::vector<unsigned int>());
+        } else
+            slot = s->second;
+
+        for (unsigned int i = 0; i < 3; ++i) {
+            float v[STRIDE];
+            f->vert[i].ToArray(v);
+            f->norm[i].ToArray(v + 3);
+            f->texc[i].ToArray(v + 6);
+            f->colr[i].ToArray(v + 8);
+
+            unsigned int b = Hash(v) & (buckets - 1);
+            int index = head[b];
+            while (index != -1 &&
+                   memcmp(&verts[index * STRIDE], v, sizeof(v)) != 0)
+                index = next[index];
+            if (index == -1) {
+                index = next.size();
+                next.push_back(head[b]);
+                head[b] = index;
+                verts.insert(verts.end(), v, v + STRIDE);
+            }
+            groups[slot].push_back(index);
+        }
+    }
+
+    // Split the welded vertices into blocks.
+    const unsigned int size = next.size();
+    float* pos = new float[size * 3];
+    float* norm = new float[size * 3];
+    float* texc = new float[size * 2];
+    float* colr = new float[size * 4];
+    for (unsigned int i = 0; i < size; ++i) {
+        const float* v = &verts[i * STRIDE];
+        memcpy(pos + i * 3, v, 3 * sizeof(float));
+        memcpy(norm + i * 3, v + 3, 3 * sizeof(float));
+        memcpy(texc + i * 2, v + 6, 2 * sizeof(float));
+        memcpy(colr + i * 4, v + 8, 4 * sizeof(float));
+    }
+    IDataBlockList tcs;
+    tcs.push_back(IDataBlockPtr(new DataBlock<2,float>(size, texc)));
+    GeometrySetPtr geom(new GeometrySet(IDataBlockPtr(new DataBlock<3,float>(size, pos)),
+                                        IDataBlockPtr(new DataBlock<3,float>(size, norm)),
+                                        tcs,
+                                        IDataBlockPtr(new DataBlock<4,float>(size, colr))));
+
+    // Concatenate the groups into one index block.
+    unsigned int* data = new unsigned int[count * 3];
+    unsigned int offset = 0;
+    for (unsigned int g = 0; g < groups.size(); ++g) {
+        memcpy(data + offset, &groups[g][0], groups[g].size() * sizeof(unsigned int));
+        offset += groups[g].size();
+    }
+    IndicesPtr indices(new Indices(count * 3, data));
+
+    offset = 0;
+    for (unsigned int g = 0; g < groups.size(); ++g) {
+        meshes.push_back(MeshPtr(new Mesh(indices, Geometry::TRIANGLES, geom,
+                                          materials[g], offset, groups[g].size())));
+        offset += groups[g].size();
+    }
+    return meshes;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,79 @@
+// Face set to mesh conversion.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_FACE_SET_CONVERTER_H_
+#define _OPENGL_FACE_SET_CONVERTER_H_
+
+#include <Geometry/Mesh.h>
+#include <Geometry/Face.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class FaceSet;
+    }
+    namespace Renderers {
+        class IRenderer;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+using Geometry::FaceSet;
+using Geometry::FacePtr;
+using Geometry::MeshPtr;
+
+/**
+ * Converts face sets into meshes drawn from buffers.
+ *
+ * The faces are welded into one geometry set, identical vertices
+ * sharing an index, and one index block. Faces are grouped by
+ * material with one mesh per material covering a range of the
+ * index block. Faces sharing a material are therefore drawn
+ * together, regardless of their order in the face set.
+ *
+ * GetMeshes converts a face set the first time it is seen, binds the
+ * blocks with the renderer and caches the result. A face set is
+ * converted again when its number of faces or its first face
+ * changes. Faces edited in place must be reported with Forget.
+ * Face sets not drawn for a number of frames are forgotten, so the
+ * buffers of deleted face sets are freed and their addresses can be
+ * reused.
+ *
+ * @class FaceSetConverter FaceSetConverter.h Renderers/OpenGL/FaceSetConverter.h
+ */
+class FaceSetConverter {
+private:
+    struct Entry {
+        unsigned int faces, seen;
+        // held so a new face set at the same address is told apart.
+        FacePtr first;
+        std::vector<MeshPtr> meshes;
+    };
+    std::map<FaceSet*, Entry> cache;
+    unsigned int frame;
+
+    void Release(Entry& entry);
+public:
+    FaceSetConverter();
+    ~FaceSetConverter();
+
+    void NewFrame();
+    const std::vector<MeshPtr>& GetMeshes(FaceSet* faces, IRenderer& renderer);
+    void Forget(FaceSet* faces);
+    void Clear();
+
+    static std::vector<MeshPtr> Convert(FaceSet* faces);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_FACE_SET_CONVERTER_H_
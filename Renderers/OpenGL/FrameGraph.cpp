@@ -0,0 +1,220 @@
+// Frame graph for render passes.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/FrameGraph.h>
+#include <Renderers/OpenGL/RenderTargetPool.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Core/Exceptions.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+FrameGraph::FrameGraph()
+    : culled(0)
+    , compiled(false) {}
+
+FrameGraph::~FrameGraph() {
+    Reset();
+}
+
+/**
+ * Import a frame buffer owned outside the graph.
+ *
+ * @param fbo Frame buffer id, zero for the window.
+ * @param viewport Region of the frame buffer used by the passes.
+ */
+FrameGraph::Resource FrameGraph::Import(GLuint fbo, Vector<4, GLint> viewport) {
+    ResourceEntry e;
+    e.viewport = viewport;
+    e.fbo = fbo;
+    e.colorFormat = e.depthFormat = 0;
+    e.target = NULL;
+    e.retained = false;
+    e.refs = 0;
+    e.first = e.last = -1;
+    resources.push_back(e);
+    return resources.size() - 1;
+}
+
+/**
+ * Create a transient target, which is taken from the render target
+ * pool while the passes using it run.
+ */
+FrameGraph::Resource FrameGraph::Create(int width, int height,
+                                        GLenum colorFormat, GLenum depthFormat) {
+    Resource r = Import(0, Vector<4, GLint>(0, 0, width, height));
+    resources[r].colorFormat = colorFormat;
+    resources[r].depthFormat = depthFormat;
+    return r;
+}
+
+/**
+ * Mark a resource as used after the graph has executed. Passes
+ * contributing to it are never culled.
+ */
+void FrameGraph::Retain(Resource r) {
+    resources[r].retained = true;
+}
+
+/**
+ * Add a pass. Passes execute in the order they are added.
+ *
+ * @param pass The pass, owned by the caller.
+ * @param type How the pass writes its output.
+ * @param write Resource written by the pass.
+ * @return Index of the pass.
+ */
+unsigned int FrameGraph::AddPass(IPass* pass, PassType type, Resource write) {
+#if OE_SAFE
+    if (compiled) throw Core::Exception("Cannot add passes to a compiled frame graph.");
+#endif
+    PassEntry e;
+    e.pass = pass;
+    e.type = type;
+    e.write = write;
+    e.culled = false;
+    passes.push_back(e);
+    return passes.size() - 1;
+}
+
+/**
+ * Declare a resource read by a pass.
+ */
+void FrameGraph::Read(unsigned int pass, Resource r) {
+    passes[pass].reads.push_back(r);
+}
+
+void FrameGraph::Compile() {
+    // count the passes reading each resource.
+    for (unsigned int i = 0; i < passes.size(); ++i)
+        for (unsigned int j = 0; j < passes[i].reads.size(); ++j)
+            ++resources[passes[i].reads[j]].refs;
+
+    // cull from the back so a culled pass releases its inputs
+    // before their producers are considered.
+    culled = 0;
+    for (int i = passes.size() - 1; i >= 0; --i) {
+        PassEntry& p = passes[i];
+        ResourceEntry& out = resources[p.write];
+        if (out.refs > 0 || out.retained) continue;
+        p.culled = true;
+        ++culled;
+        for (unsigned int j = 0; j < p.reads.size(); ++j)
+            --resources[p.reads[j]].refs;
+    }
+
+    // lifetimes of the transient targets.
+    for (unsigned int i = 0; i < passes.size(); ++i) {
+        if (passes[i].culled) continue;
+        std::vector<Resource> used = passes[i].reads;
+        used.push_back(passes[i].write);
+        for (unsigned int j = 0; j < used.size(); ++j) {
+            ResourceEntry& r = resources[used[j]];
+            if (r.first < 0) r.first = i;
+            r.last = i;
+        }
+    }
+    compiled = true;
+}
+
+void FrameGraph::Execute() {
+    if (!compiled) Compile();
+
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    Vector<4, GLint> prevViewport = GLStateCache::GetViewport();
+    GLenum prevDepthFunc = GLStateCache::GetDepthFunc();
+    bool fullscreen = false;
+
+    for (unsigned int i = 0; i < passes.size(); ++i) {
+        PassEntry& p = passes[i];
+        if (p.culled) continue;
+
+        for (unsigned int j = 0; j < resources.size(); ++j) {
+            ResourceEntry& r = resources[j];
+            if (r.first == int(i) && (r.colorFormat != 0 || r.depthFormat != 0))
+                r.target = RenderTargetPool::Acquire(r.viewport[2], r.viewport[3],
+                                                     r.colorFormat, r.depthFormat);
+        }
+
+        // open or close the fullscreen scope, copies keep it open.
+        if (p.type == FULLSCREEN && !fullscreen) {
+            GLStateCache::DepthFunc(GL_ALWAYS);
+            fullscreen = true;
+        } else if (p.type == RENDER && fullscreen) {
+            GLStateCache::DepthFunc(prevDepthFunc);
+            fullscreen = false;
+        }
+
+        if (p.type != COPY) {
+            Vector<4, GLint> v = GetViewport(p.write);
+            GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, GetFramebuffer(p.write));
+            GLStateCache::Viewport(v[0], v[1], v[2], v[3]);
+            CHECK_FOR_GL_ERROR();
+        }
+        p.pass->Execute(*this);
+        CHECK_FOR_GL_ERROR();
+
+        for (unsigned int j = 0; j < resources.size(); ++j) {
+            ResourceEntry& r = resources[j];
+            if (r.last == int(i) && r.target != NULL && !r.retained) {
+                RenderTargetPool::Release(r.target);
+                r.target = NULL;
+            }
+        }
+    }
+
+    if (fullscreen) GLStateCache::DepthFunc(prevDepthFunc);
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+    GLStateCache::Viewport(prevViewport[0], prevViewport[1],
+                           prevViewport[2], prevViewport[3]);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Remove all passes and resources, releasing retained transient
+ * targets.
+ */
+void FrameGraph::Reset() {
+    for (unsigned int i = 0; i < resources.size(); ++i)
+        if (resources[i].target != NULL)
+            RenderTargetPool::Release(resources[i].target);
+    resources.clear();
+    passes.clear();
+    compiled = false;
+}
+
+GLuint FrameGraph::GetFramebuffer(Resource r) {
+    ResourceEntry& e = resources[r];
+    return e.target ? e.target->fbo : e.fbo;
+}
+
+/**
+ * Get the color texture of a transient target, zero for imported
+ * frame buffers.
+ */
+GLuint FrameGraph::GetTexture(Resource r) {
+    ResourceEntry& e = resources[r];
+    return e.target ? e.target->color : 0;
+}
+
+Vector<4, GLint> FrameGraph::GetViewport(Resource r) {
+    return resources[r].viewport;
+}
+
+/**
+ * Get the number of passes culled by the last compile.
+ */
+unsigned int FrameGraph::GetCulledCount() {
+    return culled;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
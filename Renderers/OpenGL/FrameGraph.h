@@ -0,0 +1,118 @@
+// Frame graph for render passes.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_FRAME_GRAPH_H_
+#define _OPENGL_FRAME_GRAPH_H_
+
+#include <Meta/OpenGL.h>
+#include <Math/Vector.h>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+
+struct RenderTarget;
+
+/**
+ * Declarative description of a chain of render passes.
+ *
+ * Passes are added in execution order and declare the resources
+ * they read and the one they write. Resources are either imported
+ * frame buffers, such as the ones owned by the scene, or transient
+ * targets created by the graph.
+ *
+ * Compile culls the passes whose output is never read, starting
+ * from the retained resources, and finds the first and last pass
+ * using each transient target. Execute acquires a transient target
+ * from the render target pool before its first use and releases it
+ * after its last, so targets are reused between passes without the
+ * passes knowing about each other.
+ *
+ * Execute binds the written frame buffer and its viewport before
+ * running a pass. Consecutive fullscreen passes run in one state
+ * scope, with depth testing always passing, and copies may be
+ * placed between them without closing the scope. The bound frame
+ * buffer and viewport are restored when the graph is done.
+ *
+ * @class FrameGraph FrameGraph.h Renderers/OpenGL/FrameGraph.h
+ */
+class FrameGraph {
+public:
+    typedef unsigned int Resource;
+
+    enum PassType {
+        // renders geometry, clearing its output as needed.
+        RENDER,
+        // covers the whole output, no clear is needed.
+        FULLSCREEN,
+        // copies between frame buffers without drawing.
+        COPY
+    };
+
+    /**
+     * A pass in the graph.
+     */
+    class IPass {
+    public:
+        virtual ~IPass() {}
+        virtual void Execute(FrameGraph& graph) = 0;
+    };
+
+private:
+    struct ResourceEntry {
+        Vector<4, GLint> viewport;
+        GLuint fbo;
+        GLenum colorFormat, depthFormat;
+        RenderTarget* target;
+        bool retained;
+        unsigned int refs;
+        int first, last;
+    };
+    struct PassEntry {
+        IPass* pass;
+        PassType type;
+        std::vector<Resource> reads;
+        Resource write;
+        bool culled;
+    };
+    std::vector<ResourceEntry> resources;
+    std::vector<PassEntry> passes;
+    unsigned int culled;
+    bool compiled;
+
+public:
+    FrameGraph();
+    ~FrameGraph();
+
+    Resource Import(GLuint fbo, Vector<4, GLint> viewport);
+    Resource Create(int width, int height, GLenum colorFormat,
+                    GLenum depthFormat = 0);
+    void Retain(Resource r);
+
+    unsigned int AddPass(IPass* pass, PassType type, Resource write);
+    void Read(unsigned int pass, Resource r);
+
+    void Compile();
+    void Execute();
+    void Reset();
+
+    GLuint GetFramebuffer(Resource r);
+    GLuint GetTexture(Resource r);
+    Vector<4, GLint> GetViewport(Resource r);
+    unsigned int GetCulledCount();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_FRAME_GRAPH_H_
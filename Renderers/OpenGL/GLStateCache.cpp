@@ -0,0 +1,419 @@
+// OpenGL state cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+// Zero initialized, so everything starts out unknown.
+GLStateCache::State GLStateCache::state;
+std::vector<GLStateCache::State> GLStateCache::stack;
+
+static const GLenum capabilities[] = {
+    GL_DEPTH_TEST, GL_LIGHTING, GL_BLEND, GL_TEXTURE_2D, GL_CULL_FACE,
+    GL_COLOR_MATERIAL, GL_POLYGON_OFFSET_FILL,
+    GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3,
+    GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7
+};
+
+int GLStateCache::Slot(GLenum cap) {
+    switch (cap) {
+    case GL_DEPTH_TEST:          return 0;
+    case GL_LIGHTING:            return 1;
+    case GL_BLEND:               return 2;
+    case GL_TEXTURE_2D:          return 3;
+    case GL_CULL_FACE:           return 4;
+    case GL_COLOR_MATERIAL:      return 5;
+    case GL_POLYGON_OFFSET_FILL: return 6;
+    default:
+        if (cap >= GL_LIGHT0 && cap <= GL_LIGHT7)
+            return 7 + (cap - GL_LIGHT0);
+        return -1;
+    }
+}
+
+/**
+ * Read state from OpenGL into the shadow.
+ *
+ * @param fields Bitmask of the fields to read.
+ */
+void GLStateCache::Fetch(unsigned int fields) {
+    GLint v;
+    if (fields & BLEND_FUNC) {
+        glGetIntegerv(GL_BLEND_SRC, &v); state.blendSrc = v;
+        glGetIntegerv(GL_BLEND_DST, &v); state.blendDst = v;
+    }
+    if (fields & BLEND_EQUATION) {
+        glGetIntegerv(GL_BLEND_EQUATION_EXT, &v); state.blendEquation = v;
+    }
+    if (fields & DRAW_FB) {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING_EXT, &v); state.drawFb = v;
+    }
+    if (fields & READ_FB) {
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING_EXT, &v); state.readFb = v;
+    }
+    if (fields & VIEWPORT)
+        glGetIntegerv(GL_VIEWPORT, state.viewport);
+    if (fields & POLYGON_MODE) {
+        GLint modes[2];
+        glGetIntegerv(GL_POLYGON_MODE, modes);
+        state.polygonMode[0] = modes[0];
+        state.polygonMode[1] = modes[1];
+    }
+    if (fields & CULL_FACE) {
+        glGetIntegerv(GL_CULL_FACE_MODE, &v); state.cullFace = v;
+    }
+    if (fields & DEPTH_FUNC) {
+        glGetIntegerv(GL_DEPTH_FUNC, &v); state.depthFunc = v;
+    }
+    if (fields & DEPTH_MASK)
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &state.depthMask);
+    if (fields & TEX_ENV_MODE) {
+        TextureUnitCache::Active(0);
+        glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &state.texEnvMode);
+    }
+    if (fields & COLOR_MASK)
+        glGetBooleanv(GL_COLOR_WRITEMASK, state.colorMask);
+    if (fields & POLYGON_OFFSET) {
+        glGetFloatv(GL_POLYGON_OFFSET_FACTOR, &state.polygonOffset[0]);
+        glGetFloatv(GL_POLYGON_OFFSET_UNITS, &state.polygonOffset[1]);
+    }
+    CHECK_FOR_GL_ERROR();
+    state.known |= fields;
+}
+
+void GLStateCache::Enable(GLenum cap) {
+    Set(cap, true);
+}
+
+void GLStateCache::Disable(GLenum cap) {
+    Set(cap, false);
+}
+
+/**
+ * Enable or disable a capability, if it is not already so.
+ *
+ * @param cap OpenGL capability.
+ * @param enable True to enable.
+ */
+void GLStateCache::Set(GLenum cap, bool enable) {
+    int slot = Slot(cap);
+    signed char value = enable ? 2 : 1;
+    if (slot >= 0 && state.caps[slot] == value) return;
+    if (cap == GL_TEXTURE_2D) TextureUnitCache::Active(0);
+    if (enable) glEnable(cap);
+    else glDisable(cap);
+    if (slot >= 0) state.caps[slot] = value;
+}
+
+/**
+ * Test if a capability is enabled. Untracked capabilities are read
+ * from OpenGL.
+ *
+ * @param cap OpenGL capability.
+ * @return True if enabled.
+ */
+bool GLStateCache::IsEnabled(GLenum cap) {
+    int slot = Slot(cap);
+    if (slot >= 0 && state.caps[slot] != 0)
+        return state.caps[slot] == 2;
+    if (cap == GL_TEXTURE_2D) TextureUnitCache::Active(0);
+    bool enabled = glIsEnabled(cap) == GL_TRUE;
+    if (slot >= 0) state.caps[slot] = enabled ? 2 : 1;
+    return enabled;
+}
+
+void GLStateCache::BlendFunc(GLenum src, GLenum dst) {
+    if ((state.known & BLEND_FUNC) &&
+        state.blendSrc == src && state.blendDst == dst) return;
+    glBlendFunc(src, dst);
+    state.blendSrc = src;
+    state.blendDst = dst;
+    state.known |= BLEND_FUNC;
+}
+
+void GLStateCache::BlendEquation(GLenum equation) {
+    if ((state.known & BLEND_EQUATION) &&
+        state.blendEquation == equation) return;
+    glBlendEquationEXT(equation);
+    state.blendEquation = equation;
+    state.known |= BLEND_EQUATION;
+}
+
+GLenum GLStateCache::GetBlendSource() {
+    if (!(state.known & BLEND_FUNC)) Fetch(BLEND_FUNC);
+    return state.blendSrc;
+}
+
+GLenum GLStateCache::GetBlendDestination() {
+    if (!(state.known & BLEND_FUNC)) Fetch(BLEND_FUNC);
+    return state.blendDst;
+}
+
+GLenum GLStateCache::GetBlendEquation() {
+    if (!(state.known & BLEND_EQUATION)) Fetch(BLEND_EQUATION);
+    return state.blendEquation;
+}
+
+/**
+ * Bind a frame buffer object.
+ *
+ * @param target GL_FRAMEBUFFER_EXT, GL_DRAW_FRAMEBUFFER_EXT or
+ * GL_READ_FRAMEBUFFER_EXT.
+ * @param id Frame buffer id, zero for the window.
+ */
+void GLStateCache::BindFramebuffer(GLenum target, GLuint id) {
+    bool draw = target != GL_READ_FRAMEBUFFER_EXT;
+    bool read = target != GL_DRAW_FRAMEBUFFER_EXT;
+    if ((!draw || ((state.known & DRAW_FB) && state.drawFb == id)) &&
+        (!read || ((state.known & READ_FB) && state.readFb == id)))
+        return;
+    glBindFramebufferEXT(target, id);
+    if (draw) {
+        state.drawFb = id;
+        state.known |= DRAW_FB;
+    }
+    if (read) {
+        state.readFb = id;
+        state.known |= READ_FB;
+    }
+}
+
+/**
+ * Get the bound frame buffer object.
+ *
+ * @param target GL_DRAW_FRAMEBUFFER_EXT or GL_READ_FRAMEBUFFER_EXT.
+ * @return Frame buffer id.
+ */
+GLuint GLStateCache::GetFramebuffer(GLenum target) {
+    if (target == GL_READ_FRAMEBUFFER_EXT) {
+        if (!(state.known & READ_FB)) Fetch(READ_FB);
+        return state.readFb;
+    }
+    if (!(state.known & DRAW_FB)) Fetch(DRAW_FB);
+    return state.drawFb;
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if ((state.known & VIEWPORT) &&
+        state.viewport[0] == x && state.viewport[1] == y &&
+        state.viewport[2] == width && state.viewport[3] == height) return;
+    glViewport(x, y, width, height);
+    state.viewport[0] = x;
+    state.viewport[1] = y;
+    state.viewport[2] = width;
+    state.viewport[3] = height;
+    state.known |= VIEWPORT;
+}
+
+void GLStateCache::Viewport(Vector<4,GLint> viewport) {
+    Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+Vector<4,GLint> GLStateCache::GetViewport() {
+    if (!(state.known & VIEWPORT)) Fetch(VIEWPORT);
+    return Vector<4,GLint>(state.viewport[0], state.viewport[1],
+                           state.viewport[2], state.viewport[3]);
+}
+
+/**
+ * Set the polygon rasterization mode.
+ *
+ * @param face GL_FRONT, GL_BACK or GL_FRONT_AND_BACK.
+ * @param mode GL_POINT, GL_LINE or GL_FILL.
+ */
+void GLStateCache::PolygonMode(GLenum face, GLenum mode) {
+    bool front = face != GL_BACK;
+    bool back = face != GL_FRONT;
+    if ((state.known & POLYGON_MODE) &&
+        (!front || state.polygonMode[0] == mode) &&
+        (!back || state.polygonMode[1] == mode)) return;
+    if (!(state.known & POLYGON_MODE) && face != GL_FRONT_AND_BACK)
+        Fetch(POLYGON_MODE);
+    glPolygonMode(face, mode);
+    if (front) state.polygonMode[0] = mode;
+    if (back) state.polygonMode[1] = mode;
+    state.known |= POLYGON_MODE;
+}
+
+GLenum GLStateCache::GetPolygonMode(GLenum face) {
+    if (!(state.known & POLYGON_MODE)) Fetch(POLYGON_MODE);
+    return face == GL_BACK ? state.polygonMode[1] : state.polygonMode[0];
+}
+
+void GLStateCache::CullFace(GLenum mode) {
+    if ((state.known & CULL_FACE) && state.cullFace == mode) return;
+    glCullFace(mode);
+    state.cullFace = mode;
+    state.known |= CULL_FACE;
+}
+
+GLenum GLStateCache::GetCullFace() {
+    if (!(state.known & CULL_FACE)) Fetch(CULL_FACE);
+    return state.cullFace;
+}
+
+void GLStateCache::DepthFunc(GLenum func) {
+    if ((state.known & DEPTH_FUNC) && state.depthFunc == func) return;
+    glDepthFunc(func);
+    state.depthFunc = func;
+    state.known |= DEPTH_FUNC;
+}
+
+GLenum GLStateCache::GetDepthFunc() {
+    if (!(state.known & DEPTH_FUNC)) Fetch(DEPTH_FUNC);
+    return state.depthFunc;
+}
+
+void GLStateCache::DepthMask(bool mask) {
+    GLboolean m = mask ? GL_TRUE : GL_FALSE;
+    if ((state.known & DEPTH_MASK) && state.depthMask == m) return;
+    glDepthMask(m);
+    state.depthMask = m;
+    state.known |= DEPTH_MASK;
+}
+
+bool GLStateCache::GetDepthMask() {
+    if (!(state.known & DEPTH_MASK)) Fetch(DEPTH_MASK);
+    return state.depthMask == GL_TRUE;
+}
+
+/**
+ * Set the texture environment mode of texture unit 0.
+ */
+void GLStateCache::TexEnvMode(GLint mode) {
+    if ((state.known & TEX_ENV_MODE) && state.texEnvMode == mode) return;
+    TextureUnitCache::Active(0);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, mode);
+    state.texEnvMode = mode;
+    state.known |= TEX_ENV_MODE;
+}
+
+GLint GLStateCache::GetTexEnvMode() {
+    if (!(state.known & TEX_ENV_MODE)) Fetch(TEX_ENV_MODE);
+    return state.texEnvMode;
+}
+
+void GLStateCache::ColorMask(bool red, bool green, bool blue, bool alpha) {
+    GLboolean m[4] = { red ? GL_TRUE : GL_FALSE, green ? GL_TRUE : GL_FALSE,
+                       blue ? GL_TRUE : GL_FALSE, alpha ? GL_TRUE : GL_FALSE };
+    if ((state.known & COLOR_MASK) &&
+        state.colorMask[0] == m[0] && state.colorMask[1] == m[1] &&
+        state.colorMask[2] == m[2] && state.colorMask[3] == m[3]) return;
+    glColorMask(m[0], m[1], m[2], m[3]);
+    std::copy(m, m + 4, state.colorMask);
+    state.known |= COLOR_MASK;
+}
+
+/**
+ * Get the color mask of a channel, 0 to 3 for red, green, blue and
+ * alpha.
+ */
+bool GLStateCache::GetColorMask(unsigned int channel) {
+    if (!(state.known & COLOR_MASK)) Fetch(COLOR_MASK);
+    return state.colorMask[channel] == GL_TRUE;
+}
+
+/**
+ * Set the polygon offset. It only applies while one of the polygon
+ * offset capabilities is enabled.
+ */
+void GLStateCache::PolygonOffset(GLfloat factor, GLfloat units) {
+    if ((state.known & POLYGON_OFFSET) &&
+        state.polygonOffset[0] == factor && state.polygonOffset[1] == units) return;
+    glPolygonOffset(factor, units);
+    state.polygonOffset[0] = factor;
+    state.polygonOffset[1] = units;
+    state.known |= POLYGON_OFFSET;
+}
+
+/**
+ * Save the shadowed state.
+ */
+void GLStateCache::Push() {
+    stack.push_back(state);
+}
+
+/**
+ * Restore the state saved by the matching Push. State that was
+ * unknown when pushed is left as it is.
+ */
+void GLStateCache::Pop() {
+    if (stack.empty()) return;
+    State saved = stack.back();
+    stack.pop_back();
+
+    for (unsigned int i = 0; i < CAPS; ++i)
+        if (saved.caps[i] != 0 && saved.caps[i] != state.caps[i])
+            Set(capabilities[i], saved.caps[i] == 2);
+
+    if (saved.known & BLEND_FUNC)
+        BlendFunc(saved.blendSrc, saved.blendDst);
+    if (saved.known & BLEND_EQUATION)
+        BlendEquation(saved.blendEquation);
+    if ((saved.known & DRAW_FB) && (saved.known & READ_FB) &&
+        saved.drawFb == saved.readFb)
+        BindFramebuffer(GL_FRAMEBUFFER_EXT, saved.drawFb);
+    else {
+        if (saved.known & DRAW_FB)
+            BindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, saved.drawFb);
+        if (saved.known & READ_FB)
+            BindFramebuffer(GL_READ_FRAMEBUFFER_EXT, saved.readFb);
+    }
+    if (saved.known & VIEWPORT)
+        Viewport(saved.viewport[0], saved.viewport[1],
+                 saved.viewport[2], saved.viewport[3]);
+    if (saved.known & POLYGON_MODE) {
+        PolygonMode(GL_FRONT, saved.polygonMode[0]);
+        PolygonMode(GL_BACK, saved.polygonMode[1]);
+    }
+    if (saved.known & CULL_FACE)
+        CullFace(saved.cullFace);
+    if (saved.known & DEPTH_FUNC)
+        DepthFunc(saved.depthFunc);
+    if (saved.known & DEPTH_MASK)
+        DepthMask(saved.depthMask == GL_TRUE);
+    if (saved.known & TEX_ENV_MODE)
+        TexEnvMode(saved.texEnvMode);
+    if (saved.known & COLOR_MASK)
+        ColorMask(saved.colorMask[0] == GL_TRUE, saved.colorMask[1] == GL_TRUE,
+                  saved.colorMask[2] == GL_TRUE, saved.colorMask[3] == GL_TRUE);
+    if (saved.known & POLYGON_OFFSET)
+        PolygonOffset(saved.polygonOffset[0], saved.polygonOffset[1]);
+}
+
+/**
+ * Read all shadowed state from OpenGL. Must not be called per frame.
+ */
+void GLStateCache::Sync() {
+    for (unsigned int i = 0; i < CAPS; ++i) {
+        state.caps[i] = 0;
+        IsEnabled(capabilities[i]);
+    }
+    Fetch(ALL);
+}
+
+/**
+ * Forget the shadowed state, after OpenGL state has been changed
+ * outside the cache. The saved states are kept.
+ */
+void GLStateCache::Invalidate() {
+    for (unsigned int i = 0; i < CAPS; ++i)
+        state.caps[i] = 0;
+    state.known = 0;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
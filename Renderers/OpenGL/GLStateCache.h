@@ -0,0 +1,127 @@
+// OpenGL state cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_GL_STATE_CACHE_H_
+#define _OPENGL_GL_STATE_CACHE_H_
+
+#include <Meta/OpenGL.h>
+#include <Math/Vector.h>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+
+/**
+ * CPU shadow of the OpenGL state touched by the extension.
+ *
+ * Reading state back with glIsEnabled or glGet forces a round trip
+ * to the driver, which stalls multithreaded drivers. All per frame
+ * code instead changes the state through the cache and reads it
+ * back from the shadow. Changes that do not alter the state are not
+ * sent to OpenGL.
+ *
+ * Push saves the shadowed state and Pop restores it, issuing only
+ * the calls needed to get back.
+ *
+ * The capabilities GL_TEXTURE_2D and the texture environment mode
+ * are shadowed for texture unit 0 only, which they select before
+ * changing the state.
+ *
+ * State that is not known, because it was never set or read since
+ * the last Invalidate, is read from OpenGL the first time it is
+ * needed. The renderer reads it all with Sync when initialized, and
+ * invalidates it at the start of each frame and after each render
+ * node, as other code may change the state directly.
+ *
+ * @class GLStateCache GLStateCache.h Renderers/OpenGL/GLStateCache.h
+ */
+class GLStateCache {
+private:
+    static const unsigned int CAPS = 15;
+    enum Field {
+        BLEND_FUNC     = 1 << 0,
+        BLEND_EQUATION = 1 << 1,
+        DRAW_FB        = 1 << 2,
+        READ_FB        = 1 << 3,
+        VIEWPORT       = 1 << 4,
+        POLYGON_MODE   = 1 << 5,
+        CULL_FACE      = 1 << 6,
+        DEPTH_FUNC     = 1 << 7,
+        DEPTH_MASK     = 1 << 8,
+        TEX_ENV_MODE   = 1 << 9,
+        COLOR_MASK     = 1 << 10,
+        POLYGON_OFFSET = 1 << 11,
+        ALL            = (1 << 12) - 1
+    };
+    struct State {
+        // 0 unknown, 1 disabled, 2 enabled.
+        signed char caps[CAPS];
+        unsigned int known;
+        GLenum blendSrc, blendDst, blendEquation;
+        GLuint drawFb, readFb;
+        GLint viewport[4];
+        GLenum polygonMode[2];
+        GLenum cullFace, depthFunc;
+        GLboolean depthMask;
+        GLint texEnvMode;
+        GLboolean colorMask[4];
+        GLfloat polygonOffset[2];
+    };
+    static State state;
+    static std::vector<State> stack;
+
+    static inline int Slot(GLenum cap);
+    static void Fetch(unsigned int fields);
+public:
+    static void Enable(GLenum cap);
+    static void Disable(GLenum cap);
+    static void Set(GLenum cap, bool enable);
+    static bool IsEnabled(GLenum cap);
+
+    static void BlendFunc(GLenum src, GLenum dst);
+    static void BlendEquation(GLenum equation);
+    static GLenum GetBlendSource();
+    static GLenum GetBlendDestination();
+    static GLenum GetBlendEquation();
+
+    static void BindFramebuffer(GLenum target, GLuint id);
+    static GLuint GetFramebuffer(GLenum target = GL_DRAW_FRAMEBUFFER_EXT);
+
+    static void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    static void Viewport(Vector<4,GLint> viewport);
+    static Vector<4,GLint> GetViewport();
+
+    static void PolygonMode(GLenum face, GLenum mode);
+    static GLenum GetPolygonMode(GLenum face);
+    static void CullFace(GLenum mode);
+    static GLenum GetCullFace();
+    static void DepthFunc(GLenum func);
+    static GLenum GetDepthFunc();
+    static void DepthMask(bool mask);
+    static bool GetDepthMask();
+    static void TexEnvMode(GLint mode);
+    static GLint GetTexEnvMode();
+    static void ColorMask(bool red, bool green, bool blue, bool alpha);
+    static bool GetColorMask(unsigned int channel);
+    static void PolygonOffset(GLfloat factor, GLfloat units);
+
+    static void Push();
+    static void Pop();
+    static void Sync();
+    static void Invalidate();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_GL_STATE_CACHE_H_
@@ -0,0 +1,152 @@
+// Bounding volumes of vertex data blocks.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Resources/IDataBlock.h>
+
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+
+// Frames the bounds of a block are kept after they were last used.
+static const unsigned int KEEP_FRAMES = 600;
+
+std::map<const IDataBlock*, GeometryBounds::Cached> GeometryBounds::cache;
+unsigned int GeometryBounds::frame = 0;
+
+/**
+ * Get the bounds of a vertex block. The bounds are computed from the
+ * client side data the first time, if it is available.
+ *
+ * @param vertices Float vertex block.
+ * @return Bounds, invalid if they could not be computed.
+ */
+Bounds GeometryBounds::Get(IDataBlock* vertices) {
+    Bounds b;
+    b.valid = false;
+    b.radius = 0.0f;
+    if (vertices == NULL) return b;
+
+    std::map<const IDataBlock*, Cached>::iterator itr = cache.find(vertices);
+    if (itr != cache.end() && itr->second.size == vertices->GetSize() &&
+        (vertices->GetVoidDataPtr() == NULL ||
+         vertices->GetVoidDataPtr() == itr->second.data)) {
+        itr->second.used = frame;
+        return itr->second.bounds;
+    }
+
+    if (vertices->GetVoidDataPtr() == NULL ||
+        vertices->GetType() != Types::FLOAT ||
+        vertices->GetDimension() < 2)
+        return b;
+
+    Cached c;
+    c.size = vertices->GetSize();
+    c.data = vertices->GetVoidDataPtr();
+    c.used = frame;
+    c.bounds = Compute((const float*)vertices->GetVoidDataPtr(),
+                       vertices->GetSize(), vertices->GetDimension());
+    cache[vertices] = c;
+    return c.bounds;
+}
+
+/**
+ * Compute the box and sphere around a set of points. Only the first
+ * three components of each element are used.
+ *
+ * @param data Packed elements.
+ * @param count Number of elements.
+ * @param dimension Components per element.
+ */
+Bounds GeometryBounds::Compute(const float* data,
+                               unsigned int count,
+                               unsigned int dimension) {
+    Bounds b;
+    b.valid = count > 0;
+    b.radius = 0.0f;
+    if (!b.valid) return b;
+
+    const unsigned int comps = dimension < 3 ? dimension : 3;
+    b.min = b.max = Vector<3,float>(0.0f);
+    for (unsigned int j = 0; j < comps; ++j)
+        b.min[j] = b.max[j] = data[j];
+    for (unsigned int i = 1; i < count; ++i) {
+        const float* p = data + i * dimension;
+        for (unsigned int j = 0; j < comps; ++j) {
+            if (p[j] < b.min[j]) b.min[j] = p[j];
+            if (p[j] > b.max[j]) b.max[j] = p[j];
+        }
+    }
+    b.center = (b.min + b.max) * 0.5f;
+
+    float r2 = 0.0f;
+    for (unsigned int i = 0; i < count; ++i) {
+        const float* p = data + i * dimension;
+        float d2 = 0.0f;
+        for (unsigned int j = 0; j < comps; ++j)
+            d2 += (p[j] - b.center[j]) * (p[j] - b.center[j]);
+        if (d2 > r2) r2 = d2;
+    }
+    b.radius = sqrt(r2);
+    return b;
+}
+
+/**
+ * Drop the cached bounds of a block, eg. when its data changes.
+ */
+void GeometryBounds::Forget(const IDataBlock* vertices) {
+    cache.erase(vertices);
+}
+
+/**
+ * Start a new frame, dropping the bounds that have not been used
+ * for a while.
+ */
+void GeometryBounds::NewFrame() {
+    ++frame;
+    std::map<const IDataBlock*, Cached>::iterator itr = cache.begin();
+    while (itr != cache.end()) {
+        if (frame - itr->second.used > KEEP_FRAMES)
+            cache.erase(itr++);
+        else ++itr;
+    }
+}
+
+/**
+ * Estimate the diameter in pixels of the bounding sphere.
+ *
+ * @param b Bounds in model space.
+ * @param mv Model view matrix as passed to OpenGL.
+ * @param projScale Projection scale times half the viewport height.
+ * @return Projected diameter, very large if the camera is inside.
+ */
+float GeometryBounds::ProjectedSize(const Bounds& b,
+                                    const float mv[16],
+                                    float projScale) {
+    const Vector<3,float>& c = b.center;
+    float z = mv[2] * c[0] + mv[6] * c[1] + mv[10] * c[2] + mv[14];
+    // The largest axis scale of the model view scales the radius.
+    float sx = mv[0] * mv[0] + mv[1] * mv[1] + mv[2] * mv[2];
+    float sy = mv[4] * mv[4] + mv[5] * mv[5] + mv[6] * mv[6];
+    float sz = mv[8] * mv[8] + mv[9] * mv[9] + mv[10] * mv[10];
+    float s = sx > sy ? sx : sy;
+    s = s > sz ? s : sz;
+    float r = b.radius * sqrt(s);
+    float dist = -z;
+    if (dist <= r) return 1e9f;
+    return 2.0f * r * projScale / dist;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
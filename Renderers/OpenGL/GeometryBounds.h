@@ -0,0 +1,80 @@
+// Bounding volumes of vertex data blocks.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_GEOMETRY_BOUNDS_H_
+#define _OPENGL_GEOMETRY_BOUNDS_H_
+
+#include <Math/Vector.h>
+#include <map>
+
+namespace OpenEngine {
+    namespace Resources {
+        class IDataBlock;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+using Resources::IDataBlock;
+
+/**
+ * Axis aligned box and bounding sphere of a vertex block.
+ */
+struct Bounds {
+    Vector<3,float> min, max;
+    Vector<3,float> center;
+    float radius;
+    bool valid;
+};
+
+/**
+ * Computes and caches the bounds of vertex blocks.
+ *
+ * Vertex data is usually unloaded from client memory once it has
+ * been bound to a buffer object, so the renderer computes the bounds
+ * of float array blocks when binding them. Later queries are served
+ * from the cache.
+ *
+ * Blocks are cached by address. Binding a block computes its bounds
+ * anew, and blocks with client data are checked against the data
+ * they were computed from, so a new block at the address of a
+ * deleted one never gets its bounds. Bounds not asked for in a
+ * number of frames are dropped, and are computed again when the
+ * block is bound again or still has its data.
+ *
+ * @class GeometryBounds GeometryBounds.h Renderers/OpenGL/GeometryBounds.h
+ */
+class GeometryBounds {
+private:
+    struct Cached {
+        unsigned int size;
+        const void* data;
+        unsigned int used;
+        Bounds bounds;
+    };
+    static std::map<const IDataBlock*, Cached> cache;
+    static unsigned int frame;
+public:
+    static Bounds Get(IDataBlock* vertices);
+    static Bounds Compute(const float* data,
+                          unsigned int count,
+                          unsigned int dimension);
+    static void Forget(const IDataBlock* vertices);
+    static void NewFrame();
+
+    static float ProjectedSize(const Bounds& b,
+                               const float modelView[16],
+                               float projScale);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_GEOMETRY_BOUNDS_H_
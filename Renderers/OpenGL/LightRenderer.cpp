@@ -8,6 +8,7 @@
 //--------------------------------------------------------------------
 
 #include <Renderers/OpenGL/LightRenderer.h>
+#include <Renderers/OpenGL/GLStateCache.h>
 #include <Scene/TransformationNode.h>
 #include <Scene/DirectionalLightNode.h>
 #include <Scene/PointLightNode.h>
@@ -24,6 +25,7 @@ using OpenEngine::Math::Matrix;
 
 LightRenderer::LightRenderer()
     : count(0)
+    , maxLights(0)
 {
     pos[0] = 0.0;
     pos[1] = 0.0;
@@ -53,9 +55,7 @@ void LightRenderer::VisitTransformationNode(TransformationNode* node) {
     
 void LightRenderer::VisitDirectionalLightNode(DirectionalLightNode* node) {
 #if OE_SAFE
-    GLint max;
-    glGetIntegerv(GL_MAX_LIGHTS, &max);
-    if (count >= max) 
+    if (count >= maxLights) 
         throw new Exception("OpenGL max lights exceeded.");
 #endif
     GLint light = GL_LIGHT0+count;
@@ -67,7 +67,7 @@ void LightRenderer::VisitDirectionalLightNode(DirectionalLightNode* node) {
     glLightfv(light, GL_DIFFUSE, color);
     node->specular.ToArray(color);
     glLightfv(light, GL_SPECULAR, color);
-    glEnable(light);
+    GLStateCache::Enable(light);
     count++;
     CHECK_FOR_GL_ERROR();
     node->VisitSubNodes(*this);            
@@ -75,9 +75,7 @@ void LightRenderer::VisitDirectionalLightNode(DirectionalLightNode* node) {
     
 void LightRenderer::VisitPointLightNode(PointLightNode* node) {
 #if OE_SAFE
-    GLint max;
-    glGetIntegerv(GL_MAX_LIGHTS, &max);
-    if (count >= max) 
+    if (count >= maxLights) 
         throw new Exception("OpenGL max lights exceeded.");
 #endif
     GLint light = GL_LIGHT0 + count;
@@ -92,7 +90,7 @@ void LightRenderer::VisitPointLightNode(PointLightNode* node) {
     glLightf(light, GL_CONSTANT_ATTENUATION, node->constAtt);
     glLightf(light, GL_LINEAR_ATTENUATION, node->linearAtt);
     glLightf(light, GL_QUADRATIC_ATTENUATION, node->quadAtt);
-    glEnable(light);
+    GLStateCache::Enable(light);
     ++count;
     CHECK_FOR_GL_ERROR();
     node->VisitSubNodes(*this);
@@ -100,9 +98,7 @@ void LightRenderer::VisitPointLightNode(PointLightNode* node) {
 
 void LightRenderer::VisitSpotLightNode(SpotLightNode* node) {
 #if OE_SAFE
-    GLint max;
-    glGetIntegerv(GL_MAX_LIGHTS, &max);
-    if (count >= max) 
+    if (count >= maxLights) 
         throw new Exception("OpenGL max lights exceeded.");
 #endif
     GLint light = GL_LIGHT0+count;
@@ -120,7 +116,7 @@ void LightRenderer::VisitSpotLightNode(SpotLightNode* node) {
     glLightf(light, GL_CONSTANT_ATTENUATION, node->constAtt);
     glLightf(light, GL_LINEAR_ATTENUATION, node->linearAtt);
     glLightf(light, GL_QUADRATIC_ATTENUATION, node->quadAtt);
-    glEnable(light);
+    GLStateCache::Enable(light);
     ++count;
     CHECK_FOR_GL_ERROR();
     node->VisitSubNodes(*this);            
@@ -129,16 +125,17 @@ void LightRenderer::VisitSpotLightNode(SpotLightNode* node) {
 void LightRenderer::Handle(RenderingEventArg arg) {
     int oldCount = count;
     count = 0;
+    // query the limit once, not every frame.
+    if (maxLights == 0)
+        glGetIntegerv(GL_MAX_LIGHTS, &maxLights);
     glMatrixMode(GL_MODELVIEW);
     #if OE_SAFE
     if (arg.canvas.GetScene() == NULL)
         throw new Exception("Scene was NULL in LightRenderer.");
     #endif
     arg.canvas.GetScene()->Accept(*this);
-    GLint max;
-    glGetIntegerv(GL_MAX_LIGHTS, &max);
-    for (int i = count; i < max; ++i) {
-        glDisable(GL_LIGHT0 + i);
+    for (int i = count; i < maxLights; ++i) {
+        GLStateCache::Disable(GL_LIGHT0 + i);
         CHECK_FOR_GL_ERROR();
     }
     if (count != oldCount) {
@@ -55,7 +55,7 @@ struct LightCountChangedEventArg {
 class LightRenderer: public ISceneNodeVisitor, public IListener<RenderingEventArg> {
 private:
     float pos[4], dir[4];
-    GLint count;
+    GLint count, maxLights;
     Event<LightCountChangedEventArg> lightCountChanged;
     LightCountChangedEventArg event;
 public:
@@ -0,0 +1,178 @@
+// Level of detail selection for meshes.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/MeshLOD.h>
+#include <Renderers/OpenGL/MeshSimplifier.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Geometry/GeometrySet.h>
+#include <Scene/MeshNode.h>
+#include <algorithm>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Scene::ISceneNode;
+using Scene::MeshNode;
+using std::vector;
+
+// Frames a mesh node is remembered after it was last drawn.
+static const unsigned int KEEP_FRAMES = 30;
+
+MeshLOD::MeshLOD()
+    : hysteresis(0.1f)
+    , frame(0)
+    , reduced(0) {}
+
+MeshLOD::~MeshLOD() {}
+
+/**
+ * Start a new frame, resetting the statistics and forgetting the
+ * levels of the mesh nodes that have left the scene.
+ */
+void MeshLOD::NewFrame() {
+    ++frame;
+    reduced = 0;
+    std::map<std::pair<ISceneNode*, Mesh*>, Entry>::iterator itr = entries.begin();
+    while (itr != entries.end()) {
+        if (frame - itr->second.seen > KEEP_FRAMES)
+            entries.erase(itr++);
+        else ++itr;
+    }
+}
+
+/**
+ * Remove all levels and forget the levels of the mesh nodes.
+ */
+void MeshLOD::Clear() {
+    chains.clear();
+    entries.clear();
+}
+
+/**
+ * Add a level of detail to a mesh.
+ *
+ * @param mesh Mesh drawn at full detail.
+ * @param level Mesh drawn instead when the mesh is small.
+ * @param pixels Projected size in pixels below which the level is
+ *               used, unless a coarser level applies.
+ */
+void MeshLOD::AddLevel(MeshPtr mesh, MeshPtr level, float pixels) {
+    vector<Level>& levels = chains[mesh.get()];
+    Level l = { level, pixels };
+    vector<Level>::iterator itr = levels.begin();
+    while (itr != levels.end() && itr->pixels >= pixels) ++itr;
+    levels.insert(itr, l);
+}
+
+/**
+ * Simplify a mesh and add the result as its levels of detail. Each
+ * level keeps a fraction of the triangles of the one before it and
+ * is used below a fraction of its threshold, so the triangles of a
+ * mesh cover about the same number of pixels at every level.
+ *
+ * @see MeshSimplifier
+ *
+ * @param mesh Mesh with its positions and indices in client memory.
+ * @param levels Number of levels to build.
+ * @param pixels Projected size below which the first level is used.
+ * @param ratio Fraction of the triangles kept at each level.
+ * @return Number of levels added.
+ */
+unsigned int MeshLOD::AddChain(MeshPtr mesh, unsigned int levels,
+                               float pixels, float ratio) {
+    vector<MeshPtr> chain = MeshSimplifier::Simplify(mesh, levels, ratio);
+    float step = sqrt(ratio);
+    for (unsigned int i = 0; i < chain.size(); ++i) {
+        AddLevel(mesh, chain[i], pixels);
+        pixels *= step;
+    }
+    return chain.size();
+}
+
+/**
+ * Remove the levels of a mesh, drawing it at full detail.
+ */
+void MeshLOD::Remove(MeshPtr mesh) {
+    chains.erase(mesh.get());
+}
+
+/**
+ * Set the fraction of a threshold a mesh must pass it by before its
+ * level switches, 0.1 by default.
+ */
+void MeshLOD::SetHysteresis(float fraction) {
+    hysteresis = std::max(0.0f, std::min(fraction, 0.9f));
+}
+
+/**
+ * Select the mesh to draw for a mesh node.
+ *
+ * @param node Mesh node about to be drawn.
+ * @param modelView Column major modelview matrix of the node.
+ * @param projScale Projection scale times half the viewport height.
+ * @return The mesh of the node or one of its levels.
+ */
+Mesh* MeshLOD::Select(MeshNode* node, const float modelView[16],
+                      float projScale) {
+    Mesh* mesh = node->GetMesh().get();
+    if (chains.empty() || chains.find(mesh) == chains.end()) return mesh;
+    Bounds b = GeometryBounds::Get(mesh->GetGeometrySet()->GetVertices().get());
+    return Select(node, mesh, b, modelView, projScale);
+}
+
+/**
+ * Select the level to draw for a mesh of a node, such as one of the
+ * meshes of a static batch node.
+ *
+ * @param node Node holding the mesh.
+ * @param mesh Mesh about to be drawn.
+ * @param b Bounds used for the projected size of the mesh.
+ * @param modelView Column major modelview matrix of the node.
+ * @param projScale Projection scale times half the viewport height.
+ * @return The mesh or one of its levels.
+ */
+Mesh* MeshLOD::Select(ISceneNode* node, Mesh* mesh, const Bounds& b,
+                      const float modelView[16], float projScale) {
+    if (chains.empty()) return mesh;
+    std::map<Mesh*, vector<Level> >::iterator c = chains.find(mesh);
+    if (c == chains.end()) return mesh;
+    if (!b.valid) return mesh;
+    float pixels = GeometryBounds::ProjectedSize(b, modelView, projScale);
+
+    // a new node takes the level of its size right away.
+    const vector<Level>& levels = c->second;
+    Entry& e = entries[std::make_pair(node, mesh)];
+    float h = e.seen == 0 ? 0.0f : hysteresis;
+    bool first = e.seen != frame;
+    e.seen = frame;
+
+    // level zero is the mesh itself, level l uses levels[l - 1].
+    unsigned int l = std::min<unsigned int>(e.level, levels.size());
+    while (l < levels.size() && pixels < levels[l].pixels * (1.0f - h)) ++l;
+    while (l > 0 && pixels > levels[l - 1].pixels * (1.0f + h)) --l;
+    e.level = l;
+
+    if (l == 0) return mesh;
+    if (first) ++reduced;
+    return levels[l - 1].mesh.get();
+}
+
+/**
+ * Get the number of mesh nodes drawn below full detail in the
+ * current frame.
+ */
+unsigned int MeshLOD::GetReducedCount() {
+    return reduced;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
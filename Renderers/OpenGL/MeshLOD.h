@@ -0,0 +1,97 @@
+// Level of detail selection for meshes.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_MESH_LOD_H_
+#define _OPENGL_MESH_LOD_H_
+
+#include <Geometry/Mesh.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Scene {
+        class ISceneNode;
+        class MeshNode;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+using Geometry::Mesh;
+using Geometry::MeshPtr;
+
+struct Bounds;
+
+/**
+ * Picks the level of detail a mesh node is drawn with.
+ *
+ * A mesh is given a chain of less detailed meshes, each used when
+ * the projected size of the bounding sphere of the mesh falls below
+ * a number of pixels. The levels are usually built by
+ * MeshSimplifier and share the geometry set of the mesh, with index
+ * blocks of fewer triangles, but any mesh can be a level.
+ *
+ * The meshes of static batch nodes are selected the same way, from
+ * the bounds of their batch.
+ *
+ * The level of each mesh node is kept between frames. A node only
+ * switches to a coarser level once its size is a fraction below the
+ * threshold of that level, and back once it is the same fraction
+ * above it, so nodes near a threshold do not switch every frame.
+ * The selection is repeatable within a frame, so the depth pre-pass
+ * and the following pass draw the same level.
+ *
+ * Meshes without bounds, and meshes whose bounding sphere contains
+ * the eye, are drawn at full detail.
+ *
+ * @class MeshLOD MeshLOD.h Renderers/OpenGL/MeshLOD.h
+ */
+class MeshLOD {
+private:
+    struct Level {
+        MeshPtr mesh;
+        float pixels;
+    };
+    struct Entry {
+        unsigned int level, seen;
+        Entry() : level(0), seen(0) {}
+    };
+    // coarser levels of each mesh by decreasing threshold.
+    std::map<Mesh*, std::vector<Level> > chains;
+    // levels of the meshes by the node holding them.
+    std::map<std::pair<Scene::ISceneNode*, Mesh*>, Entry> entries;
+    float hysteresis;
+    unsigned int frame, reduced;
+public:
+    MeshLOD();
+    ~MeshLOD();
+
+    void NewFrame();
+    void Clear();
+
+    void AddLevel(MeshPtr mesh, MeshPtr level, float pixels);
+    unsigned int AddChain(MeshPtr mesh, unsigned int levels, float pixels,
+                          float ratio = 0.5f);
+    void Remove(MeshPtr mesh);
+    void SetHysteresis(float fraction);
+
+    Mesh* Select(Scene::MeshNode* node,
+                 const float modelView[16],
+                 float projScale);
+    Mesh* Select(Scene::ISceneNode* node, Mesh* mesh, const Bounds& b,
+                 const float modelView[16],
+                 float projScale);
+
+    unsigned int GetReducedCount();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_MESH_LOD_H_
@@ -0,0 +1,299 @@
+// Quadric error mesh simplification.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/MeshSimplifier.h>
+
+#include <Geometry/GeometrySet.h>
+#include <Resources/DataBlock.h>
+#include <Resources/Indices.h>
+#include <Logging/Logger.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace OpenEngine::Geometry;
+using namespace OpenEngine::Resources;
+using std::vector;
+
+// Weight of the planes holding the border edges in place, relative
+// to the planes of the triangles.
+static const double BORDER_WEIGHT = 1000.0;
+
+// Symmetric 4x4 matrix summing the squared distances to a set of
+// planes, stored as its upper triangle.
+struct Quadric {
+    double q[10];
+    Quadric() {
+        for (unsigned int i = 0; i < 10; ++i) q[i] = 0.0;
+    }
+    void AddPlane(const double n[3], double d, double w) {
+        q[0] += w * n[0] * n[0]; q[1] += w * n[0] * n[1];
+        q[2] += w * n[0] * n[2]; q[3] += w * n[0] * d;
+        q[4] += w * n[1] * n[1]; q[5] += w * n[1] * n[2];
+        q[6] += w * n[1] * d;    q[7] += w * n[2] * n[2];
+        q[8] += w * n[2] * d;    q[9] += w * d * d;
+    }
+    void Add(const Quadric& o) {
+        for (unsigned int i = 0; i < 10; ++i) q[i] += o.q[i];
+    }
+    double Error(const float* p) const {
+        double x = p[0], y = p[1], z = p[2];
+        return x * x * q[0] + 2 * x * y * q[1] + 2 * x * z * q[2] + 2 * x * q[3]
+            + y * y * q[4] + 2 * y * z * q[5] + 2 * y * q[6]
+            + z * z * q[7] + 2 * z * q[8] + q[9];
+    }
+};
+
+// Collapse of a vertex onto a neighbour. The stamps tell if either
+// vertex has changed since the cost was computed.
+struct Collapse {
+    double cost;
+    unsigned int from, to, fromStamp, toStamp;
+    // cheapest first in a priority queue.
+    bool operator<(const Collapse& c) const { return cost > c.cost; }
+};
+
+// Edge collapse state of one mesh, reduced level by level.
+class Simplification {
+private:
+    const float* pos;
+    unsigned int dim;
+    vector<unsigned int> tris;
+    vector<bool> removed, gone;
+    vector<vector<unsigned int> > around;
+    vector<Quadric> quadrics;
+    vector<unsigned int> stamps;
+    std::priority_queue<Collapse> heap;
+    unsigned int alive;
+
+    const float* P(unsigned int v) { return pos + v * dim; }
+
+    // Unnormalized normal of a triangle, returns twice its area.
+    double Normal(const float* a, const float* b, const float* c, double n[3]) {
+        double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+        return sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    }
+
+    void Push(unsigned int from, unsigned int to) {
+        Quadric q = quadrics[from];
+        q.Add(quadrics[to]);
+        Collapse c = { q.Error(P(to)), from, to, stamps[from], stamps[to] };
+        heap.push(c);
+    }
+
+    // Check that the vertices share a triangle and that moving from
+    // onto to flips none of the other triangles around from.
+    bool Valid(unsigned int from, unsigned int to) {
+        bool shared = false;
+        for (unsigned int i = 0; i < around[from].size(); ++i) {
+            unsigned int t = around[from][i];
+            if (removed[t]) continue;
+            unsigned int* c = &tris[t * 3];
+            if (c[0] == to || c[1] == to || c[2] == to) {
+                shared = true;
+                continue;
+            }
+            const float* p[3];
+            for (unsigned int k = 0; k < 3; ++k)
+                p[k] = P(c[k] == from ? to : c[k]);
+            double before[3], after[3];
+            Normal(P(c[0]), P(c[1]), P(c[2]), before);
+            if (Normal(p[0], p[1], p[2], after) <= 0.0 ||
+                before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+                return false;
+        }
+        return shared;
+    }
+
+    void CollapseEdge(unsigned int from, unsigned int to) {
+        for (unsigned int i = 0; i < around[from].size(); ++i) {
+            unsigned int t = around[from][i];
+            if (removed[t]) continue;
+            unsigned int* c = &tris[t * 3];
+            if (c[0] == to || c[1] == to || c[2] == to) {
+                removed[t] = true;
+                --alive;
+                continue;
+            }
+            for (unsigned int k = 0; k < 3; ++k)
+                if (c[k] == from) c[k] = to;
+            around[to].push_back(t);
+        }
+        around[from].clear();
+        gone[from] = true;
+        quadrics[to].Add(quadrics[from]);
+        ++stamps[to];
+
+        // drop the removed triangles and requeue the edges of to.
+        vector<unsigned int>& a = around[to];
+        unsigned int n = 0;
+        for (unsigned int i = 0; i < a.size(); ++i)
+            if (!removed[a[i]]) a[n++] = a[i];
+        a.resize(n);
+        for (unsigned int i = 0; i < a.size(); ++i)
+            for (unsigned int k = 0; k < 3; ++k) {
+                unsigned int w = tris[a[i] * 3 + k];
+                if (w == to) continue;
+                Push(w, to);
+                Push(to, w);
+            }
+    }
+
+public:
+    Simplification(const float* pos, unsigned int dim, unsigned int vertices,
+                   const unsigned int* index, unsigned int count)
+        : pos(pos), dim(dim), gone(vertices, false), around(vertices),
+          quadrics(vertices), stamps(vertices, 0), alive(0) {
+        // triangles using each edge, and the last one seen.
+        std::map<std::pair<unsigned int, unsigned int>,
+            std::pair<unsigned int, unsigned int> > edges;
+        for (unsigned int i = 0; i + 2 < count; i += 3) {
+            unsigned int c[3] = { index[i], index[i+1], index[i+2] };
+            if (c[0] >= vertices || c[1] >= vertices || c[2] >= vertices ||
+                c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+                continue;
+            unsigned int t = tris.size() / 3;
+            tris.insert(tris.end(), c, c + 3);
+            double n[3];
+            double area = Normal(P(c[0]), P(c[1]), P(c[2]), n);
+            for (unsigned int k = 0; k < 3; ++k) {
+                around[c[k]].push_back(t);
+                unsigned int a = c[k], b = c[(k + 1) % 3];
+                std::pair<unsigned int, unsigned int>& e =
+                    edges[std::make_pair(std::min(a, b), std::max(a, b))];
+                ++e.first;
+                e.second = t;
+            }
+            if (area <= 0.0) continue;
+            for (unsigned int k = 0; k < 3; ++k) n[k] /= area;
+            const float* p = P(c[0]);
+            double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+            for (unsigned int k = 0; k < 3; ++k)
+                quadrics[c[k]].AddPlane(n, d, area * 0.5);
+        }
+        alive = tris.size() / 3;
+        removed.resize(alive, false);
+
+        // hold the border edges with a plane along the edge,
+        // perpendicular to its triangle.
+        std::map<std::pair<unsigned int, unsigned int>,
+            std::pair<unsigned int, unsigned int> >::iterator itr;
+        for (itr = edges.begin(); itr != edges.end(); ++itr) {
+            if (itr->second.first != 1) continue;
+            unsigned int* c = &tris[itr->second.second * 3];
+            unsigned int a = itr->first.first, b = itr->first.second;
+            double n[3];
+            double area = Normal(P(c[0]), P(c[1]), P(c[2]), n);
+            if (area <= 0.0) continue;
+            const float* pa = P(a);
+            const float* pb = P(b);
+            double e[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+            double len2 = e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+            double p[3] = { e[1] * n[2] - e[2] * n[1],
+                            e[2] * n[0] - e[0] * n[2],
+                            e[0] * n[1] - e[1] * n[0] };
+            double l = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            if (l <= 0.0) continue;
+            for (unsigned int k = 0; k < 3; ++k) p[k] /= l;
+            double d = -(p[0] * pa[0] + p[1] * pa[1] + p[2] * pa[2]);
+            quadrics[a].AddPlane(p, d, BORDER_WEIGHT * len2);
+            quadrics[b].AddPlane(p, d, BORDER_WEIGHT * len2);
+        }
+
+        for (unsigned int t = 0; t < alive; ++t)
+            for (unsigned int k = 0; k < 3; ++k) {
+                Push(tris[t * 3 + k], tris[t * 3 + (k + 1) % 3]);
+                Push(tris[t * 3 + (k + 1) % 3], tris[t * 3 + k]);
+            }
+    }
+
+    void Reduce(unsigned int target) {
+        while (alive > target && !heap.empty()) {
+            Collapse c = heap.top();
+            heap.pop();
+            if (gone[c.from] || gone[c.to] ||
+                stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp ||
+                !Valid(c.from, c.to))
+                continue;
+            CollapseEdge(c.from, c.to);
+        }
+    }
+
+    unsigned int GetTriangleCount() {
+        return alive;
+    }
+
+    IndicesPtr GetIndices() {
+        unsigned int* data = new unsigned int[alive * 3];
+        unsigned int n = 0;
+        for (unsigned int t = 0; t < removed.size(); ++t)
+            if (!removed[t])
+                for (unsigned int k = 0; k < 3; ++k) data[n++] = tris[t * 3 + k];
+        return IndicesPtr(new Indices(alive * 3, data));
+    }
+};
+
+/**
+ * Build a chain of simplified versions of a mesh.
+ *
+ * Each level has a fraction of the triangles of the one before it,
+ * starting from the mesh itself. The chain ends early when a level
+ * cannot be reduced by at least half of that.
+ *
+ * @param mesh Triangle mesh with positions and indices in client memory.
+ * @param levels Number of simplified levels to build.
+ * @param ratio Fraction of the triangles kept at each level.
+ * @return Simplified meshes from the most to the least detailed,
+ *         empty if the mesh cannot be simplified.
+ */
+vector<MeshPtr> MeshSimplifier::Simplify(MeshPtr mesh,
+                                         unsigned int levels,
+                                         float ratio) {
+    vector<MeshPtr> chain;
+    GeometrySetPtr geom = mesh->GetGeometrySet();
+    IDataBlockPtr v = geom->GetVertices();
+    IndicesPtr i = mesh->GetIndices();
+    if (mesh->GetType() != Geometry::TRIANGLES || v == NULL ||
+        v->GetVoidDataPtr() == NULL || v->GetType() != Types::FLOAT ||
+        v->GetDimension() < 3 || i == NULL || i->GetData() == NULL) {
+        logger.warning << "Mesh without client side triangles not simplified." << logger.end;
+        return chain;
+    }
+    if (ratio <= 0.0f || ratio >= 1.0f) {
+        logger.warning << "Simplification ratio must be between 0 and 1." << logger.end;
+        return chain;
+    }
+
+    Simplification s((const float*)v->GetVoidDataPtr(), v->GetDimension(),
+                     v->GetSize(), i->GetData() + mesh->GetIndexOffset(),
+                     mesh->GetDrawingRange());
+    for (unsigned int l = 0; l < levels; ++l) {
+        unsigned int before = s.GetTriangleCount();
+        unsigned int target = (unsigned int)(before * ratio);
+        s.Reduce(target);
+        unsigned int after = s.GetTriangleCount();
+        if (after == 0 || after > before - (before - target) / 2) break;
+        chain.push_back(MeshPtr(new Mesh(s.GetIndices(), Geometry::TRIANGLES, geom,
+                                         mesh->GetMaterial(), 0, after * 3)));
+    }
+    return chain;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
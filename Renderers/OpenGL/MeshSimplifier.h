@@ -0,0 +1,54 @@
+// Quadric error mesh simplification.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_MESH_SIMPLIFIER_H_
+#define _OPENGL_MESH_SIMPLIFIER_H_
+
+#include <Geometry/Mesh.h>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Geometry::MeshPtr;
+
+/**
+ * Builds simplified versions of triangle meshes.
+ *
+ * Edges are collapsed in the order of their quadric error, the
+ * squared distance to the planes of the triangles around the removed
+ * vertex. A vertex is collapsed onto one of its neighbours, so the
+ * simplified meshes only get a new index block and share the
+ * geometry set and material of the original. Their vertex buffers
+ * are therefore bound once for all levels.
+ *
+ * Edges with a single triangle, at the border of the mesh or at
+ * seams where vertices are split for their normals or texture
+ * coordinates, are held in place by planes perpendicular to them.
+ * Collapses that would flip a triangle are skipped.
+ *
+ * The positions and indices must still be in client memory, so
+ * meshes are simplified before they are rendered the first time.
+ * Simplification runs on the cpu and is meant for loading time.
+ *
+ * @class MeshSimplifier MeshSimplifier.h Renderers/OpenGL/MeshSimplifier.h
+ */
+class MeshSimplifier {
+public:
+    static std::vector<MeshPtr> Simplify(MeshPtr mesh,
+                                         unsigned int levels,
+                                         float ratio = 0.5f);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_MESH_SIMPLIFIER_H_
@@ -0,0 +1,549 @@
+// Software rasterized occlusion buffer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/OcclusionBuffer.h>
+#include <Renderers/OpenGL/DXTCompressor.h>
+#include <Core/Thread.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OE_OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+const unsigned int OcclusionBuffer::TILE;
+
+// Smallest clip space w of a projected corner.
+static const float NEAR_W = 1e-4f;
+
+// Longest sleep in microseconds while the bands of a frame are
+// finished, of Render waiting for the bands taken by the workers and
+// of workers that found every band taken before the gate closes.
+static const unsigned int FINISH_SLEEP = 100;
+
+/**
+ * Rasterizes the bands of rows handed out by Render until the
+ * buffer is deleted. Between frames the worker is blocked on the
+ * gate of the buffer.
+ */
+class OcclusionWorker : public Core::Thread {
+public:
+    OcclusionBuffer* buffer;
+
+    void Run() {
+        int band;
+        for (;;) {
+            buffer->gate.Lock();
+            buffer->gate.Unlock();
+            if (!buffer->NextWorkerBand(band)) return;
+            if (band >= 0) buffer->RasterizeBand(band);
+            else Core::Thread::Sleep(FINISH_SLEEP);
+        }
+    }
+};
+
+/**
+ * Create a buffer. The dimensions are rounded up to whole tiles.
+ *
+ * @param threads Number of threads, zero for one per processor.
+ */
+OcclusionBuffer::OcclusionBuffer(unsigned int width, unsigned int height,
+                                 unsigned int threads)
+    : tilesX((std::max(width, 1u) + TILE - 1) / TILE)
+    , tilesY((std::max(height, 1u) + TILE - 1) / TILE)
+    , threads(threads == 0 ? DXTCompressor::DefaultThreads() : threads)
+    , tested(0)
+    , culled(0)
+    , running(true)
+    , bands(0)
+    , nextBand(0)
+    , doneBands(0) {
+    this->width = tilesX * TILE;
+    this->height = tilesY * TILE;
+    depth.resize(this->width * this->height, 1.0f);
+    hiz.resize(tilesX * tilesY, 1.0f);
+}
+
+/**
+ * Stop the worker threads.
+ */
+OcclusionBuffer::~OcclusionBuffer() {
+    mutex.Lock();
+    running = false;
+    mutex.Unlock();
+    if (!workers.empty()) gate.Unlock();
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+}
+
+/**
+ * Add an occluder mesh. The data is copied, so it may be unloaded
+ * afterwards.
+ *
+ * @param positions Vertex positions, the first three components of
+ *                  each vertex are used.
+ * @param dimension Components per vertex.
+ * @param count Number of vertices.
+ * @param indices Triangle list indices.
+ * @param indexCount Number of indices.
+ * @return Id of the occluder.
+ */
+unsigned int OcclusionBuffer::AddOccluder(const float* positions,
+                                          unsigned int dimension,
+                                          unsigned int count,
+                                          const unsigned int* indices,
+                                          unsigned int indexCount) {
+    occluders.push_back(Occluder());
+    Occluder& o = occluders.back();
+    o.positions.resize(count * 3, 0.0f);
+    const unsigned int comps = std::min(dimension, 3u);
+    for (unsigned int i = 0; i < count; ++i)
+        for (unsigned int j = 0; j < comps; ++j)
+            o.positions[i * 3 + j] = positions[i * dimension + j];
+    indexCount -= indexCount % 3;
+    o.indices.reserve(indexCount);
+    for (unsigned int i = 0; i < indexCount; i += 3)
+        if (indices[i] < count && indices[i+1] < count && indices[i+2] < count)
+            o.indices.insert(o.indices.end(), indices + i, indices + i + 3);
+    return occluders.size() - 1;
+}
+
+/**
+ * Remove all occluders.
+ */
+void OcclusionBuffer::Clear() {
+    occluders.clear();
+    instances.clear();
+}
+
+/**
+ * Queue an occluder for the next render.
+ *
+ * @param occluder Id from AddOccluder.
+ * @param mvp Column major model view projection matrix.
+ */
+void OcclusionBuffer::Draw(unsigned int occluder, const float mvp[16]) {
+    Instance i;
+    i.occluder = occluder;
+    std::copy(mvp, mvp + 16, i.mvp);
+    instances.push_back(i);
+}
+
+/**
+ * Clear the buffer and rasterize the queued occluders.
+ */
+void OcclusionBuffer::Render() {
+    tested = culled = 0;
+
+    // Transform the triangles to the screen. Triangles facing away
+    // or crossing the near plane are dropped.
+    triangles.clear();
+    const float sx = width * 0.5f, sy = height * 0.5f;
+    for (unsigned int d = 0; d < instances.size(); ++d) {
+        const Occluder& o = occluders[instances[d].occluder];
+        const float* m = instances[d].mvp;
+        const unsigned int count = o.positions.size() / 3;
+        std::vector<float> screen(count * 4);
+        for (unsigned int i = 0; i < count; ++i) {
+            const float* p = &o.positions[i * 3];
+            float* s = &screen[i * 4];
+            float w = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+            s[3] = w;
+            if (w < NEAR_W) continue;
+            s[0] = ((m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12]) / w + 1.0f) * sx;
+            s[1] = ((m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13]) / w + 1.0f) * sy;
+            s[2] = ((m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14]) / w + 1.0f) * 0.5f;
+            // in front of the near plane.
+            if (s[2] < 0.0f) s[3] = 0.0f;
+        }
+        for (unsigned int i = 0; i < o.indices.size(); i += 3) {
+            const float* a = &screen[o.indices[i] * 4];
+            const float* b = &screen[o.indices[i+1] * 4];
+            const float* c = &screen[o.indices[i+2] * 4];
+            if (a[3] < NEAR_W || b[3] < NEAR_W || c[3] < NEAR_W) continue;
+            float area = (b[0] - a[0]) * (c[1] - a[1]) - (c[0] - a[0]) * (b[1] - a[1]);
+            if (area <= 0.0f) continue;
+            triangles.insert(triangles.end(), a, a + 3);
+            triangles.insert(triangles.end(), b, b + 3);
+            triangles.insert(triangles.end(), c, c + 3);
+        }
+    }
+    instances.clear();
+
+    // The workers are started by the first render, so the gate is
+    // held by the rendering thread. The calling thread renders a
+    // band as well.
+    unsigned int n = std::min(threads, tilesY);
+    if (workers.empty() && n > 1) {
+        gate.Lock();
+        for (unsigned int i = 1; i < n; ++i) {
+            OcclusionWorker* w = new OcclusionWorker();
+            w->buffer = this;
+            workers.push_back(w);
+            w->Start();
+        }
+    }
+
+    // Rasterize bands of tile rows, along with the workers. The gate
+    // is open until every band is taken.
+    mutex.Lock();
+    bands = workers.size() + 1;
+    nextBand = doneBands = 0;
+    mutex.Unlock();
+    if (!workers.empty()) gate.Unlock();
+    int band;
+    while (NextWorkerBand(band) && band >= 0)
+        RasterizeBand(band);
+    if (!workers.empty()) gate.Lock();
+
+    // wait for the bands taken by the workers.
+    unsigned int wait = 10;
+    mutex.Lock();
+    while (doneBands < bands) {
+        mutex.Unlock();
+        Core::Thread::Sleep(wait);
+        wait = std::min(wait * 2, FINISH_SLEEP);
+        mutex.Lock();
+    }
+    mutex.Unlock();
+}
+
+/**
+ * Take the next band to rasterize.
+ *
+ * @param band Set to the band, or -1 if all are taken.
+ * @return False once the buffer is being deleted.
+ */
+bool OcclusionBuffer::NextWorkerBand(int& band) {
+    mutex.Lock();
+    band = nextBand < bands ? int(nextBand++) : -1;
+    bool res = running;
+    mutex.Unlock();
+    return res;
+}
+
+/**
+ * Rasterize a band taken with NextWorkerBand and count it as done.
+ */
+void OcclusionBuffer::RasterizeBand(unsigned int band) {
+    RasterizeRows(tilesY * band / bands * TILE,
+                  tilesY * (band + 1) / bands * TILE);
+    mutex.Lock();
+    ++doneBands;
+    mutex.Unlock();
+}
+
+/**
+ * Clear and rasterize the rows from first to last, and build their
+ * tiles of the hierarchical depth buffer. The rows must be whole
+ * tiles.
+ */
+void OcclusionBuffer::RasterizeRows(unsigned int first, unsigned int last) {
+    std::fill(depth.begin() + first * width, depth.begin() + last * width, 1.0f);
+
+    for (unsigned int t = 0; t < triangles.size(); t += 9) {
+        const float* v = &triangles[t];
+        float minX = std::min(v[0], std::min(v[3], v[6]));
+        float maxX = std::max(v[0], std::max(v[3], v[6]));
+        float minY = std::min(v[1], std::min(v[4], v[7]));
+        float maxY = std::max(v[1], std::max(v[4], v[7]));
+        int x0 = int(std::max(std::floor(minX), 0.0f));
+        int x1 = int(std::min(std::ceil(maxX), float(width - 1)));
+        int y0 = int(std::max(std::floor(minY), float(first)));
+        int y1 = int(std::min(std::ceil(maxY), float(last - 1)));
+        if (x0 > x1 || y0 > y1) continue;
+
+        // Edge functions, positive inside, and the depth plane.
+        float a[3], b[3], c[3];
+        for (unsigned int e = 0; e < 3; ++e) {
+            const float* p = v + e * 3;
+            const float* q = v + ((e + 1) % 3) * 3;
+            a[e] = p[1] - q[1];
+            b[e] = q[0] - p[0];
+            c[e] = -(a[e] * p[0] + b[e] * p[1]);
+        }
+        // edge e is opposite corner (e + 2) % 3.
+        float area = c[0] + c[1] + c[2];
+        float z0 = v[2], dz1 = (v[5] - z0) / area, dz2 = (v[8] - z0) / area;
+        float za = dz1 * a[2] + dz2 * a[0];
+        float zb = dz1 * b[2] + dz2 * b[0];
+        float zc = z0 + dz1 * c[2] + dz2 * c[0];
+
+        x0 &= ~3;
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            float* row = &depth[y * width];
+#ifdef OE_OCCLUSION_SSE2
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 step = _mm_set1_ps(4.0f);
+            __m128 px = _mm_setr_ps(x0 + 0.5f, x0 + 1.5f, x0 + 2.5f, x0 + 3.5f);
+            __m128 ea = _mm_set1_ps(a[0]), eb = _mm_set1_ps(a[1]), ec = _mm_set1_ps(a[2]);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(ea, px), _mm_set1_ps(b[0] * py + c[0]));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(eb, px), _mm_set1_ps(b[1] * py + c[1]));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(ec, px), _mm_set1_ps(b[2] * py + c[2]));
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                                  _mm_set1_ps(zb * py + zc));
+            const __m128 de0 = _mm_mul_ps(ea, step), de1 = _mm_mul_ps(eb, step);
+            const __m128 de2 = _mm_mul_ps(ec, step);
+            const __m128 dz = _mm_set1_ps(za * 4.0f);
+            for (int x = x0; x <= x1; x += 4) {
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+                                           _mm_and_ps(_mm_cmpge_ps(e1, zero),
+                                                      _mm_cmpge_ps(e2, zero)));
+                if (_mm_movemask_ps(inside)) {
+                    __m128 old = _mm_loadu_ps(row + x);
+                    __m128 nearer = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                                    _mm_andnot_ps(inside, old)));
+                }
+                e0 = _mm_add_ps(e0, de0);
+                e1 = _mm_add_ps(e1, de1);
+                e2 = _mm_add_ps(e2, de2);
+                z = _mm_add_ps(z, dz);
+            }
+#else
+            for (int x = x0; x <= x1; ++x) {
+                float px = x + 0.5f;
+                if (a[0] * px + b[0] * py + c[0] < 0.0f ||
+                    a[1] * px + b[1] * py + c[1] < 0.0f ||
+                    a[2] * px + b[2] * py + c[2] < 0.0f)
+                    continue;
+                float z = za * px + zb * py + zc;
+                if (z < row[x]) row[x] = z;
+            }
+#endif
+        }
+    }
+
+    // Farthest depth of each tile.
+    for (unsigned int ty = first / TILE; ty < last / TILE; ++ty)
+        for (unsigned int tx = 0; tx < tilesX; ++tx) {
+            float farthest = 0.0f;
+            for (unsigned int y = ty * TILE; y < (ty + 1) * TILE; ++y) {
+                const float* row = &depth[y * width + tx * TILE];
+                for (unsigned int x = 0; x < TILE; ++x)
+                    farthest = std::max(farthest, row[x]);
+            }
+            hiz[ty * tilesX + tx] = farthest;
+        }
+}
+
+/**
+ * Test if any part of a box may be visible.
+ *
+ * @param min Lower corner of the box.
+ * @param max Upper corner of the box.
+ * @param mvp Column major model view projection matrix.
+ * @return False if the box is hidden by the occluders.
+ */
+bool OcclusionBuffer::IsVisible(const float min[3], const float max[3],
+                                const float mvp[16]) {
+    ++tested;
+    const float* m = mvp;
+    float lo[3] = {  1e30f,  1e30f,  1e30f };
+    float hi[3] = { -1e30f, -1e30f, -1e30f };
+    for (unsigned int k = 0; k < 8; ++k) {
+        float p[3] = { k & 1 ? max[0] : min[0],
+                       k & 2 ? max[1] : min[1],
+                       k & 4 ? max[2] : min[2] };
+        float w = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+        if (w < NEAR_W) return true;
+        float s[3];
+        for (unsigned int j = 0; j < 3; ++j)
+            s[j] = (m[j] * p[0] + m[4+j] * p[1] + m[8+j] * p[2] + m[12+j]) / w;
+        for (unsigned int j = 0; j < 3; ++j) {
+            lo[j] = std::min(lo[j], s[j]);
+            hi[j] = std::max(hi[j], s[j]);
+        }
+    }
+
+    // Pixels covered by the box and its nearest depth.
+    int x0 = int(std::max(std::floor((lo[0] + 1.0f) * width * 0.5f), 0.0f));
+    int x1 = int(std::min(std::ceil((hi[0] + 1.0f) * width * 0.5f), float(width - 1)));
+    int y0 = int(std::max(std::floor((lo[1] + 1.0f) * height * 0.5f), 0.0f));
+    int y1 = int(std::min(std::ceil((hi[1] + 1.0f) * height * 0.5f), float(height - 1)));
+    float z = (lo[2] + 1.0f) * 0.5f;
+    if (x0 > x1 || y0 > y1) return true;
+
+    for (int ty = y0 / TILE; ty <= y1 / int(TILE); ++ty)
+        for (int tx = x0 / TILE; tx <= x1 / int(TILE); ++tx) {
+            if (z > hiz[ty * tilesX + tx]) continue;
+            int ry0 = std::max(y0, ty * int(TILE)), ry1 = std::min(y1, (ty + 1) * int(TILE) - 1);
+            int rx0 = std::max(x0, tx * int(TILE)), rx1 = std::min(x1, (tx + 1) * int(TILE) - 1);
+            for (int y = ry0; y <= ry1; ++y)
+                for (int x = rx0; x <= rx1; ++x)
+                    if (z <= depth[y * width + x]) return true;
+        }
+    ++culled;
+    return false;
+}
+
+unsigned int OcclusionBuffer::GetWidth() {
+    return width;
+}
+
+unsigned int OcclusionBuffer::GetHeight() {
+    return height;
+}
+
+/**
+ * Get the depth of the pixels, from zero at the near plane to one
+ * at the far plane, row by row from the bottom.
+ */
+const float* OcclusionBuffer::GetDepth() {
+    return &depth[0];
+}
+
+/**
+ * Get the number of triangles rasterized by the last render.
+ */
+unsigned int OcclusionBuffer::GetTriangleCount() {
+    return triangles.size() / 9;
+}
+
+/**
+ * Get the number of boxes tested since the last render.
+ */
+unsigned int OcclusionBuffer::GetTestedCount() {
+    return tested;
+}
+
+/**
+ * Get the number of boxes found hidden since the last render.
+ */
+unsigned int OcclusionBuffer::GetCulledCount() {
+    return culled;
+}
+
+/**
+ * Measure the rasterization speed on a synthetic scene of boxes in
+ * front of the camera and log it.
+ *
+ * @param threads Number of threads, zero for one per processor.
+ * @param iterations Number of times the scene is rendered.
+ * @return Millions of triangles per second.
+ */
+float OcclusionBuffer::Benchmark(unsigned int width,
+                                 unsigned int height,
+                                 unsigned int threads,
+                                 unsigned int iterations) {
+    OcclusionBuffer buffer(width, height, threads);
+
+    // A unit cube with outward facing triangles.
+    const float cube[24] = { -1,-1,-1,  1,-1,-1,  -1, 1,-1,  1, 1,-1,
+                             -1,-1, 1,  1,-1, 1,  -1, 1, 1,  1, 1, 1 };
+    const unsigned int faces[36] = { 0,2,1, 1,2,3,  4,5,6, 5,7,6,
+                                     0,1,4, 1,5,4,  2,6,3, 3,6,7,
+                                     0,4,2, 2,4,6,  1,3,5, 3,7,5 };
+    unsigned int cubeId = buffer.AddOccluder(cube, 3, 8, faces, 36);
+
+    // Cubes on a grid, seen through a perspective projection.
+    const unsigned int grid = 16;
+    std::vector<float> mvps;
+    for (unsigned int i = 0; i < grid * grid; ++i) {
+        float x = (float(i % grid) - grid * 0.5f) * 3.0f;
+        float y = (float(i / grid) - grid * 0.5f) * 2.0f;
+        float z = -20.0f - float(i % 7) * 5.0f;
+        float f = 1.0f, zn = 1.0f, zf = 200.0f;
+        float mvp[16] = { f * 0.5f, 0, 0, 0,
+                          0, f, 0, 0,
+                          0, 0, (zf + zn) / (zn - zf), -1,
+                          0, 0, 0, 0 };
+        // translation by (x, y, z) folded into the projection.
+        mvp[12] = mvp[0] * x;
+        mvp[13] = mvp[5] * y;
+        mvp[14] = mvp[10] * z + 2.0f * zf * zn / (zn - zf);
+        mvp[15] = -z;
+        mvps.insert(mvps.end(), mvp, mvp + 16);
+    }
+
+    Utils::Timer timer;
+    timer.Start();
+    unsigned int tris = 0;
+    for (unsigned int it = 0; it < iterations; ++it) {
+        for (unsigned int i = 0; i < grid * grid; ++i)
+            buffer.Draw(cubeId, &mvps[i * 16]);
+        buffer.Render();
+        tris += buffer.GetTriangleCount();
+    }
+    double usecs = (double)timer.GetElapsedTime().AsInt();
+    if (usecs <= 0.0) usecs = 1.0;
+    float mtps = (float)(tris / usecs);
+
+    logger.info << "Occlusion buffer: " << buffer.GetWidth() << "x"
+                << buffer.GetHeight() << " with "
+                << (threads == 0 ? DXTCompressor::DefaultThreads() : threads)
+                << " threads, " << mtps << " million triangles/s" << logger.end;
+    return mtps;
+}
+
+/**
+ * Check IsVisible against boxes around a square occluder and log
+ * the result. The occluder covers the middle of the screen halfway
+ * into the depth range, drawn with the identity as projection.
+ *
+ * @param threads Number of threads, zero for one per processor.
+ * @return True if every box got the expected visibility.
+ */
+bool OcclusionBuffer::SelfTest(unsigned int threads) {
+    OcclusionBuffer buffer(64, 32, threads);
+    const float quad[12] = { -0.5f,-0.5f, 0.0f,   0.5f,-0.5f, 0.0f,
+                             -0.5f, 0.5f, 0.0f,   0.5f, 0.5f, 0.0f };
+    const unsigned int faces[6] = { 0,1,2, 1,3,2 };
+    unsigned int quadId = buffer.AddOccluder(quad, 3, 4, faces, 6);
+    const float identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+
+    struct Box {
+        float min[3], max[3];
+        bool visible;
+    };
+    const Box boxes[] = {
+        // behind the occluder.
+        { { -0.2f, -0.2f,  0.2f }, { 0.2f, 0.2f,  0.5f }, false },
+        // in front of it.
+        { { -0.2f, -0.2f, -0.5f }, { 0.2f, 0.2f, -0.1f }, true },
+        // behind it, reaching past its edge.
+        { {  0.3f, -0.2f,  0.2f }, { 0.8f, 0.2f,  0.5f }, true },
+        // beside it.
+        { { -0.9f, -0.9f,  0.2f }, { -0.7f, -0.7f, 0.5f }, true },
+        // crossing it.
+        { { -0.2f, -0.2f, -0.2f }, { 0.2f, 0.2f,  0.2f }, true }
+    };
+    const unsigned int count = sizeof(boxes) / sizeof(Box);
+
+    // Render twice, so the workers are parked and woken again.
+    unsigned int failed = 0;
+    for (unsigned int frame = 0; frame < 2; ++frame) {
+        buffer.Draw(quadId, identity);
+        buffer.Render();
+        for (unsigned int i = 0; i < count; ++i)
+            if (buffer.IsVisible(boxes[i].min, boxes[i].max, identity) != boxes[i].visible) {
+                logger.warning << "Occlusion buffer: box " << i << " should be "
+                               << (boxes[i].visible ? "visible" : "hidden") << logger.end;
+                ++failed;
+            }
+    }
+    logger.info << "Occlusion buffer: self test "
+                << (failed == 0 ? "passed" : "failed") << logger.end;
+    return failed == 0;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,120 @@
+// Software rasterized occlusion buffer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_OCCLUSION_BUFFER_H_
+#define _OPENGL_OCCLUSION_BUFFER_H_
+
+#include <Core/Mutex.h>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+class OcclusionWorker;
+
+/**
+ * Low resolution depth buffer rendered on the cpu, for culling
+ * meshes hidden behind large occluders before they are sent to
+ * OpenGL.
+ *
+ * Occluder meshes are added once with a copy of their positions and
+ * triangle indices. Each frame the occluders in view are queued
+ * with their model view projection matrices and Render rasterizes
+ * them. The buffer is split into bands of rows rendered by a number
+ * of threads, four pixels at a time with SSE2 when available. Each
+ * band then builds its part of a hierarchical depth buffer holding
+ * the farthest depth of every 8x8 tile.
+ *
+ * The worker threads are started by the first Render and live as
+ * long as the buffer. Render opens a gate mutex, held by the
+ * rendering thread between frames, and hands out the bands to the
+ * workers and the calling thread alike, so bands are not held up by
+ * a worker that wakes late. Idle workers are blocked on the gate,
+ * so Render and the destructor must be called from one thread.
+ *
+ * IsVisible tests a box against the tiles it covers, and only reads
+ * the pixels of tiles that do not hide it. Triangles crossing the
+ * near plane are not rasterized and boxes crossing it are visible,
+ * so the test errs on the visible side.
+ *
+ * The buffer does not use OpenGL.
+ *
+ * @class OcclusionBuffer OcclusionBuffer.h Renderers/OpenGL/OcclusionBuffer.h
+ */
+class OcclusionBuffer {
+public:
+    static const unsigned int TILE = 8;
+
+private:
+    struct Occluder {
+        std::vector<float> positions;
+        std::vector<unsigned int> indices;
+    };
+    struct Instance {
+        unsigned int occluder;
+        float mvp[16];
+    };
+
+    unsigned int width, height, tilesX, tilesY, threads;
+    std::vector<float> depth, hiz;
+    std::vector<Occluder> occluders;
+    std::vector<Instance> instances;
+    // screen space x, y and depth of the triangle corners.
+    std::vector<float> triangles;
+    unsigned int tested, culled;
+
+    // guards the bands and the running flag.
+    Core::Mutex mutex;
+    // held by the rendering thread while the workers are parked.
+    Core::Mutex gate;
+    bool running;
+    unsigned int bands, nextBand, doneBands;
+    std::vector<OcclusionWorker*> workers;
+
+    friend class OcclusionWorker;
+    bool NextWorkerBand(int& band);
+    void RasterizeBand(unsigned int band);
+    void RasterizeRows(unsigned int first, unsigned int last);
+public:
+    OcclusionBuffer(unsigned int width = 256, unsigned int height = 128,
+                    unsigned int threads = 0);
+    ~OcclusionBuffer();
+
+    unsigned int AddOccluder(const float* positions,
+                             unsigned int dimension,
+                             unsigned int count,
+                             const unsigned int* indices,
+                             unsigned int indexCount);
+    void Clear();
+    void Draw(unsigned int occluder, const float mvp[16]);
+    void Render();
+
+    bool IsVisible(const float min[3], const float max[3],
+                   const float mvp[16]);
+
+    unsigned int GetWidth();
+    unsigned int GetHeight();
+    const float* GetDepth();
+    unsigned int GetTriangleCount();
+    unsigned int GetTestedCount();
+    unsigned int GetCulledCount();
+
+    static float Benchmark(unsigned int width = 256,
+                           unsigned int height = 128,
+                           unsigned int threads = 0,
+                           unsigned int iterations = 100);
+    static bool SelfTest(unsigned int threads = 0);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_OCCLUSION_BUFFER_H_
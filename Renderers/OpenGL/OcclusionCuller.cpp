@@ -0,0 +1,249 @@
+// Occlusion culling with hardware queries.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/OcclusionCuller.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <algorithm>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Scene::ISceneNode;
+
+// Frames a mesh is remembered after it was last seen.
+static const unsigned int KEEP_FRAMES = 30;
+
+OcclusionCuller::OcclusionCuller()
+    : active(0)
+    , supported(false)
+    , enabled(false)
+    , frame(0)
+    , interval(4)
+    , tested(0)
+    , culled(0)
+    , drawn(0) {}
+
+/**
+ * Destructor. The queries are not deleted, as the context may be
+ * gone, use Clear while it is current.
+ */
+OcclusionCuller::~OcclusionCuller() {}
+
+/**
+ * Check for occlusion query support. Called by the renderer when
+ * the context is ready.
+ */
+void OcclusionCuller::Initialize() {
+    supported = glewIsSupported("GL_VERSION_1_5");
+}
+
+/**
+ * Start a new frame, resetting the statistics and forgetting the
+ * meshes that have left the scene.
+ */
+void OcclusionCuller::NewFrame() {
+    ++frame;
+    tested = culled = drawn = 0;
+    std::map<ISceneNode*, Entry>::iterator itr = entries.begin();
+    while (itr != entries.end()) {
+        if (frame - itr->second.seen > KEEP_FRAMES) {
+            if (itr->second.query != 0) queries.push_back(itr->second.query);
+            entries.erase(itr++);
+        } else ++itr;
+    }
+}
+
+/**
+ * Delete all queries and forget the visibility of the meshes.
+ */
+void OcclusionCuller::Clear() {
+    for (std::map<ISceneNode*, Entry>::iterator itr = entries.begin();
+         itr != entries.end(); ++itr)
+        if (itr->second.query != 0) queries.push_back(itr->second.query);
+    if (!queries.empty())
+        glDeleteQueries(queries.size(), &queries[0]);
+    CHECK_FOR_GL_ERROR();
+    queries.clear();
+    entries.clear();
+    active = 0;
+}
+
+void OcclusionCuller::SetEnabled(bool enabled) {
+    this->enabled = enabled;
+}
+
+bool OcclusionCuller::IsEnabled() {
+    return enabled && supported;
+}
+
+/**
+ * Set the number of frames between the queries of visible meshes,
+ * four by default. Longer intervals issue fewer queries but find
+ * hidden meshes later.
+ */
+void OcclusionCuller::SetQueryInterval(unsigned int frames) {
+    interval = std::max(1u, frames);
+}
+
+GLuint OcclusionCuller::Query(Entry& entry) {
+    if (entry.query == 0) {
+        if (queries.empty())
+            glGenQueries(1, &entry.query);
+        else {
+            entry.query = queries.back();
+            queries.pop_back();
+        }
+    }
+    entry.pending = true;
+    entry.queried = frame;
+    ++tested;
+    return entry.query;
+}
+
+void OcclusionCuller::DrawBox(const Bounds& b) {
+    GLStateCache::Push();
+    GLStateCache::DepthMask(false);
+    GLStateCache::Disable(GL_CULL_FACE);
+    GLStateCache::PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    GLStateCache::ColorMask(false, false, false, false);
+
+    const Vector<3,float>& lo = b.min;
+    const Vector<3,float>& hi = b.max;
+    glBegin(GL_QUADS);
+    // faces along each axis, at the low and the high side.
+    for (unsigned int a = 0; a < 3; ++a) {
+        unsigned int u = (a + 1) % 3, v = (a + 2) % 3;
+        for (unsigned int s = 0; s < 2; ++s) {
+            float p[3];
+            p[a] = s ? hi[a] : lo[a];
+            p[u] = lo[u]; p[v] = lo[v]; glVertex3fv(p);
+            p[u] = hi[u];               glVertex3fv(p);
+            p[v] = hi[v];               glVertex3fv(p);
+            p[u] = lo[u];               glVertex3fv(p);
+        }
+    }
+    glEnd();
+
+    GLStateCache::ColorMask(true, true, true, true);
+    GLStateCache::Pop();
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Decide if a mesh is drawn. If it is, the mesh must be drawn next,
+ * followed by a call to End. If it is not, a query has been issued
+ * for its bounding box when needed.
+ *
+ * @param node Mesh or static batch node about to be drawn.
+ * @param b Bounds of the mesh vertices.
+ * @param modelView Column major modelview matrix of the mesh, which
+ *                  must also be the current OpenGL modelview.
+ * @return True if the mesh should be drawn.
+ */
+bool OcclusionCuller::Begin(ISceneNode* node, const Bounds& b,
+                            const float modelView[16]) {
+    if (!IsEnabled() || !b.valid) {
+        ++drawn;
+        return true;
+    }
+
+    // a node reached twice in a frame shares its visibility with
+    // itself, so the other instances are drawn.
+    Entry& e = entries[node];
+    if (e.seen == frame) {
+        ++drawn;
+        return true;
+    }
+    e.seen = frame;
+
+    // collect the result of an earlier query if it is ready.
+    if (e.pending) {
+        GLint available = 0;
+        glGetQueryObjectiv(e.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(e.query, GL_QUERY_RESULT, &samples);
+            e.visible = samples > 0;
+            e.pending = false;
+        }
+    }
+
+    // the box would be clipped by the near plane if the eye is
+    // inside it.
+    const float* m = modelView;
+    float dist = 0.0f, scale = 0.0f;
+    for (unsigned int j = 0; j < 3; ++j) {
+        float c = m[j] * b.center[0] + m[4+j] * b.center[1] +
+            m[8+j] * b.center[2] + m[12+j];
+        dist += c * c;
+        scale = std::max(scale, m[j*4] * m[j*4] + m[j*4+1] * m[j*4+1] +
+                         m[j*4+2] * m[j*4+2]);
+    }
+    if (dist <= b.radius * b.radius * scale) {
+        e.visible = true;
+        ++drawn;
+        return true;
+    }
+
+    if (!e.visible) {
+        if (!e.pending) {
+            glBeginQuery(GL_SAMPLES_PASSED, Query(e));
+            DrawBox(b);
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+        ++culled;
+        return false;
+    }
+
+    if (!e.pending && frame - e.queried >= interval) {
+        active = Query(e);
+        glBeginQuery(GL_SAMPLES_PASSED, active);
+    }
+    ++drawn;
+    return true;
+}
+
+/**
+ * End the drawing of a mesh started by Begin.
+ */
+void OcclusionCuller::End() {
+    if (active == 0) return;
+    glEndQuery(GL_SAMPLES_PASSED);
+    CHECK_FOR_GL_ERROR();
+    active = 0;
+}
+
+/**
+ * Get the number of queries issued in the current frame.
+ */
+unsigned int OcclusionCuller::GetTestedCount() {
+    return tested;
+}
+
+/**
+ * Get the number of meshes skipped as hidden in the current frame.
+ */
+unsigned int OcclusionCuller::GetCulledCount() {
+    return culled;
+}
+
+/**
+ * Get the number of meshes drawn through the culler in the current
+ * frame.
+ */
+unsigned int OcclusionCuller::GetDrawnCount() {
+    return drawn;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
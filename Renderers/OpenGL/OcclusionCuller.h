@@ -0,0 +1,93 @@
+// Occlusion culling with hardware queries.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_OCCLUSION_CULLER_H_
+#define _OPENGL_OCCLUSION_CULLER_H_
+
+#include <Meta/OpenGL.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Scene {
+        class ISceneNode;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+struct Bounds;
+
+/**
+ * Skips meshes hidden behind the ones drawn before them.
+ *
+ * Visibility is coherent between frames, so each mesh is drawn or
+ * skipped from the result of an occlusion query issued in an earlier
+ * frame, and the renderer never waits for a result. Results that are
+ * not ready keep the previous visibility.
+ *
+ * A mesh believed hidden is not drawn. Its bounding box is drawn
+ * instead, without writing color or depth, inside a query. A visible
+ * mesh is drawn inside a query every few frames, to find out when it
+ * becomes hidden. Meshes without bounds, and meshes whose bounding
+ * sphere contains the eye, are always drawn.
+ *
+ * A mesh that becomes visible appears one frame late. Meshes are
+ * tested in scene order, so drawing large occluders first culls the
+ * most. The meshes of a static batch node are tested together from
+ * the bounds of the batch.
+ *
+ * Requires OpenGL 1.5. Disabled by default.
+ *
+ * @class OcclusionCuller OcclusionCuller.h Renderers/OpenGL/OcclusionCuller.h
+ */
+class OcclusionCuller {
+private:
+    struct Entry {
+        GLuint query;
+        bool pending, visible;
+        // frame the mesh was last seen and last queried.
+        unsigned int seen, queried;
+        Entry() : query(0), pending(false), visible(true), seen(0), queried(0) {}
+    };
+    std::map<Scene::ISceneNode*, Entry> entries;
+    std::vector<GLuint> queries;
+    // query around the mesh being drawn, zero if none.
+    GLuint active;
+    bool supported, enabled;
+    unsigned int frame, interval;
+    unsigned int tested, culled, drawn;
+
+    GLuint Query(Entry& entry);
+    void DrawBox(const Bounds& b);
+public:
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    void Initialize();
+    void NewFrame();
+    void Clear();
+
+    void SetEnabled(bool enabled);
+    bool IsEnabled();
+    void SetQueryInterval(unsigned int frames);
+
+    bool Begin(Scene::ISceneNode* node, const Bounds& b,
+               const float modelView[16]);
+    void End();
+
+    unsigned int GetTestedCount();
+    unsigned int GetCulledCount();
+    unsigned int GetDrawnCount();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_OCCLUSION_CULLER_H_
@@ -0,0 +1,169 @@
+// Post process resolution control.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/PostProcessResolution.h>
+#include <Scene/PostProcessNode.h>
+#include <algorithm>
+#include <cmath>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Scene::PostProcessNode;
+
+// Frames measured but not read back before timing is paused.
+static const unsigned int MAX_PENDING = 4;
+// Largest relative change of the dynamic scale per frame.
+static const float MAX_STEP = 0.1f;
+
+PostProcessResolution::PostProcessResolution()
+    : supported(false)
+    , depth(0)
+    , target(0.0f)
+    , minimum(0.5f)
+    , dynamic(1.0f)
+    , time(0.0f) {}
+
+PostProcessResolution::~PostProcessResolution() {}
+
+/**
+ * Check for timer query support. Called by the renderer when the
+ * context is ready.
+ */
+void PostProcessResolution::Initialize() {
+    supported = glewGetExtension("GL_EXT_timer_query") == GL_TRUE;
+}
+
+/**
+ * Read back the measured frames and adjust the dynamic scale. Called
+ * by the renderer before each frame.
+ */
+void PostProcessResolution::Update() {
+    if (!current.empty()) {
+        pending.push_back(current);
+        current.clear();
+    }
+
+    // queries finish in order, so a frame is done when its last
+    // query is.
+    bool measured = false;
+    while (!pending.empty()) {
+        std::vector<GLuint>& frame = pending.front();
+        GLint available = 0;
+        glGetQueryObjectiv(frame.back(), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+        GLuint64EXT total = 0;
+        for (unsigned int i = 0; i < frame.size(); ++i) {
+            GLuint64EXT elapsed = 0;
+            glGetQueryObjectui64vEXT(frame[i], GL_QUERY_RESULT, &elapsed);
+            total += elapsed;
+            queries.push_back(frame[i]);
+        }
+        time = total * 1.0e-6f;
+        measured = true;
+        pending.pop_front();
+    }
+    CHECK_FOR_GL_ERROR();
+    if (!measured || target <= 0.0f) return;
+
+    // The time grows with the number of pixels, the square of the
+    // scale.
+    float scale = dynamic * sqrt(target / std::max(time, 0.001f));
+    scale = std::min(std::max(scale, dynamic * (1.0f - MAX_STEP)),
+                     dynamic * (1.0f + MAX_STEP));
+    dynamic = std::min(std::max(scale, minimum), 1.0f);
+}
+
+/**
+ * Set the fraction of its dimension a node renders its scene at.
+ */
+void PostProcessResolution::SetScale(PostProcessNode* node, Scale scale) {
+    if (scale == FULL) scales.erase(node);
+    else scales[node] = scale;
+}
+
+PostProcessResolution::Scale PostProcessResolution::GetScale(PostProcessNode* node) {
+    std::map<PostProcessNode*, Scale>::iterator itr = scales.find(node);
+    return itr == scales.end() ? FULL : itr->second;
+}
+
+/**
+ * Set the GPU time in milliseconds the post processing should take
+ * per frame. Zero disables the dynamic scale.
+ */
+void PostProcessResolution::SetTargetTime(float ms) {
+    target = ms;
+    if (target <= 0.0f) dynamic = 1.0f;
+}
+
+float PostProcessResolution::GetTargetTime() {
+    return target;
+}
+
+/**
+ * Set the smallest dynamic scale, 0.5 by default.
+ */
+void PostProcessResolution::SetMinimumScale(float scale) {
+    minimum = scale;
+    dynamic = std::max(dynamic, minimum);
+}
+
+float PostProcessResolution::GetDynamicScale() {
+    return dynamic;
+}
+
+/**
+ * Get the GPU time of post processing in the newest measured frame,
+ * in milliseconds.
+ */
+float PostProcessResolution::GetTime() {
+    return time;
+}
+
+/**
+ * Get the size of the scene rendered by a node.
+ */
+Vector<2, int> PostProcessResolution::GetDimension(PostProcessNode* node) {
+    Vector<2, int> dims = node->GetDimension();
+    float scale = dynamic / GetScale(node);
+    return Vector<2, int>(std::max(1, int(dims[0] * scale + 0.5f)),
+                          std::max(1, int(dims[1] * scale + 0.5f)));
+}
+
+/**
+ * Start timing the passes of a post process node. Timer queries do
+ * not nest, so only the outermost node is timed.
+ *
+ * @return True if a query was started, which must be passed to End.
+ */
+bool PostProcessResolution::Begin() {
+    if (depth++ > 0 || !supported || target <= 0.0f ||
+        pending.size() >= MAX_PENDING)
+        return false;
+    GLuint query;
+    if (queries.empty())
+        glGenQueries(1, &query);
+    else {
+        query = queries.back();
+        queries.pop_back();
+    }
+    glBeginQuery(GL_TIME_ELAPSED_EXT, query);
+    current.push_back(query);
+    return true;
+}
+
+void PostProcessResolution::End(bool timed) {
+    --depth;
+    if (timed) glEndQuery(GL_TIME_ELAPSED_EXT);
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,89 @@
+// Post process resolution control.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_POST_PROCESS_RESOLUTION_H_
+#define _OPENGL_POST_PROCESS_RESOLUTION_H_
+
+#include <Meta/OpenGL.h>
+#include <Math/Vector.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Scene {
+        class PostProcessNode;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+using Math::Vector;
+
+/**
+ * Resolution of the scenes rendered by post process nodes.
+ *
+ * Each node renders its scene at a fixed fraction of its dimension,
+ * full, half or quarter, set with SetScale. On top of that a dynamic
+ * scale keeps the GPU time of post processing near a target. The
+ * time is measured with timer queries around the outermost post
+ * process nodes and read back a few frames later, without waiting
+ * for the GPU. Update adjusts the dynamic scale once per frame from
+ * the newest measured frame.
+ *
+ * The scene frame buffers keep their size. A scaled scene is drawn
+ * in the lower left corner of the buffer, and the effect upsamples
+ * it using the vec2 uniform resolutionScale, which holds the used
+ * fraction of the buffer. Effects without that uniform are always
+ * rendered at full resolution.
+ *
+ * @class PostProcessResolution PostProcessResolution.h Renderers/OpenGL/PostProcessResolution.h
+ */
+class PostProcessResolution {
+public:
+    enum Scale {
+        FULL    = 1,
+        HALF    = 2,
+        QUARTER = 4
+    };
+
+private:
+    std::map<Scene::PostProcessNode*, Scale> scales;
+    // timer queries of the frames not read back yet, oldest first.
+    std::deque<std::vector<GLuint> > pending;
+    // queries of the frame being rendered and unused queries.
+    std::vector<GLuint> current, queries;
+    bool supported;
+    unsigned int depth;
+    float target, minimum, dynamic, time;
+
+public:
+    PostProcessResolution();
+    ~PostProcessResolution();
+
+    void Initialize();
+    void Update();
+
+    void SetScale(Scene::PostProcessNode* node, Scale scale);
+    Scale GetScale(Scene::PostProcessNode* node);
+    void SetTargetTime(float ms);
+    float GetTargetTime();
+    void SetMinimumScale(float scale);
+    float GetDynamicScale();
+    float GetTime();
+
+    Vector<2, int> GetDimension(Scene::PostProcessNode* node);
+    bool Begin();
+    void End(bool timed);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_POST_PROCESS_RESOLUTION_H_
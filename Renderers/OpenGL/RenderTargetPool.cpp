@@ -0,0 +1,388 @@
+// Transient render target pool.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/RenderTargetPool.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Resources/FrameBuffer.h>
+#include <Resources/ITexture2D.h>
+#include <Core/Exceptions.h>
+#include <Logging/Logger.h>
+#include <algorithm>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+
+// Number of frames an unused target is kept before it is deleted.
+static const unsigned int KEEP_FRAMES = 3;
+
+RenderTargetPool::FreeLists RenderTargetPool::available;
+std::vector<RenderTarget*> RenderTargetPool::targets;
+std::map<GLuint, GLuint> RenderTargetPool::attached;
+std::map<GLuint, unsigned int> RenderTargetPool::tracked;
+std::map<GLuint, GLuint> RenderTargetPool::owned;
+unsigned int RenderTargetPool::frame = 0;
+unsigned int RenderTargetPool::inUse = 0;
+unsigned int RenderTargetPool::memory = 0;
+unsigned int RenderTargetPool::peak = 0;
+unsigned int RenderTargetPool::deleted = 0;
+
+bool RenderTargetPool::Key::operator<(const Key& k) const {
+    if (width != k.width) return width < k.width;
+    if (height != k.height) return height < k.height;
+    if (colorFormat != k.colorFormat) return colorFormat < k.colorFormat;
+    return depthFormat < k.depthFormat;
+}
+
+// Estimated bytes per texel, drivers pad three channel formats.
+static unsigned int TexelSize(GLenum format) {
+    switch (format) {
+    case 0:                      return 0;
+    case GL_DEPTH_COMPONENT16:   return 2;
+    case GL_RGBA16F_ARB:         return 8;
+    case GL_RGB32F_ARB:          return 12;
+    case GL_RGBA32F_ARB:         return 16;
+    default:                     return 4;
+    }
+}
+
+static unsigned int TexelSize(ColorFormat format) {
+    switch (format) {
+    case RGB32F:  return 12;
+    case RGBA32F: return 16;
+    default:      return 4;
+    }
+}
+
+static bool IsFloat(GLenum format) {
+    return format == GL_RGBA16F_ARB || format == GL_RGB32F_ARB ||
+        format == GL_RGBA32F_ARB;
+}
+
+void RenderTargetPool::Allocated(unsigned int bytes) {
+    memory += bytes;
+    if (memory > peak) peak = memory;
+}
+
+unsigned int RenderTargetPool::Size(const RenderTarget* t) {
+    return t->width * t->height *
+        (TexelSize(t->colorFormat) + TexelSize(t->depthFormat));
+}
+
+RenderTarget* RenderTargetPool::Create(Key key) {
+    RenderTarget* t = new RenderTarget();
+    t->width = key.width;
+    t->height = key.height;
+    t->colorFormat = key.colorFormat;
+    t->depthFormat = key.depthFormat;
+    t->color = t->depth = 0;
+
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    glGenFramebuffersEXT(1, &t->fbo);
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, t->fbo);
+    CHECK_FOR_GL_ERROR();
+
+    if (key.colorFormat != 0) {
+        glGenTextures(1, &t->color);
+        TextureUnitCache::Bind(GL_TEXTURE_2D, t->color);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, key.colorFormat, key.width, key.height, 0,
+                     GL_RGBA, IsFloat(key.colorFormat) ? GL_FLOAT : GL_UNSIGNED_BYTE,
+                     NULL);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                  GL_TEXTURE_2D, t->color, 0);
+        CHECK_FOR_GL_ERROR();
+    } else {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    if (key.depthFormat != 0) {
+        glGenRenderbuffersEXT(1, &t->depth);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, t->depth);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, key.depthFormat,
+                                 key.width, key.height);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                     GL_RENDERBUFFER_EXT, t->depth);
+        CHECK_FOR_GL_ERROR();
+    }
+    CHECK_FRAMEBUFFER_STATUS();
+
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+    CHECK_FOR_GL_ERROR();
+
+    targets.push_back(t);
+    Allocated(Size(t));
+    return t;
+}
+
+void RenderTargetPool::Delete(RenderTarget* t) {
+    // frame buffers holding the depth buffer must attach it again
+    // if it is reused.
+    std::map<GLuint, GLuint>::iterator itr = attached.begin();
+    while (itr != attached.end()) {
+        if (itr->second == t->depth) attached.erase(itr++);
+        else ++itr;
+    }
+
+    if (t->color != 0) {
+        TextureUnitCache::Forget(t->color);
+        glDeleteTextures(1, &t->color);
+    }
+    if (t->depth != 0)
+        glDeleteRenderbuffersEXT(1, &t->depth);
+    glDeleteFramebuffersEXT(1, &t->fbo);
+    CHECK_FOR_GL_ERROR();
+
+    ++deleted;
+    memory -= Size(t);
+    delete t;
+}
+
+/**
+ * Acquire a render target. A released target with the same size and
+ * formats is reused if there is one, otherwise a new one is created.
+ * The contents of the target are undefined.
+ *
+ * @param width Target width.
+ * @param height Target height.
+ * @param colorFormat Internal format of the color texture, zero for
+ *                    no color attachment.
+ * @param depthFormat Internal format of the depth buffer, zero for no
+ *                    depth attachment.
+ */
+RenderTarget* RenderTargetPool::Acquire(int width, int height,
+                                        GLenum colorFormat, GLenum depthFormat) {
+    Key key = { width, height, colorFormat, depthFormat };
+    std::vector<RenderTarget*>& list = available[key];
+    RenderTarget* t;
+    if (list.empty())
+        t = Create(key);
+    else {
+        t = list.back();
+        list.pop_back();
+    }
+    t->lastUsed = frame;
+    ++inUse;
+    return t;
+}
+
+/**
+ * Hand a target back to the pool once its contents have been
+ * consumed. Passes acquiring a target from now on may render to it.
+ */
+void RenderTargetPool::Release(RenderTarget* t) {
+#if OE_SAFE
+    if (t == NULL) throw Core::Exception("Cannot release NULL render target.");
+#endif
+    Key key = { t->width, t->height, t->colorFormat, t->depthFormat };
+    t->lastUsed = frame;
+    available[key].push_back(t);
+    --inUse;
+}
+
+/**
+ * Acquire a depth buffer for a frame buffer without a depth texture
+ * and attach it. The frame buffer must be bound. Release the
+ * returned target when the pass rendering to the frame buffer is
+ * done.
+ *
+ * @param fb Bound frame buffer.
+ */
+RenderTarget* RenderTargetPool::AcquireDepth(FrameBuffer* fb) {
+    DropDepth(fb);
+    Math::Vector<2, int> dims = fb->GetDimension();
+    RenderTarget* t = Acquire(dims[0], dims[1], 0);
+    GLuint& depth = attached[fb->GetID()];
+    if (depth != t->depth) {
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                     GL_RENDERBUFFER_EXT, t->depth);
+        CHECK_FOR_GL_ERROR();
+        depth = t->depth;
+    }
+    return t;
+}
+
+/**
+ * Count the attachments of a frame buffer bound by the renderer in
+ * the memory usage. A frame buffer without a depth texture gets a
+ * depth buffer of its own. The frame buffer must be bound.
+ */
+void RenderTargetPool::Track(FrameBuffer* fb) {
+    // a frame buffer deleted without Untrack left its id behind.
+    Forget(fb->GetID());
+
+    Math::Vector<2, int> dims = fb->GetDimension();
+    unsigned int texel = 0;
+    for (unsigned int i = 0; i < fb->GetNumberOfAttachments(); ++i)
+        texel += TexelSize(fb->GetTexAttachment(i)->GetColorFormat());
+    if (fb->GetDepthTexture())
+        texel += TexelSize(GL_DEPTH_COMPONENT);
+    else {
+        GLuint depth;
+        glGenRenderbuffersEXT(1, &depth);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depth);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24,
+                                 dims[0], dims[1]);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                     GL_RENDERBUFFER_EXT, depth);
+        CHECK_FOR_GL_ERROR();
+        owned[fb->GetID()] = depth;
+        texel += TexelSize(GL_DEPTH_COMPONENT24);
+    }
+
+    unsigned int size = dims[0] * dims[1] * texel;
+    tracked[fb->GetID()] = size;
+    Allocated(size);
+}
+
+/**
+ * Forget a frame buffer bound by the renderer and delete its own
+ * depth buffer. Called when the frame buffer is deleted.
+ */
+void RenderTargetPool::Untrack(FrameBuffer* fb) {
+    Forget(fb->GetID());
+}
+
+void RenderTargetPool::Forget(GLuint fbo) {
+    std::map<GLuint, GLuint>::iterator depth = owned.find(fbo);
+    if (depth != owned.end()) {
+        glDeleteRenderbuffersEXT(1, &depth->second);
+        CHECK_FOR_GL_ERROR();
+        owned.erase(depth);
+    }
+    attached.erase(fbo);
+    std::map<GLuint, unsigned int>::iterator itr = tracked.find(fbo);
+    if (itr == tracked.end()) return;
+    ++deleted;
+    memory -= itr->second;
+    tracked.erase(itr);
+}
+
+/**
+ * Delete the depth buffer of a tracked frame buffer without a depth
+ * texture, for frame buffers drawn without depth testing or given a
+ * pooled depth buffer by AcquireDepth. Must be called before depth
+ * is attached to the frame buffer in another way.
+ */
+void RenderTargetPool::DropDepth(FrameBuffer* fb) {
+    std::map<GLuint, GLuint>::iterator itr = owned.find(fb->GetID());
+    if (itr == owned.end()) return;
+    // detach it first, so its memory is freed right away.
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, fb->GetID());
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                 GL_RENDERBUFFER_EXT, 0);
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+    glDeleteRenderbuffersEXT(1, &itr->second);
+    CHECK_FOR_GL_ERROR();
+    owned.erase(itr);
+
+    Math::Vector<2, int> dims = fb->GetDimension();
+    unsigned int bytes = dims[0] * dims[1] * TexelSize(GL_DEPTH_COMPONENT24);
+    unsigned int& size = tracked[fb->GetID()];
+    size -= bytes;
+    memory -= bytes;
+}
+
+/**
+ * Get the depth buffer attached to a frame buffer by the pool, its
+ * own or one acquired with AcquireDepth, zero if it has none.
+ */
+GLuint RenderTargetPool::GetDepthBuffer(GLuint fbo) {
+    std::map<GLuint, GLuint>::iterator itr = attached.find(fbo);
+    if (itr != attached.end()) return itr->second;
+    itr = owned.find(fbo);
+    return itr != owned.end() ? itr->second : 0;
+}
+
+/**
+ * Start a new frame, deleting the targets that have not been used
+ * for a few frames.
+ */
+void RenderTargetPool::NewFrame() {
+    ++frame;
+    for (FreeLists::iterator itr = available.begin(); itr != available.end(); ++itr) {
+        std::vector<RenderTarget*>& list = itr->second;
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < list.size(); ++i) {
+            if (frame - list[i]->lastUsed > KEEP_FRAMES) {
+                targets.erase(std::find(targets.begin(), targets.end(), list[i]));
+                Delete(list[i]);
+            } else list[kept++] = list[i];
+        }
+        list.resize(kept);
+    }
+}
+
+/**
+ * Delete all targets and forget the tracked frame buffers. Must be
+ * called while the context is current, targets still acquired
+ * become invalid.
+ */
+void RenderTargetPool::Clear() {
+    if (!targets.empty() || !tracked.empty())
+        logger.info << "Render targets peak memory: "
+                    << peak / 1024 << " KB" << logger.end;
+    for (unsigned int i = 0; i < targets.size(); ++i)
+        Delete(targets[i]);
+    for (std::map<GLuint, GLuint>::iterator itr = owned.begin();
+         itr != owned.end(); ++itr)
+        glDeleteRenderbuffersEXT(1, &itr->second);
+    owned.clear();
+    targets.clear();
+    available.clear();
+    attached.clear();
+    tracked.clear();
+    memory = inUse = 0;
+    ++deleted;
+}
+
+unsigned int RenderTargetPool::GetTargetCount() {
+    return targets.size();
+}
+
+unsigned int RenderTargetPool::GetTargetsInUse() {
+    return inUse;
+}
+
+/**
+ * Get the bytes held by pooled targets and tracked frame buffers.
+ */
+unsigned int RenderTargetPool::GetMemoryUsage() {
+    return memory;
+}
+
+/**
+ * Get the highest memory usage seen, in bytes.
+ */
+unsigned int RenderTargetPool::GetPeakMemoryUsage() {
+    return peak;
+}
+
+/**
+ * Get the number of frame buffers deleted by the pool or forgotten
+ * after the renderer deleted them. The ids of those frame buffers
+ * may have been reused since.
+ */
+unsigned int RenderTargetPool::GetDeleteCount() {
+    return deleted;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,112 @@
+// Transient render target pool.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_RENDER_TARGET_POOL_H_
+#define _OPENGL_RENDER_TARGET_POOL_H_
+
+#include <Meta/OpenGL.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Resources {
+        class FrameBuffer;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * A pooled render target. The color attachment is a texture that
+ * can be sampled, the depth attachment is a render buffer. Either
+ * is zero if it was not requested.
+ */
+struct RenderTarget {
+    GLuint fbo, color, depth;
+    int width, height;
+    GLenum colorFormat, depthFormat;
+    unsigned int lastUsed;
+};
+
+/**
+ * Pool of transient render targets.
+ *
+ * Passes acquire the targets they render to when they start and
+ * release them when their result has been consumed. Released targets
+ * are handed to the next pass asking for the same size, format and
+ * attachments, so passes whose lifetimes do not overlap share the
+ * memory, both within a frame and across frames. Targets that have
+ * not been used for a few frames are deleted by NewFrame.
+ *
+ * Frame buffers owned by the scene are bound once by the renderer
+ * and live as long as their nodes. They are registered with Track
+ * so the reported memory covers every render target, and must be
+ * forgotten with Untrack when they are deleted, as their ids are
+ * reused. A frame buffer without a depth texture gets a depth
+ * buffer of its own when it is tracked, so it can be depth tested
+ * like before. Passes that only need depth while they render, see
+ * AcquireDepth, hand that buffer back and borrow one from the pool
+ * instead. Frame buffers drawn without depth testing can drop it
+ * with DropDepth.
+ *
+ * Objects built from the attachments of a frame buffer must be
+ * rebuilt when GetDeleteCount changes, as a frame buffer with the
+ * same id may then have other attachments.
+ *
+ * @class RenderTargetPool RenderTargetPool.h Renderers/OpenGL/RenderTargetPool.h
+ */
+class RenderTargetPool {
+private:
+    struct Key {
+        int width, height;
+        GLenum colorFormat, depthFormat;
+        bool operator<(const Key& k) const;
+    };
+    typedef std::map<Key, std::vector<RenderTarget*> > FreeLists;
+
+    static FreeLists available;
+    static std::vector<RenderTarget*> targets;
+    // render buffer last attached as depth to each scene frame buffer.
+    static std::map<GLuint, GLuint> attached;
+    static std::map<GLuint, unsigned int> tracked;
+    // depth buffers of tracked frame buffers without a depth texture.
+    static std::map<GLuint, GLuint> owned;
+    static unsigned int frame, inUse, memory, peak, deleted;
+
+    static RenderTarget* Create(Key key);
+    static void Forget(GLuint fbo);
+    static void Delete(RenderTarget* target);
+    static unsigned int Size(const RenderTarget* target);
+    static void Allocated(unsigned int bytes);
+public:
+    static RenderTarget* Acquire(int width, int height,
+                                 GLenum colorFormat,
+                                 GLenum depthFormat = GL_DEPTH_COMPONENT24);
+    static void Release(RenderTarget* target);
+
+    static RenderTarget* AcquireDepth(Resources::FrameBuffer* fb);
+
+    static void Track(Resources::FrameBuffer* fb);
+    static void Untrack(Resources::FrameBuffer* fb);
+    static void DropDepth(Resources::FrameBuffer* fb);
+    static GLuint GetDepthBuffer(GLuint fbo);
+    static void NewFrame();
+    static void Clear();
+
+    static unsigned int GetTargetCount();
+    static unsigned int GetTargetsInUse();
+    static unsigned int GetMemoryUsage();
+    static unsigned int GetPeakMemoryUsage();
+    static unsigned int GetDeleteCount();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_RENDER_TARGET_POOL_H_
@@ -9,6 +9,8 @@
 
 #include <Renderers/IRenderingView.h>
 #include <Renderers/OpenGL/Renderer.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
 #include <Scene/ISceneNode.h>
 #include <Logging/Logger.h>
 #include <Meta/OpenGL.h>
@@ -26,6 +28,18 @@
 #include <Resources/FrameBuffer.h>
 
 #include <Resources/OpenGLShader.h>
+#include <Renderers/OpenGL/TextureUploader.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Renderers/OpenGL/TextureMipStreamer.h>
+#include <Renderers/OpenGL/TextureCache.h>
+#include <Renderers/OpenGL/DXTCompressor.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Renderers/OpenGL/DebugDrawBatch.h>
+#include <Renderers/OpenGL/PostProcessResolution.h>
+#include <Renderers/OpenGL/RenderTargetPool.h>
+#include <Renderers/OpenGL/DepthOnlyRenderer.h>
+#include <Renderers/OpenGL/OcclusionCuller.h>
+#include <Renderers/OpenGL/MeshLOD.h>
 
 using namespace OpenEngine::Resources;
 
@@ -41,7 +55,19 @@ using OpenEngine::Display::IViewingVolume;
 
 GLSLVersion Renderer::glslversion = GLSL_UNKNOWN;
 
-Renderer::Renderer(): init(false) {
+Renderer::Renderer()
+    : init(false)
+    , asyncTextures(true)
+    , cpuCompression(false)
+    , uploader(NULL)
+    , residency(new TextureResidencyManager(*this))
+    , streamer(new TextureMipStreamer(*residency))
+    , textureCache(new TextureCache(*residency))
+    , debugBatch(new DebugDrawBatch())
+    , resolution(new PostProcessResolution())
+    , depthOnly(new DepthOnlyRenderer())
+    , occlusion(new OcclusionCuller())
+    , lod(new MeshLOD()) {
     //backgroundColor = Vector<4,float>(1.0);
 }
 
@@ -49,7 +75,17 @@ Renderer::Renderer(): init(false) {
  * Renderer destructor.
  * Deletes the internal viewport.
  */
-Renderer::~Renderer() { }
+Renderer::~Renderer() {
+    delete uploader;
+    delete residency;
+    delete streamer;
+    delete textureCache;
+    delete debugBatch;
+    delete resolution;
+    delete depthOnly;
+    delete occlusion;
+    delete lod;
+}
 
 void Renderer::InitializeGLSLVersion() {
     // Initialize the "OpenGL Extension Wrangler" library
@@ -92,11 +128,15 @@ void Renderer::SetupTexParameters(ITexture2D* tex){
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,         tex->GetWrapping());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,         tex->GetWrapping());
+    // Mipmaps are generated explicitly when framebuffer objects
+    // are supported, see GenerateMipmaps.
     if (tex->UseMipmapping()){
-        glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP,    GL_TRUE);
+        if (!fboSupport)
+            glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, tex->GetFiltering());
     }else{
-        glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP,    GL_FALSE);
+        if (!fboSupport)
+            glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE);
         if (tex->GetFiltering() == NONE)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         else
@@ -106,7 +146,6 @@ void Renderer::SetupTexParameters(ITexture2D* tex){
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     else
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
     CHECK_FOR_GL_ERROR();
 }
 
@@ -120,10 +159,12 @@ void Renderer::SetupTexParameters(ITexture3D* tex){
     glTexParameteri(target, GL_TEXTURE_WRAP_T,         tex->GetWrapping());
     glTexParameteri(target, GL_TEXTURE_WRAP_R,         tex->GetWrapping());
     if (tex->UseMipmapping()){
-        glTexParameteri(target, GL_GENERATE_MIPMAP,    GL_TRUE);
+        if (!fboSupport)
+            glTexParameteri(target, GL_GENERATE_MIPMAP, GL_TRUE);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, tex->GetFiltering());
     }else{
-        glTexParameteri(target, GL_GENERATE_MIPMAP,    GL_FALSE);
+        if (!fboSupport)
+            glTexParameteri(target, GL_GENERATE_MIPMAP, GL_FALSE);
         if (tex->GetFiltering() == NONE)        
             glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         else
@@ -133,7 +174,6 @@ void Renderer::SetupTexParameters(ITexture3D* tex){
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     else
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
     CHECK_FOR_GL_ERROR();
 }
 
@@ -282,6 +322,19 @@ void Renderer::Handle(Renderers::InitializeEventArg arg) {
 
     bufferSupport = glewIsSupported("GL_VERSION_2_0");
     fboSupport = glewGetExtension("GL_EXT_framebuffer_object") == GL_TRUE;
+
+    // Stream textures through pixel buffers if supported.
+    if (asyncTextures && bufferSupport &&
+        glewGetExtension("GL_ARB_pixel_buffer_object") == GL_TRUE)
+        uploader = new TextureUploader(*this);
+
+    // Time post processing if timer queries are supported.
+    resolution->Initialize();
+    depthOnly->Initialize(bufferSupport);
+    occlusion->Initialize();
+
+    // Let shaders report the textures they bind.
+    OpenGLShader::SetTextureResidency(residency);
         
     // Vector<4,float> bgc = backgroundColor;
     // glClearColor(bgc[0], bgc[1], bgc[2], bgc[3]);
@@ -290,8 +343,14 @@ void Renderer::Handle(Renderers::InitializeEventArg arg) {
     // glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT ); 
     // CHECK_FOR_GL_ERROR();
 
+    // Read the initial state once, the state cache is used from
+    // here on.
+    GLStateCache::Sync();
+    TextureUnitCache::Invalidate();
+    GLStateCache::TexEnvMode(GL_MODULATE);
+
     // Enable depth testing
-    glEnable(GL_DEPTH_TEST);						   
+    GLStateCache::Enable(GL_DEPTH_TEST);						   
     CHECK_FOR_GL_ERROR();
 
     // Set perspective calculations to most accurate
@@ -310,6 +369,21 @@ void Renderer::Handle(Renderers::InitializeEventArg arg) {
 void Renderer::Handle(Renderers::ProcessEventArg arg) {
     // @todo: assert we are in preprocess stage
 
+    // State and texture bindings may have been changed outside the
+    // renderer.
+    GLStateCache::Invalidate();
+    TextureUnitCache::Invalidate();
+
+    // Finish texture uploads that are ready.
+    residency->NewFrame();
+    if (uploader) uploader->Process();
+    RenderTargetPool::NewFrame();
+    resolution->Update();
+    occlusion->NewFrame();
+    lod->NewFrame();
+    depthOnly->NewFrame();
+    GeometryBounds::NewFrame();
+
     Vector<4,float> bgc = backgroundColor;
     glClearColor(bgc[0], bgc[1], bgc[2], bgc[3]);
 
@@ -323,7 +397,7 @@ void Renderer::Handle(Renderers::ProcessEventArg arg) {
 
         // Set viewport size 
         Vector<4,int> d(0, 0, arg.canvas.GetWidth(), arg.canvas.GetHeight());
-        glViewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
+        GLStateCache::Viewport((GLsizei)d[0], (GLsizei)d[1], (GLsizei)d[2], (GLsizei)d[3]);
         CHECK_FOR_GL_ERROR();
 
         // apply the volume
@@ -339,6 +413,10 @@ void Renderer::Handle(Renderers::ProcessEventArg arg) {
     this->stage = RENDERER_POSTPROCESS;
     this->postProcess.Notify(rarg);
     this->stage = RENDERER_PREPROCESS;
+
+    // Keep the textures within the memory budget.
+    residency->Update();
+    streamer->Update();
 }
 
 
@@ -354,6 +432,12 @@ void Renderer::Handle(Renderers::DeinitializeEventArg arg) {
     if (!init) return;
     this->stage = RENDERER_DEINITIALIZE;
     this->deinitialize.Notify(RenderingEventArg(arg.canvas, *this));
+    delete uploader;
+    uploader = NULL;
+    RenderTargetPool::Clear();
+    debugBatch->Clear();
+    depthOnly->Clear();
+    occlusion->Clear();
     init = false;
 }
 
@@ -417,19 +501,125 @@ bool Renderer::FrameBufferSupport(){
     return fboSupport;
 }
 
+bool Renderer::TextureArraySupport(){
+    return texture2DArraySupport;
+}
+
+void Renderer::SetAsyncTextureLoading(bool enable) {
+    asyncTextures = enable;
+}
+
+bool Renderer::GetAsyncTextureLoading() {
+    return asyncTextures;
+}
+
+void Renderer::SetCPUTextureCompression(bool enable) {
+    cpuCompression = enable;
+}
+
+bool Renderer::GetCPUTextureCompression() {
+    return cpuCompression;
+}
+
+TextureResidencyManager& Renderer::GetTextureResidency() {
+    return *residency;
+}
+
+TextureMipStreamer& Renderer::GetTextureStreamer() {
+    return *streamer;
+}
+
+DebugDrawBatch& Renderer::GetDebugDraw() {
+    return *debugBatch;
+}
+
+PostProcessResolution& Renderer::GetPostProcessResolution() {
+    return *resolution;
+}
+
+DepthOnlyRenderer& Renderer::GetDepthOnlyRenderer() {
+    return *depthOnly;
+}
+
+OcclusionCuller& Renderer::GetOcclusionCuller() {
+    return *occlusion;
+}
+
+MeshLOD& Renderer::GetMeshLOD() {
+    return *lod;
+}
+
+TextureCache& Renderer::GetTextureCache() {
+    return *textureCache;
+}
+
 GLSLVersion Renderer::GetGLSLVersion() {
     return glslversion;
 }
 
 void Renderer::LoadTexture(ITexture2DPtr texr) {
-    LoadTexture(texr.get());
+    // Upload precompressed levels from the texture cache.
+    if (compressionSupport && texr != NULL && texr->GetID() == 0 &&
+        textureCache->Upload(texr))
+        return;
+
+    // Let the uploader stream the texture if it is enabled. It
+    // hands large textures to the mipmap streamer once loaded.
+    if (uploader && texr != NULL && texr->GetID() == 0) {
+        uploader->Enqueue(texr);
+        return;
+    }
+
+    // Stream the mipmap levels of large textures, otherwise upload
+    // the image already loaded.
+    bool loaded = true;
+    if (texr != NULL && texr->GetID() == 0 && streamer->MayAccept(texr.get()) &&
+        texr->GetVoidDataPtr() == NULL) {
+        loaded = false;
+        texr->Load();
+    }
+    bool streamed = texr != NULL && texr->GetID() == 0 && StreamTexture(texr);
+    if (!streamed && CreateTexture(texr.get()))
+        residency->Register(texr);
+    // Return the texture in the state we got it.
+    if (!loaded) texr->Unload();
 }
 void Renderer::LoadTexture(ITexture2D* texr) {
+    if (CreateTexture(texr))
+        residency->Register(texr);
+}
+
+/**
+ * Stream the mipmap levels of a loaded texture if it is large
+ * enough.
+ *
+ * @param texr Texture with its image in client memory.
+ * @return True if the texture is streamed.
+ */
+bool Renderer::StreamTexture(ITexture2DPtr texr) {
+    if (!streamer->Accepts(texr.get())) return false;
+    ColorFormat f = texr->GetColorFormat();
+    streamer->Add(texr, GLInternalColorFormat(f), GLColorFormat(f));
+    return true;
+}
+
+/**
+ * Give a texture an id and upload its image right away. Textures
+ * in the upload queue are finished instead.
+ *
+ * @param texr Texture to load.
+ * @return True if the texture was created.
+ */
+bool Renderer::CreateTexture(ITexture2D* texr) {
     // check for null pointers
-    if (texr == NULL) return;
+    if (texr == NULL) return false;
+
+    // a texture in the upload queue is needed right away.
+    if (uploader) uploader->Finish(texr);
+    streamer->Finish(texr);
 
     // check if textures has already been bound.
-    if (texr->GetID() != 0) return;
+    if (texr->GetID() != 0) return false;
 
     // signal we need the texture data if not loaded.
     bool loaded = true;
@@ -445,13 +635,33 @@ void Renderer::LoadTexture(ITexture2D* texr) {
     CHECK_FOR_GL_ERROR();
 
     texr->SetID(texid);
-    glBindTexture(GL_TEXTURE_2D, texid);
+    UploadTexture(texr, texr->GetVoidDataPtr());
+
+    // Return the texture in the state we got it.
+    if (!loaded)
+        texr->Unload();
+    return true;
+}
+
+/**
+ * Upload the image of a texture with an id. If a pixel unpack
+ * buffer is bound the data pointer is an offset into it.
+ *
+ * @param texr Texture to upload.
+ * @param data Image data or buffer offset.
+ */
+void Renderer::UploadTexture(ITexture2D* texr, const GLvoid* data) {
+    TextureUnitCache::Bind(GL_TEXTURE_2D, texr->GetID());
     CHECK_FOR_GL_ERROR();
     
     SetupTexParameters(texr);
     CHECK_FOR_GL_ERROR();
 
     SetTextureCompression(texr);
+    if (cpuCompression && UploadCompressed(texr, data)) {
+        TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+        return;
+    }
     GLint internalFormat = GLInternalColorFormat(texr->GetColorFormat());
     GLenum colorFormat = GLColorFormat(texr->GetColorFormat());
 
@@ -463,14 +673,101 @@ void Renderer::LoadTexture(ITexture2D* texr) {
                  0, // border
                  colorFormat,
                  texr->GetType(),
-                 texr->GetVoidDataPtr());
+                 data);
     CHECK_FOR_GL_ERROR();
+    GenerateMipmaps(GL_TEXTURE_2D, texr->UseMipmapping());
     
-    glBindTexture(GL_TEXTURE_2D, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+}
 
-    // Return the texture in the state we got it.
-    if (!loaded)
-        texr->Unload();
+/**
+ * Compress the image of the bound texture on the cpu and upload it
+ * with its mipmap chain. Only byte RGB and RGBA images in client
+ * memory marked for compression are handled.
+ *
+ * @param texr Texture to upload.
+ * @param data Image data, NULL if it is in a pixel buffer.
+ * @return True if the texture was uploaded.
+ */
+bool Renderer::UploadCompressed(ITexture2D* texr, const GLvoid* data) {
+    ColorFormat f = texr->GetColorFormat();
+    if (data == NULL || texr->GetType() != Types::UBYTE ||
+        (f != RGB_COMPRESSED && f != RGBA_COMPRESSED))
+        return false;
+    const unsigned int channels = f == RGBA_COMPRESSED ? 4 : 3;
+    if (texr->GetChannels() != channels) return false;
+    const GLenum internalFormat = GLInternalColorFormat(f);
+
+    unsigned int w = texr->GetWidth(), h = texr->GetHeight();
+    std::vector<unsigned char> image((const unsigned char*)data,
+                                     (const unsigned char*)data + w * h * channels);
+    std::vector<unsigned char> blocks;
+    for (unsigned int level = 0; ; ++level) {
+        blocks.resize(DXTCompressor::CompressedSize(w, h, channels));
+        DXTCompressor::Compress(&image[0], w, h, channels, false, &blocks[0]);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat,
+                               w, h, 0, blocks.size(), &blocks[0]);
+        CHECK_FOR_GL_ERROR();
+        if (!texr->UseMipmapping() || (w == 1 && h == 1)) break;
+        std::vector<unsigned char> next((w > 1 ? w / 2 : 1) *
+                                        (h > 1 ? h / 2 : 1) * channels);
+        DXTCompressor::Downsample(&image[0], w, h, channels, &next[0]);
+        image.swap(next);
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return true;
+}
+
+/**
+ * Build the mipmap chain of the bound texture from its first level.
+ * Without framebuffer objects the chain is maintained by
+ * GL_GENERATE_MIPMAP set in SetupTexParameters.
+ *
+ * @param target Texture target.
+ * @param mipmapped True if the texture uses mipmapping.
+ */
+void Renderer::GenerateMipmaps(GLenum target, bool mipmapped) {
+    if (!fboSupport || !mipmapped) return;
+    glGenerateMipmapEXT(target);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Give a texture a single white texel to display until its image
+ * has been uploaded.
+ *
+ * @param texr Texture with an id.
+ */
+void Renderer::UploadPlaceholder(ITexture2D* texr) {
+    const GLubyte white[4] = {255, 255, 255, 255};
+    TextureUnitCache::Bind(GL_TEXTURE_2D, texr->GetID());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, white);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Upload the image of a texture that keeps its id again, eg. after
+ * it was evicted. The current image is shown until the upload is
+ * done.
+ *
+ * @param texr Texture with an id.
+ */
+void Renderer::ReloadTexture(ITexture2DPtr texr) {
+    if (uploader) {
+        uploader->Reload(texr);
+        return;
+    }
+    bool loaded = texr->GetVoidDataPtr() != NULL;
+    if (!loaded) texr->Load();
+    UploadTexture(texr.get(), texr->GetVoidDataPtr());
+    residency->Register(texr);
+    if (!loaded) texr->Unload();
 }
 
 void Renderer::LoadTexture(ITexture3DPtr texr) {
@@ -503,7 +800,7 @@ void Renderer::LoadTexture(ITexture3D* texr) {
     CHECK_FOR_GL_ERROR();
 
     texr->SetID(texid);
-    glBindTexture(texr->GetUseCase(), texid);
+    TextureUnitCache::Bind(texr->GetUseCase(), texid);
     CHECK_FOR_GL_ERROR();
     
     SetupTexParameters(texr);
@@ -523,7 +820,10 @@ void Renderer::LoadTexture(ITexture3D* texr) {
                  texr->GetType(),
                  texr->GetVoidDataPtr());
     CHECK_FOR_GL_ERROR();
+    GenerateMipmaps(texr->GetUseCase(), texr->UseMipmapping());
     
+    residency->Register(texr);
+
     // Return the texture in the state we got it.
     if (!loaded)
         texr->Unload();
@@ -537,7 +837,7 @@ void Renderer::BindTexture(ICubemapPtr cmap) {
     CHECK_FOR_GL_ERROR();
 
     cmap->SetID(texid);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texid);
+    TextureUnitCache::Bind(GL_TEXTURE_CUBE_MAP, texid);
     CHECK_FOR_GL_ERROR();
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -570,7 +870,7 @@ void Renderer::BindTexture(ICubemapPtr cmap) {
                          cmap->GetRawData((ICubemap::Face)(ICubemap::POSITIVE_X + i), m));
         CHECK_FOR_GL_ERROR();
     }
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 void Renderer::RebindTexture(ITexture2DPtr texr, unsigned int xOffset, unsigned int yOffset, unsigned int width, unsigned int height) {
@@ -585,9 +885,13 @@ void Renderer::RebindTexture(ITexture2D* texr, unsigned int xOffset, unsigned in
         throw Exception("Trying to rebind unbound texture.");
 #endif
 
+    // The sub image can only be replaced once the image is there.
+    if (uploader) uploader->Finish(texr);
+    streamer->Finish(texr);
+
     // Bind the texture
     GLuint texid = texr->GetID();
-    glBindTexture(GL_TEXTURE_2D, texid);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, texid);
     CHECK_FOR_GL_ERROR();
 
     // Setup texture parameters
@@ -605,7 +909,7 @@ void Renderer::RebindTexture(ITexture2D* texr, unsigned int xOffset, unsigned in
                     texr->GetType(),
                     texr->GetVoidDataPtr());
     CHECK_FOR_GL_ERROR();
-
+    GenerateMipmaps(GL_TEXTURE_2D, texr->UseMipmapping());
 }
 
 void Renderer::RebindTexture(ITexture3DPtr texr, unsigned int xOffset, unsigned int yOffset, unsigned int zOffset, unsigned int width, unsigned int height, unsigned int depth) {
@@ -622,7 +926,7 @@ void Renderer::RebindTexture(ITexture3D* texr, unsigned int xOffset, unsigned in
 
     // Bind the texture
     GLuint texid = texr->GetID();
-    glBindTexture(texr->GetUseCase(), texid);
+    TextureUnitCache::Bind(texr->GetUseCase(), texid);
     CHECK_FOR_GL_ERROR();
 
     // Setup texture parameters
@@ -642,7 +946,7 @@ void Renderer::RebindTexture(ITexture3D* texr, unsigned int xOffset, unsigned in
                     texr->GetType(),
                     texr->GetVoidDataPtr());
     CHECK_FOR_GL_ERROR();
-
+    GenerateMipmaps(texr->GetUseCase(), texr->UseMipmapping());
 }
 
 void Renderer::BindFrameBuffer(FrameBuffer* fb){
@@ -656,7 +960,8 @@ void Renderer::BindFrameBuffer(FrameBuffer* fb){
     glGenFramebuffersEXT(1, &fboID);
     CHECK_FOR_GL_ERROR();
     fb->SetID(fboID);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboID);
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, fboID);
     CHECK_FOR_GL_ERROR();
 
     /*
@@ -671,7 +976,7 @@ void Renderer::BindFrameBuffer(FrameBuffer* fb){
     for (unsigned int i = 0; i < fb->GetNumberOfAttachments(); ++i){
         ITexture2DPtr tex = fb->GetTexAttachment(i);
         LoadTexture(tex.get());
-        glBindTexture(GL_TEXTURE_2D, tex->GetID());  // Why is this needed?
+        TextureUnitCache::Bind(GL_TEXTURE_2D, tex->GetID());  // Why is this needed?
         glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, 
                                   GL_COLOR_ATTACHMENT0_EXT + i,
                                   GL_TEXTURE_2D, tex->GetID(), 0);
@@ -680,26 +985,37 @@ void Renderer::BindFrameBuffer(FrameBuffer* fb){
 
     if (fb->GetDepthTexture() != NULL) {
         LoadTexture(fb->GetDepthTexture());
-        glBindTexture(GL_TEXTURE_2D, fb->GetDepthTexture()->GetID()); // Why is this needed?
+        TextureUnitCache::Bind(GL_TEXTURE_2D, fb->GetDepthTexture()->GetID()); // Why is this needed?
         glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, 
                                   GL_DEPTH_ATTACHMENT_EXT,
                                   GL_TEXTURE_2D, fb->GetDepthTexture()->GetID(), 0);
-    } else {
-        Vector<2, int> viewDim = fb->GetDimension();
-        
-        GLuint depth;
-        glGenRenderbuffersEXT(1, &depth);
-        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depth);
-        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, viewDim[0], viewDim[1]);
-        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
-        
-        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-                                     GL_RENDERBUFFER_EXT, depth);
-        CHECK_FOR_GL_ERROR();
     }
+    // Frame buffers without a depth texture get a depth buffer from
+    // the render target pool.
+    RenderTargetPool::Track(fb);
     CHECK_FRAMEBUFFER_STATUS();
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+}
+
+/**
+ * Delete the frame buffer object of a frame buffer bound with
+ * BindFrameBuffer, along with its depth buffer if the renderer gave
+ * it one. Must be called before the frame buffer is deleted, while
+ * the context is current. The textures are left alone.
+ *
+ * @param fb Bound frame buffer.
+ */
+void Renderer::UnbindFrameBuffer(FrameBuffer* fb) {
+    GLuint fbo = fb->GetID();
+    if (fbo == 0) return;
+    RenderTargetPool::Untrack(fb);
+    if (GLStateCache::GetFramebuffer(GL_DRAW_FRAMEBUFFER_EXT) == fbo ||
+        GLStateCache::GetFramebuffer(GL_READ_FRAMEBUFFER_EXT) == fbo)
+        GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+    glDeleteFramebuffersEXT(1, &fbo);
+    CHECK_FOR_GL_ERROR();
+    fb->SetID(0);
 }
 
 void Renderer::BindDataBlock(IDataBlock* bo){
@@ -725,6 +1041,12 @@ void Renderer::BindDataBlock(IDataBlock* bo){
                      size,
                      bo->GetVoidDataPtr(), access);
         
+        // Keep the bounds of vertex data before it leaves memory.
+        GeometryBounds::Forget(bo);
+        if ((GLenum)bo->GetBlockType() == GL_ARRAY_BUFFER &&
+            bo->GetType() == Types::FLOAT && bo->GetDimension() >= 3)
+            GeometryBounds::Get(bo);
+
         if (bo->GetUnloadPolicy() == UNLOAD_AUTOMATIC)
             bo->Unload();
     }
@@ -752,6 +1074,12 @@ void Renderer::RebindDataBlock(IDataBlockPtr ptr, unsigned int start, unsigned i
                      size,
                      bo->GetVoidDataPtr(), access);
         
+        // The data changed, recompute the bounds.
+        GeometryBounds::Forget(bo);
+        if ((GLenum)bo->GetBlockType() == GL_ARRAY_BUFFER &&
+            bo->GetType() == Types::FLOAT && bo->GetDimension() >= 3)
+            GeometryBounds::Get(bo);
+
         if (bo->GetUnloadPolicy() == UNLOAD_AUTOMATIC)
             bo->Unload();
     }
@@ -762,12 +1090,13 @@ void Renderer::RebindDataBlock(IDataBlockPtr ptr, unsigned int start, unsigned i
 
 
 void Renderer::DrawFace(FacePtr f) {
+    TextureUnitCache::Active(0);
     if (f->mat->Get2DTextures().size() == 0) {
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glDisable(GL_TEXTURE_2D);
+        TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+        GLStateCache::Disable(GL_TEXTURE_2D);
     } else {
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, (*f->mat->Get2DTextures().begin()).second->GetID());
+        GLStateCache::Enable(GL_TEXTURE_2D);
+        TextureUnitCache::Bind(GL_TEXTURE_2D, (*f->mat->Get2DTextures().begin()).second->GetID());
     }
     float col[4];
     f->mat->diffuse.ToArray(col);
@@ -792,7 +1121,7 @@ void Renderer::DrawFace(FacePtr f) {
         glVertex3f(v[0],v[1],v[2]);
     }
     glEnd();
-    glDisable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_TEXTURE_2D);
 }
 
 /**
@@ -803,11 +1132,9 @@ void Renderer::DrawFace(FacePtr f) {
  * @param width line width, default i one.
  */
 void Renderer::DrawFace(FacePtr face, Vector<3,float> color, float width) {
-    GLboolean t = glIsEnabled(GL_TEXTURE_2D);
-    GLboolean l = glIsEnabled(GL_LIGHTING);
-    CHECK_FOR_GL_ERROR();
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_LIGHTING);
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_LIGHTING);
     CHECK_FOR_GL_ERROR();
 
     glLineWidth(width);
@@ -827,8 +1154,7 @@ void Renderer::DrawFace(FacePtr face, Vector<3,float> color, float width) {
     CHECK_FOR_GL_ERROR();
 
     // reset state
-    if (t) glEnable(GL_TEXTURE_2D);
-    if (l) glEnable(GL_LIGHTING);
+    GLStateCache::Pop();
     CHECK_FOR_GL_ERROR();
 }
 
@@ -840,11 +1166,9 @@ void Renderer::DrawFace(FacePtr face, Vector<3,float> color, float width) {
  * @param width line width, default i one.
  */
 void Renderer::DrawLine(Line line, Vector<3,float> color, float width) {
-    GLboolean t = glIsEnabled(GL_TEXTURE_2D);
-    GLboolean l = glIsEnabled(GL_LIGHTING);
-    CHECK_FOR_GL_ERROR();
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_LIGHTING);
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_LIGHTING);
     CHECK_FOR_GL_ERROR();
 
     glLineWidth(width);
@@ -857,9 +1181,8 @@ void Renderer::DrawLine(Line line, Vector<3,float> color, float width) {
     glEnd();
     CHECK_FOR_GL_ERROR();
 
-    // reset state 
-    if (t) glEnable(GL_TEXTURE_2D);
-    if (l) glEnable(GL_LIGHTING);
+    // reset state
+    GLStateCache::Pop();
     CHECK_FOR_GL_ERROR();
 }
 
@@ -871,11 +1194,9 @@ void Renderer::DrawLine(Line line, Vector<3,float> color, float width) {
  * @param size dot size, default i one.
  */
 void Renderer::DrawPoint(Vector<3,float> point, Vector<3,float> color , float size) {
-    GLboolean t = glIsEnabled(GL_TEXTURE_2D);
-    GLboolean l = glIsEnabled(GL_LIGHTING);
-    CHECK_FOR_GL_ERROR();
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_LIGHTING);
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_LIGHTING);
     CHECK_FOR_GL_ERROR();
 
     glPointSize(size);
@@ -888,8 +1209,7 @@ void Renderer::DrawPoint(Vector<3,float> point, Vector<3,float> color , float si
     CHECK_FOR_GL_ERROR();
 
     // reset state
-    if (t) glEnable(GL_TEXTURE_2D);
-    if (l) glEnable(GL_LIGHTING);
+    GLStateCache::Pop();
     CHECK_FOR_GL_ERROR();
 }
 
@@ -909,11 +1229,9 @@ Vector<4,float> Renderer::GetBackgroundColor() {
  * @param color  Color of sphere.
  */
     void Renderer::DrawSphere(Vector<3,float> center, float radius, Vector<3,float> color) {
-    GLboolean t = glIsEnabled(GL_TEXTURE_2D);
-    GLboolean l = glIsEnabled(GL_LIGHTING);
-    CHECK_FOR_GL_ERROR();
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_LIGHTING);
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_TEXTURE_2D);
+    GLStateCache::Disable(GL_LIGHTING);
     CHECK_FOR_GL_ERROR();
 
     glPushMatrix();
@@ -929,8 +1247,7 @@ Vector<4,float> Renderer::GetBackgroundColor() {
     glPopMatrix();
 
     // reset state
-    if (t) glEnable(GL_TEXTURE_2D);
-    if (l) glEnable(GL_LIGHTING);
+    GLStateCache::Pop();
     CHECK_FOR_GL_ERROR();
 }
 
@@ -55,12 +55,24 @@ using OpenEngine::Resources::IDataBlock;
  */
 enum GLSLVersion { GLSL_UNKNOWN, GLSL_NONE, GLSL_14, GLSL_20 };
 
+class TextureUploader;
+class TextureResidencyManager;
+class TextureMipStreamer;
+class TextureCache;
+class DebugDrawBatch;
+class PostProcessResolution;
+class DepthOnlyRenderer;
+class OcclusionCuller;
+class MeshLOD;
+
 /**
  * Renderer using OpenGL
  *
  * @class Renderer Renderer.h Renderers/OpenGL/IRenderer.h
  */
 class Renderer : public IRenderer {
+    friend class TextureUploader;
+    friend class TextureResidencyManager;
 private:
     static GLSLVersion glslversion;
     bool texture2DArraySupport;
@@ -68,6 +80,17 @@ private:
     bool bufferSupport;
     bool fboSupport;
     bool init;
+    bool asyncTextures;
+    bool cpuCompression;
+    TextureUploader* uploader;
+    TextureResidencyManager* residency;
+    TextureMipStreamer* streamer;
+    TextureCache* textureCache;
+    DebugDrawBatch* debugBatch;
+    PostProcessResolution* resolution;
+    DepthOnlyRenderer* depthOnly;
+    OcclusionCuller* occlusion;
+    MeshLOD* lod;
     Vector<4,float> backgroundColor;
 
     // Event lists for the rendering phases.
@@ -81,6 +104,13 @@ private:
     inline void SetupTexParameters(ITexture2D* tex);
     inline void SetupTexParameters(ITexture3D* tex);
     inline void SetTextureCompression(ITexture* tex);
+    bool StreamTexture(ITexture2DPtr tex);
+    bool CreateTexture(ITexture2D* tex);
+    void UploadTexture(ITexture2D* tex, const GLvoid* data);
+    void UploadPlaceholder(ITexture2D* tex);
+    void ReloadTexture(ITexture2DPtr tex);
+    void GenerateMipmaps(GLenum target, bool mipmapped);
+    bool UploadCompressed(ITexture2D* tex, const GLvoid* data);
 
     inline unsigned int GLTypeSize(Type t);
     inline GLenum GLAccessType(BlockType b, UpdateMode u);
@@ -115,6 +145,97 @@ public:
 
     virtual bool BufferSupport();
     virtual bool FrameBufferSupport();
+    bool TextureArraySupport();
+
+    /**
+     * Enable or disable asynchronous loading of 2D textures. When
+     * enabled textures loaded through shared pointers are decoded
+     * on worker threads and streamed through pixel buffer objects,
+     * displaying a placeholder until they are resident. Must be set
+     * before the renderer is initialized.
+     *
+     * @param enable True to load textures asynchronously.
+     */
+    void SetAsyncTextureLoading(bool enable);
+    bool GetAsyncTextureLoading();
+
+    /**
+     * Compress textures on the cpu instead of letting the driver
+     * compress them. RGB and RGBA textures using compression are
+     * compressed to DXT1 and DXT5 with their mipmap chain.
+     *
+     * @param enable True to compress textures on the cpu.
+     */
+    void SetCPUTextureCompression(bool enable);
+    bool GetCPUTextureCompression();
+
+    /**
+     * Get the manager tracking texture memory. Use it to set a
+     * texture memory budget.
+     *
+     * @return Texture residency manager.
+     */
+    TextureResidencyManager& GetTextureResidency();
+
+    /**
+     * Get the streamer uploading the mipmap levels of large
+     * textures on demand. Streaming is disabled until a size
+     * threshold is set.
+     *
+     * @return Texture mipmap streamer.
+     */
+    TextureMipStreamer& GetTextureStreamer();
+
+    /**
+     * Get the batch collecting debug geometry. While it is open the
+     * debug drawing helpers append to it instead of drawing
+     * immediately.
+     *
+     * @return Debug geometry batch.
+     */
+    DebugDrawBatch& GetDebugDraw();
+
+    /**
+     * Get the resolution control of post processing. It sets the
+     * resolution each post process node renders its scene at, and
+     * can scale it dynamically to meet a GPU time target.
+     *
+     * @return Post process resolution control.
+     */
+    PostProcessResolution& GetPostProcessResolution();
+
+    /**
+     * Get the renderer drawing meshes to the depth buffer only,
+     * shared by the shadow maps and the depth pre-pass.
+     *
+     * @return Depth only renderer.
+     */
+    DepthOnlyRenderer& GetDepthOnlyRenderer();
+
+    /**
+     * Get the occlusion culler of the rendering view. Its counts of
+     * tested, culled and drawn meshes cover the last frame.
+     *
+     * @return Occlusion culler.
+     */
+    OcclusionCuller& GetOcclusionCuller();
+
+    /**
+     * Get the level of detail selection of the rendering view, where
+     * meshes are given their simplified levels.
+     *
+     * @return Level of detail selection.
+     */
+    MeshLOD& GetMeshLOD();
+
+    /**
+     * Get the cache of precompressed textures. Textures created
+     * through the cache are uploaded from their cache files when
+     * texture compression is supported.
+     *
+     * @return Texture cache.
+     */
+    TextureCache& GetTextureCache();
 
     /**
      * Get the supported version of OpenGL Shader Language.
@@ -137,6 +258,7 @@ public:
     virtual void RebindTexture(ITexture3DPtr texr, unsigned int x, unsigned int y, unsigned int z, unsigned int w, unsigned int h, unsigned int d);
     virtual void RebindTexture(ITexture3D* texr, unsigned int x, unsigned int y, unsigned int z, unsigned int w, unsigned int h, unsigned int d);
     virtual void BindFrameBuffer(FrameBuffer* fb);
+    void UnbindFrameBuffer(FrameBuffer* fb);
     virtual void BindDataBlock(IDataBlock* bo);
     virtual void RebindDataBlock(Resources::IDataBlockPtr ptr, unsigned int start, unsigned int end);
     virtual void DrawFace(FacePtr face);
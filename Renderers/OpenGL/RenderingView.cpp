@@ -9,16 +9,34 @@
 
 #include <Renderers/OpenGL/RenderingView.h>
 #include <Renderers/OpenGL/Renderer.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Renderers/OpenGL/TextureMipStreamer.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Renderers/OpenGL/DebugDrawBatch.h>
+#include <Renderers/OpenGL/FaceSetConverter.h>
+#include <Renderers/OpenGL/VertexArrayBuffers.h>
+#include <Renderers/OpenGL/RenderTargetPool.h>
+#include <Renderers/OpenGL/FrameGraph.h>
+#include <Renderers/OpenGL/PostProcessResolution.h>
+#include <Renderers/OpenGL/DepthOnlyRenderer.h>
+#include <Renderers/OpenGL/OcclusionCuller.h>
+#include <Renderers/OpenGL/OcclusionBuffer.h>
+#include <Renderers/OpenGL/MeshLOD.h>
 #include <Geometry/FaceSet.h>
 #include <Geometry/VertexArray.h>
 #include <Scene/GeometryNode.h>
 #include <Scene/VertexArrayNode.h>
 #include <Scene/TransformationNode.h>
 #include <Scene/DisplayListNode.h>
+#include <Scene/StaticBatchNode.h>
 #include <Scene/RenderNode.h>
 #include <Scene/PostProcessNode.h>
 #include <Resources/IShaderResource.h>
 #include <Resources/ITexture2D.h>
+#include <Resources/NormalVisualizationShader.h>
+#include <Resources/OpenGLShader.h>
 #include <Display/Viewport.h>
 #include <Display/IViewingVolume.h>
 #include <Geometry/GeometrySet.h>
@@ -47,6 +65,79 @@ using OpenEngine::Display::Viewport;
 using OpenEngine::Display::IViewingVolume;
 using OpenEngine::Scene::RenderStateNode;
 
+// Render state options in the order of their bits in RenderState.
+static const RenderStateNode::RenderStateOption renderStateOptions[] = {
+    RenderStateNode::TEXTURE,
+    RenderStateNode::SHADER,
+    RenderStateNode::BACKFACE,
+    RenderStateNode::LIGHTING,
+    RenderStateNode::DEPTH_TEST,
+    RenderStateNode::WIREFRAME,
+    RenderStateNode::SOFT_NORMAL,
+    RenderStateNode::HARD_NORMAL,
+    RenderStateNode::BINORMAL,
+    RenderStateNode::TANGENT,
+    RenderStateNode::COLOR_MATERIAL
+};
+
+enum {
+    RS_TEXTURE        = 1 << 0,
+    RS_SHADER         = 1 << 1,
+    RS_BACKFACE       = 1 << 2,
+    RS_LIGHTING       = 1 << 3,
+    RS_DEPTH_TEST     = 1 << 4,
+    RS_WIREFRAME      = 1 << 5,
+    RS_SOFT_NORMAL    = 1 << 6,
+    RS_HARD_NORMAL    = 1 << 7,
+    RS_BINORMAL       = 1 << 8,
+    RS_TANGENT        = 1 << 9,
+    RS_COLOR_MATERIAL = 1 << 10,
+    RS_COUNT          = 11,
+    RS_ALL            = (1 << RS_COUNT) - 1
+};
+
+typedef map<Mesh*, pair<MeshPtr, unsigned int> > OccluderMap;
+
+// Queues the occluder meshes of a scene in an occlusion buffer.
+class OccluderCollector : public ISceneNodeVisitor {
+    OcclusionBuffer& buffer;
+    OccluderMap& occluders;
+    Matrix<4, 4, float> modelView, projection;
+public:
+    OccluderCollector(OcclusionBuffer& buffer, OccluderMap& occluders,
+                      Matrix<4, 4, float> modelView, Matrix<4, 4, float> projection)
+        : buffer(buffer), occluders(occluders)
+        , modelView(modelView), projection(projection) {}
+    void VisitTransformationNode(TransformationNode* node) {
+        Matrix<4, 4, float> old = modelView;
+        modelView = node->GetTransformationMatrix() * modelView;
+        node->VisitSubNodes(*this);
+        modelView = old;
+    }
+    void VisitMeshNode(MeshNode* node) {
+        OccluderMap::iterator itr = occluders.find(node->GetMesh().get());
+        if (itr != occluders.end()) {
+            float mvp[16];
+            (modelView * projection).ToArray(mvp);
+            buffer.Draw(itr->second.second, mvp);
+        }
+        node->VisitSubNodes(*this);
+    }
+    void VisitStaticBatchNode(StaticBatchNode* node) {
+        const vector<MeshPtr>& meshes = node->GetMeshes();
+        for (unsigned int i = 0; i < meshes.size(); ++i) {
+            OccluderMap::iterator itr = occluders.find(meshes[i].get());
+            if (itr == occluders.end()) continue;
+            float mvp[16];
+            (modelView * projection).ToArray(mvp);
+            buffer.Draw(itr->second.second, mvp);
+        }
+        node->VisitSubNodes(*this);
+    }
+    // Transparent meshes hide nothing.
+    void VisitBlendingNode(BlendingNode* node) {}
+};
+
 /**
  * Rendering view constructor.
  *
@@ -55,22 +146,42 @@ using OpenEngine::Scene::RenderStateNode;
 RenderingView::RenderingView() {
     renderBinormal=renderTangent=renderSoftNormal=renderHardNormal = false;
     renderTexture = renderShader = true;
-    currentRenderState = new RenderStateNode();
-    currentRenderState->EnableOption(RenderStateNode::TEXTURE);
-    currentRenderState->EnableOption(RenderStateNode::SHADER);
-    currentRenderState->EnableOption(RenderStateNode::BACKFACE);
-    currentRenderState->EnableOption(RenderStateNode::DEPTH_TEST);
-    currentRenderState->DisableOption(RenderStateNode::LIGHTING); //@todo
-    currentRenderState->DisableOption(RenderStateNode::WIREFRAME);
+    RenderState root;
+    root.enabled = RS_TEXTURE | RS_SHADER | RS_BACKFACE | RS_DEPTH_TEST;
+    root.disabled = RS_LIGHTING | RS_WIREFRAME; //@todo
+    renderStates.reserve(16);
+    renderStates.push_back(root);
     
     currentGeom = GeometrySetPtr(new GeometrySet());
     indexBuffer = IndicesPtr();
+    arg = NULL;
+    finalStamp = RenderTargetPool::GetDeleteCount();
+    residency = NULL;
+    streamer = NULL;
+    debug = NULL;
+    resolution = NULL;
+    depthOnly = NULL;
+    occlusion = NULL;
+    occlusionBuffer = NULL;
+    lod = NULL;
+    depthPrePass = false;
+    normalShader = NULL;
+    converter = new FaceSetConverter();
+    vertexArrays = new VertexArrayBuffers();
+    projScale = 1.0f;
 }
 
 /**
- * Rendering view destructor.
+ * Rendering view destructor. The OpenGL context may be gone, so
+ * only client memory is freed, the buffers and frame buffers are
+ * deleted when the renderer deinitializes.
  */
-RenderingView::~RenderingView() {}
+RenderingView::~RenderingView() {
+    delete normalShader;
+    delete converter;
+    delete vertexArrays;
+    delete occlusionBuffer;
+}
 
 void RenderingView::Handle(RenderingEventArg arg) {
     if (arg.renderer.GetCurrentStage() == IRenderer::RENDERER_PROCESS){
@@ -81,11 +192,46 @@ void RenderingView::Handle(RenderingEventArg arg) {
         
         this->arg = &arg;
         currentModelViewMatrix = arg.canvas.GetViewingVolume()->GetViewMatrix();
+        converter->NewFrame();
+        vertexArrays->NewFrame();
+
+        // Report texture usage if the renderer tracks it.
+        Renderer* glRenderer = dynamic_cast<Renderer*>(&arg.renderer);
+        residency = glRenderer ? &glRenderer->GetTextureResidency() : NULL;
+        streamer = glRenderer ? &glRenderer->GetTextureStreamer() : NULL;
+        resolution = glRenderer ? &glRenderer->GetPostProcessResolution() : NULL;
+        depthOnly = glRenderer ? &glRenderer->GetDepthOnlyRenderer() : NULL;
+        occlusion = glRenderer ? &glRenderer->GetOcclusionCuller() : NULL;
+        lod = glRenderer ? &glRenderer->GetMeshLOD() : NULL;
+
+        // Collect the debug geometry of the view and draw it in one
+        // batch after the scene it belongs to.
+        debug = glRenderer ? &glRenderer->GetDebugDraw() : NULL;
+        if (debug) debug->Begin(currentModelViewMatrix);
+
+        // Scale from view space to pixels, used to select the
+        // resident mipmap levels of streamed textures and the levels
+        // of detail of meshes.
+        projectionMatrix = arg.canvas.GetViewingVolume()->GetProjectionMatrix();
+        float proj[16];
+        projectionMatrix.ToArray(proj);
+        projScale = proj[5] * arg.canvas.GetHeight() * 0.5f;
+
+        // Rasterize the occluders in view on the cpu.
+        if (occlusionBuffer && !occluders.empty()) {
+            OccluderCollector collector(*occlusionBuffer, occluders,
+                                        currentModelViewMatrix, projectionMatrix);
+            arg.canvas.GetScene()->Accept(collector);
+            occlusionBuffer->Render();
+        }
         
         // setup default render state
-        // RenderStateNode* renderStateNode = new RenderStateNode();
-        ApplyRenderState(currentRenderState);
+        renderStates.resize(1);
+        ApplyRenderState(renderStates.back(), RS_ALL);
+        GLenum depthFunc = GLStateCache::GetDepthFunc();
+        RenderDepthPrePass(arg.canvas.GetScene(), false);
         arg.canvas.GetScene()->Accept(*this);
+        GLStateCache::DepthFunc(depthFunc);
         this->arg = NULL;
         
         // cleanup
@@ -94,8 +240,9 @@ void RenderingView::Handle(RenderingEventArg arg) {
             currentShader.reset();
         }
         if (currentTexture != 0) {
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glDisable(GL_TEXTURE_2D);
+            TextureUnitCache::Active(0);
+            TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+            GLStateCache::Disable(GL_TEXTURE_2D);
             CHECK_FOR_GL_ERROR();
             currentTexture = 0;
         }
@@ -103,115 +250,236 @@ void RenderingView::Handle(RenderingEventArg arg) {
         if (currentGeom) {
             ApplyGeometrySet(GeometrySetPtr());
         }
-    }}
+
+        if (debug) {
+            debug->End(arg.renderer.BufferSupport());
+            debug = NULL;
+        }
+    }
+    // Free the converted face sets, vertex array buffers and final
+    // targets while the context is current.
+    else if (arg.renderer.GetCurrentStage() == IRenderer::RENDERER_DEINITIALIZE) {
+        converter->Clear();
+        vertexArrays->Clear();
+        ClearFinalTargets();
+    }
+}
     
 /**
- * Process a rendering node.
+ * Convert a face set again the next time it is drawn. Must be called
+ * after faces of a drawn face set are edited in place, while the
+ * OpenGL context is current.
  *
- * @param node Rendering node to apply.
+ * @param faces Face set that changed.
  */
-void RenderingView::VisitRenderNode(RenderNode* node) {
-    node->Apply(*arg, *this);
+void RenderingView::ForgetFaceSet(FaceSet* faces) {
+    converter->Forget(faces);
 }
 
-void RenderingView::ApplyRenderState(RenderStateNode* node) {
-    if (node->IsOptionEnabled(RenderStateNode::WIREFRAME)) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        CHECK_FOR_GL_ERROR();
-    }
-    else if (node->IsOptionDisabled(RenderStateNode::WIREFRAME)) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        CHECK_FOR_GL_ERROR();
-    }
+/**
+ * Upload a vertex array again the next time it is drawn. Must be
+ * called after the data of a drawn vertex array is changed in place,
+ * while the OpenGL context is current.
+ *
+ * @param va Vertex array that changed.
+ */
+void RenderingView::ForgetVertexArray(VertexArray* va) {
+    vertexArrays->Forget(va);
+}
 
-    if (node->IsOptionEnabled(RenderStateNode::BACKFACE)) {
-        glDisable(GL_CULL_FACE);
-        CHECK_FOR_GL_ERROR();
-    }
-    else if (node->IsOptionDisabled(RenderStateNode::BACKFACE)) {
-        glEnable(GL_CULL_FACE);
-        CHECK_FOR_GL_ERROR();
-    }
+/**
+ * Lay down the depth of the opaque meshes before the scene and its
+ * post process scenes are drawn, so the expensive materials are only
+ * shaded for visible fragments. Disabled by default.
+ *
+ * Materials must not move their vertices in the shader, as the
+ * pre-pass uses the fixed function transform.
+ */
+void RenderingView::SetDepthPrePass(bool enabled) {
+    depthPrePass = enabled;
+}
 
-    if (node->IsOptionEnabled(RenderStateNode::LIGHTING)) {
-        glEnable(GL_LIGHTING);
-        CHECK_FOR_GL_ERROR();
-    }
-    else if (node->IsOptionDisabled(RenderStateNode::LIGHTING)) {
-        glDisable(GL_LIGHTING);
-        CHECK_FOR_GL_ERROR();
-    }
+bool RenderingView::GetDepthPrePass() {
+    return depthPrePass;
+}
 
-    if (node->IsOptionEnabled(RenderStateNode::DEPTH_TEST)) {
-        glEnable(GL_DEPTH_TEST);
-        CHECK_FOR_GL_ERROR();
+/**
+ * Use a mesh as an occluder. Meshes hidden behind the occluders in
+ * an occlusion buffer rendered on the cpu are not drawn. Good
+ * occluders are large, opaque and have few triangles.
+ *
+ * The vertices and indices are copied, so the mesh must still have
+ * its client side data.
+ *
+ * @param mesh Triangle mesh.
+ */
+void RenderingView::AddOccluder(MeshPtr mesh) {
+    IDataBlockPtr v = mesh->GetGeometrySet()->GetVertices();
+    IndicesPtr i = mesh->GetIndices();
+    if (mesh->GetType() != Geometry::TRIANGLES || v == NULL ||
+        v->GetVoidDataPtr() == NULL || v->GetType() != Types::FLOAT ||
+        i == NULL || i->GetData() == NULL) {
+        logger.warning << "Occluder mesh without client side triangles ignored." << logger.end;
+        return;
     }
-    else if (node->IsOptionDisabled(RenderStateNode::DEPTH_TEST)) {
-        glDisable(GL_DEPTH_TEST);
-        CHECK_FOR_GL_ERROR();
+    if (occluders.find(mesh.get()) != occluders.end()) return;
+    if (occlusionBuffer == NULL) occlusionBuffer = new OcclusionBuffer();
+    unsigned int id =
+        occlusionBuffer->AddOccluder((const float*)v->GetVoidDataPtr(),
+                                     v->GetDimension(), v->GetSize(),
+                                     i->GetData() + mesh->GetIndexOffset(),
+                                     mesh->GetDrawingRange());
+    occluders[mesh.get()] = make_pair(mesh, id);
+}
+
+/**
+ * Get the occlusion buffer, NULL until an occluder is added.
+ */
+OcclusionBuffer* RenderingView::GetOcclusionBuffer() {
+    return occlusionBuffer;
+}
+
+/**
+ * Draw the depth of the meshes in a scene and set the depth test to
+ * pass for equal depths. The caller restores the depth function when
+ * the scene is drawn.
+ *
+ * The pre-pass loads matrices multiplied on the cpu, while the scene
+ * is drawn with the matrix stack and shaders that need not use
+ * ftransform, so the depths of the two passes may differ in the last
+ * bits. The pre-pass depths are pushed back by a small polygon offset,
+ * larger on sloped polygons, so the following pass still passes on them.
+ *
+ * @param node Root of the scene.
+ * @param subNodes True to draw the sub nodes only.
+ */
+void RenderingView::RenderDepthPrePass(ISceneNode* node, bool subNodes) {
+    if (!depthPrePass || depthOnly == NULL || !GLStateCache::IsEnabled(GL_DEPTH_TEST))
+        return;
+    depthOnly->Begin(currentModelViewMatrix);
+    depthOnly->SetMeshLOD(lod, projScale);
+    if (subNodes) node->VisitSubNodes(*depthOnly);
+    else node->Accept(*depthOnly);
+
+    bool mask[4];
+    for (unsigned int i = 0; i < 4; ++i)
+        mask[i] = GLStateCache::GetColorMask(i);
+    bool offset = GLStateCache::IsEnabled(GL_POLYGON_OFFSET_FILL);
+    GLStateCache::ColorMask(false, false, false, false);
+    if (!offset) {
+        GLStateCache::Enable(GL_POLYGON_OFFSET_FILL);
+        GLStateCache::PolygonOffset(1.0f, 1.0f);
     }
+    depthOnly->Flush();
+    if (!offset) GLStateCache::Disable(GL_POLYGON_OFFSET_FILL);
+    GLStateCache::ColorMask(mask[0], mask[1], mask[2], mask[3]);
+    GLStateCache::DepthFunc(GL_LEQUAL);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Process a rendering node.
+ *
+ * @param node Rendering node to apply.
+ */
+void RenderingView::VisitRenderNode(RenderNode* node) {
+    node->Apply(*arg, *this);
+    // The node may change any state outside the caches.
+    GLStateCache::Invalidate();
+    TextureUnitCache::Invalidate();
+}
+
+/**
+ * Apply the options of a render state that have changed.
+ *
+ * @param state Combined render state.
+ * @param changed Bitmask of the options to apply.
+ */
+void RenderingView::ApplyRenderState(const RenderState& state, unsigned int changed) {
+    unsigned int on = state.enabled & changed;
+    unsigned int off = state.disabled & changed;
+
+    if (on & RS_WIREFRAME)
+        GLStateCache::PolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    else if (off & RS_WIREFRAME)
+        GLStateCache::PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    if (on & RS_BACKFACE)
+        GLStateCache::Disable(GL_CULL_FACE);
+    else if (off & RS_BACKFACE)
+        GLStateCache::Enable(GL_CULL_FACE);
+
+    if (on & RS_LIGHTING)
+        GLStateCache::Enable(GL_LIGHTING);
+    else if (off & RS_LIGHTING)
+        GLStateCache::Disable(GL_LIGHTING);
+
+    if (on & RS_DEPTH_TEST)
+        GLStateCache::Enable(GL_DEPTH_TEST);
+    else if (off & RS_DEPTH_TEST)
+        GLStateCache::Disable(GL_DEPTH_TEST);
     
-    if (node->IsOptionEnabled(RenderStateNode::COLOR_MATERIAL)) {
-        glEnable(GL_COLOR_MATERIAL);
-        CHECK_FOR_GL_ERROR();
-    }
-    else if (node->IsOptionDisabled(RenderStateNode::COLOR_MATERIAL)) {
-        glDisable(GL_COLOR_MATERIAL);
-        CHECK_FOR_GL_ERROR();
-    }
+    if (on & RS_COLOR_MATERIAL)
+        GLStateCache::Enable(GL_COLOR_MATERIAL);
+    else if (off & RS_COLOR_MATERIAL)
+        GLStateCache::Disable(GL_COLOR_MATERIAL);
+    CHECK_FOR_GL_ERROR();
 
-    if (node->IsOptionEnabled(RenderStateNode::BINORMAL))
-        renderBinormal = true;
-    else if (node->IsOptionDisabled(RenderStateNode::BINORMAL))
-        renderBinormal = false;
+    if (on & RS_BINORMAL) renderBinormal = true;
+    else if (off & RS_BINORMAL) renderBinormal = false;
 
-    if (node->IsOptionEnabled(RenderStateNode::TANGENT))
-        renderTangent = true;
-    else if (node->IsOptionDisabled(RenderStateNode::TANGENT))
-        renderTangent = false;
+    if (on & RS_TANGENT) renderTangent = true;
+    else if (off & RS_TANGENT) renderTangent = false;
 
-    if (node->IsOptionEnabled(RenderStateNode::SOFT_NORMAL))
-        renderSoftNormal = true;
-    else if (node->IsOptionDisabled(RenderStateNode::SOFT_NORMAL))
-        renderSoftNormal = false;
+    if (on & RS_SOFT_NORMAL) renderSoftNormal = true;
+    else if (off & RS_SOFT_NORMAL) renderSoftNormal = false;
 
-    if (node->IsOptionEnabled(RenderStateNode::HARD_NORMAL))
-        renderHardNormal = true;
-    else if (node->IsOptionDisabled(RenderStateNode::HARD_NORMAL))
-        renderHardNormal = false;
+    if (on & RS_HARD_NORMAL) renderHardNormal = true;
+    else if (off & RS_HARD_NORMAL) renderHardNormal = false;
 
-    if (node->IsOptionEnabled(RenderStateNode::TEXTURE))
-        renderTexture = true;
-    else if (node->IsOptionDisabled(RenderStateNode::TEXTURE))
-        renderTexture = false;
+    if (on & RS_TEXTURE) renderTexture = true;
+    else if (off & RS_TEXTURE) renderTexture = false;
 
-    if (node->IsOptionEnabled(RenderStateNode::SHADER))
-        renderShader = true;
-    else if (node->IsOptionDisabled(RenderStateNode::SHADER))
-        renderShader = false;
+    if (on & RS_SHADER) renderShader = true;
+    else if (off & RS_SHADER) renderShader = false;
 }
 
 
 /**
  * Process a render state node.
  *
+ * The options of the node are combined with the current render state
+ * and pushed on the render state stack. Only the options that differ
+ * from the current state are applied, on entry and again on exit.
+ *
  * @param node Render state node to apply.
  */
 void RenderingView::VisitRenderStateNode(Scene::RenderStateNode* node) {
-    // save old state
-    RenderStateNode* prevCurrent = currentRenderState;
+    // read the options of the node into bitmasks
+    unsigned int enabled = 0, disabled = 0;
+    for (unsigned int i = 0; i < RS_COUNT; ++i) {
+        if (node->IsOptionEnabled(renderStateOptions[i]))
+            enabled |= 1 << i;
+        else if (node->IsOptionDisabled(renderStateOptions[i]))
+            disabled |= 1 << i;
+    }
+
+    // combine with the current state, the node takes precedence
+    RenderState prev = renderStates.back();
+    RenderState state;
+    state.enabled = (prev.enabled & ~disabled) | enabled;
+    state.disabled = (prev.disabled & ~enabled) | disabled;
+    unsigned int changed = (state.enabled ^ prev.enabled) | (state.disabled ^ prev.disabled);
 
-    // apply combined render state
-    currentRenderState = currentRenderState->GetCombined(*node);
-    ApplyRenderState(currentRenderState);
+    renderStates.push_back(state);
+    if (changed) ApplyRenderState(state, changed);
 
     // visit sub tree
     node->VisitSubNodes(*this);
 
     // restore previous state
-    delete currentRenderState;
-    currentRenderState = prevCurrent;
-    ApplyRenderState(currentRenderState);
+    renderStates.pop_back();
+    if (changed) ApplyRenderState(prev, changed);
 
     CHECK_FOR_GL_ERROR();
 }
@@ -231,12 +499,14 @@ void RenderingView::VisitTransformationNode(TransformationNode* node) {
     CHECK_FOR_GL_ERROR();
     Matrix<4, 4, float> oldModelView = currentModelViewMatrix;
     currentModelViewMatrix = m * currentModelViewMatrix;
+    if (debug) debug->SetTransform(currentModelViewMatrix);
     // traverse sub nodes
     node->VisitSubNodes(*this);
     CHECK_FOR_GL_ERROR();
     // pop transformation matrix
     glPopMatrix();
     currentModelViewMatrix = oldModelView;
+    if (debug) debug->SetTransform(currentModelViewMatrix);
     CHECK_FOR_GL_ERROR();
 }
 
@@ -272,23 +542,32 @@ void RenderingView::ApplyMaterial(MaterialPtr mat) {
     
     // if the face has no texture reset the current texture 
     else if (mat->Get2DTextures().size() == 0 || !renderTexture) {
-        glBindTexture(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
-        glDisable(GL_TEXTURE_2D);
+        TextureUnitCache::Active(0);
+        TextureUnitCache::Bind(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
+        GLStateCache::Disable(GL_TEXTURE_2D);
         CHECK_FOR_GL_ERROR();
         currentTexture = 0;
     }
     
     // check if texture shall be applied
-    else if (renderTexture &&
-             currentTexture != (*mat->Get2DTextures().begin()).second->GetID()) {  // and face texture is different then the current one
-        currentTexture = (*mat->Get2DTextures().begin()).second->GetID();
-        glEnable(GL_TEXTURE_2D);
+    else if (renderTexture) {
+        ITexture2DPtr tex = (*mat->Get2DTextures().begin()).second;
+        // mark the texture as used, this may reload it.
+        if (residency) residency->Touch(tex);
+
+        // and face texture is different then the current one
+        if (currentTexture != tex->GetID()) {
+            currentTexture = tex->GetID();
+            // fixed function texturing uses unit 0.
+            TextureUnitCache::Active(0);
+            GLStateCache::Enable(GL_TEXTURE_2D);
 #ifdef DEBUG
-        if (!glIsTexture(currentTexture)) //@todo: ifdef to debug
-            throw Exception("texture not bound, id: " + currentTexture);
+            if (!glIsTexture(currentTexture)) //@todo: ifdef to debug
+                throw Exception("texture not bound, id: " + currentTexture);
 #endif
-        glBindTexture(GL_TEXTURE_2D, currentTexture);
-        CHECK_FOR_GL_ERROR();
+            TextureUnitCache::Bind(GL_TEXTURE_2D, currentTexture);
+            CHECK_FOR_GL_ERROR();
+        }
     }
         
     // Apply materials
@@ -448,6 +727,10 @@ void RenderingView::ApplyMesh(Mesh* prim) {
                              prim->GetMaterial()->shad);
         */
         ApplyGeometrySet(prim->GetGeometrySet());
+
+        // Select the mipmap levels needed for the mesh.
+        if (streamer && streamer->HasStreams())
+            RequestMipLevels(prim);
         
         // Apply the material.
         ApplyMaterial(prim->GetMaterial());
@@ -462,10 +745,22 @@ void RenderingView::ApplyMesh(Mesh* prim) {
         unsigned int offset = prim->GetIndexOffset();
         Geometry::Type type = prim->GetType();
         if (bufferSupport) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GetID());
-        if (indexBuffer->GetID() != 0){
-            glDrawElements(type, count, GL_UNSIGNED_INT, (GLvoid*)(offset * sizeof(GLuint)));
-        }else{
-            glDrawElements(type, count, GL_UNSIGNED_INT, indexBuffer->GetData() + offset);
+        const GLvoid* indices = (indexBuffer->GetID() != 0) ?
+            (GLvoid*)(offset * sizeof(GLuint)) : 
+            (GLvoid*)(indexBuffer->GetData() + offset);
+        glDrawElements(type, count, GL_UNSIGNED_INT, indices);
+
+        // Draw the normals of the mesh from the same buffers.
+        if (type == GL_TRIANGLES &&
+            (renderSoftNormal || renderHardNormal || renderTangent || renderBinormal)) {
+            AttributeBlocks blocks = prim->GetGeometrySet()->GetAttributeLists();
+            AttributeBlocks::const_iterator tan = blocks.find("tangent");
+            AttributeBlocks::const_iterator bin = blocks.find("binormal");
+            if (BeginDebugVectors(tan != blocks.end() ? tan->second : IDataBlockPtr(),
+                                  bin != blocks.end() ? bin->second : IDataBlockPtr())) {
+                glDrawElements(type, count, GL_UNSIGNED_INT, indices);
+                EndDebugVectors();
+            }
         }
 
         if (bufferSupport) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -480,13 +775,63 @@ void RenderingView::ApplyMesh(Mesh* prim) {
     CHECK_FOR_GL_ERROR();
 }
 
+/**
+ * Request the mipmap levels of the streamed textures of a mesh from
+ * the projected size of its bounding sphere. Meshes without known
+ * bounds request the full textures.
+ *
+ * @param prim Mesh about to be drawn.
+ */
+void RenderingView::RequestMipLevels(Mesh* prim) {
+    float pixels = 1e9f;
+    Bounds b = GeometryBounds::Get(prim->GetGeometrySet()->GetVertices().get());
+    if (b.valid) {
+        float f[16];
+        currentModelViewMatrix.ToArray(f);
+        pixels = GeometryBounds::ProjectedSize(b, f, projScale);
+    }
+
+    map<string, ITexture2DPtr> texs = prim->GetMaterial()->Get2DTextures();
+    map<string, ITexture2DPtr>::iterator itr = texs.begin();
+    for (; itr != texs.end(); ++itr)
+        streamer->Request(itr->second.get(), pixels);
+}
+
 /**
  * Process a mesh node.
  *
  * @param node Mesh node to render
  */
 void RenderingView::VisitMeshNode(MeshNode* node) {
-    ApplyMesh(node->GetMesh().get());
+    Mesh* mesh = node->GetMesh().get();
+    if (occlusionBuffer && !occluders.empty() &&
+        occluders.find(mesh) == occluders.end()) {
+        // Skip the mesh if it is behind the occluders.
+        Bounds b = GeometryBounds::Get(mesh->GetGeometrySet()->GetVertices().get());
+        if (b.valid) {
+            float mvp[16];
+            (currentModelViewMatrix * projectionMatrix).ToArray(mvp);
+            float lo[3] = { b.min[0], b.min[1], b.min[2] };
+            float hi[3] = { b.max[0], b.max[1], b.max[2] };
+            if (!occlusionBuffer->IsVisible(lo, hi, mvp)) {
+                node->VisitSubNodes(*this);
+                return;
+            }
+        }
+    }
+    float f[16];
+    currentModelViewMatrix.ToArray(f);
+    // Draw the level of detail for the size of the mesh.
+    Mesh* draw = lod ? lod->Select(node, f, projScale) : mesh;
+    if (occlusion && occlusion->IsEnabled()) {
+        // Skip the mesh if it was hidden in an earlier frame.
+        Bounds b = GeometryBounds::Get(mesh->GetGeometrySet()->GetVertices().get());
+        if (occlusion->Begin(node, b, f)) {
+            ApplyMesh(draw);
+            occlusion->End();
+        }
+    } else
+        ApplyMesh(draw);
     node->VisitSubNodes(*this);
     CHECK_FOR_GL_ERROR();
 }
@@ -497,6 +842,41 @@ void RenderingView::VisitMeshNode(MeshNode* node) {
  * @param node Geometry node to render
  */
 void RenderingView::VisitGeometryNode(GeometryNode* node) {
+    FaceSet* faces = node->GetFaceSet();
+    if (faces == NULL) return;
+
+    // Outside a frame, e.g. when compiled into a display list, there
+    // is no renderer to bind buffers with.
+    if (arg == NULL) {
+        RenderFaces(faces);
+        return;
+    }
+
+    // Draw the face set through the mesh path, converting it to
+    // buffers the first time it is seen.
+    const vector<MeshPtr>& meshes = converter->GetMeshes(faces, arg->renderer);
+    for (vector<MeshPtr>::const_iterator itr = meshes.begin(); 
+         itr != meshes.end(); ++itr)
+        ApplyMesh(itr->get());
+    CHECK_FOR_GL_ERROR();
+
+    // The converted buffers hold no tangents or binormals, and the
+    // normals are only drawn on the GPU when geometry shaders are
+    // supported. Draw the rest from the faces.
+    bool normals = (renderSoftNormal || renderHardNormal) && 
+        !NormalVisualizationShader::IsSupported();
+    if (normals || renderTangent || renderBinormal) {
+        for (FaceList::iterator itr = faces->begin(); itr != faces->end(); itr++)
+            RenderDebugGeometry(*itr, normals);
+    }
+}
+
+/**
+ * Draw a face set in immediate mode.
+ *
+ * @param faces Face set to draw.
+ */
+void RenderingView::RenderFaces(FaceSet* faces) {
     // reset last state for matrial applying
     currentTexture = 0;
     currentShader.reset();
@@ -506,8 +886,6 @@ void RenderingView::VisitGeometryNode(GeometryNode* node) {
 
     // Remember last bound texture and shader
     FaceList::iterator itr;
-    FaceSet* faces = node->GetFaceSet();
-    if (faces == NULL) return;
 
     // for each face ...
     for (itr = faces->begin(); itr != faces->end(); itr++) {
@@ -530,7 +908,7 @@ void RenderingView::VisitGeometryNode(GeometryNode* node) {
         glEnd();
         CHECK_FOR_GL_ERROR();
 
-        RenderDebugGeometry(f);
+        RenderDebugGeometry(f, true);
     }
 
     // last we release the final shader
@@ -538,8 +916,9 @@ void RenderingView::VisitGeometryNode(GeometryNode* node) {
         currentShader->ReleaseShader();
 
     // disable textures if it has been enabled
-    glBindTexture(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
-    glDisable(GL_TEXTURE_2D);
+    TextureUnitCache::Active(0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
+    GLStateCache::Disable(GL_TEXTURE_2D);
     CHECK_FOR_GL_ERROR();
 }
 
@@ -562,35 +941,50 @@ void RenderingView::VisitVertexArrayNode(VertexArrayNode* node){
     glEnableClientState(GL_NORMAL_ARRAY);
     glEnableClientState(GL_COLOR_ARRAY);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-    glEnable(GL_TEXTURE_2D);
+    TextureUnitCache::Active(0);
+    GLStateCache::Enable(GL_TEXTURE_2D);
     CHECK_FOR_GL_ERROR();
 
     // Get vertex array from the vertex array node
     list<VertexArray*> vaList = node->GetVertexArrays();
+    // Outside a frame, e.g. when compiled into a display list, there
+    // is no renderer to ask, so the arrays are drawn from client
+    // memory. arg is NULL there, see the constructor and Handle.
+    bool bufferSupport = arg != NULL && arg->renderer.BufferSupport();
     for(list<VertexArray*>::iterator itr = vaList.begin(); itr!=vaList.end(); itr++) {
         VertexArray* va = (*itr);
 
         ApplyMaterial(va->mat);
         
-        // Setup pointers to arrays
-        glNormalPointer(GL_FLOAT, 0, va->GetNormals());
-        glColorPointer(4, GL_FLOAT, 0, va->GetColors());
-        glTexCoordPointer(2, GL_FLOAT, 0, va->GetTexCoords());
-        glVertexPointer(3, GL_FLOAT, 0, va->GetVertices());
+        // Setup pointers to arrays, from buffers uploaded once if
+        // supported.
+        if (bufferSupport)
+            vertexArrays->Apply(va);
+        else {
+            glNormalPointer(GL_FLOAT, 0, va->GetNormals());
+            glColorPointer(4, GL_FLOAT, 0, va->GetColors());
+            glTexCoordPointer(2, GL_FLOAT, 0, va->GetTexCoords());
+            glVertexPointer(3, GL_FLOAT, 0, va->GetVertices());
+        }
         glDrawArrays(GL_TRIANGLES, 0, va->GetNumFaces()*3);
+
+        // Draw the normals from the same arrays.
+        if (BeginDebugVectors(IDataBlockPtr(), IDataBlockPtr())) {
+            glDrawArrays(GL_TRIANGLES, 0, va->GetNumFaces()*3);
+            EndDebugVectors();
+        }
     }
+    if (bufferSupport) glBindBuffer(GL_ARRAY_BUFFER, 0);
     CHECK_FOR_GL_ERROR();
 
-    /* @todo: added debug rendering of normals and other things:
-       RenderDebugGeometry(face); */
-
     // last we release the final shader
     if (currentShader != NULL)
         currentShader->ReleaseShader();
 
     // Disable all state changes
-    glBindTexture(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
-    glDisable(GL_TEXTURE_2D);
+    TextureUnitCache::Active(0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0); // @todo, remove this if not needed, release texture
+    GLStateCache::Disable(GL_TEXTURE_2D);
 	glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_NORMAL_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
@@ -603,6 +997,108 @@ void RenderingView::VisitDisplayListNode(DisplayListNode* node) {
     CHECK_FOR_GL_ERROR();
 }
 
+/**
+ * Process a static batch node, drawing one mesh per material. The
+ * batch is culled as a whole from its bounds.
+ *
+ * @param node Static batch node.
+ */
+void RenderingView::VisitStaticBatchNode(StaticBatchNode* node) {
+    const vector<MeshPtr>& meshes = node->GetMeshes();
+    const Bounds& b = node->GetBounds();
+    if (occlusionBuffer && !occluders.empty() && b.valid) {
+        // Skip the batch if it is behind the occluders, unless it
+        // holds one of them.
+        bool occluder = false;
+        for (unsigned int i = 0; i < meshes.size() && !occluder; ++i)
+            occluder = occluders.find(meshes[i].get()) != occluders.end();
+        float mvp[16];
+        (currentModelViewMatrix * projectionMatrix).ToArray(mvp);
+        float lo[3] = { b.min[0], b.min[1], b.min[2] };
+        float hi[3] = { b.max[0], b.max[1], b.max[2] };
+        if (!occluder && !occlusionBuffer->IsVisible(lo, hi, mvp)) {
+            node->VisitSubNodes(*this);
+            return;
+        }
+    }
+    float f[16];
+    currentModelViewMatrix.ToArray(f);
+    bool culling = occlusion && occlusion->IsEnabled();
+    if (!culling || occlusion->Begin(node, b, f)) {
+        for (vector<MeshPtr>::const_iterator itr = meshes.begin(); 
+             itr != meshes.end(); ++itr)
+            ApplyMesh(lod ? lod->Select(node, itr->get(), b, f, projScale) : itr->get());
+        if (culling) occlusion->End();
+    }
+    node->VisitSubNodes(*this);
+    CHECK_FOR_GL_ERROR();
+}
+
+// Renders the sub nodes of the innermost post process node in a
+// chain to its scene frame buffer.
+class ScenePass : public FrameGraph::IPass {
+    FrameBuffer* fb;
+    ISceneNode* scene;
+    RenderingView& view;
+public:
+    ScenePass(FrameBuffer* fb, ISceneNode* scene, RenderingView& view)
+        : fb(fb), scene(scene), view(view) {}
+    void Execute(FrameGraph& graph) {
+        // The depth buffer is only needed while the scene is drawn,
+        // so it is shared with the passes not overlapping this.
+        RenderTarget* depth = NULL;
+        if (!fb->GetDepthTexture())
+            depth = RenderTargetPool::AcquireDepth(fb);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        CHECK_FOR_GL_ERROR();
+        GLenum depthFunc = GLStateCache::GetDepthFunc();
+        view.RenderDepthPrePass(scene, true);
+        scene->VisitSubNodes(view);
+        // Debug geometry of the scene is drawn into its frame buffer,
+        // depth tested against the scene and post processed with it.
+        view.FlushDebugGeometry();
+        GLStateCache::DepthFunc(depthFunc);
+        if (depth) RenderTargetPool::Release(depth);
+    }
+};
+
+// Applies the effect of a post process node, optionally through a
+// frame buffer also writing the final frame buffer.
+class EffectPass : public FrameGraph::IPass {
+    PostProcessNode* node;
+    GLuint fbo;
+public:
+    EffectPass(PostProcessNode* node) : node(node), fbo(0) {}
+    void SetFramebuffer(GLuint fbo) { this->fbo = fbo; }
+    void Execute(FrameGraph& graph) {
+        if (fbo != 0)
+            GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, fbo);
+        node->GetEffect()->ApplyShader();
+        glRecti(-1,-1,1,1);
+        node->GetEffect()->ReleaseShader();
+    }
+};
+
+// Copies the color of one frame buffer to another.
+class CopyPass : public FrameGraph::IPass {
+    FrameGraph::Resource from, to;
+public:
+    CopyPass(FrameGraph::Resource from, FrameGraph::Resource to)
+        : from(from), to(to) {}
+    void Execute(FrameGraph& graph) {
+        Vector<4, GLint> src = graph.GetViewport(from);
+        Vector<4, GLint> dst = graph.GetViewport(to);
+        GLStateCache::BindFramebuffer(GL_READ_FRAMEBUFFER_EXT, graph.GetFramebuffer(from));
+        GLStateCache::BindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, graph.GetFramebuffer(to));
+        // @TODO Blit the depth buffer with nearest and color buffers
+        // with linear filtering?
+        glBlitFramebufferEXT(src[0], src[1], src[2], src[3],
+                             dst[0], dst[1], dst[2], dst[3],
+                             GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        CHECK_FOR_GL_ERROR();
+    }
+};
+
 void RenderingView::VisitPostProcessNode(PostProcessNode* node) {
     node->PreEffect(arg, &currentModelViewMatrix);
     
@@ -614,80 +1110,234 @@ void RenderingView::VisitPostProcessNode(PostProcessNode* node) {
         node->VisitSubNodes(*this);
         return;
     }
-    
-    // Save the previous state
-    GLint prevFbo;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prevFbo);
-    Vector<4, GLint> prevDims;
-    glGetIntegerv(GL_VIEWPORT, prevDims.ToArray());
-    CHECK_FOR_GL_ERROR();
-    
-    // Setup the new frame buffer
-    Vector<2, int> dims = node->GetDimension();
-    glViewport(0, 0, dims[0], dims[1]);
-    CHECK_FOR_GL_ERROR();
-    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, node->GetSceneFrameBuffer()->GetID());
-    // Blit the previous framebuffer depth for merging instead of sorting.
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    CHECK_FOR_GL_ERROR();
-    
-    // Render to the scene frame buffer
-    node->VisitSubNodes(*this);
 
-    // Bind the previous frame buffer as both draw and read buffer.
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prevFbo);
-    glViewport(prevDims[0], prevDims[1], prevDims[2], prevDims[3]);
-    CHECK_FOR_GL_ERROR();
-
-    // Gently disable the depth func (while preserving depth writes)
-    glDepthFunc(GL_ALWAYS);
+    // Post process nodes that are the only child of the previous
+    // one form a chain. The effect of each node covers the scene
+    // frame buffer of its parent, so only the innermost scene is
+    // cleared and rendered. Disabled nodes in the chain are passed
+    // through.
+    vector<PostProcessNode*> chain(1, node);
+    ISceneNode* scene = node;
+    while (scene->GetNumberOfNodes() == 1) {
+        PostProcessNode* inner = dynamic_cast<PostProcessNode*>(scene->GetNode(0));
+        if (inner == NULL) break;
+        inner->PreEffect(arg, &currentModelViewMatrix);
+        if (inner->GetEnabled()) chain.push_back(inner);
+        scene = inner;
+    }
 
-    // Then render the effect
-    node->GetEffect()->ApplyShader();
-    glRecti(-1,-1,1,1);
-    node->GetEffect()->ReleaseShader();
-    // @TODO reset to previous depth func, not just less
-    glDepthFunc(GL_LESS);
+    FrameGraph graph;
+    FrameGraph::Resource out = graph.Import(GLStateCache::GetFramebuffer(),
+                                            GLStateCache::GetViewport());
+    graph.Retain(out);
+
+    // Effects declaring resolutionScale may render their scene at a
+    // lower resolution, in the lower left corner of the scene frame
+    // buffer, and upsample it.
+    vector<FrameGraph::Resource> scenes;
+    for (unsigned int i = 0; i < chain.size(); ++i) {
+        Vector<2, int> full = chain[i]->GetDimension();
+        Vector<2, int> dims = full;
+        IShaderResourcePtr effect = chain[i]->GetEffect();
+        if (effect->GetUniformID("resolutionScale") >= 0) {
+            if (resolution) dims = resolution->GetDimension(chain[i]);
+            effect->SetUniform("resolutionScale",
+                               Vector<2, float>(float(dims[0]) / full[0],
+                                                float(dims[1]) / full[1]));
+        }
+        scenes.push_back(graph.Import(chain[i]->GetSceneFrameBuffer()->GetID(),
+                                      Vector<4, GLint>(0, 0, dims[0], dims[1])));
+    }
 
-    // Store the effect in the final frame buffer
-    FrameBuffer* finalFb = node->GetFinalFrameBuffer();
-    if (finalFb != NULL){
+    ScenePass scenePass(chain.back()->GetSceneFrameBuffer(), scene, *this);
+    graph.AddPass(&scenePass, FrameGraph::RENDER, scenes.back());
+
+    // The passes must not move once added.
+    vector<EffectPass> effects;
+    vector<CopyPass> copies;
+    effects.reserve(chain.size());
+    copies.reserve(chain.size());
+    for (int i = chain.size() - 1; i >= 0; --i) {
+        FrameGraph::Resource target = i == 0 ? out : scenes[i-1];
+        effects.push_back(EffectPass(chain[i]));
+        unsigned int pass = graph.AddPass(&effects.back(), FrameGraph::FULLSCREEN, target);
+        graph.Read(pass, scenes[i]);
+
+        // Store the effect in the final frame buffer
+        FrameBuffer* finalFb = chain[i]->GetFinalFrameBuffer();
+        if (finalFb == NULL) continue;
         if (finalFb->GetID() == 0){
             // Initialize the final frame buffer and assign the
             // textures to the effect shader.
             arg->renderer.BindFrameBuffer(finalFb);
-            for (unsigned int i = 0; i < finalFb->GetNumberOfAttachments(); ++i){
-                string colorid = "finalColor" + Utils::Convert::ToString<unsigned int>(i);
-                if (node->GetEffect()->GetUniformID(colorid) >= 0)
-                    node->GetEffect()->SetTexture(colorid, finalFb->GetTexAttachment(i));
+            // effects are drawn without depth testing.
+            RenderTargetPool::DropDepth(finalFb);
+            for (unsigned int j = 0; j < finalFb->GetNumberOfAttachments(); ++j){
+                string colorid = "finalColor" + Utils::Convert::ToString<unsigned int>(j);
+                if (chain[i]->GetEffect()->GetUniformID(colorid) >= 0)
+                    chain[i]->GetEffect()->SetTexture(colorid, finalFb->GetTexAttachment(j));
                 CHECK_FOR_GL_ERROR();
             }
         }
-        // Blit the images from the previous framebuffer to the final framebuffer
-        glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, finalFb->GetID());
-        // @TODO Blit the depth buffer with nearest and color buffers
-        // with linear filtering?
-        glBlitFramebufferEXT(prevDims[0], prevDims[1], prevDims[2], prevDims[3], 
-			     0, 0, dims[0], dims[1], 
-			     GL_COLOR_BUFFER_BIT, GL_LINEAR);
-        CHECK_FOR_GL_ERROR();
-        
-        // Reset to previous fbo
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prevFbo);
+        // Write the final frame buffer along with the target when
+        // possible, instead of copying the target afterwards.
+        GLuint mrt = GetFinalTarget(graph.GetFramebuffer(target),
+                                    graph.GetViewport(target), chain[i]);
+        if (mrt != 0) {
+            effects.back().SetFramebuffer(mrt);
+            continue;
+        }
+        Vector<2, int> dims = finalFb->GetDimension();
+        FrameGraph::Resource finalTarget = graph.Import(finalFb->GetID(),
+                                                        Vector<4, GLint>(0, 0, dims[0], dims[1]));
+        graph.Retain(finalTarget);
+        copies.push_back(CopyPass(target, finalTarget));
+        pass = graph.AddPass(&copies.back(), FrameGraph::COPY, finalTarget);
+        graph.Read(pass, target);
     }
 
+    // Debug geometry collected so far belongs to the target bound
+    // now, not to the scene frame buffer.
+    FlushDebugGeometry();
+
+    bool timed = resolution && resolution->Begin();
+    graph.Execute();
+    if (resolution) resolution->End(timed);
     currentShader.reset();
 }
     
+/**
+ * Get a frame buffer drawing to the color and depth buffers of a
+ * target and to the final frame buffer of a post process node. The
+ * effect writes gl_FragColor, which goes to both color buffers, so
+ * the final frame buffer needs no copy.
+ *
+ * The frame buffer is built once from the attachments of the target,
+ * and again once the render target pool has deleted frame buffers,
+ * as their ids may be reused with other attachments. A depth buffer
+ * the pool attaches to the target is attached to the frame buffer
+ * too, again whenever the pool hands the target another one.
+ *
+ * Zero is returned if the effect cannot write both. This happens
+ * when the target is the window, which cannot share a frame buffer
+ * with a texture, the target has no color texture or depth that can
+ * be shared, the sizes differ, blending is enabled, or the effect
+ * samples the final frame buffer or does not write the same color to
+ * every draw buffer.
+ *
+ * @param fbo Frame buffer the effect is applied to.
+ * @param viewport Viewport of the effect.
+ * @param node Post process node with a bound final frame buffer.
+ */
+GLuint RenderingView::GetFinalTarget(GLuint fbo, Vector<4, GLint> viewport,
+                                     PostProcessNode* node) {
+    // gl_FragColor is written to every draw buffer from OpenGL 2.0.
+    if (fbo == 0 || !arg->renderer.BufferSupport() ||
+        GLStateCache::IsEnabled(GL_BLEND))
+        return 0;
+
+    FrameBuffer* finalFb = node->GetFinalFrameBuffer();
+    Vector<2, int> dims = finalFb->GetDimension();
+    if (finalFb->GetNumberOfAttachments() != 1 ||
+        viewport[0] != 0 || viewport[1] != 0 ||
+        viewport[2] != dims[0] || viewport[3] != dims[1])
+        return 0;
+
+    OpenGLShader* effect = dynamic_cast<OpenGLShader*>(node->GetEffect().get());
+    if (effect == NULL || !effect->BroadcastsFragColor() ||
+        effect->GetUniformID("finalColor0") >= 0)
+        return 0;
+
+    if (finalStamp != RenderTargetPool::GetDeleteCount()) {
+        ClearFinalTargets();
+        finalStamp = RenderTargetPool::GetDeleteCount();
+    }
+    GLuint depthBuffer = RenderTargetPool::GetDepthBuffer(fbo);
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    pair<GLuint, GLuint> key(fbo, finalFb->GetID());
+    map<pair<GLuint, GLuint>, FinalTarget>::iterator itr = finalTargets.find(key);
+    if (itr != finalTargets.end()) {
+        FinalTarget& target = itr->second;
+        if (target.fbo != 0 && target.depth != depthBuffer) {
+            GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, target.fbo);
+            glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                         GL_RENDERBUFFER_EXT, depthBuffer);
+            GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+            CHECK_FOR_GL_ERROR();
+            target.depth = depthBuffer;
+        }
+        return target.fbo;
+    }
+
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, fbo);
+    GLint colorType, color, otherType, depthType, depth;
+    glGetFramebufferAttachmentParameterivEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                             GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE_EXT, &colorType);
+    glGetFramebufferAttachmentParameterivEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                             GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME_EXT, &color);
+    glGetFramebufferAttachmentParameterivEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT,
+                                             GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE_EXT, &otherType);
+    glGetFramebufferAttachmentParameterivEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                             GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE_EXT, &depthType);
+    glGetFramebufferAttachmentParameterivEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                             GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME_EXT, &depth);
+    CHECK_FOR_GL_ERROR();
+
+    // Only depth buffers known to the pool can be followed when they
+    // change between frames.
+    bool shared = depthType == GL_RENDERBUFFER_EXT && GLuint(depth) == depthBuffer;
+    GLuint mrt = 0;
+    if (colorType == GL_TEXTURE && otherType == GL_NONE &&
+        (depthType == GL_TEXTURE || depthType == GL_NONE || shared)) {
+        glGenFramebuffersEXT(1, &mrt);
+        GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, mrt);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                  GL_TEXTURE_2D, color, 0);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT,
+                                  GL_TEXTURE_2D, finalFb->GetTexAttachment(0)->GetID(), 0);
+        if (depthType == GL_TEXTURE)
+            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                      GL_TEXTURE_2D, depth, 0);
+        else if (shared)
+            glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                         GL_RENDERBUFFER_EXT, depthBuffer);
+        const GLenum buffers[] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
+        glDrawBuffers(2, buffers);
+        CHECK_FOR_GL_ERROR();
+        if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+            glDeleteFramebuffersEXT(1, &mrt);
+            mrt = 0;
+        }
+    }
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+    CHECK_FOR_GL_ERROR();
+
+    FinalTarget target = { mrt, shared ? depthBuffer : 0 };
+    finalTargets[key] = target;
+    return mrt;
+}
+
+/**
+ * Delete the frame buffers built by GetFinalTarget.
+ */
+void RenderingView::ClearFinalTargets() {
+    map<pair<GLuint, GLuint>, FinalTarget>::iterator itr;
+    for (itr = finalTargets.begin(); itr != finalTargets.end(); ++itr)
+        if (itr->second.fbo != 0) {
+            glDeleteFramebuffersEXT(1, &itr->second.fbo);
+            CHECK_FOR_GL_ERROR();
+        }
+    finalTargets.clear();
+}
+
 void RenderingView::VisitBlendingNode(BlendingNode* node) {
     // save original blend state
-    GLboolean blending = glIsEnabled(GL_BLEND);
-    GLenum source, destination, equation;
-    glGetIntegerv(GL_BLEND_SRC, (GLint*) &source);
-    glGetIntegerv(GL_BLEND_DST, (GLint*) &destination);
-    glGetIntegerv(GL_BLEND_EQUATION, (GLint*) &equation);
+    bool blending = GLStateCache::IsEnabled(GL_BLEND);
+    GLenum source = GLStateCache::GetBlendSource();
+    GLenum destination = GLStateCache::GetBlendDestination();
+    GLenum equation = GLStateCache::GetBlendEquation();
 
-    glEnable(GL_BLEND);
+    GLStateCache::Enable(GL_BLEND);
     SwitchBlending(node->GetSource(),
                    node->GetDestination(),
                    node->GetEquation());
@@ -695,7 +1345,7 @@ void RenderingView::VisitBlendingNode(BlendingNode* node) {
 
     // apply original blend state
     SwitchBlending(source, destination, equation);
-    if (!blending) glDisable(GL_BLEND);
+    if (!blending) GLStateCache::Disable(GL_BLEND);
     CHECK_FOR_GL_ERROR();
 }
 
@@ -739,28 +1389,73 @@ GLenum RenderingView::ConvertBlendingEquation(BlendingNode::BlendingEquation equ
 
 void RenderingView::SwitchBlending(GLenum source, GLenum destination,
                                      GLenum equation) {
-    glBlendFunc(source, destination);
-    glBlendEquationEXT(equation);
+    GLStateCache::BlendFunc(source, destination);
+    GLStateCache::BlendEquation(equation);
     CHECK_FOR_GL_ERROR();
 }
 
-void RenderingView::RenderDebugGeometry(FacePtr f) {
-        // Render normal if enabled
-        GLboolean l = glIsEnabled(GL_LIGHTING);
-        CHECK_FOR_GL_ERROR();
-        glDisable(GL_LIGHTING);
-        CHECK_FOR_GL_ERROR();
+void RenderingView::RenderDebugGeometry(FacePtr f, bool normals) {
+        // Batched lines are drawn unlit when the batch ends, only
+        // immediate lines need the state changed per face.
+        if (!debug) {
+            GLStateCache::Push();
+            GLStateCache::Disable(GL_LIGHTING);
+            CHECK_FOR_GL_ERROR();
+        }
 
+        // Render normal if enabled
         if (renderBinormal)
             RenderBinormals(f);
         if (renderTangent)
             RenderTangents(f);
-        if (renderSoftNormal)
+        if (normals && renderSoftNormal)
             RenderNormals(f);
-        if (renderHardNormal)
+        if (normals && renderHardNormal)
             RenderHardNormal(f);
-        if (l) glEnable(GL_LIGHTING);
-        CHECK_FOR_GL_ERROR();
+
+        if (!debug) {
+            GLStateCache::Pop();
+            CHECK_FOR_GL_ERROR();
+        }
+}
+
+/**
+ * Prepare drawing the debug vectors of the bound geometry on the
+ * GPU. The caller draws the triangles again if it returns true, and
+ * then calls EndDebugVectors.
+ *
+ * @param tangents Tangent array of the geometry, may be empty.
+ * @param binormals Binormal array of the geometry, may be empty.
+ * @return True if any vectors are enabled and can be drawn.
+ */
+bool RenderingView::BeginDebugVectors(IDataBlockPtr tangents, IDataBlockPtr binormals) {
+    bool tang = renderTangent && tangents != NULL;
+    bool bino = renderBinormal && binormals != NULL;
+    if (!(renderSoftNormal || renderHardNormal || tang || bino))
+        return false;
+
+    if (normalShader == NULL) {
+        if (!NormalVisualizationShader::IsSupported()) return false;
+        normalShader = new NormalVisualizationShader();
+        normalShader->Load();
+    }
+
+    GLStateCache::Push();
+    GLStateCache::Disable(GL_LIGHTING);
+    normalShader->SetVectors(renderSoftNormal, tang, bino, renderHardNormal);
+    normalShader->SetAttributes(tangents, binormals);
+    normalShader->ApplyShader();
+    CHECK_FOR_GL_ERROR();
+    return true;
+}
+
+void RenderingView::EndDebugVectors() {
+    normalShader->ReleaseShader();
+    GLStateCache::Pop();
+    CHECK_FOR_GL_ERROR();
+
+    // The material shader was unbound, it must be applied again.
+    currentShader.reset();
 }
 
 void RenderingView::RenderNormals(FacePtr face) {
@@ -804,7 +1499,18 @@ void RenderingView::RenderTangents(FacePtr face) {
 }
 
 void RenderingView::RenderLine(Vector<3,float> vert, Vector<3,float> norm, Vector<3,float> color) {
-    arg->renderer.DrawLine(Line(vert,vert+norm),color,1);
+    if (debug) debug->AddLine(vert, vert+norm, color, 1);
+    else arg->renderer.DrawLine(Line(vert,vert+norm),color,1);
+}
+
+/**
+ * Draw the debug geometry collected so far into the bound frame
+ * buffer and keep collecting.
+ */
+void RenderingView::FlushDebugGeometry() {
+    if (!debug) return;
+    debug->End(arg->renderer.BufferSupport());
+    debug->Begin(currentModelViewMatrix);
 }
 
 } // NS OpenGL
@@ -16,6 +16,8 @@
 #include <Scene/RenderStateNode.h>
 #include <Scene/BlendingNode.h>
 #include <list>
+#include <map>
+#include <vector>
 
 namespace OpenEngine {
     // Forward declarations.
@@ -23,7 +25,9 @@ namespace OpenEngine {
         class GeometrySet;
         typedef boost::shared_ptr<GeometrySet> GeometrySetPtr;
         class Mesh;
+        typedef boost::shared_ptr<Mesh> MeshPtr;
         class Model;
+        class VertexArray;
     }
     namespace Resources {
         class IDataBlock;
@@ -31,10 +35,23 @@ namespace OpenEngine {
         typedef std::list<IDataBlockPtr > IDataBlockList;
         class Indices;
         typedef boost::shared_ptr<Indices > IndicesPtr;
+        class NormalVisualizationShader;
     }
 namespace Renderers {
 namespace OpenGL {
 
+class TextureResidencyManager;
+class TextureMipStreamer;
+class DebugDrawBatch;
+class FaceSetConverter;
+class VertexArrayBuffers;
+class PostProcessResolution;
+class DepthOnlyRenderer;
+class OcclusionCuller;
+class OcclusionBuffer;
+class MeshLOD;
+class ScenePass;
+
 using namespace OpenEngine::Renderers;
 using namespace OpenEngine::Resources;
 using namespace OpenEngine::Scene;
@@ -47,6 +64,7 @@ using namespace std;
  */
 class RenderingView 
     : public IRenderingView {    
+    friend class ScenePass;
 private:
     void RenderLine(Vector<3,float> vert,
                     Vector<3,float> norm,
@@ -64,9 +82,17 @@ public:
     void VisitRenderStateNode(RenderStateNode* node);
     void VisitRenderNode(RenderNode* node);
     void VisitDisplayListNode(DisplayListNode* node);
+    void VisitStaticBatchNode(StaticBatchNode* node);
     void VisitBlendingNode(BlendingNode* node);
     void VisitPostProcessNode(PostProcessNode* node);
     virtual void Handle(RenderingEventArg arg);
+
+    void SetDepthPrePass(bool enabled);
+    bool GetDepthPrePass();
+    void AddOccluder(MeshPtr mesh);
+    OcclusionBuffer* GetOcclusionBuffer();
+    void ForgetFaceSet(FaceSet* faces);
+    void ForgetVertexArray(Geometry::VertexArray* va);
     
 protected:
     Matrix<4, 4, float> currentModelViewMatrix;
@@ -75,10 +101,45 @@ protected:
     bool renderTexture, renderShader;
     unsigned int currentTexture;
     IShaderResourcePtr currentShader;
+    TextureResidencyManager* residency;
+    TextureMipStreamer* streamer;
+    DebugDrawBatch* debug;
+    NormalVisualizationShader* normalShader;
+    FaceSetConverter* converter;
+    VertexArrayBuffers* vertexArrays;
+    PostProcessResolution* resolution;
+    DepthOnlyRenderer* depthOnly;
+    OcclusionCuller* occlusion;
+    OcclusionBuffer* occlusionBuffer;
+    MeshLOD* lod;
+    // occluder meshes, held so their addresses are not reused, and
+    // their ids in the occlusion buffer.
+    map<Mesh*, pair<MeshPtr, unsigned int> > occluders;
+    Matrix<4, 4, float> projectionMatrix;
+    bool depthPrePass;
+    float projScale;
     IndicesPtr indexBuffer;
     GeometrySetPtr currentGeom;
+    // frame buffer writing an effect to a target and a final frame
+    // buffer, and the depth buffer of the target attached to it.
+    struct FinalTarget {
+        GLuint fbo, depth;
+    };
+    // final targets keyed by the ids of the target and the final
+    // frame buffer. Rebuilt when the render target pool has deleted
+    // frame buffers since finalStamp.
+    map<pair<GLuint, GLuint>, FinalTarget> finalTargets;
+    unsigned int finalStamp;
 
-    RenderStateNode* currentRenderState;
+    /**
+     * Combined render state as bitmasks, one bit per option in
+     * renderStateOptions.
+     */
+    struct RenderState {
+        unsigned int enabled, disabled;
+    };
+    // stack of combined render states, the root state at the bottom.
+    vector<RenderState> renderStates;
 
     void SwitchBlending(BlendingNode::BlendingFactor source, 
                         BlendingNode::BlendingFactor destination,
@@ -87,17 +148,26 @@ protected:
                                GLenum eqation);
     inline GLenum ConvertBlendingFactor(BlendingNode::BlendingFactor factor);
     inline GLenum ConvertBlendingEquation(BlendingNode::BlendingEquation equation);
-    inline void RenderDebugGeometry(FacePtr face);
+    inline void RenderDebugGeometry(FacePtr face, bool normals);
     inline void RenderBinormals(FacePtr face);
     inline void RenderTangents(FacePtr face);
     inline void RenderNormals(FacePtr face);
     inline void RenderHardNormal(FacePtr face);
+    bool BeginDebugVectors(IDataBlockPtr tangents, IDataBlockPtr binormals);
+    void EndDebugVectors();
     inline void ApplyMaterial(Geometry::MaterialPtr mat);
     void ApplyGeometrySet(GeometrySetPtr geom, IShaderResourcePtr shader);
     void ApplyGeometrySet(GeometrySetPtr geom);
     void ApplyMesh(Mesh* prim);
+    void RenderFaces(FaceSet* faces);
+    void RequestMipLevels(Mesh* prim);
+    void RenderDepthPrePass(ISceneNode* node, bool subNodes);
+    GLuint GetFinalTarget(GLuint fbo, Vector<4, GLint> viewport,
+                          PostProcessNode* node);
+    void ClearFinalTargets();
+    void FlushDebugGeometry();
     inline void ApplyModel(Model* model);
-    inline void ApplyRenderState(RenderStateNode* node);
+    inline void ApplyRenderState(const RenderState& state, unsigned int changed);
 };
 
 } // NS OpenGL
@@ -12,6 +12,7 @@
 #include <Scene/MeshNode.h>
 #include <Geometry/Mesh.h>
 #include <Scene/VertexArrayNode.h>
+#include <Scene/StaticBatchNode.h>
 #include <Geometry/FaceSet.h>
 #include <Geometry/Face.h>
 #include <Meta/OpenGL.h>
@@ -99,14 +100,31 @@ void ShaderLoader::VisitVertexArrayNode(VertexArrayNode* node) {
 }
 
 void ShaderLoader::VisitMeshNode(MeshNode* node) { 
+    LoadPhong(node->GetMesh());
+}
+
+/**
+ * The baked meshes of static batch nodes get the same shaders as
+ * mesh nodes.
+ *
+ * @param node Static batch node
+ */
+void ShaderLoader::VisitStaticBatchNode(StaticBatchNode* node) {
+    const std::vector<MeshPtr>& meshes = node->GetMeshes();
+    for (unsigned int i = 0; i < meshes.size(); ++i)
+        LoadPhong(meshes[i]);
+    node->VisitSubNodes(*this);
+}
+
+void ShaderLoader::LoadPhong(MeshPtr mesh) {
     if (!lr) return;
-    MaterialPtr m = node->GetMesh()->GetMaterial();
+    MaterialPtr m = mesh->GetMaterial();
     if (m->shad) return; //only apply phong if no shader is present
     if (m->shading == Material::PHONG || m->shading == Material::BLINN) {
         IShaderResourcePtr shad = shaders[m];
         if (!shad) {
             logger.info << "loading phong shader" << logger.end;
-            shad = IShaderResourcePtr(new PhongShader(node->GetMesh(), *lr));
+            shad = IShaderResourcePtr(new PhongShader(mesh, *lr));
             shad->Load();
             TextureList texs = shad->GetTextures();
             for (unsigned int i = 0; i < texs.size(); ++i)
@@ -17,6 +17,7 @@
 #include <Scene/ISceneNode.h>
 #include <Scene/ISceneNodeVisitor.h>
 #include <Geometry/Material.h>
+#include <Geometry/Mesh.h>
 #include <Resources/IShaderResource.h>
 
 #include <map>
@@ -28,8 +29,10 @@ namespace OpenGL {
 using OpenEngine::Scene::GeometryNode;
 using OpenEngine::Scene::MeshNode;
 using OpenEngine::Scene::VertexArrayNode;
+using OpenEngine::Scene::StaticBatchNode;
 using OpenEngine::Scene::ISceneNodeVisitor;
 using Geometry::MaterialPtr;
+using Geometry::MeshPtr;
 using Resources::IShaderResourcePtr;
 using Renderers::OpenGL::LightRenderer;
 
@@ -44,6 +47,8 @@ private:
     Scene::ISceneNode& scene;
     LightRenderer* lr;
     std::map<MaterialPtr,IShaderResourcePtr> shaders;
+
+    void LoadPhong(MeshPtr mesh);
 public:
     ShaderLoader(TextureLoader& textureLoader, Scene::ISceneNode& scene);
     ~ShaderLoader();
@@ -52,6 +57,7 @@ public:
     void VisitGeometryNode(GeometryNode* node);
     void VisitVertexArrayNode(VertexArrayNode* node);
     void VisitMeshNode(MeshNode* node);
+    void VisitStaticBatchNode(StaticBatchNode* node);
     void SetLightRenderer(LightRenderer* lr);
 };
 
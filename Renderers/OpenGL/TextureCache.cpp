@@ -0,0 +1,411 @@
+// OpenGL compressed texture cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/TextureCache.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/DXTCompressor.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Resources/ResourceManager.h>
+#include <Resources/DirectoryManager.h>
+#include <Logging/Logger.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+using std::string;
+
+static const char MAGIC[4] = {'O', 'E', 'T', 'C'};
+static const unsigned int HEADER_FIELDS = 8;
+static const unsigned int LEVEL_FIELDS = 4;
+
+/**
+ * Read only memory mapping of a file.
+ */
+class MappedFile {
+public:
+    const unsigned char* data;
+    unsigned int size;
+
+    MappedFile(const string& path) : data(NULL), size(0) {
+#ifdef _WIN32
+        mapping = NULL;
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+        size = GetFileSize(file, NULL);
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return;
+        data = (const unsigned char*)p;
+        size = st.st_size;
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap((void*)data, size);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+};
+
+/**
+ * Get the size and modification time of a file.
+ *
+ * @return True if the file exists.
+ */
+static bool StatFile(const string& path, unsigned int& time, unsigned int& size) {
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0) return false;
+    time = (unsigned int)st.st_mtime;
+    size = (unsigned int)st.st_size;
+    return true;
+}
+
+/**
+ * Write a file under a temporary name and rename it into place, so
+ * a crash or a concurrent writer never leaves a truncated file at
+ * the path.
+ *
+ * @return True if the file was written.
+ */
+static bool WriteFile(const string& path,
+                      const std::vector<unsigned int>& header,
+                      const std::vector<std::vector<unsigned char> >& blocks) {
+    std::ostringstream tmp;
+#ifdef _WIN32
+    tmp << path << ".tmp" << GetCurrentProcessId();
+#else
+    tmp << path << ".tmp" << getpid();
+#endif
+    FILE* out = fopen(tmp.str().c_str(), "wb");
+    if (out == NULL) return false;
+    bool ok = fwrite(&header[0], sizeof(unsigned int), header.size(), out)
+        == header.size();
+    for (unsigned int i = 0; ok && i < blocks.size(); ++i)
+        ok = fwrite(&blocks[i][0], 1, blocks[i].size(), out) == blocks[i].size();
+    ok = fclose(out) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp.str().c_str(), path.c_str(),
+                           MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = ok && rename(tmp.str().c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) remove(tmp.str().c_str());
+    return ok;
+}
+
+TextureCache::TextureCache(TextureResidencyManager& residency)
+    : residency(residency)
+    , hits(0)
+    , misses(0) {}
+
+TextureCache::~TextureCache() {}
+
+/**
+ * Create a texture resource whose uploads go through the cache.
+ *
+ * @param file Texture file, looked up in the resource path.
+ * @return The texture resource.
+ */
+ITexture2DPtr TextureCache::Load(const string& file) {
+    ITexture2DPtr tex = ResourceManager<ITexture2D>::Create(file);
+    Register(tex, file);
+    return tex;
+}
+
+/**
+ * Let the uploads of an existing texture go through the cache.
+ *
+ * @param tex Texture resource.
+ * @param file The file the texture is loaded from.
+ */
+void TextureCache::Register(ITexture2DPtr tex, const string& file) {
+    if (tex == NULL) return;
+    Source& s = sources[tex.get()];
+    s.tex = tex;
+    s.file = file;
+}
+
+/**
+ * Check if a texture is uploaded through the cache.
+ */
+bool TextureCache::Contains(const ITexture2D* tex) {
+    std::map<const ITexture2D*, Source>::iterator itr = sources.find(tex);
+    if (itr == sources.end()) return false;
+    if (itr->second.tex.expired()) {
+        sources.erase(itr);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Upload a texture from its cache file, building the file first if
+ * it is missing or out of date. Requires S3TC support.
+ *
+ * @param tex Registered texture without an id.
+ * @return True if the texture was uploaded, false if the renderer
+ * should upload it the usual way.
+ */
+bool TextureCache::Upload(ITexture2DPtr tex) {
+    if (!Contains(tex.get()) || tex->GetID() != 0) return false;
+    const string& file = sources[tex.get()].file;
+    const string source = DirectoryManager::FindFileInPath(file);
+    const string path = CachePath(source.empty() ? file : source);
+
+    unsigned int srcTime = 0, srcSize = 0, bytes = 0;
+    bool hasSource = StatFile(source, srcTime, srcSize);
+    if (UploadFile(tex.get(), path, srcTime, srcSize, hasSource, bytes))
+        ++hits;
+    else {
+        ++misses;
+        if (!Build(tex.get(), path, srcTime, srcSize, bytes)) return false;
+    }
+    // Count the compressed levels like any other upload.
+    residency.Register(tex);
+    residency.SetResident(tex.get(), bytes);
+    return true;
+}
+
+/**
+ * Get the cache file of a source file.
+ */
+string TextureCache::CachePath(const string& file) {
+    if (directory.empty()) return file + ".oetc";
+    string name = file;
+    for (unsigned int i = 0; i < name.size(); ++i)
+        if (name[i] == '/' || name[i] == '\\' || name[i] == ':')
+            name[i] = '_';
+    return directory + "/" + name + ".oetc";
+}
+
+/**
+ * Upload the levels of a cache file if it is valid. The checks are
+ * done by subtraction, so corrupt counts and offsets cannot wrap
+ * around. Invalid files are rebuilt by the caller.
+ */
+bool TextureCache::UploadFile(ITexture2D* tex, const string& path,
+                              unsigned int srcTime, unsigned int srcSize,
+                              bool checkSource, unsigned int& bytes) {
+    MappedFile f(path);
+    const unsigned int headerSize = HEADER_FIELDS * sizeof(unsigned int);
+    if (f.data == NULL || f.size < headerSize) return false;
+    if (memcmp(f.data, MAGIC, 4) != 0) return false;
+
+    const unsigned int* h = (const unsigned int*)f.data;
+    if (h[1] != VERSION) return false;
+    if (checkSource && (h[2] != srcTime || h[3] != srcSize)) return false;
+    const GLenum internal = h[6];
+    const unsigned int count = h[7];
+    if (count == 0 ||
+        count > (f.size - headerSize) / (LEVEL_FIELDS * sizeof(unsigned int)))
+        return false;
+    const unsigned int* levels = h + HEADER_FIELDS;
+    for (unsigned int i = 0; i < count; ++i) {
+        const unsigned int* l = levels + i * LEVEL_FIELDS;
+        if (l[2] > f.size || l[3] > f.size - l[2]) return false;
+    }
+
+    const unsigned int upload = tex->UseMipmapping() ? count : 1;
+    GLuint id;
+    glGenTextures(1, &id);
+    tex->SetID(id);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, id);
+    SetupParameters(tex, upload);
+    bytes = 0;
+    for (unsigned int i = 0; i < upload; ++i) {
+        const unsigned int* l = levels + i * LEVEL_FIELDS;
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, internal, l[0], l[1], 0,
+                               l[3], f.data + l[2]);
+        bytes += l[3];
+    }
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+    return true;
+}
+
+/**
+ * Compress and mipmap the texture on the cpu, upload it and write
+ * the levels to the cache file.
+ */
+bool TextureCache::Build(ITexture2D* tex, const string& path,
+                         unsigned int srcTime, unsigned int srcSize,
+                         unsigned int& bytes) {
+    bool loaded = tex->GetVoidDataPtr() != NULL;
+    if (!loaded) tex->Load();
+
+    bool bgr = false;
+    switch (tex->GetColorFormat()) {
+    case BGR:
+    case BGRA:
+        bgr = true;
+    case RGB:
+    case RGBA:
+        break;
+    default:
+        if (!loaded) tex->Unload();
+        return false;
+    }
+    const unsigned int channels = tex->GetChannels();
+    if (tex->GetVoidDataPtr() == NULL || tex->GetType() != Types::UBYTE ||
+        tex->GetChannelSize() != 8 || (channels != 3 && channels != 4)) {
+        if (!loaded) tex->Unload();
+        return false;
+    }
+    const GLenum internal = channels == 4
+        ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+    // Compress the chain, halving the image for each level.
+    std::vector<unsigned int> header(HEADER_FIELDS);
+    std::vector<std::vector<unsigned char> > blocks;
+    unsigned int w = tex->GetWidth(), h = tex->GetHeight();
+    std::vector<unsigned char> image((const unsigned char*)tex->GetVoidDataPtr(),
+                                     (const unsigned char*)tex->GetVoidDataPtr()
+                                     + w * h * channels);
+    if (!loaded) tex->Unload();
+    for (;;) {
+        blocks.push_back(std::vector<unsigned char>
+                         (DXTCompressor::CompressedSize(w, h, channels)));
+        DXTCompressor::Compress(&image[0], w, h, channels, bgr,
+                                &blocks.back()[0]);
+        header.push_back(w);
+        header.push_back(h);
+        header.push_back(0);
+        header.push_back(blocks.back().size());
+        if (w == 1 && h == 1) break;
+        std::vector<unsigned char> next((w > 1 ? w / 2 : 1) *
+                                        (h > 1 ? h / 2 : 1) * channels);
+        DXTCompressor::Downsample(&image[0], w, h, channels, &next[0]);
+        image.swap(next);
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+
+    const unsigned int count = blocks.size();
+    const unsigned int upload = tex->UseMipmapping() ? count : 1;
+    GLuint id;
+    glGenTextures(1, &id);
+    tex->SetID(id);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, id);
+    SetupParameters(tex, upload);
+    bytes = 0;
+    for (unsigned int i = 0; i < upload; ++i) {
+        const unsigned int* l = &header[HEADER_FIELDS + i * LEVEL_FIELDS];
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, internal, l[0], l[1], 0,
+                               l[3], &blocks[i][0]);
+        bytes += l[3];
+    }
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+
+    memcpy(&header[0], MAGIC, 4);
+    header[1] = VERSION;
+    header[2] = srcTime;
+    header[3] = srcSize;
+    header[4] = header[HEADER_FIELDS];
+    header[5] = header[HEADER_FIELDS + 1];
+    header[6] = internal;
+    header[7] = count;
+    unsigned int offset = header.size() * sizeof(unsigned int);
+    for (unsigned int i = 0; i < count; ++i) {
+        header[HEADER_FIELDS + i * LEVEL_FIELDS + 2] = offset;
+        offset += blocks[i].size();
+    }
+
+    if (!WriteFile(path, header, blocks))
+        logger.warning << "TextureCache: could not write " << path << logger.end;
+    return true;
+}
+
+/**
+ * Set the sampling parameters of the bound texture.
+ */
+void TextureCache::SetupParameters(ITexture2D* tex, unsigned int levels) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, tex->GetWrapping());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tex->GetWrapping());
+    if (tex->UseMipmapping())
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, tex->GetFiltering());
+    else if (tex->GetFiltering() == NONE)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if (tex->GetFiltering() == NONE)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Set the directory cache files are written to. If empty the files
+ * are written next to their source.
+ */
+void TextureCache::SetDirectory(const string& dir) {
+    directory = dir;
+}
+
+string TextureCache::GetDirectory() {
+    return directory;
+}
+
+/**
+ * Get the number of textures uploaded from valid cache files.
+ */
+unsigned int TextureCache::GetHits() {
+    return hits;
+}
+
+/**
+ * Get the number of textures whose cache file had to be built.
+ */
+unsigned int TextureCache::GetMisses() {
+    return misses;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
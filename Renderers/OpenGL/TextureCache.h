@@ -0,0 +1,99 @@
+// OpenGL compressed texture cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_CACHE_H_
+#define _OPENGL_TEXTURE_CACHE_H_
+
+#include <Meta/OpenGL.h>
+#include <Resources/ITexture2D.h>
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <string>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+class TextureResidencyManager;
+
+using Resources::ITexture2D;
+using Resources::ITexture2DPtr;
+
+/**
+ * Cache of precompressed, premipmapped textures.
+ *
+ * Textures loaded through the cache are stored in a cache file the
+ * first time they are uploaded: a header followed by the DXT1 (RGB)
+ * or DXT5 (RGBA) blocks of every mipmap level, compressed on the cpu
+ * by DXTCompressor. Later uploads map the cache file into memory and
+ * pass each level directly to glCompressedTexImage2D, skipping both
+ * decoding and driver side compression. A cache file is rebuilt when
+ * the size or modification time of its source changes, or when it
+ * is corrupt. If the source is missing the cache file is used as is,
+ * so precompressed files can be shipped on their own.
+ *
+ * Cache files are written next to their source unless a cache
+ * directory is set. They are written under a temporary name and
+ * renamed into place, so an interrupted or concurrent build never
+ * leaves a truncated cache file behind.
+ *
+ * File layout, all fields are 32 bit unsigned integers in host byte
+ * order:
+ * @code
+ * magic "OETC", version, source time, source size,
+ * width, height, internal format, level count,
+ * level count x { width, height, offset, size },
+ * block data
+ * @endcode
+ *
+ * @class TextureCache TextureCache.h Renderers/OpenGL/TextureCache.h
+ */
+class TextureCache {
+private:
+    struct Source {
+        boost::weak_ptr<ITexture2D> tex;
+        std::string file;
+    };
+
+    TextureResidencyManager& residency;
+    std::map<const ITexture2D*, Source> sources;
+    std::string directory;
+    unsigned int hits, misses;
+
+    std::string CachePath(const std::string& file);
+    bool UploadFile(ITexture2D* tex, const std::string& path,
+                    unsigned int srcTime, unsigned int srcSize,
+                    bool checkSource, unsigned int& bytes);
+    bool Build(ITexture2D* tex, const std::string& path,
+               unsigned int srcTime, unsigned int srcSize,
+               unsigned int& bytes);
+    void SetupParameters(ITexture2D* tex, unsigned int levels);
+
+public:
+    static const unsigned int VERSION = 1;
+
+    TextureCache(TextureResidencyManager& residency);
+    ~TextureCache();
+
+    ITexture2DPtr Load(const std::string& file);
+    void Register(ITexture2DPtr tex, const std::string& file);
+    bool Contains(const ITexture2D* tex);
+    bool Upload(ITexture2DPtr tex);
+
+    void SetDirectory(const std::string& dir);
+    std::string GetDirectory();
+    unsigned int GetHits();
+    unsigned int GetMisses();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_TEXTURE_CACHE_H_
@@ -0,0 +1,360 @@
+// OpenGL mipmap level streamer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/TextureMipStreamer.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Renderers/OpenGL/DXTCompressor.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+
+TextureMipStreamer::TextureMipStreamer(TextureResidencyManager& residency)
+    : residency(residency)
+    , threshold(0)
+    , coarseSize(64)
+    , frameBudget(1024 * 1024)
+    , linger(60)
+    , frame(0)
+    , resident(0) {}
+
+/**
+ * The gl textures are owned by the texture resources and are not
+ * deleted here.
+ */
+TextureMipStreamer::~TextureMipStreamer() {}
+
+/**
+ * Check if a texture may be streamed before its image is loaded.
+ * Textures whose size is not known yet may be.
+ *
+ * @param tex Texture without an id.
+ * @return False if the texture is never streamed.
+ */
+bool TextureMipStreamer::MayAccept(ITexture2D* tex) {
+    if (threshold == 0 || tex == NULL) return false;
+    if (!tex->UseMipmapping() || tex->UseCompression()) return false;
+    unsigned int size = tex->GetWidth() > tex->GetHeight()
+        ? tex->GetWidth() : tex->GetHeight();
+    return size == 0 || size >= threshold;
+}
+
+/**
+ * Check if a loaded texture should be streamed.
+ *
+ * @param tex Texture with its image in client memory.
+ * @return True if the texture is eligible for streaming.
+ */
+bool TextureMipStreamer::Accepts(ITexture2D* tex) {
+    if (!MayAccept(tex) || tex->GetVoidDataPtr() == NULL) return false;
+    unsigned int size = tex->GetWidth() > tex->GetHeight()
+        ? tex->GetWidth() : tex->GetHeight();
+    if (size < threshold) return false;
+    if (tex->GetType() != Types::UBYTE || tex->GetChannelSize() != 8)
+        return false;
+
+    switch (tex->GetColorFormat()) {
+    case ALPHA:
+    case LUMINANCE:
+    case LUMINANCE_ALPHA:
+    case RGB:
+    case BGR:
+    case RGBA:
+    case BGRA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Start streaming a texture. The texture is given an id, unless it
+ * has a placeholder already, and its coarse levels are uploaded
+ * right away.
+ *
+ * @param tex Loaded texture accepted by Accepts.
+ * @param internalFormat Internal gl format of the texture.
+ * @param format Gl format of the texture data.
+ */
+void TextureMipStreamer::Add(ITexture2DPtr tex,
+                             GLint internalFormat,
+                             GLenum format) {
+    Stream& s = streams[tex.get()];
+    s.tex = tex;
+    s.internalFormat = internalFormat;
+    s.format = format;
+    s.channels = tex->GetChannels();
+    BuildChain(s, tex.get());
+
+    if (tex->GetID() == 0) {
+        glGenTextures(1, &s.id);
+        tex->SetID(s.id);
+    } else s.id = tex->GetID();
+    TextureUnitCache::Bind(GL_TEXTURE_2D, s.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, tex->GetWrapping());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tex->GetWrapping());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, tex->GetFiltering());
+    if (tex->GetFiltering() == NONE)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    else
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, s.levels.size() - 1);
+    CHECK_FOR_GL_ERROR();
+
+    // Upload from the smallest level up to the coarse level.
+    s.top = s.levels.size();
+    unsigned int coarse = CoarseLevel(s);
+    while (s.top > coarse)
+        UploadLevel(s, --s.top);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, s.top);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+
+    // The coarse levels are never released, so only the finer
+    // levels are kept on the cpu.
+    for (unsigned int l = coarse; l < s.levels.size(); ++l)
+        std::vector<unsigned char>().swap(s.levels[l]);
+
+    s.wanted = s.top;
+    s.requested = frame;
+    residency.Register(tex.get());
+    residency.SetResident(tex.get(), ResidentSize(s));
+}
+
+/**
+ * Upload all levels of a streamed texture and stop streaming it.
+ * Used when the full image is needed, eg. before a sub image update.
+ *
+ * @param tex Texture to finish.
+ */
+void TextureMipStreamer::Finish(ITexture2D* tex) {
+    std::map<const ITexture2D*, Stream>::iterator itr = streams.find(tex);
+    if (itr == streams.end()) return;
+    Stream& s = itr->second;
+    TextureUnitCache::Bind(GL_TEXTURE_2D, s.id);
+    while (s.top > 0)
+        UploadLevel(s, --s.top);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+    Complete(itr);
+}
+
+/**
+ * Stop streaming a texture with all its levels resident, freeing
+ * the levels on the cpu. The full texture is handled by the
+ * residency manager from now.
+ */
+void TextureMipStreamer::Complete(std::map<const ITexture2D*, Stream>::iterator itr) {
+    Stream& s = itr->second;
+    for (unsigned int l = 0; l < s.levels.size(); ++l)
+        resident -= LevelSize(s, l);
+    ITexture2DPtr ptr = s.tex.lock();
+    residency.Unregister(itr->first);
+    if (ptr) residency.Register(ptr);
+    streams.erase(itr);
+}
+
+bool TextureMipStreamer::IsStreamed(const ITexture2D* tex) {
+    return streams.find(tex) != streams.end();
+}
+
+bool TextureMipStreamer::HasStreams() {
+    return !streams.empty();
+}
+
+/**
+ * Request the level of a texture needed to cover a number of
+ * pixels on screen. The finest level requested in a frame wins.
+ *
+ * @param tex Texture about to be used.
+ * @param pixels Projected size of the geometry using it.
+ */
+void TextureMipStreamer::Request(const ITexture2D* tex, float pixels) {
+    std::map<const ITexture2D*, Stream>::iterator itr = streams.find(tex);
+    if (itr == streams.end()) return;
+    Stream& s = itr->second;
+
+    unsigned int level = 0;
+    float size = s.widths[0] > s.heights[0] ? s.widths[0] : s.heights[0];
+    while (level + 1 < s.levels.size() && size * 0.5f >= pixels) {
+        size *= 0.5f;
+        ++level;
+    }
+    if (s.requested != frame || level < s.wanted)
+        s.wanted = level;
+    s.requested = frame;
+}
+
+/**
+ * Move every streamed texture one level towards its requested
+ * level. Finer levels are uploaded within the per frame budget,
+ * levels no longer needed are released. Textures that have not been
+ * requested for a while fall back to their coarse level.
+ */
+void TextureMipStreamer::Update() {
+    unsigned int spent = 0;
+    std::map<const ITexture2D*, Stream>::iterator itr = streams.begin();
+    while (itr != streams.end()) {
+        Stream& s = itr->second;
+        if (s.tex.expired()) {
+            glDeleteTextures(1, &s.id);
+            TextureUnitCache::Forget(s.id);
+            for (unsigned int l = s.top; l < s.levels.size(); ++l)
+                resident -= LevelSize(s, l);
+            residency.Unregister(itr->first);
+            streams.erase(itr++);
+            continue;
+        }
+
+        unsigned int target = s.requested + linger >= frame
+            ? s.wanted : CoarseLevel(s);
+        if (target < s.top) {
+            unsigned int size = LevelSize(s, s.top - 1);
+            if (spent == 0 || spent + size <= frameBudget) {
+                TextureUnitCache::Bind(GL_TEXTURE_2D, s.id);
+                UploadLevel(s, --s.top);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, s.top);
+                spent += size;
+                if (s.top == 0) {
+                    Complete(itr++);
+                    continue;
+                }
+                residency.SetResident(itr->first, ResidentSize(s));
+            }
+        } else if (target > s.top + 1) {
+            // Keep one extra level to avoid thrashing at the boundary.
+            TextureUnitCache::Bind(GL_TEXTURE_2D, s.id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, s.top + 1);
+            ReleaseLevel(s, s.top++);
+            residency.SetResident(itr->first, ResidentSize(s));
+        }
+        ++itr;
+    }
+    TextureUnitCache::Bind(GL_TEXTURE_2D, 0);
+    CHECK_FOR_GL_ERROR();
+    ++frame;
+}
+
+/**
+ * Copy the texture image and build its mipmap chain with a box
+ * filter.
+ */
+void TextureMipStreamer::BuildChain(Stream& s, ITexture2D* tex) {
+    const unsigned int c = s.channels;
+    unsigned int w = tex->GetWidth(), h = tex->GetHeight();
+    const unsigned char* data = (const unsigned char*)tex->GetVoidDataPtr();
+
+    s.widths.clear();
+    s.heights.clear();
+    s.levels.clear();
+    s.widths.push_back(w);
+    s.heights.push_back(h);
+    s.levels.push_back(std::vector<unsigned char>(data, data + w * h * c));
+
+    while (w > 1 || h > 1) {
+        const unsigned int nw = w > 1 ? w / 2 : 1;
+        const unsigned int nh = h > 1 ? h / 2 : 1;
+        std::vector<unsigned char> dst(nw * nh * c);
+        DXTCompressor::Downsample(&s.levels.back()[0], w, h, c, &dst[0]);
+        w = nw;
+        h = nh;
+        s.widths.push_back(w);
+        s.heights.push_back(h);
+        s.levels.push_back(dst);
+    }
+}
+
+/**
+ * Upload a level of the bound texture.
+ */
+void TextureMipStreamer::UploadLevel(Stream& s, unsigned int level) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, level, s.internalFormat,
+                 s.widths[level], s.heights[level], 0,
+                 s.format, GL_UNSIGNED_BYTE, &s.levels[level][0]);
+    CHECK_FOR_GL_ERROR();
+    resident += LevelSize(s, level);
+}
+
+/**
+ * Free the storage of a level of the bound texture.
+ */
+void TextureMipStreamer::ReleaseLevel(Stream& s, unsigned int level) {
+    glTexImage2D(GL_TEXTURE_2D, level, s.internalFormat, 0, 0, 0,
+                 s.format, GL_UNSIGNED_BYTE, NULL);
+    CHECK_FOR_GL_ERROR();
+    resident -= LevelSize(s, level);
+}
+
+/**
+ * Get the size of a level in bytes.
+ */
+unsigned int TextureMipStreamer::LevelSize(const Stream& s, unsigned int level) {
+    return s.widths[level] * s.heights[level] * s.channels;
+}
+
+/**
+ * Get the size of the resident levels in bytes.
+ */
+unsigned int TextureMipStreamer::ResidentSize(const Stream& s) {
+    unsigned int size = 0;
+    for (unsigned int l = s.top; l < s.levels.size(); ++l)
+        size += LevelSize(s, l);
+    return size;
+}
+
+/**
+ * Get the finest level that is always resident.
+ */
+unsigned int TextureMipStreamer::CoarseLevel(const Stream& s) {
+    unsigned int level = 0;
+    while (level + 1 < s.levels.size() &&
+           (s.widths[level] > coarseSize || s.heights[level] > coarseSize))
+        ++level;
+    return level;
+}
+
+/**
+ * Set the size from which textures are streamed. Must be set before
+ * the textures are loaded.
+ *
+ * @param size Minimum width or height, zero disables streaming.
+ */
+void TextureMipStreamer::SetThreshold(unsigned int size) {
+    threshold = size;
+}
+
+unsigned int TextureMipStreamer::GetThreshold() {
+    return threshold;
+}
+
+/**
+ * Set the number of bytes that may be uploaded per frame. At least
+ * one level is uploaded per frame regardless of the budget.
+ */
+void TextureMipStreamer::SetFrameBudget(unsigned int bytes) {
+    frameBudget = bytes;
+}
+
+/**
+ * Get the size of the levels currently resident on the gpu.
+ *
+ * @return Size in bytes.
+ */
+unsigned int TextureMipStreamer::GetResidentBytes() {
+    return resident;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
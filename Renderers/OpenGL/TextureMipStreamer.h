@@ -0,0 +1,109 @@
+// OpenGL mipmap level streamer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_MIP_STREAMER_H_
+#define _OPENGL_TEXTURE_MIP_STREAMER_H_
+
+#include <Meta/OpenGL.h>
+#include <Resources/ITexture2D.h>
+#include <boost/weak_ptr.hpp>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+class TextureResidencyManager;
+
+using Resources::ITexture2D;
+using Resources::ITexture2DPtr;
+
+/**
+ * Streams the mipmap levels of large 2D textures to the gpu.
+ *
+ * The mipmap chain of a streamed texture is built once on the cpu.
+ * Only the coarse levels are uploaded when the texture is loaded,
+ * finer levels follow one at a time from the smallest upward. The
+ * rendering view requests a level for each texture based on the
+ * projected size of the meshes using it, and levels that are no
+ * longer needed are released again. The resident range is selected
+ * with GL_TEXTURE_BASE_LEVEL. The coarse levels always stay resident,
+ * so only the finer levels are kept on the cpu. Once the finest level
+ * is resident the texture is no longer streamed and its levels are
+ * freed on the cpu.
+ *
+ * The resident levels are counted by the texture residency manager,
+ * which does not evict streamed textures itself.
+ *
+ * Only mipmapped, uncompressed textures with byte channels at least
+ * as large as the threshold are streamed. Whether a texture is
+ * streamed is decided once its image is loaded, by the texture
+ * uploader if it is enabled, so the rendering thread does not load
+ * the image itself.
+ *
+ * @class TextureMipStreamer TextureMipStreamer.h Renderers/OpenGL/TextureMipStreamer.h
+ */
+class TextureMipStreamer {
+private:
+    struct Stream {
+        boost::weak_ptr<ITexture2D> tex;
+        GLuint id;
+        GLint internalFormat;
+        GLenum format;
+        unsigned int channels;
+        std::vector<unsigned int> widths, heights;
+        std::vector<std::vector<unsigned char> > levels;
+        unsigned int top;
+        unsigned int wanted;
+        unsigned int requested;
+    };
+
+    TextureResidencyManager& residency;
+    std::map<const ITexture2D*, Stream> streams;
+    unsigned int threshold;
+    unsigned int coarseSize;
+    unsigned int frameBudget;
+    unsigned int linger;
+    unsigned int frame;
+    unsigned int resident;
+
+    void BuildChain(Stream& s, ITexture2D* tex);
+    void UploadLevel(Stream& s, unsigned int level);
+    void ReleaseLevel(Stream& s, unsigned int level);
+    unsigned int LevelSize(const Stream& s, unsigned int level);
+    unsigned int ResidentSize(const Stream& s);
+    unsigned int CoarseLevel(const Stream& s);
+    void Complete(std::map<const ITexture2D*, Stream>::iterator itr);
+
+public:
+    TextureMipStreamer(TextureResidencyManager& residency);
+    ~TextureMipStreamer();
+
+    bool MayAccept(ITexture2D* tex);
+    bool Accepts(ITexture2D* tex);
+    void Add(ITexture2DPtr tex, GLint internalFormat, GLenum format);
+    void Finish(ITexture2D* tex);
+    bool IsStreamed(const ITexture2D* tex);
+    bool HasStreams();
+
+    void Request(const ITexture2D* tex, float pixels);
+    void Update();
+
+    void SetThreshold(unsigned int size);
+    unsigned int GetThreshold();
+    void SetFrameBudget(unsigned int bytes);
+    unsigned int GetResidentBytes();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_TEXTURE_MIP_STREAMER_H_
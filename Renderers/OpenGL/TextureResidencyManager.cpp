@@ -0,0 +1,327 @@
+// OpenGL texture residency manager.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/Renderer.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using namespace Resources;
+
+/**
+ * Sort entries so the least recently used comes first.
+ */
+struct LeastRecentlyUsed {
+    template <class T>
+    bool operator()(const T* a, const T* b) const {
+        return a->lastUsed < b->lastUsed;
+    }
+};
+
+TextureResidencyManager::TextureResidencyManager(Renderer& renderer)
+    : renderer(renderer)
+    , budget(0)
+    , usage(0)
+    , frame(0)
+    , warned(false) {}
+
+TextureResidencyManager::~TextureResidencyManager() {}
+
+/**
+ * Register a loaded texture. Registering a texture again updates
+ * its size, eg. after it has been reloaded.
+ *
+ * @param tex Texture with a valid id.
+ */
+void TextureResidencyManager::Register(ITexture2DPtr tex) {
+    if (tex == NULL || tex->GetID() == 0) return;
+    std::map<const void*, Entry>::iterator itr = entries.find(tex.get());
+    if (itr != entries.end()) usage -= itr->second.resident;
+    Entry& e = entries[tex.get()];
+    e.tex = tex;
+    e.id = tex->GetID();
+    e.width = tex->GetWidth();
+    e.height = tex->GetHeight();
+    e.depth = 1;
+    e.format = tex->GetColorFormat();
+    e.mipmapped = tex->UseMipmapping();
+    e.size = EstimateSize(e.width, e.height, 1, e.format, e.mipmapped);
+    e.resident = e.size;
+    e.lastUsed = frame;
+    e.pinned = false;
+    e.evicted = false;
+    usage += e.resident;
+}
+
+/**
+ * Register a texture that may not be evicted.
+ *
+ * @param tex Texture with a valid id.
+ */
+void TextureResidencyManager::Register(ITexture2D* tex) {
+    if (tex == NULL || tex->GetID() == 0) return;
+    if (entries.find(tex) != entries.end()) return;
+    Entry& e = entries[tex];
+    e.id = tex->GetID();
+    e.width = tex->GetWidth();
+    e.height = tex->GetHeight();
+    e.depth = 1;
+    e.format = tex->GetColorFormat();
+    e.mipmapped = tex->UseMipmapping();
+    e.size = EstimateSize(e.width, e.height, 1, e.format, e.mipmapped);
+    e.resident = e.size;
+    e.lastUsed = frame;
+    e.pinned = true;
+    e.evicted = false;
+    usage += e.resident;
+}
+
+/**
+ * Register a 3D texture or texture array. These are never evicted.
+ *
+ * @param tex Texture with a valid id.
+ */
+void TextureResidencyManager::Register(ITexture3D* tex) {
+    if (tex == NULL || tex->GetID() == 0) return;
+    if (entries.find(tex) != entries.end()) return;
+    Entry& e = entries[tex];
+    e.id = tex->GetID();
+    e.width = tex->GetWidth();
+    e.height = tex->GetHeight();
+    e.depth = tex->GetDepth();
+    e.format = tex->GetColorFormat();
+    e.mipmapped = tex->UseMipmapping();
+    e.size = EstimateSize(e.width, e.height, e.depth, e.format, e.mipmapped);
+    e.resident = e.size;
+    e.lastUsed = frame;
+    e.pinned = true;
+    e.evicted = false;
+    usage += e.resident;
+}
+
+/**
+ * Stop tracking a texture.
+ */
+void TextureResidencyManager::Unregister(const void* tex) {
+    std::map<const void*, Entry>::iterator itr = entries.find(tex);
+    if (itr == entries.end()) return;
+    usage -= itr->second.resident;
+    entries.erase(itr);
+}
+
+/**
+ * Set the memory used by a texture whose resident levels are
+ * managed elsewhere, eg. by the mipmap streamer.
+ *
+ * @param tex Registered texture.
+ * @param bytes Size of the resident levels.
+ */
+void TextureResidencyManager::SetResident(const void* tex, unsigned int bytes) {
+    std::map<const void*, Entry>::iterator itr = entries.find(tex);
+    if (itr == entries.end()) return;
+    usage -= itr->second.resident;
+    itr->second.resident = bytes;
+    usage += bytes;
+}
+
+/**
+ * Mark a texture as used in the current frame, reloading it if it
+ * has been evicted.
+ *
+ * @param tex Texture about to be bound.
+ */
+void TextureResidencyManager::Touch(ITexture2DPtr tex) {
+    std::map<const void*, Entry>::iterator itr = entries.find(tex.get());
+    if (itr == entries.end()) return;
+    Entry& e = itr->second;
+    e.lastUsed = frame;
+    if (e.evicted)
+        Restore(e, tex);
+}
+
+/**
+ * Mark a texture as used in the current frame.
+ *
+ * @param tex Texture about to be bound.
+ */
+void TextureResidencyManager::Touch(const void* tex) {
+    std::map<const void*, Entry>::iterator itr = entries.find(tex);
+    if (itr == entries.end()) return;
+    itr->second.lastUsed = frame;
+}
+
+/**
+ * Start a new frame.
+ */
+void TextureResidencyManager::NewFrame() {
+    ++frame;
+}
+
+/**
+ * Forget textures that no longer exist and bring the usage below
+ * the budget. Textures used in the current frame are left alone.
+ */
+void TextureResidencyManager::Update() {
+    std::vector<Entry*> candidates;
+    std::map<const void*, Entry>::iterator itr = entries.begin();
+    while (itr != entries.end()) {
+        Entry& e = itr->second;
+        if (!e.pinned && e.tex.expired()) {
+            // The resource is gone, release its gl texture.
+            glDeleteTextures(1, &e.id);
+            TextureUnitCache::Forget(e.id);
+            usage -= e.resident;
+            entries.erase(itr++);
+            continue;
+        }
+        if (!e.pinned && !e.evicted && e.lastUsed < frame)
+            candidates.push_back(&e);
+        ++itr;
+    }
+
+    if (budget == 0 || usage <= budget) return;
+
+    std::sort(candidates.begin(), candidates.end(), LeastRecentlyUsed());
+    std::vector<Entry*>::iterator c = candidates.begin();
+    for (; c != candidates.end() && usage > budget; ++c)
+        Evict(**c);
+    CHECK_FOR_GL_ERROR();
+
+    if (usage > budget && !warned) {
+        logger.warning << "Textures in use exceed the texture budget: "
+                       << usage << " > " << budget << " bytes"
+                       << logger.end;
+        warned = true;
+    }
+}
+
+/**
+ * Replace the texture image with a placeholder, keeping its id so
+ * materials and shaders holding it stay valid.
+ */
+void TextureResidencyManager::Evict(Entry& e) {
+    ITexture2DPtr tex = e.tex.lock();
+    if (tex) renderer.UploadPlaceholder(tex.get());
+    usage -= e.resident;
+    e.resident = 0;
+    e.evicted = true;
+}
+
+/**
+ * Upload the image of an evicted texture again. The renderer
+ * registers the texture anew once it is resident.
+ */
+void TextureResidencyManager::Restore(Entry& e, ITexture2DPtr tex) {
+    e.evicted = false;
+    renderer.ReloadTexture(tex);
+}
+
+/**
+ * Set the texture memory budget.
+ *
+ * @param bytes Budget in bytes, zero disables eviction.
+ */
+void TextureResidencyManager::SetBudget(unsigned int bytes) {
+    budget = bytes;
+    warned = false;
+}
+
+unsigned int TextureResidencyManager::GetBudget() {
+    return budget;
+}
+
+/**
+ * Get the estimated memory used by all tracked textures.
+ *
+ * @return Usage in bytes.
+ */
+unsigned int TextureResidencyManager::GetUsage() {
+    return usage;
+}
+
+unsigned int TextureResidencyManager::GetFrame() {
+    return frame;
+}
+
+/**
+ * Get the size of a pixel as stored by the gpu. RGB is assumed to be
+ * padded to four bytes.
+ *
+ * @param f Color format.
+ * @return Bits per pixel.
+ */
+unsigned int TextureResidencyManager::BitsPerPixel(ColorFormat f) {
+    switch (f) {
+    case ALPHA:
+    case LUMINANCE:
+        return 8;
+    case LUMINANCE_ALPHA:
+        return 16;
+    case RGB:
+    case BGR:
+    case RGBA:
+    case BGRA:
+    case LUMINANCE32F:
+    case DEPTH:
+        return 32;
+    case RGB_COMPRESSED:
+        return 4;
+    case RGBA_COMPRESSED:
+    case ALPHA_COMPRESSED:
+    case LUMINANCE_COMPRESSED:
+    case LUMINANCE_ALPHA_COMPRESSED:
+        return 8;
+    case RGB32F:
+    case RGBA32F:
+        return 128;
+    default:
+        return 32;
+    }
+}
+
+/**
+ * Estimate the memory used by a texture including its mipmap
+ * chain. The depth is treated as array layers and is not reduced
+ * along the chain.
+ *
+ * @return Size in bytes.
+ */
+unsigned int TextureResidencyManager::EstimateSize(unsigned int width,
+                                                   unsigned int height,
+                                                   unsigned int depth,
+                                                   ColorFormat format,
+                                                   bool mipmapped) {
+    const unsigned int bpp = BitsPerPixel(format);
+    const bool blocks = format == RGB_COMPRESSED || format == RGBA_COMPRESSED;
+    unsigned int w = width == 0 ? 1 : width;
+    unsigned int h = height == 0 ? 1 : height;
+    unsigned int d = depth == 0 ? 1 : depth;
+    unsigned int total = 0;
+    for (;;) {
+        if (blocks)
+            total += ((w + 3) / 4) * ((h + 3) / 4) * 2 * bpp * d;
+        else
+            total += w * h * d * bpp / 8;
+        if (!mipmapped || (w == 1 && h == 1)) break;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return total;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
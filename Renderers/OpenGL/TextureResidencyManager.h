@@ -0,0 +1,105 @@
+// OpenGL texture residency manager.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_RESIDENCY_MANAGER_H_
+#define _OPENGL_TEXTURE_RESIDENCY_MANAGER_H_
+
+#include <Meta/OpenGL.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/ITexture3D.h>
+#include <boost/weak_ptr.hpp>
+#include <map>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+class Renderer;
+
+using Resources::ITexture2D;
+using Resources::ITexture2DPtr;
+using Resources::ITexture3D;
+using Resources::ColorFormat;
+
+/**
+ * Keeps track of the video memory used by textures and keeps it
+ * below a budget.
+ *
+ * Every texture loaded by the renderer is registered with an
+ * estimated size, and every bind marks the texture as used in the
+ * current frame. When the estimated total exceeds the budget the
+ * least recently used textures are evicted. An evicted texture keeps
+ * its id with a placeholder image, and its image is uploaded again,
+ * through the texture uploader if enabled, the next time it is used.
+ *
+ * Textures registered without a shared pointer (frame buffer
+ * attachments, 3D textures, streamed textures) are counted but never
+ * evicted.
+ *
+ * @class TextureResidencyManager TextureResidencyManager.h Renderers/OpenGL/TextureResidencyManager.h
+ */
+class TextureResidencyManager {
+private:
+    struct Entry {
+        boost::weak_ptr<ITexture2D> tex;
+        GLuint id;
+        unsigned int width, height, depth;
+        ColorFormat format;
+        unsigned int size;
+        unsigned int resident;
+        unsigned int lastUsed;
+        bool pinned;
+        bool evicted;
+        bool mipmapped;
+    };
+
+    Renderer& renderer;
+    std::map<const void*, Entry> entries;
+    unsigned int budget;
+    unsigned int usage;
+    unsigned int frame;
+    bool warned;
+
+    void Evict(Entry& entry);
+    void Restore(Entry& entry, ITexture2DPtr tex);
+
+public:
+    TextureResidencyManager(Renderer& renderer);
+    ~TextureResidencyManager();
+
+    void Register(ITexture2DPtr tex);
+    void Register(ITexture2D* tex);
+    void Register(ITexture3D* tex);
+    void Unregister(const void* tex);
+    void SetResident(const void* tex, unsigned int bytes);
+
+    void Touch(ITexture2DPtr tex);
+    void Touch(const void* tex);
+
+    void NewFrame();
+    void Update();
+
+    void SetBudget(unsigned int bytes);
+    unsigned int GetBudget();
+    unsigned int GetUsage();
+    unsigned int GetFrame();
+
+    static unsigned int BitsPerPixel(ColorFormat f);
+    static unsigned int EstimateSize(unsigned int width,
+                                     unsigned int height,
+                                     unsigned int depth,
+                                     ColorFormat format,
+                                     bool mipmapped);
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_TEXTURE_RESIDENCY_MANAGER_H_
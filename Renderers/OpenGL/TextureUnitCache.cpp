@@ -0,0 +1,131 @@
+// OpenGL texture unit state cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/TextureUnitCache.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+// Bindings are stored as id + 1, zero meaning unknown.
+GLuint TextureUnitCache::bound[TextureUnitCache::MAX_UNITS][TextureUnitCache::TARGETS];
+unsigned int TextureUnitCache::active = TextureUnitCache::UNKNOWN;
+unsigned int TextureUnitCache::binds = 0;
+unsigned int TextureUnitCache::skipped = 0;
+
+int TextureUnitCache::Slot(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D:           return 0;
+    case GL_TEXTURE_3D:           return 1;
+    case GL_TEXTURE_2D_ARRAY_EXT: return 2;
+    case GL_TEXTURE_CUBE_MAP:     return 3;
+    case GL_TEXTURE_RECTANGLE_ARB: return 4;
+    default:                      return -1;
+    }
+}
+
+/**
+ * Bind a texture to the active texture unit. Unit 0 is selected if
+ * the active unit is unknown.
+ *
+ * @param target Texture target.
+ * @param id Texture id, zero to unbind.
+ */
+void TextureUnitCache::Bind(GLenum target, GLuint id) {
+    if (active == UNKNOWN) Active(0);
+    int slot = Slot(target);
+    if (slot < 0 || active >= MAX_UNITS) {
+        // untracked target or unit, always bind.
+        ++binds;
+        glBindTexture(target, id);
+        return;
+    }
+    if (bound[active][slot] == id + 1) {
+        ++skipped;
+        return;
+    }
+    ++binds;
+    glBindTexture(target, id);
+    bound[active][slot] = id + 1;
+}
+
+/**
+ * Bind a texture to a texture unit. The unit is made active if the
+ * binding changes.
+ *
+ * @param unit Texture unit index, zero based.
+ * @param target Texture target.
+ * @param id Texture id, zero to unbind.
+ */
+void TextureUnitCache::Bind(unsigned int unit, GLenum target, GLuint id) {
+    int slot = Slot(target);
+    if (slot >= 0 && unit < MAX_UNITS && bound[unit][slot] == id + 1) {
+        ++skipped;
+        return;
+    }
+    Active(unit);
+    Bind(target, id);
+}
+
+/**
+ * Select the active texture unit.
+ *
+ * @param unit Texture unit index, zero based.
+ */
+void TextureUnitCache::Active(unsigned int unit) {
+    if (active == unit) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active = unit;
+}
+
+/**
+ * Forget a texture id, which must be done when it is deleted.
+ *
+ * @param id Deleted texture id.
+ */
+void TextureUnitCache::Forget(GLuint id) {
+    for (unsigned int u = 0; u < MAX_UNITS; ++u)
+        for (unsigned int t = 0; t < TARGETS; ++t)
+            if (bound[u][t] == id + 1) bound[u][t] = 0;
+}
+
+/**
+ * Forget all bindings and the active unit. The next binds will be
+ * issued to OpenGL.
+ */
+void TextureUnitCache::Invalidate() {
+    for (unsigned int u = 0; u < MAX_UNITS; ++u)
+        for (unsigned int t = 0; t < TARGETS; ++t)
+            bound[u][t] = 0;
+    active = UNKNOWN;
+}
+
+/**
+ * Get the number of binds issued to OpenGL since the statistics
+ * were reset.
+ */
+unsigned int TextureUnitCache::GetBindCount() {
+    return binds;
+}
+
+/**
+ * Get the number of redundant binds skipped since the statistics
+ * were reset.
+ */
+unsigned int TextureUnitCache::GetSkippedCount() {
+    return skipped;
+}
+
+void TextureUnitCache::ResetStatistics() {
+    binds = skipped = 0;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
@@ -0,0 +1,62 @@
+// OpenGL texture unit state cache.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_UNIT_CACHE_H_
+#define _OPENGL_TEXTURE_UNIT_CACHE_H_
+
+#include <Meta/OpenGL.h>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+/**
+ * Shadow of the texture bindings of all texture units.
+ *
+ * Every texture bind in the renderer, the shaders and the canvases
+ * goes through the cache, which only calls glActiveTexture and
+ * glBindTexture when the state actually changes. The active unit is
+ * left where the last bind put it, so code using fixed function
+ * texturing must select unit 0 with Active or bind through it.
+ *
+ * The cache assumes it knows the state of the context. Code binding
+ * textures behind its back must call Invalidate, and deleted texture
+ * ids must be reported with Forget as OpenGL reuses them. The
+ * renderer invalidates the cache at the start of every frame.
+ *
+ * @class TextureUnitCache TextureUnitCache.h Renderers/OpenGL/TextureUnitCache.h
+ */
+class TextureUnitCache {
+private:
+    static const unsigned int MAX_UNITS = 32;
+    static const unsigned int TARGETS = 5;
+    static const GLuint UNKNOWN = ~0u;
+
+    static GLuint bound[MAX_UNITS][TARGETS];
+    static unsigned int active;
+    static unsigned int binds, skipped;
+
+    static inline int Slot(GLenum target);
+public:
+    static void Bind(GLenum target, GLuint id);
+    static void Bind(unsigned int unit, GLenum target, GLuint id);
+    static void Active(unsigned int unit);
+    static void Forget(GLuint id);
+    static void Invalidate();
+
+    static unsigned int GetBindCount();
+    static unsigned int GetSkippedCount();
+    static void ResetStatistics();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_TEXTURE_UNIT_CACHE_H_
@@ -0,0 +1,399 @@
+// OpenGL asynchronous texture uploader.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/TextureUploader.h>
+#include <Renderers/OpenGL/Renderer.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+using Core::Thread;
+
+// Number of frames after which a pixel buffer is considered free
+// when fences are not supported by the driver.
+static const unsigned int RETIRE_FRAMES = 2;
+
+// Longest sleep in microseconds of an idle worker, and of Finish
+// waiting for a worker. The sleeps double from a short first one, so
+// idle workers wake up rarely but busy ones pick up the next job
+// right away.
+static const unsigned int IDLE_SLEEP = 8000;
+static const unsigned int FINISH_SLEEP = 1000;
+
+TextureUploader::Worker::Worker(TextureUploader& uploader)
+    : uploader(uploader) {}
+
+void TextureUploader::Worker::Run() {
+    unsigned int idle = 500;
+    Job* job;
+    while (uploader.NextWorkerJob(job)) {
+        if (job == NULL) {
+            // nothing to do, back off.
+            Thread::Sleep(idle);
+            idle = std::min(idle * 2, IDLE_SLEEP);
+            continue;
+        }
+        idle = 500;
+        if (job->state == DECODING)
+            uploader.Decode(job);
+        else if (job->state == COPYING)
+            uploader.Copy(job);
+    }
+}
+
+/**
+ * Create the uploader and start the worker threads.
+ * Must be constructed with a current OpenGL context.
+ *
+ * @param renderer Renderer used to create the gl textures.
+ * @param workers Number of decoding threads.
+ * @param buffers Number of pixel buffer objects in the pool.
+ */
+TextureUploader::TextureUploader(Renderer& renderer,
+                                 unsigned int workers,
+                                 unsigned int buffers)
+    : renderer(renderer)
+    , running(true)
+    , syncSupport(glewGetExtension("GL_ARB_sync") == GL_TRUE)
+    , frame(0) {
+    pbos.resize(buffers);
+    glGenBuffers(buffers, &pbos[0]);
+    CHECK_FOR_GL_ERROR();
+    freePbos = pbos;
+
+    for (unsigned int i = 0; i < workers; ++i) {
+        Worker* w = new Worker(*this);
+        this->workers.push_back(w);
+        w->Start();
+    }
+}
+
+/**
+ * Stop the workers and release the pixel buffers.
+ * Textures still in flight are left with their placeholder image.
+ */
+TextureUploader::~TextureUploader() {
+    mutex.Lock();
+    running = false;
+    mutex.Unlock();
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+
+    std::list<Job*>::iterator itr = jobs.begin();
+    for (; itr != jobs.end(); ++itr) {
+        Job* job = *itr;
+        if (job->state == MAPPED || job->state == COPIED) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (job->fence) glDeleteSync(job->fence);
+        delete job;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    jobs.clear();
+    pending.clear();
+
+    glDeleteBuffers(pbos.size(), &pbos[0]);
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Schedule a texture for upload. The texture is given an id and a
+ * placeholder image right away so it can be bound immediately.
+ *
+ * @param tex Texture to upload.
+ */
+void TextureUploader::Enqueue(ITexture2DPtr tex) {
+    if (tex == NULL || tex->GetID() != 0) return;
+
+    GLuint texid;
+    glGenTextures(1, &texid);
+    CHECK_FOR_GL_ERROR();
+    tex->SetID(texid);
+    renderer.UploadPlaceholder(tex.get());
+    Queue(tex);
+}
+
+/**
+ * Schedule the image of a texture that already has an id for upload
+ * again. The texture keeps its current image until then.
+ *
+ * @param tex Texture to upload.
+ */
+void TextureUploader::Reload(ITexture2DPtr tex) {
+    if (tex == NULL || tex->GetID() == 0) return;
+    Queue(tex);
+}
+
+void TextureUploader::Queue(ITexture2DPtr tex) {
+    Job* job = new Job();
+    job->tex = tex;
+    job->state = QUEUED;
+    job->loaded = tex->GetVoidDataPtr() != NULL;
+    job->size = 0;
+    job->pbo = 0;
+    job->dest = NULL;
+    job->fence = 0;
+    job->frame = 0;
+
+    mutex.Lock();
+    if (pending.find(tex.get()) == pending.end()) {
+        jobs.push_back(job);
+        pending[tex.get()] = job;
+    } else delete job;
+    mutex.Unlock();
+}
+
+/**
+ * Advance all uploads. Called once per frame before rendering.
+ */
+void TextureUploader::Process() {
+    ++frame;
+    mutex.Lock();
+    std::list<Job*>::iterator itr = jobs.begin();
+    while (itr != jobs.end()) {
+        Job* job = *itr;
+        switch (job->state) {
+        case DECODED:
+            Map(job);
+            break;
+        case COPIED:
+            Upload(job);
+            break;
+        case UPLOADED:
+            if (IsRetired(job)) {
+                if (job->fence) glDeleteSync(job->fence);
+                if (job->pbo) freePbos.push_back(job->pbo);
+                delete job;
+                itr = jobs.erase(itr);
+                continue;
+            }
+            break;
+        default:
+            break;
+        }
+        ++itr;
+    }
+    mutex.Unlock();
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Force the upload of a texture to complete before returning. Used
+ * when the texture image is needed right away, eg. as a frame
+ * buffer attachment or before a sub image update.
+ *
+ * @param tex Texture to finish.
+ */
+void TextureUploader::Finish(ITexture2D* tex) {
+    mutex.Lock();
+    std::map<ITexture2D*, Job*>::iterator itr = pending.find(tex);
+    if (itr == pending.end()) {
+        mutex.Unlock();
+        return;
+    }
+    Job* job = itr->second;
+    unsigned int wait = 100;
+    while (job->state != UPLOADED) {
+        switch (job->state) {
+        case QUEUED:
+            job->state = DECODING;
+            mutex.Unlock();
+            Decode(job);
+            mutex.Lock();
+            break;
+        case MAPPED:
+            job->state = COPYING;
+            mutex.Unlock();
+            Copy(job);
+            mutex.Lock();
+            break;
+        case DECODED:
+            // Skip the pixel buffer and upload straight from
+            // client memory.
+            renderer.UploadTexture(tex, tex->GetVoidDataPtr());
+            renderer.residency->Register(job->tex);
+            if (!job->loaded) tex->Unload();
+            job->state = UPLOADED;
+            pending.erase(tex);
+            break;
+        case COPIED:
+            Upload(job);
+            break;
+        default:
+            // a worker is busy with the texture, wait for it.
+            mutex.Unlock();
+            Thread::Sleep(wait);
+            wait = std::min(wait * 2, FINISH_SLEEP);
+            mutex.Lock();
+        }
+    }
+    mutex.Unlock();
+}
+
+/**
+ * Check if a texture is still waiting for its image.
+ */
+bool TextureUploader::IsPending(ITexture2D* tex) {
+    mutex.Lock();
+    bool res = pending.find(tex) != pending.end();
+    mutex.Unlock();
+    return res;
+}
+
+/**
+ * Get the number of textures still displaying their placeholder.
+ */
+unsigned int TextureUploader::GetPendingCount() {
+    mutex.Lock();
+    unsigned int count = pending.size();
+    mutex.Unlock();
+    return count;
+}
+
+/**
+ * Find a job for a worker thread and mark it as taken.
+ *
+ * @param res Set to the job, or NULL if there is none.
+ * @return False when the uploader is stopping.
+ */
+bool TextureUploader::NextWorkerJob(Job*& res) {
+    res = NULL;
+    mutex.Lock();
+    if (!running) {
+        mutex.Unlock();
+        return false;
+    }
+    std::list<Job*>::iterator itr = jobs.begin();
+    for (; itr != jobs.end(); ++itr) {
+        Job* job = *itr;
+        if (job->state == QUEUED) {
+            job->state = DECODING;
+            res = job;
+            break;
+        } else if (job->state == MAPPED) {
+            job->state = COPYING;
+            res = job;
+            break;
+        }
+    }
+    mutex.Unlock();
+    return true;
+}
+
+/**
+ * Load the texture data into memory. Runs without the lock held.
+ */
+void TextureUploader::Decode(Job* job) {
+    ITexture2D* tex = job->tex.get();
+    if (tex->GetVoidDataPtr() == NULL)
+        tex->Load();
+    unsigned int size = tex->GetWidth() * tex->GetHeight() *
+        tex->GetChannels() * tex->GetChannelSize() / 8;
+    mutex.Lock();
+    job->size = size;
+    job->state = DECODED;
+    mutex.Unlock();
+}
+
+/**
+ * Copy the texture data into the mapped pixel buffer. Runs without
+ * the lock held.
+ */
+void TextureUploader::Copy(Job* job) {
+    memcpy(job->dest, job->tex->GetVoidDataPtr(), job->size);
+    mutex.Lock();
+    job->state = COPIED;
+    mutex.Unlock();
+}
+
+/**
+ * Map a free pixel buffer for a decoded texture. Textures without
+ * any data (eg. render targets) are allocated right away, and large
+ * textures are handed to the mipmap streamer.
+ */
+void TextureUploader::Map(Job* job) {
+    ITexture2D* tex = job->tex.get();
+    if (renderer.StreamTexture(job->tex)) {
+        if (!job->loaded) tex->Unload();
+        job->state = UPLOADED;
+        pending.erase(tex);
+        return;
+    }
+    if (tex->GetVoidDataPtr() == NULL) {
+        renderer.UploadTexture(tex, NULL);
+        renderer.residency->Register(job->tex);
+        job->state = UPLOADED;
+        pending.erase(tex);
+        return;
+    }
+    if (freePbos.empty()) return;
+
+    job->pbo = freePbos.back();
+    freePbos.pop_back();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    // orphan the previous storage so the driver need not wait for it.
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, job->size, NULL, GL_STREAM_DRAW);
+    job->dest = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    CHECK_FOR_GL_ERROR();
+
+    if (job->dest == NULL) {
+        logger.warning << "TextureUploader: could not map pixel buffer" << logger.end;
+        freePbos.push_back(job->pbo);
+        job->pbo = 0;
+        return;
+    }
+    job->state = MAPPED;
+}
+
+/**
+ * Unmap the pixel buffer and let the driver transfer it into the
+ * texture.
+ */
+void TextureUploader::Upload(Job* job) {
+    ITexture2D* tex = job->tex.get();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    job->dest = NULL;
+    // With a bound unpack buffer the data pointer is an offset.
+    renderer.UploadTexture(tex, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    CHECK_FOR_GL_ERROR();
+
+    if (syncSupport)
+        job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    job->frame = frame;
+    renderer.residency->Register(job->tex);
+    if (!job->loaded) tex->Unload();
+    job->state = UPLOADED;
+    pending.erase(tex);
+}
+
+/**
+ * Check if the gpu is done reading the pixel buffer of a job.
+ */
+bool TextureUploader::IsRetired(Job* job) {
+    if (job->pbo == 0) return true;
+    if (job->fence)
+        return glClientWaitSync(job->fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+    return frame >= job->frame + RETIRE_FRAMES;
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
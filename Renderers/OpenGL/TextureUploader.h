@@ -0,0 +1,108 @@
+// OpenGL asynchronous texture uploader.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_UPLOADER_H_
+#define _OPENGL_TEXTURE_UPLOADER_H_
+
+#include <Meta/OpenGL.h>
+#include <Core/Thread.h>
+#include <Core/Mutex.h>
+#include <Resources/ITexture2D.h>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+class Renderer;
+
+using Resources::ITexture2D;
+using Resources::ITexture2DPtr;
+
+/**
+ * Streams 2D textures onto the gpu without stalling the rendering
+ * thread.
+ *
+ * Textures are decoded by a set of worker threads and copied into a
+ * pool of pixel buffer objects, from where the driver can transfer
+ * them asynchronously. A texture gets its id and a 1x1 placeholder
+ * image immediately when enqueued, and the real image replaces the
+ * placeholder a frame or two later. A texture that already has an
+ * id, eg. one evicted by the residency manager, can be reloaded the
+ * same way and keeps its id. Pixel buffers are only reused once the
+ * fence placed after their upload has been signaled.
+ *
+ * All methods must be called from the rendering thread.
+ *
+ * @class TextureUploader TextureUploader.h Renderers/OpenGL/TextureUploader.h
+ */
+class TextureUploader {
+private:
+    enum State { QUEUED, DECODING, DECODED, MAPPED, COPYING, COPIED, UPLOADED };
+
+    struct Job {
+        ITexture2DPtr tex;
+        State state;
+        bool loaded;
+        unsigned int size;
+        GLuint pbo;
+        void* dest;
+        GLsync fence;
+        unsigned int frame;
+    };
+
+    class Worker : public Core::Thread {
+    private:
+        TextureUploader& uploader;
+    public:
+        Worker(TextureUploader& uploader);
+        void Run();
+    };
+
+    Renderer& renderer;
+    // guards the jobs, the pending map and the running flag.
+    Core::Mutex mutex;
+    bool running;
+    bool syncSupport;
+    unsigned int frame;
+    std::vector<Worker*> workers;
+    std::vector<GLuint> pbos;
+    std::vector<GLuint> freePbos;
+    std::list<Job*> jobs;
+    std::map<ITexture2D*, Job*> pending;
+
+    void Queue(ITexture2DPtr tex);
+    bool NextWorkerJob(Job*& res);
+    void Decode(Job* job);
+    void Copy(Job* job);
+    void Map(Job* job);
+    void Upload(Job* job);
+    bool IsRetired(Job* job);
+
+public:
+    TextureUploader(Renderer& renderer,
+                    unsigned int workers = 2,
+                    unsigned int buffers = 4);
+    ~TextureUploader();
+
+    void Enqueue(ITexture2DPtr tex);
+    void Reload(ITexture2DPtr tex);
+    void Process();
+    void Finish(ITexture2D* tex);
+    bool IsPending(ITexture2D* tex);
+    unsigned int GetPendingCount();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_TEXTURE_UPLOADER_H_
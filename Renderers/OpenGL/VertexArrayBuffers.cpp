@@ -0,0 +1,137 @@
+// Buffer objects of vertex arrays.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Renderers/OpenGL/VertexArrayBuffers.h>
+#include <Geometry/VertexArray.h>
+#include <cstring>
+
+namespace OpenEngine {
+namespace Renderers {
+namespace OpenGL {
+
+// Interleaved layout: position, normal, color and texture coordinate.
+static const unsigned int STRIDE = 3 + 3 + 4 + 2;
+static const unsigned int NORMAL_OFFSET = 3;
+static const unsigned int COLOR_OFFSET = 6;
+static const unsigned int TEXCOORD_OFFSET = 10;
+
+// Frames a buffer is kept after its vertex array was last applied.
+static const unsigned int KEEP_FRAMES = 30;
+
+VertexArrayBuffers::VertexArrayBuffers()
+    : frame(0) {}
+
+/**
+ * Destructor. The buffers are not deleted, as the context may be
+ * gone, use Clear while it is current.
+ */
+VertexArrayBuffers::~VertexArrayBuffers() {}
+
+/**
+ * Start a new frame, deleting the buffers of the vertex arrays that
+ * have not been applied for a while. Must be called while the
+ * OpenGL context is current.
+ */
+void VertexArrayBuffers::NewFrame() {
+    ++frame;
+    std::map<VertexArray*, Entry>::iterator itr = buffers.begin();
+    while (itr != buffers.end()) {
+        if (frame - itr->second.seen > KEEP_FRAMES) {
+            glDeleteBuffers(1, &itr->second.id);
+            buffers.erase(itr++);
+        } else ++itr;
+    }
+}
+
+void VertexArrayBuffers::Upload(VertexArray* va, Entry& entry) {
+    entry.faces = va->GetNumFaces();
+    entry.vertices = va->GetVertices();
+    entry.normals = va->GetNormals();
+    entry.colors = va->GetColors();
+    entry.texCoords = va->GetTexCoords();
+
+    const unsigned int count = entry.faces * 3;
+    float* data = new float[count * STRIDE];
+    for (unsigned int i = 0; i < count; ++i) {
+        float* d = data + i * STRIDE;
+        memcpy(d, entry.vertices + i * 3, 3 * sizeof(float));
+        memcpy(d + NORMAL_OFFSET, entry.normals + i * 3, 3 * sizeof(float));
+        memcpy(d + COLOR_OFFSET, entry.colors + i * 4, 4 * sizeof(float));
+        memcpy(d + TEXCOORD_OFFSET, entry.texCoords + i * 2, 2 * sizeof(float));
+    }
+
+    if (entry.id == 0) glGenBuffers(1, &entry.id);
+    glBindBuffer(GL_ARRAY_BUFFER, entry.id);
+    glBufferData(GL_ARRAY_BUFFER, count * STRIDE * sizeof(float), data, GL_STATIC_DRAW);
+    CHECK_FOR_GL_ERROR();
+    delete[] data;
+}
+
+/**
+ * Bind the buffer of a vertex array and point the vertex, normal,
+ * color and texture coordinate arrays into it, uploading it first
+ * if needed. The buffer is left bound.
+ *
+ * @param va Vertex array to draw.
+ */
+void VertexArrayBuffers::Apply(VertexArray* va) {
+    std::map<VertexArray*, Entry>::iterator itr = buffers.find(va);
+    if (itr == buffers.end()) {
+        Entry entry;
+        entry.id = 0;
+        entry.seen = frame;
+        itr = buffers.insert(std::make_pair(va, entry)).first;
+        Upload(va, itr->second);
+    } else {
+        Entry& entry = itr->second;
+        entry.seen = frame;
+        if (entry.faces != va->GetNumFaces() ||
+            entry.vertices != va->GetVertices() ||
+            entry.normals != va->GetNormals() ||
+            entry.colors != va->GetColors() ||
+            entry.texCoords != va->GetTexCoords())
+            Upload(va, entry);
+        else
+            glBindBuffer(GL_ARRAY_BUFFER, entry.id);
+    }
+
+    const GLsizei stride = STRIDE * sizeof(float);
+    glVertexPointer(3, GL_FLOAT, stride, 0);
+    glNormalPointer(GL_FLOAT, stride, (GLvoid*)(NORMAL_OFFSET * sizeof(float)));
+    glColorPointer(4, GL_FLOAT, stride, (GLvoid*)(COLOR_OFFSET * sizeof(float)));
+    glTexCoordPointer(2, GL_FLOAT, stride, (GLvoid*)(TEXCOORD_OFFSET * sizeof(float)));
+    CHECK_FOR_GL_ERROR();
+}
+
+/**
+ * Delete the buffer of a vertex array, it is uploaded again the next
+ * time it is applied. Must be called while the OpenGL context is
+ * current.
+ */
+void VertexArrayBuffers::Forget(VertexArray* va) {
+    std::map<VertexArray*, Entry>::iterator itr = buffers.find(va);
+    if (itr == buffers.end()) return;
+    glDeleteBuffers(1, &itr->second.id);
+    buffers.erase(itr);
+}
+
+/**
+ * Delete all buffers. Must be called while the OpenGL context is
+ * current.
+ */
+void VertexArrayBuffers::Clear() {
+    for (std::map<VertexArray*, Entry>::iterator itr = buffers.begin();
+         itr != buffers.end(); ++itr)
+        glDeleteBuffers(1, &itr->second.id);
+    buffers.clear();
+}
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
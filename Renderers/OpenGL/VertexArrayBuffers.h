@@ -0,0 +1,67 @@
+// Buffer objects of vertex arrays.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_VERTEX_ARRAY_BUFFERS_H_
+#define _OPENGL_VERTEX_ARRAY_BUFFERS_H_
+
+#include <Meta/OpenGL.h>
+#include <map>
+
+namespace OpenEngine {
+    namespace Geometry {
+        class VertexArray;
+    }
+namespace Renderers {
+namespace OpenGL {
+
+using Geometry::VertexArray;
+
+/**
+ * Uploads vertex arrays into interleaved buffer objects.
+ *
+ * The first time a vertex array is applied its vertices, normals,
+ * colors and texture coordinates are interleaved into a static
+ * buffer object. Later frames only bind the buffer and set the
+ * pointers into it. A vertex array is uploaded again if its face
+ * count or data pointers change. Changes to the data in place must
+ * be reported with Forget. Buffers of vertex arrays not applied for
+ * a number of frames are deleted, so deleted vertex arrays do not
+ * keep their buffers.
+ *
+ * Requires buffer object support.
+ *
+ * @class VertexArrayBuffers VertexArrayBuffers.h Renderers/OpenGL/VertexArrayBuffers.h
+ */
+class VertexArrayBuffers {
+private:
+    struct Entry {
+        GLuint id;
+        unsigned int faces, seen;
+        const float *vertices, *normals, *colors, *texCoords;
+    };
+    std::map<VertexArray*, Entry> buffers;
+    unsigned int frame;
+
+    void Upload(VertexArray* va, Entry& entry);
+public:
+    VertexArrayBuffers();
+    ~VertexArrayBuffers();
+
+    void NewFrame();
+
+    void Apply(VertexArray* va);
+    void Forget(VertexArray* va);
+    void Clear();
+};
+
+} // NS OpenGL
+} // NS Renderers
+} // NS OpenEngine
+
+#endif // _OPENGL_VERTEX_ARRAY_BUFFERS_H_
@@ -0,0 +1,99 @@
+// OpenGL normal visualization shader abstraction
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Resources/NormalVisualizationShader.h>
+
+#include <Resources/DirectoryManager.h>
+
+namespace OpenEngine {
+namespace Resources {
+
+// Vertices emitted per triangle: three vectors at each vertex and
+// the face normal, two vertices per line.
+static const GLint MAX_VERTICES = (3 * 3 + 1) * 2;
+
+NormalVisualizationShader::NormalVisualizationShader()
+    : OpenGLShader(DirectoryManager::FindFileInPath("extensions/OpenGLRenderer/shaders/NormalVisualizationShader.glsl"))
+    , program(0)
+    , tangentLoc(-1)
+    , binormalLoc(-1)
+{
+    SetGeometryLayout(GL_TRIANGLES, GL_LINE_STRIP, MAX_VERTICES);
+    SetVectors(true, false, false, false);
+}
+
+NormalVisualizationShader::~NormalVisualizationShader() {}
+
+/**
+ * Check if the shader can be used, which requires geometry shader
+ * support. Only valid after the renderer is initialized.
+ */
+bool NormalVisualizationShader::IsSupported() {
+    return shaderModel > 0 && vertexSupport && geometrySupport;
+}
+
+/**
+ * Select the vectors to draw.
+ */
+void NormalVisualizationShader::SetVectors(bool normals, bool tangents,
+                                           bool binormals, bool hardNormals) {
+    SetUniform("normals", normals ? 1.0f : 0.0f);
+    SetUniform("tangents", tangents ? 1.0f : 0.0f);
+    SetUniform("binormals", binormals ? 1.0f : 0.0f);
+    SetUniform("hardNormals", hardNormals ? 1.0f : 0.0f);
+}
+
+/**
+ * Set the tangent and binormal arrays of the mesh to draw. Either
+ * may be empty.
+ */
+void NormalVisualizationShader::SetAttributes(IDataBlockPtr tangents,
+                                              IDataBlockPtr binormals) {
+    this->tangents = tangents;
+    this->binormals = binormals;
+}
+
+void NormalVisualizationShader::BindAttribute(GLint loc, IDataBlockPtr values) {
+    if (loc < 0) return;
+    if (values == NULL) {
+        glDisableVertexAttribArray(loc);
+        glVertexAttrib3f(loc, 0.0f, 0.0f, 0.0f);
+        return;
+    }
+    glEnableVertexAttribArray(loc);
+    if (values->GetID() != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, values->GetID());
+        glVertexAttribPointer(loc, values->GetDimension(), GL_FLOAT, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    } else
+        glVertexAttribPointer(loc, values->GetDimension(), GL_FLOAT, GL_FALSE, 0, values->GetVoidDataPtr());
+}
+
+void NormalVisualizationShader::ApplyShader() {
+    OpenGLShader::ApplyShader();
+
+    // Look the attributes up again if the program was reloaded.
+    if (program != shaderProgram) {
+        program = shaderProgram;
+        tangentLoc = glGetAttribLocation(program, "tangent");
+        binormalLoc = glGetAttribLocation(program, "binormal");
+    }
+    BindAttribute(tangentLoc, tangents);
+    BindAttribute(binormalLoc, binormals);
+    CHECK_FOR_GL_ERROR();
+}
+
+void NormalVisualizationShader::ReleaseShader() {
+    if (tangentLoc >= 0) glDisableVertexAttribArray(tangentLoc);
+    if (binormalLoc >= 0) glDisableVertexAttribArray(binormalLoc);
+    OpenGLShader::ReleaseShader();
+}
+
+}
+}
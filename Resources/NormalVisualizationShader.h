@@ -0,0 +1,54 @@
+// OpenGL normal visualization shader abstraction
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_NORMAL_VISUALIZATION_SHADER_RESOURCE_H_
+#define _OPENGL_NORMAL_VISUALIZATION_SHADER_RESOURCE_H_
+
+#include <Resources/OpenGLShader.h>
+#include <Resources/IDataBlock.h>
+
+namespace OpenEngine {
+namespace Resources {
+
+/**
+ * Shader drawing the normals, tangents and binormals of triangle
+ * meshes. A geometry shader expands each triangle of the mesh into
+ * lines, so the vectors are read directly from the vertex buffers
+ * and no per frame work is done on the CPU.
+ *
+ * Normals are read from the normal array, tangents and binormals
+ * from the vertex attributes given by SetAttributes.
+ *
+ * Requires GL_ARB_geometry_shader4.
+ *
+ * @class NormalVisualizationShader NormalVisualizationShader.h Resources/NormalVisualizationShader.h
+ */
+class NormalVisualizationShader: public OpenGLShader {
+private:
+    GLuint program;
+    GLint tangentLoc, binormalLoc;
+    IDataBlockPtr tangents, binormals;
+
+    inline void BindAttribute(GLint loc, IDataBlockPtr values);
+public:
+    NormalVisualizationShader();
+    virtual ~NormalVisualizationShader();
+
+    static bool IsSupported();
+
+    void SetVectors(bool normals, bool tangents, bool binormals, bool hardNormals);
+    void SetAttributes(IDataBlockPtr tangents, IDataBlockPtr binormals);
+    void ApplyShader();
+    void ReleaseShader();
+};
+
+}
+}
+
+#endif //_OPENGL_NORMAL_VISUALIZATION_SHADER_RESOURCE_H_
@@ -19,7 +19,9 @@
 #include <Resources/ResourceManager.h>
 #include <Resources/ITexture2D.h>
 #include <Resources/ITexture3D.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
 
+#include <cctype>
 #include <cstring>
 
 namespace OpenEngine {
@@ -29,6 +31,7 @@ namespace OpenEngine {
         bool OpenGLShader::vertexSupport = false;
         bool OpenGLShader::geometrySupport = false;
         bool OpenGLShader::fragmentSupport = false;
+        Renderers::OpenGL::TextureResidencyManager* OpenGLShader::residency = NULL;
 
         OpenGLShader::OpenGLShader() {
             resource.clear();
@@ -36,6 +39,11 @@ namespace OpenEngine {
             shaderProgram = 0;
             vertexShaderId = 0;
             fragmentShaderId = 0;
+            geometryShaderId = 0;
+            geometryInput = GL_TRIANGLES;
+            geometryOutput = GL_TRIANGLE_STRIP;
+            geometryVertices = 3;
+            broadcast = false;
         }
 
         OpenGLShader::OpenGLShader(string filename)
@@ -44,6 +52,11 @@ namespace OpenEngine {
             shaderProgram = 0;
             vertexShaderId = 0;
             fragmentShaderId = 0;
+            geometryShaderId = 0;
+            geometryInput = GL_TRIANGLES;
+            geometryOutput = GL_TRIANGLE_STRIP;
+            geometryVertices = 3;
+            broadcast = false;
         }
 
         OpenGLShader::~OpenGLShader() {
@@ -88,6 +101,14 @@ namespace OpenEngine {
             // logger.info << "Fragment shader support: " << fragmentSupport << logger.end;
         }
 
+        /**
+         * Set the manager notified of every texture bound by a
+         * shader.
+         */
+        void OpenGLShader::SetTextureResidency(Renderers::OpenGL::TextureResidencyManager* r){
+            residency = r;
+        }
+
         void OpenGLShader::Load() {
             if (shaderModel == 0) return;
 
@@ -117,10 +138,15 @@ namespace OpenEngine {
             glDetachShader(shaderProgram, vertexShaderId);
             glDeleteShader(vertexShaderId);
             glDeleteShader(fragmentShaderId);
+            if (geometryShaderId != 0) {
+                glDetachShader(shaderProgram, geometryShaderId);
+                glDeleteShader(geometryShaderId);
+            }
             glDeleteProgram(shaderProgram);
             shaderProgram = 0;
             vertexShaderId = 0;
             fragmentShaderId = 0;
+            geometryShaderId = 0;
         }
 
         void OpenGLShader::ApplyShader(){
@@ -373,19 +399,22 @@ namespace OpenEngine {
                 glAttachShader(shaderProgram, vertexShaderId);
             }
 
-            /*        
             // attach geometry shader
             if (!geometryShaders.empty() && geometrySupport){
-                GLuint shader = LoadShader(geometryShaders, GL_GEOMETRY_SHADER_ARB);
+                geometryShaderId = LoadShader(geometryShaders, GL_GEOMETRY_SHADER_ARB);
 #if OE_SAFE
-                if (shader == 0)
+                if (geometryShaderId == 0)
                     throw Exception("Failed loading geometryshader");
 #endif
-                glAttachShader(shaderProgram, shader);
+                glAttachShader(shaderProgram, geometryShaderId);
+                // the layout must be set before linking.
+                glProgramParameteriARB(shaderProgram, GL_GEOMETRY_INPUT_TYPE_ARB, geometryInput);
+                glProgramParameteriARB(shaderProgram, GL_GEOMETRY_OUTPUT_TYPE_ARB, geometryOutput);
+                glProgramParameteriARB(shaderProgram, GL_GEOMETRY_VERTICES_OUT_ARB, geometryVertices);
             }
-            */
 
             // attach fragment shader
+            broadcast = false;
             if (!fragmentShaders.empty() && fragmentSupport){
                 fragmentShaderId = LoadShader(fragmentShaders, GL_FRAGMENT_SHADER);
 #if OE_SAFE
@@ -409,6 +438,36 @@ namespace OpenEngine {
             
         }
 
+        /**
+         * Look for the identifiers gl_FragColor, gl_FragData and
+         * discard in shader source, skipping comments. Parts of
+         * longer identifiers do not count.
+         *
+         * @param src Shader source.
+         * @param color Set if gl_FragColor is used.
+         * @param other Set if gl_FragData or discard is used.
+         */
+        void OpenGLShader::ScanFragmentOutputs(const char* src, bool& color, bool& other) {
+            const char* p = src;
+            while (*p) {
+                if (p[0] == '/' && p[1] == '/') {
+                    while (*p && *p != '\n') ++p;
+                } else if (p[0] == '/' && p[1] == '*') {
+                    const char* end = strstr(p + 2, "*/");
+                    p = end ? end + 2 : p + strlen(p);
+                } else if (isalpha((unsigned char)*p) || *p == '_') {
+                    const char* start = p;
+                    while (isalnum((unsigned char)*p) || *p == '_') ++p;
+                    string word(start, p - start);
+                    if (word == "gl_FragColor") color = true;
+                    else if (word == "gl_FragData" || word == "discard") other = true;
+                } else if (isdigit((unsigned char)*p)) {
+                    // numbers such as 1e5 are not identifiers.
+                    while (isalnum((unsigned char)*p) || *p == '_' || *p == '.') ++p;
+                } else ++p;
+            }
+        }
+
         /**
          * Loads the given shader. OpenGL 2.0 and above.
          */        
@@ -434,6 +493,15 @@ namespace OpenEngine {
 ] == NULL) return 0;
             }
 
+            // A fragment shader writing only gl_FragColor and never
+            // discarding covers every draw buffer.
+            if (type == GL_FRAGMENT_SHADER) {
+                bool color = false, other = false;
+                for (unsigned int i = defines.size(); i < size; ++i)
+                    ScanFragmentOutputs(shaderBits[i], color, other);
+                broadcast = color && !other;
+            }
+
             glShaderSource(shader, size, shaderBits, NULL);
 
             // Compile shader
@@ -478,6 +546,29 @@ void OpenGLShader::ClearDefines() {
     defines.clear();
 }
 
+/**
+ * Set the primitive layout of the geometry shader. Takes effect the
+ * next time the shader is loaded.
+ *
+ * @param input Input primitive type, e.g. GL_TRIANGLES.
+ * @param output Output primitive type, e.g. GL_LINE_STRIP.
+ * @param vertices Maximum number of vertices emitted per primitive.
+ */
+void OpenGLShader::SetGeometryLayout(GLenum input, GLenum output, GLint vertices) {
+    geometryInput = input;
+    geometryOutput = output;
+    geometryVertices = vertices;
+}
+
+/**
+ * Check if the fragment shader writes the same color to every draw
+ * buffer, that is it writes gl_FragColor, not gl_FragData, and never
+ * discards fragments.
+ */
+bool OpenGLShader::BroadcastsFragColor() {
+    return broadcast;
+}
+
     }
 }
 
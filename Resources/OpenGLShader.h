@@ -20,6 +20,11 @@
 using namespace std;
 
 namespace OpenEngine {
+    namespace Renderers {
+        namespace OpenGL {
+            class TextureResidencyManager;
+        }
+    }
     namespace Resources {
         // forward declarations
         class ITexture2D;
@@ -78,6 +83,7 @@ namespace OpenEngine {
         protected:
             static int shaderModel;
             static bool vertexSupport, geometrySupport, fragmentSupport;
+            static Renderers::OpenGL::TextureResidencyManager* residency;
             
         protected:
             string resource;
@@ -90,6 +96,10 @@ namespace OpenEngine {
             GLuint shaderProgram;
             GLuint fragmentShaderId;
             GLuint vertexShaderId;
+            GLuint geometryShaderId;
+            GLenum geometryInput, geometryOutput;
+            GLint geometryVertices;
+            bool broadcast;
             GLint nextTexUnit;
 
             Utils::Timer timer;
@@ -116,6 +126,7 @@ namespace OpenEngine {
             GLint GetUniLoc(const GLchar *name);
             void BindShaderPrograms();
             GLuint LoadShader(vector<string>, int);
+            static void ScanFragmentOutputs(const char* src, bool& color, bool& other);
             void BindUniforms();
             void BindUniform(uniform uni);
             void BindUniform(matrix mat);
@@ -149,6 +160,10 @@ namespace OpenEngine {
             void AddDefine(string name, int val);
             void ClearDefines();
 
+            // Primitive types and output size of the geometry shader.
+            void SetGeometryLayout(GLenum input, GLenum output, GLint vertices);
+            bool BroadcastsFragColor();
+
             // Uniform functions
 #undef GL_SHADER_SCALAR
 #define GL_SHADER_SCALAR(type, extension)                               \
@@ -168,6 +183,7 @@ namespace OpenEngine {
             bool HasAttribute(string name);
 
             static void ShaderSupport();
+            static void SetTextureResidency(Renderers::OpenGL::TextureResidencyManager* r);
 
             inline int GetShaderModel() { return shaderModel; }
             inline bool HasVertexSupport() { return vertexSupport; }
@@ -13,10 +13,14 @@
 #include <Resources/ITexture2D.h>
 #include <Resources/ITexture3D.h>
 #include <Resources/ICubemap.h>
+#include <Renderers/OpenGL/TextureResidencyManager.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
 
 namespace OpenEngine {
     namespace Resources {
 
+        using Renderers::OpenGL::TextureUnitCache;
+
         void OpenGLShader::SetTexture(string name, ITexture2DPtr tex, bool force){
             sampler2D sam;
             sam.tex = tex;
@@ -212,28 +216,33 @@ namespace OpenEngine {
                 unboundCubemaps.clear();
             }
 
-            // Bind all the textures
+            // Mark the textures as used first, as reloading a texture
+            // binds it on the active unit.
             map<string, sampler2D>::iterator itr2 = boundTex2Ds.begin();
+            map<string, sampler3D>::iterator itr3 = boundTex3Ds.begin();
+            if (residency) {
+                for (; itr2 != boundTex2Ds.end(); ++itr2)
+                    residency->Touch(itr2->second.tex);
+                for (; itr3 != boundTex3Ds.end(); ++itr3)
+                    residency->Touch(itr3->second.tex.get());
+            }
+
+            // Bind all the textures that are not already bound.
+            itr2 = boundTex2Ds.begin();
             while(itr2 != boundTex2Ds.end()){
-                glActiveTexture(GL_TEXTURE0 + itr2->second.texUnit);
-                glBindTexture(GL_TEXTURE_2D, itr2->second.tex->GetID());
+                TextureUnitCache::Bind(itr2->second.texUnit, GL_TEXTURE_2D, itr2->second.tex->GetID());
                 itr2++;
             }
-            map<string, sampler3D>::iterator itr3 = boundTex3Ds.begin();
+            itr3 = boundTex3Ds.begin();
             while(itr3 != boundTex3Ds.end()){
-                glActiveTexture(GL_TEXTURE0 + itr3->second.texUnit);
-                glBindTexture(itr3->second.tex->GetUseCase(), itr3->second.tex->GetID());
+                TextureUnitCache::Bind(itr3->second.texUnit, itr3->second.tex->GetUseCase(), itr3->second.tex->GetID());
                 itr3++;
             }
             map<string, samplerCubemap>::iterator itrCube = boundCubemaps.begin();
             while(itrCube != boundCubemaps.end()){
-                glActiveTexture(GL_TEXTURE0 + itrCube->second.texUnit);
-                glBindTexture(GL_TEXTURE_CUBE_MAP, itrCube->second.tex->GetID());
+                TextureUnitCache::Bind(itrCube->second.texUnit, GL_TEXTURE_CUBE_MAP, itrCube->second.tex->GetID());
                 itrCube++;
             }
-
-            // reset the active texture
-            glActiveTexture(GL_TEXTURE0);
         }
 
     }
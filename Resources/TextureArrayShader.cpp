@@ -0,0 +1,56 @@
+// OpenGL texture array shader abstraction
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Resources/TextureArrayShader.h>
+
+#include <Resources/DirectoryManager.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+
+namespace OpenEngine {
+namespace Resources {
+
+using Renderers::OpenGL::GLStateCache;
+
+TextureArrayShader::TextureArrayShader(ITexture3DPtr layers, LightRenderer& lr)
+    : OpenGLShader(DirectoryManager::FindFileInPath("extensions/OpenGLRenderer/shaders/TextureArrayShader.glsl"))
+    , layers(layers)
+    , lr(lr)
+    , lights(1) // cannot compile shader with zero lights.
+{
+    lr.LightCountChangedEvent().Attach(*this);
+    Update();
+}
+
+TextureArrayShader::~TextureArrayShader() {
+    lr.LightCountChangedEvent().Detach(*this);
+}
+
+void TextureArrayShader::Update() {
+    SetTexture("layers", layers);
+    AddDefine("NUM_LIGHTS", lights);
+}
+
+void TextureArrayShader::Handle(LightCountChangedEventArg arg) {
+    if (arg.count == lights || arg.count == 0) return;
+    lights = arg.count;
+
+    ClearDefines();
+    Unload();
+    Update();
+    Load();
+}
+
+void TextureArrayShader::ApplyShader() {
+    // follow the fixed function lighting state.
+    SetUniform("lighting", GLStateCache::IsEnabled(GL_LIGHTING) ? 1.0f : 0.0f);
+    OpenGLShader::ApplyShader();
+}
+
+}
+}
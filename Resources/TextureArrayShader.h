@@ -0,0 +1,51 @@
+// OpenGL texture array shader abstraction
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OPENGL_TEXTURE_ARRAY_SHADER_RESOURCE_H_
+#define _OPENGL_TEXTURE_ARRAY_SHADER_RESOURCE_H_
+
+#include <Resources/OpenGLShader.h>
+#include <Resources/ITexture3D.h>
+#include <Core/IListener.h>
+#include <Renderers/OpenGL/LightRenderer.h>
+
+namespace OpenEngine {
+namespace Resources {
+
+using Core::IListener;
+using Renderers::OpenGL::LightCountChangedEventArg;
+using Renderers::OpenGL::LightRenderer;
+
+/**
+ * Shader texturing meshes from a layer of a 2D texture array. The
+ * layer is given by the third texture coordinate, so meshes using
+ * different layers share the shader and the texture bind.
+ *
+ * Lighting is computed per vertex like the fixed function pipeline.
+ *
+ * @class TextureArrayShader TextureArrayShader.h Resources/TextureArrayShader.h
+ */
+class TextureArrayShader: public OpenGLShader, public IListener<LightCountChangedEventArg> {
+private:
+    ITexture3DPtr layers;
+    LightRenderer& lr;
+    unsigned int lights;
+
+    inline void Update();
+public:
+    TextureArrayShader(ITexture3DPtr layers, LightRenderer& lr);
+    virtual ~TextureArrayShader();
+    void ApplyShader();
+    void Handle(LightCountChangedEventArg arg);
+};
+
+}
+}
+
+#endif //_OPENGL_TEXTURE_ARRAY_SHADER_RESOURCE_H_
@@ -25,6 +25,13 @@ using namespace Geometry;
 using namespace Renderers;
 using namespace Core;
 
+/**
+ * Compiles geometry and vertex array nodes into display lists.
+ *
+ * @deprecated Display lists are not available in core profiles, use
+ *             StaticBatchTransformer.
+ * @class DisplayListTransformer DisplayListTransformer.h Scene/DisplayListTransformer.h
+ */
 class DisplayListTransformer : public ISceneNodeVisitor, public IListener<RenderingEventArg> {
  private:
     RenderingEventArg* arg;
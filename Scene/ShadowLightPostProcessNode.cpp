@@ -10,11 +10,21 @@
 #include <Scene/ShadowLightPostProcessNode.h>
 #include <Scene/TransformationNode.h>
 #include <Scene/MeshNode.h>
+#include <Scene/StaticBatchNode.h>
 #include <Logging/Logger.h>
 #include <Meta/OpenGL.h>
+#include <Renderers/OpenGL/TextureUnitCache.h>
+#include <Renderers/OpenGL/GLStateCache.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Renderers/OpenGL/DepthOnlyRenderer.h>
+#include <Renderers/OpenGL/Renderer.h>
+#include <Core/Exceptions.h>
 #include <Geometry/Mesh.h>
 #include <Geometry/GeometrySet.h>
 #include <Resources/IShaderResource.h>
+#include <Utils/Convert.h>
+#include <cmath>
+#include <algorithm>
 
 namespace OpenEngine {
 namespace Scene {
@@ -23,9 +33,18 @@ using namespace Resources;
 using namespace Math;
 using namespace Display;
 using namespace Geometry;
+using Renderers::OpenGL::TextureUnitCache;
+using Renderers::OpenGL::GLStateCache;
+using Renderers::OpenGL::GeometryBounds;
+using Renderers::OpenGL::Bounds;
+
+// Frames a mesh must keep its model matrix to be cached as static.
+static const unsigned int STABLE_FRAMES = 16;
+
+const unsigned int ShadowLightPostProcessNode::MAX_CASCADES;
 
 ShadowLightPostProcessNode::DepthRenderer::DepthRenderer(ShadowLightPostProcessNode* n)
-    : shadowNode(n) {
+    : shadowNode(n), depthOnly(NULL), frame(0) {
 
 }
 
@@ -64,19 +83,32 @@ void ShadowLightPostProcessNode::DepthRenderer::ApplyViewingVolume(IViewingVolum
 
 
 void ShadowLightPostProcessNode::DepthRenderer::Render(Renderers::RenderingEventArg arg) {
-    GLint prevFbo;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prevFbo);
-    Vector<4, GLint> prevDims;
-    glGetIntegerv(GL_VIEWPORT, prevDims.ToArray());
-    CHECK_FOR_GL_ERROR();
+    GLuint prevFbo = GLStateCache::GetFramebuffer();
+    Vector<4, GLint> prevDims = GLStateCache::GetViewport();
+
+    Renderers::OpenGL::Renderer* glRenderer =
+        dynamic_cast<Renderers::OpenGL::Renderer*>(&arg.renderer);
+#if OE_SAFE
+    if (glRenderer == NULL)
+        throw Core::Exception("Shadow maps require the OpenGL renderer.");
+#endif
+    depthOnly = &glRenderer->GetDepthOnlyRenderer();
+
+    shadowNode->culled = 0;
+
+    std::vector<FrameBuffer*>& old = shadowNode->oldCacheFBs;
+    for (unsigned int i = 0; i < old.size(); ++i) {
+        glRenderer->UnbindFrameBuffer(old[i]);
+        delete old[i];
+    }
+    old.clear();
+    FrameBuffer* cacheFB = shadowNode->cacheFB;
+    if (cacheFB != NULL && cacheFB->GetID() == 0)
+        arg.renderer.BindFrameBuffer(cacheFB);
 
     // Setup the new frame buffer
-    Vector<2, int> dims = shadowNode->shadowDims;
-    glViewport(0, 0, dims[0], dims[1]);
-    CHECK_FOR_GL_ERROR();
-    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, shadowNode->depthFB->GetID());
-    // Blit the previous framebuffer depth for merging instead of sorting.
-    glClear(GL_DEPTH_BUFFER_BIT);
+    GLuint depthFbo = shadowNode->depthFB->GetID();
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, depthFbo);
     CHECK_FOR_GL_ERROR();
 
     // We need to setup the texture for depth compare
@@ -85,35 +117,45 @@ void ShadowLightPostProcessNode::DepthRenderer::Render(Renderers::RenderingEvent
 
     //ApplyViewingVolume(*(arg.canvas.GetViewingVolume()));
 
-    // Apply VV
-    ApplyViewingVolume(*(shadowNode->viewingVolume));
-
     // Turn of unneeded stuff!
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    GLStateCache::ColorMask(false, false, false, false);
 
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
-
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(1.1, 4.0);
+    GLStateCache::Enable(GL_CULL_FACE);
+    GLStateCache::CullFace(GL_FRONT);
 
+    GLStateCache::Enable(GL_DEPTH_TEST);
+    GLStateCache::Enable(GL_POLYGON_OFFSET_FILL);
+    GLStateCache::PolygonOffset(1.1f, 4.0f);
 
     // Draw it
-
-    shadowNode->Accept(*this);
+    if (cacheFB == NULL) {
+        glClear(GL_DEPTH_BUFFER_BIT);
+        DrawCascades(ALL);
+    } else {
+        // Render the static casters to the cache when it is out of
+        // date, otherwise start from the cached depth.
+        if (!UpdateCache()) {
+            glClear(GL_DEPTH_BUFFER_BIT);
+            DrawCascades(STATIC);
+            CopyDepth(depthFbo, cacheFB->GetID());
+        } else
+            CopyDepth(cacheFB->GetID(), depthFbo);
+        GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, depthFbo);
+        DrawCascades(DYNAMIC);
+    }
+    draws.clear();
 
     // glBindTexture(GL_TEXTURE_2D,shadowNode->depthFB->GetDepthTexture()->GetID());
     // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_NONE);
 
-    glDisable(GL_POLYGON_OFFSET_FILL);
-    glCullFace(GL_BACK);
+    GLStateCache::Disable(GL_POLYGON_OFFSET_FILL);
+    GLStateCache::CullFace(GL_BACK);
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    GLStateCache::ColorMask(true, true, true, true);
 
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prevFbo);
-    glViewport(prevDims[0], prevDims[1], prevDims[2], prevDims[3]);
+    GLStateCache::BindFramebuffer(GL_FRAMEBUFFER_EXT, prevFbo);
+    GLStateCache::Viewport(prevDims[0], prevDims[1], prevDims[2], prevDims[3]);
     CHECK_FOR_GL_ERROR();
 
     // Reset viewing volume
@@ -121,83 +163,372 @@ void ShadowLightPostProcessNode::DepthRenderer::Render(Renderers::RenderingEvent
 
 }
 
-void ShadowLightPostProcessNode::DepthRenderer::VisitTransformationNode(TransformationNode* node) {
-    // push transformation matrix
-    Matrix<4,4,float> m = node->GetTransformationMatrix();
-    float f[16];
-    m.ToArray(f);
-    glPushMatrix();
-    glMultMatrixf(f);
-    CHECK_FOR_GL_ERROR();
-    //Matrix<4, 4, float> oldModelView = currentModelViewMatrix;
-    //currentModelViewMatrix = m * currentModelViewMatrix;
-    // traverse sub nodes
-    node->VisitSubNodes(*this);
-    CHECK_FOR_GL_ERROR();
-    // pop transformation matrix
-    glPopMatrix();
-    //currentModelViewMatrix = oldModelView;
-    CHECK_FOR_GL_ERROR();
-}
+/**
+ * Collect the meshes under the shadow node with their model
+ * matrices and world bounding spheres. A mesh is static when its
+ * model matrix has not changed for a number of frames.
+ */
+void ShadowLightPostProcessNode::DepthRenderer::Collect() {
+    draws.clear();
+    model = Matrix<4,4,float>();
+    ++frame;
+    shadowNode->Accept(*this);
 
-void ShadowLightPostProcessNode::DepthRenderer::VisitMeshNode(MeshNode* node) {
-    MeshPtr mesh = node->GetMesh();
-    GeometrySetPtr geom = mesh->GetGeometrySet();
+    // forget the meshes that are no longer in the scene.
+    std::map<ISceneNode*, Tracked>::iterator itr = tracked.begin();
+    while (itr != tracked.end()) {
+        if (itr->second.seen != frame) tracked.erase(itr++);
+        else ++itr;
+    }
+}
 
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glDisableClientState(GL_COLOR_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glEnableClientState(GL_VERTEX_ARRAY);
+/**
+ * Get the light space depth of the collected caster nearest to the
+ * light. Casters without bounds are left out.
+ *
+ * @param light Light view matrix, column major.
+ * @return The largest z of a caster, -1e30 if there is none.
+ */
+float ShadowLightPostProcessNode::DepthRenderer::GetNearestCaster(const float* light) {
+    float z = -1e30f;
+    for (unsigned int i = 0; i < draws.size(); ++i) {
+        const Draw& draw = draws[i];
+        if (!draw.bounded) continue;
+        const Vector<3,float>& c = draw.center;
+        z = std::max(z, light[2] * c[0] + light[6] * c[1] +
+                     light[10] * c[2] + light[14] + draw.radius);
+    }
+    return z;
+}
 
-    IDataBlockPtr v = geom->GetVertices();
+// Sphere against the clip planes of a column major projection.
+static bool Intersects(const float* m, const Vector<3,float>& c, float r) {
+    for (unsigned int i = 0; i < 6; ++i) {
+        unsigned int row = i / 2;
+        float sign = (i % 2) ? -1.0f : 1.0f;
+        float n[4];
+        for (unsigned int j = 0; j < 4; ++j)
+            n[j] = m[j*4+3] + sign * m[j*4+row];
+        float len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (n[0] * c[0] + n[1] * c[1] + n[2] * c[2] + n[3] < -r * len)
+            return false;
+    }
+    return true;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, v->GetID());
-    if (v->GetID() != 0)
-        glVertexPointer(v->GetDimension(), GL_FLOAT, 0, 0);
-    else
-        glVertexPointer(v->GetDimension(), GL_FLOAT, 0, v->GetVoidDataPtr());
+/**
+ * Draw the collected casters of a kind to the tile of each cascade
+ * they intersect.
+ */
+void ShadowLightPostProcessNode::DepthRenderer::DrawCascades(Kind kind) {
+    for (unsigned int c = 0; c < shadowNode->cascadeCount; ++c) {
+        Cascade& cascade = shadowNode->cascades[c];
+        Vector<4, int> v = cascade.viewport;
+        GLStateCache::Viewport(v[0], v[1], v[2], v[3]);
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(cascade.matrix);
+        glMatrixMode(GL_MODELVIEW);
+        CHECK_FOR_GL_ERROR();
+        for (unsigned int i = 0; i < draws.size(); ++i) {
+            Draw& draw = draws[i];
+            if ((kind == STATIC && !draw.isStatic) ||
+                (kind == DYNAMIC && draw.isStatic))
+                continue;
+            if (draw.bounded && !Intersects(cascade.matrix, draw.center, draw.radius)) {
+                ++shadowNode->culled;
+                continue;
+            }
+            depthOnly->Add(draw.mesh.get(), draw.model);
+        }
+        depthOnly->Flush();
+    }
+}
 
+/**
+ * Check if the cached static depth is up to date, and remember the
+ * state it is rendered with from now on.
+ *
+ * @return True if the cache can be used.
+ */
+bool ShadowLightPostProcessNode::DepthRenderer::UpdateCache() {
+    std::vector<ISceneNode*> statics;
+    for (unsigned int i = 0; i < draws.size(); ++i)
+        if (draws[i].isStatic) statics.push_back(draws[i].node);
+
+    bool valid = shadowNode->cacheValid && statics == cached;
+    for (unsigned int c = 0; c < shadowNode->cascadeCount; ++c) {
+        float* m = shadowNode->cascades[c].matrix;
+        valid = valid && std::equal(m, m + 16, cachedMatrices[c]);
+        std::copy(m, m + 16, cachedMatrices[c]);
+    }
+    cached.swap(statics);
+    shadowNode->cacheValid = true;
+    return valid;
+}
 
+void ShadowLightPostProcessNode::DepthRenderer::CopyDepth(GLuint from, GLuint to) {
+    Vector<2, int> dims = shadowNode->shadowDims;
+    GLStateCache::BindFramebuffer(GL_READ_FRAMEBUFFER_EXT, from);
+    GLStateCache::BindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, to);
+    glBlitFramebufferEXT(0, 0, dims[0], dims[1], 0, 0, dims[0], dims[1],
+                         GL_DEPTH_BUFFER_BIT, GL_NEAREST);
     CHECK_FOR_GL_ERROR();
+}
 
-    IndicesPtr indexBuffer = mesh->GetIndices();
-    GLsizei count = mesh->GetDrawingRange();
-    unsigned int offset = mesh->GetIndexOffset();
-    Geometry::Type type = mesh->GetType();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GetID());
-    if (indexBuffer->GetID() != 0){
-        glDrawElements(type, count, GL_UNSIGNED_INT, (GLvoid*)(offset * sizeof(GLuint)));
-    }else{
-        glDrawElements(type, count, GL_UNSIGNED_INT, indexBuffer->GetData() + offset);
-    }
+void ShadowLightPostProcessNode::DepthRenderer::VisitTransformationNode(TransformationNode* node) {
+    Matrix<4,4,float> oldModel = model;
+    model = node->GetTransformationMatrix() * model;
+    node->VisitSubNodes(*this);
+    model = oldModel;
+}
 
+/**
+ * Track the model matrix of a node.
+ *
+ * @return True if the node has kept its model matrix long enough to
+ *         be cached as static.
+ */
+bool ShadowLightPostProcessNode::DepthRenderer::Track(ISceneNode* node, const float m[16]) {
+    // a node reached twice in a frame is treated as dynamic.
+    Tracked& t = tracked[node];
+    if (t.seen == frame) return false;
+    if (std::equal(m, m + 16, t.model)) ++t.stable;
+    else t.stable = 0;
+    std::copy(m, m + 16, t.model);
+    t.seen = frame;
+    return t.stable >= STABLE_FRAMES;
+}
 
+/**
+ * Collect a mesh drawn with the current model matrix.
+ *
+ * @param node Node holding the mesh.
+ * @param mesh Mesh to draw.
+ * @param b Bounds of the mesh in model space.
+ * @param isStatic True if the mesh may be cached.
+ */
+void ShadowLightPostProcessNode::DepthRenderer::AddDraw(ISceneNode* node, MeshPtr mesh,
+                                                        const Bounds& b, bool isStatic) {
+    Draw draw;
+    draw.node = node;
+    draw.mesh = mesh;
+    draw.isStatic = isStatic;
+    model.ToArray(draw.model);
+    const float* m = draw.model;
+
+    draw.bounded = b.valid;
+    if (b.valid) {
+        Vector<3,float> c = b.center;
+        float scale = 0.0f;
+        for (unsigned int j = 0; j < 3; ++j) {
+            draw.center[j] = m[j] * c[0] + m[4+j] * c[1] + m[8+j] * c[2] + m[12+j];
+            scale = std::max(scale, m[j*4] * m[j*4] + m[j*4+1] * m[j*4+1] +
+                             m[j*4+2] * m[j*4+2]);
+        }
+        draw.radius = b.radius * sqrt(scale);
+    }
+    draws.push_back(draw);
+}
 
+void ShadowLightPostProcessNode::DepthRenderer::VisitMeshNode(MeshNode* node) {
+    float m[16];
+    model.ToArray(m);
+    MeshPtr mesh = node->GetMesh();
+    AddDraw(node, mesh, GeometryBounds::Get(mesh->GetGeometrySet()->GetVertices().get()),
+            Track(node, m));
     node->VisitSubNodes(*this);
-    CHECK_FOR_GL_ERROR();
 }
 
-
+void ShadowLightPostProcessNode::DepthRenderer::VisitStaticBatchNode(StaticBatchNode* node) {
+    float m[16];
+    model.ToArray(m);
+    bool isStatic = Track(node, m);
+    const std::vector<MeshPtr>& meshes = node->GetMeshes();
+    for (unsigned int i = 0; i < meshes.size(); ++i)
+        AddDraw(node, meshes[i], node->GetBounds(), isStatic);
+    node->VisitSubNodes(*this);
+}
 
 ShadowLightPostProcessNode::ShadowLightPostProcessNode(IShaderResourcePtr s,
                                                        Vector<2,int> dims,
                                                        Vector<2,int> shadowDims)
-: PostProcessNode(s, dims, 1, true),viewingVolume(NULL),shadowDims(shadowDims) {
+: PostProcessNode(s, dims, 1, true),viewingVolume(NULL),shadowDims(shadowDims)
+, cascadeCount(1), splitLambda(0.5f), shadowDistance(0.0f)
+, cacheFB(NULL), cacheValid(false), culled(0) {
     depthFB = new FrameBuffer(shadowDims,0,true);
+    SetCascades(1);
     depthRenderer = new DepthRenderer(this);
 
     GetEffect()->SetTexture("shadow", depthFB->GetDepthTexture());
 }
 
+ShadowLightPostProcessNode::~ShadowLightPostProcessNode() {
+    delete depthRenderer;
+    delete cacheFB;
+    for (unsigned int i = 0; i < oldCacheFBs.size(); ++i)
+        delete oldCacheFBs[i];
+}
+
 void ShadowLightPostProcessNode::SetViewingVolume(IViewingVolume* v) {
     viewingVolume = v;
 }
 
+/**
+ * Split the camera frustum into cascades. The split distances blend
+ * a logarithmic and a uniform distribution.
+ *
+ * @param count Number of cascades, one disables cascading.
+ * @param lambda Weight of the logarithmic distribution, from 0 to 1.
+ */
+void ShadowLightPostProcessNode::SetCascades(unsigned int count, float lambda) {
+    cascadeCount = std::max(1u, std::min(count, MAX_CASCADES));
+    splitLambda = lambda;
+
+    // tiles of the shadow map, two by two at most.
+    unsigned int cols = cascadeCount > 1 ? 2 : 1;
+    unsigned int rows = cascadeCount > 2 ? 2 : 1;
+    int w = shadowDims[0] / cols, h = shadowDims[1] / rows;
+    for (unsigned int i = 0; i < cascadeCount; ++i)
+        cascades[i].viewport = Vector<4, int>((i % cols) * w, (i / cols) * h, w, h);
+}
+
+unsigned int ShadowLightPostProcessNode::GetCascades() {
+    return cascadeCount;
+}
+
+/**
+ * Limit the distance from the camera covered by the cascades. Zero,
+ * the default, covers the camera frustum.
+ */
+void ShadowLightPostProcessNode::SetShadowDistance(float distance) {
+    shadowDistance = distance;
+}
+
+/**
+ * Keep the depth of static shadow casters between frames. Disabled
+ * by default.
+ */
+void ShadowLightPostProcessNode::SetStaticCaching(bool enabled) {
+    if (enabled && cacheFB == NULL)
+        cacheFB = new FrameBuffer(shadowDims,0,true);
+    else if (!enabled && cacheFB != NULL) {
+        // a bound frame buffer is deleted by the next render.
+        if (cacheFB->GetID() == 0) delete cacheFB;
+        else oldCacheFBs.push_back(cacheFB);
+        cacheFB = NULL;
+    }
+    cacheValid = false;
+}
+
+/**
+ * Render the static shadow casters again in the next frame.
+ */
+void ShadowLightPostProcessNode::InvalidateShadowCache() {
+    cacheValid = false;
+}
+
+/**
+ * Get the number of meshes left out of the shadow map in the last
+ * frame, counted once per cascade.
+ */
+unsigned int ShadowLightPostProcessNode::GetCulledCasters() {
+    return culled;
+}
+
+// column major product a * b.
+static void Multiply(const float* a, const float* b, float* out) {
+    for (unsigned int c = 0; c < 4; ++c)
+        for (unsigned int r = 0; r < 4; ++r)
+            out[c*4+r] = a[r] * b[c*4] + a[4+r] * b[c*4+1] +
+                a[8+r] * b[c*4+2] + a[12+r] * b[c*4+3];
+}
+
+/**
+ * Fit an orthographic light projection to each slice of the camera
+ * frustum.
+ */
+void ShadowLightPostProcessNode::FitCascades(IViewingVolume& camera) {
+    float view[16], proj[16], light[16];
+    camera.GetViewMatrix().ToArray(view);
+    camera.GetProjectionMatrix().ToArray(proj);
+    viewingVolume->GetViewMatrix().ToArray(light);
+    float casterZ = depthRenderer->GetNearestCaster(light);
+
+    // frustum shape from the perspective projection.
+    float tanX = 1.0f / proj[0], tanY = 1.0f / proj[5];
+    float zNear = proj[14] / (proj[10] - 1.0f);
+    float zFar = proj[14] / (proj[10] + 1.0f);
+    if (shadowDistance > 0.0f) zFar = std::min(zFar, shadowDistance);
+
+    float start = zNear;
+    for (unsigned int c = 0; c < cascadeCount; ++c) {
+        Cascade& cascade = cascades[c];
+        float i = float(c + 1) / cascadeCount;
+        float end = splitLambda * zNear * pow(zFar / zNear, i) +
+            (1.0f - splitLambda) * (zNear + (zFar - zNear) * i);
+        cascade.split = end;
+
+        // slice corners in light space.
+        float corners[8][3];
+        float center[3] = { 0.0f, 0.0f, 0.0f };
+        for (unsigned int k = 0; k < 8; ++k) {
+            float d = (k & 4) ? end : start;
+            float e[3] = { (k & 1 ? d : -d) * tanX, (k & 2 ? d : -d) * tanY, -d };
+            // eye to world with the inverse of the rigid view.
+            float w[3];
+            for (unsigned int j = 0; j < 3; ++j)
+                w[j] = view[j*4]   * (e[0] - view[12]) +
+                       view[j*4+1] * (e[1] - view[13]) +
+                       view[j*4+2] * (e[2] - view[14]);
+            for (unsigned int j = 0; j < 3; ++j) {
+                corners[k][j] = light[j] * w[0] + light[4+j] * w[1] +
+                    light[8+j] * w[2] + light[12+j];
+                center[j] += corners[k][j] * 0.125f;
+            }
+        }
+        start = end;
+
+        // The bounding sphere of the slice keeps its size when the
+        // camera turns, the radius is rounded up so it does not
+        // change with rounding errors either.
+        float radius = 0.0f;
+        for (unsigned int k = 0; k < 8; ++k) {
+            float d[3] = { corners[k][0] - center[0], corners[k][1] - center[1],
+                           corners[k][2] - center[2] };
+            radius = std::max(radius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        }
+        radius = std::max(ceil(sqrt(radius) * 16.0f), 1.0f) / 16.0f;
+
+        // snap the origin to whole texels so the shadows do not
+        // shimmer when the camera moves.
+        Vector<4, int> v = cascade.viewport;
+        float unitX = 2.0f * radius / v[2], unitY = 2.0f * radius / v[3];
+        float left = floor((center[0] - radius) / unitX) * unitX;
+        float bottom = floor((center[1] - radius) / unitY) * unitY;
+
+        // The volume starts at the nearest caster toward the light,
+        // rounded up to the radius so moving casters rarely change
+        // it, or at the light if that is nearer.
+        float farZ = center[2] - radius;
+        float nearZ = std::max(std::max(center[2] + radius, 0.0f), casterZ);
+        nearZ = ceil(nearZ / radius) * radius;
+        float ortho[16] = {0};
+        ortho[0] = 1.0f / radius;
+        ortho[5] = 1.0f / radius;
+        ortho[10] = -2.0f / (nearZ - farZ);
+        ortho[12] = -(left / radius + 1.0f);
+        ortho[13] = -(bottom / radius + 1.0f);
+        ortho[14] = (nearZ + farZ) / (nearZ - farZ);
+        ortho[15] = 1.0f;
+        Multiply(ortho, light, cascade.matrix);
+    }
+}
+
 void ShadowLightPostProcessNode::Initialize(Renderers::RenderingEventArg arg) {
     //depthFB->GetDepthTexture()->SetMipmapping(true);
     arg.renderer.BindFrameBuffer(depthFB);
 
-    glBindTexture(GL_TEXTURE_2D,depthFB->GetDepthTexture()->GetID());
+    TextureUnitCache::Bind(GL_TEXTURE_2D,depthFB->GetDepthTexture()->GetID());
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_COMPARE_R_TO_TEXTURE_ARB);
     // GL_LINEAR does not make sense for depth texture. However, next tutorial shows usage of GL_LINEAR and PCF
@@ -212,6 +543,15 @@ void ShadowLightPostProcessNode::Initialize(Renderers::RenderingEventArg arg) {
 
 void ShadowLightPostProcessNode::Handle(Renderers::RenderingEventArg arg) {
     if (arg.renderer.GetCurrentStage() == Renderers::IRenderer::RENDERER_PREPROCESS) {
+        depthRenderer->Collect();
+        if (cascadeCount > 1)
+            FitCascades(*(arg.canvas.GetViewingVolume()));
+        else {
+            float view[16], proj[16];
+            viewingVolume->GetViewMatrix().ToArray(view);
+            viewingVolume->GetProjectionMatrix().ToArray(proj);
+            Multiply(proj, view, cascades[0].matrix);
+        }
         depthRenderer->Render(arg);
 
         Matrix<4,4,float> bias(.5, .0, .0,  .0,
@@ -224,6 +564,45 @@ void ShadowLightPostProcessNode::Handle(Renderers::RenderingEventArg arg) {
                                 viewingVolume->GetViewMatrix() *
                                 viewingVolume->GetProjectionMatrix() *
                                 bias);
+
+        if (cascadeCount > 1) {
+            Vector<4, float> splits(0.0f);
+            for (unsigned int c = 0; c < cascadeCount; ++c) {
+                // scale and offset from clip space to the tile.
+                Cascade& cascade = cascades[c];
+                float sx = float(cascade.viewport[2]) / shadowDims[0];
+                float sy = float(cascade.viewport[3]) / shadowDims[1];
+                float ox = float(cascade.viewport[0]) / shadowDims[0];
+                float oy = float(cascade.viewport[1]) / shadowDims[1];
+                float tile[16] = { .5f * sx, .0f, .0f, .0f,
+                                   .0f, .5f * sy, .0f, .0f,
+                                   .0f, .0f, .5f, .0f,
+                                   .5f * sx + ox, .5f * sy + oy, .5f, 1.0f };
+                float m[16];
+                Multiply(tile, cascade.matrix, m);
+                std::string name = "cascadeMat[" + Utils::Convert::ToString<unsigned int>(c) + "]";
+                GetEffect()->SetUniform(name, Matrix<4,4,float>(m[0],  m[1],  m[2],  m[3],
+                                                                m[4],  m[5],  m[6],  m[7],
+                                                                m[8],  m[9],  m[10], m[11],
+                                                                m[12], m[13], m[14], m[15]));
+                splits[c] = cascade.split;
+            }
+            GetEffect()->SetUniform("cascadeSplits", splits);
+            GetEffect()->SetUniform("cascades", int(cascadeCount));
+        }
+    }
+    // Delete the cache frame buffers while the context is current,
+    // the cache is bound again if the renderer is initialized anew.
+    else if (arg.renderer.GetCurrentStage() == Renderers::IRenderer::RENDERER_DEINITIALIZE) {
+        Renderers::OpenGL::Renderer* glRenderer =
+            dynamic_cast<Renderers::OpenGL::Renderer*>(&arg.renderer);
+        for (unsigned int i = 0; i < oldCacheFBs.size(); ++i) {
+            if (glRenderer) glRenderer->UnbindFrameBuffer(oldCacheFBs[i]);
+            delete oldCacheFBs[i];
+        }
+        oldCacheFBs.clear();
+        if (glRenderer && cacheFB != NULL) glRenderer->UnbindFrameBuffer(cacheFB);
+        cacheValid = false;
     }
     PostProcessNode::Handle(arg);
 }
@@ -14,41 +14,151 @@
 #include <Scene/PostProcessNode.h>
 #include <Display/IViewingVolume.h>
 #include <Resources/FrameBuffer.h>
+#include <Geometry/Mesh.h>
+#include <Math/Matrix.h>
+#include <Meta/OpenGL.h>
+#include <map>
+#include <vector>
 
 
 namespace OpenEngine {
+    namespace Renderers {
+        namespace OpenGL {
+            class DepthOnlyRenderer;
+            struct Bounds;
+        }
+    }
 namespace Scene {
 
 /**
- * Short description.
+ * Post process node with a shadow map rendered from a light.
+ *
+ * The shadow map is rendered from the viewing volume of the light
+ * before the scene, and the effect gets it as the texture "shadow"
+ * along with the matrix "lightMat" from world to shadow map
+ * coordinates.
+ *
+ * In cascaded mode the camera frustum is split into up to four
+ * slices, each covered by an orthographic projection along the
+ * light direction around the bounding sphere of the slice. Its
+ * extent does not change as the camera turns and its origin is
+ * snapped to whole texels. The projection reaches back toward the
+ * light to the nearest shadow caster. The cascades are tiles of the
+ * shadow map, rendered from one traversal of the scene. The effect
+ * gets the matrices "cascadeMat[i]" from world to shadow map
+ * coordinates of each tile, the vec4 "cascadeSplits" with the camera
+ * distance of the far end of each slice, and the int "cascades".
+ *
+ * Meshes outside the light frustum, or the tile of a cascade, are
+ * not drawn to the shadow map. With static caching enabled, meshes
+ * whose model matrix has not changed for a number of frames are
+ * static. Their depth is kept in a second buffer and copied to the
+ * shadow map each frame, before the dynamic meshes are drawn. The
+ * cache is rendered again when the light projection, the cascades
+ * or the set of static meshes change, or on InvalidateShadowCache
+ * when static meshes are changed in other ways.
  *
  * @class ShadowLightPostProcessNode ShadowLightPostProcessNode.h ons/OpenGLRenderer/Scene/ShadowLightPostProcessNode.h
  */
 class ShadowLightPostProcessNode : public PostProcessNode {
+public:
+    static const unsigned int MAX_CASCADES = 4;
+
 private:
     class DepthRenderer : public ISceneNodeVisitor {
+        enum Kind { ALL, STATIC, DYNAMIC };
+        /**
+         * A mesh with its model matrix and world bounding sphere.
+         */
+        struct Draw {
+            // mesh or static batch node holding the mesh.
+            ISceneNode* node;
+            Geometry::MeshPtr mesh;
+            float model[16];
+            Math::Vector<3, float> center;
+            float radius;
+            bool bounded, isStatic;
+        };
+        /**
+         * Model matrix of a mesh in the previous frame and the number
+         * of frames it has been unchanged.
+         */
+        struct Tracked {
+            float model[16];
+            unsigned int stable, seen;
+            Tracked() : stable(0), seen(0) {}
+        };
         ShadowLightPostProcessNode* shadowNode;
+        Renderers::OpenGL::DepthOnlyRenderer* depthOnly;
+        // meshes collected for the current frame.
+        std::vector<Draw> draws;
+        std::map<ISceneNode*, Tracked> tracked;
+        // static meshes and cascade matrices in the cached depth.
+        std::vector<ISceneNode*> cached;
+        float cachedMatrices[MAX_CASCADES][16];
+        Math::Matrix<4,4,float> model;
+        unsigned int frame;
+
+        void DrawCascades(Kind kind);
+        bool UpdateCache();
+        void CopyDepth(GLuint from, GLuint to);
+        bool Track(ISceneNode* node, const float model[16]);
+        void AddDraw(ISceneNode* node, Geometry::MeshPtr mesh,
+                     const Renderers::OpenGL::Bounds& b, bool isStatic);
     public:
         DepthRenderer(ShadowLightPostProcessNode* n);
+        void Collect();
+        float GetNearestCaster(const float* light);
         void Render(Renderers::RenderingEventArg arg);
 
         void VisitTransformationNode(TransformationNode* node);
         void VisitMeshNode(MeshNode* node);
+        void VisitStaticBatchNode(StaticBatchNode* node);
         void ApplyViewingVolume(Display::IViewingVolume& volume);
     };
 
+    /**
+     * A slice of the camera frustum with its own light projection
+     * and tile of the shadow map.
+     */
+    struct Cascade {
+        // light view and projection, column major.
+        float matrix[16];
+        // distance from the camera to the far end of the slice.
+        float split;
+        Math::Vector<4, int> viewport;
+    };
+
     DepthRenderer* depthRenderer;
     Display::IViewingVolume* viewingVolume;
     Resources::FrameBuffer* depthFB;
+    // depth of the static casters, NULL when caching is disabled.
+    Resources::FrameBuffer* cacheFB;
+    // cache frame buffers to delete while the context is current.
+    std::vector<Resources::FrameBuffer*> oldCacheFBs;
+    bool cacheValid;
+    unsigned int culled;
     Vector<2, int> shadowDims;
+    unsigned int cascadeCount;
+    float splitLambda, shadowDistance;
+    Cascade cascades[MAX_CASCADES];
+
+    void FitCascades(Display::IViewingVolume& camera);
 public:
     ShadowLightPostProcessNode(Resources::IShaderResourcePtr shader,
                                Math::Vector<2, int> dims,
                                Math::Vector<2, int> shadowDims);
+    ~ShadowLightPostProcessNode();
     void Handle(Renderers::RenderingEventArg arg);
     void Initialize(Renderers::RenderingEventArg arg);
 
     void SetViewingVolume(Display::IViewingVolume* v);
+    void SetCascades(unsigned int count, float lambda = 0.5f);
+    unsigned int GetCascades();
+    void SetShadowDistance(float distance);
+    void SetStaticCaching(bool enabled);
+    void InvalidateShadowCache();
+    unsigned int GetCulledCasters();
 };
 } // NS Scene
 } // NS OpenEngine
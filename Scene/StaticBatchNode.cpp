@@ -0,0 +1,55 @@
+// OpenGL static batch node.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include <Scene/StaticBatchNode.h>
+
+namespace OpenEngine {
+    namespace Scene {
+
+/**
+ * Default constructor to satisfy scene node requirements. Creates
+ * an empty batch.
+ */
+StaticBatchNode::StaticBatchNode() {
+    bounds.radius = 0.0f;
+    bounds.valid = false;
+}
+
+/**
+ * Create a static batch node.
+ *
+ * @param meshes Baked meshes, one per material.
+ * @param bounds Bounds of the baked vertices.
+ */
+StaticBatchNode::StaticBatchNode(std::vector<MeshPtr> meshes, Bounds bounds)
+    : meshes(meshes)
+    , bounds(bounds) {}
+
+StaticBatchNode::~StaticBatchNode() {}
+
+/**
+ * Get the baked meshes.
+ *
+ * @return Meshes sharing one geometry set and index block.
+ */
+const std::vector<MeshPtr>& StaticBatchNode::GetMeshes() {
+    return meshes;
+}
+
+/**
+ * Get the bounds of the baked vertices in the space of the node.
+ *
+ * @return Bounds, not valid for an empty batch.
+ */
+const Bounds& StaticBatchNode::GetBounds() {
+    return bounds;
+}
+
+}
+}
@@ -0,0 +1,56 @@
+// OpenGL static batch node.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OE_STATIC_BATCH_NODE_H_
+#define _OE_STATIC_BATCH_NODE_H_
+
+#include <Scene/ISceneNode.h>
+#include <Geometry/Mesh.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <vector>
+
+namespace OpenEngine {
+namespace Scene { 
+
+using Geometry::MeshPtr;
+using Renderers::OpenGL::Bounds;
+
+/**
+ * Static geometry baked into shared buffers.
+ *
+ * The vertices are transformed into the space of the node, and the
+ * meshes, one per material, share a geometry set and an index
+ * block. The rendering view draws the node with one call per mesh.
+ * The bounds of the baked vertices are kept with the node, so the
+ * batch is culled as a whole even when its vertices are no longer
+ * in client memory.
+ *
+ * @see StaticBatchTransformer
+ * @class StaticBatchNode StaticBatchNode.h Scene/StaticBatchNode.h
+ */
+class StaticBatchNode : public ISceneNode {
+    OE_SCENE_NODE(StaticBatchNode, ISceneNode)
+
+public:
+    StaticBatchNode();
+    StaticBatchNode(std::vector<MeshPtr> meshes, Bounds bounds);
+    ~StaticBatchNode();
+    const std::vector<MeshPtr>& GetMeshes();
+    const Bounds& GetBounds();
+
+private:
+    std::vector<MeshPtr> meshes;
+    Bounds bounds;
+
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _OE_STATIC_BATCH_NODE_H_
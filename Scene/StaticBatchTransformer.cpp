@@ -0,0 +1,446 @@
+// Static batch transformer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//---------------------------------------------------------------------
+
+#include <Scene/StaticBatchTransformer.h>
+
+#include <Renderers/IRenderer.h>
+#include <Renderers/OpenGL/GeometryBounds.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/MeshNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/VertexArrayNode.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/VertexArray.h>
+#include <Geometry/Mesh.h>
+#include <Geometry/GeometrySet.h>
+#include <Resources/DataBlock.h>
+#include <Resources/Indices.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+
+namespace OpenEngine {
+namespace Scene {
+
+    using namespace OpenEngine::Geometry;
+    using namespace OpenEngine::Resources;
+
+    // Texture coordinate of vertices without one.
+    static const float DEFAULT_TEXCOORD[2] = {0.0f, 0.0f};
+    // Normal and color of vertices without one, the initial current
+    // normal and color of OpenGL.
+    static const float DEFAULT_NORMAL[3] = {0.0f, 0.0f, 1.0f};
+    static const float DEFAULT_COLOR[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    // Orders the pieces of a cell by the appearance of their material.
+    struct PieceOrder {
+        template <class T>
+        bool operator()(const T& a, const T& b) const {
+            return a.first < b.first;
+        }
+    };
+
+    StaticBatchTransformer::StaticBatchTransformer(IRenderer& renderer)
+        : renderer(renderer)
+        , maxVertices(65536)
+        , cellSize(0.0f)
+        , skipped(0) {
+    }
+
+    StaticBatchTransformer::~StaticBatchTransformer() {
+        Clear();
+    }
+
+    /**
+     * Set the maximum number of vertices in a batch. Defaults to
+     * 65536.
+     */
+    void StaticBatchTransformer::SetMaximumVertices(unsigned int vertices) {
+        maxVertices = vertices;
+    }
+
+    /**
+     * Set the size of the grid cells used to cluster the geometry,
+     * zero to merge all geometry regardless of its position. Defaults
+     * to zero.
+     */
+    void StaticBatchTransformer::SetCellSize(float size) {
+        cellSize = size;
+    }
+
+    void StaticBatchTransformer::Clear() {
+        for (unsigned int i = 0; i < pieces.size(); ++i)
+            delete pieces[i];
+        pieces.clear();
+        current.clear();
+        baked.clear();
+        skipped = 0;
+    }
+
+    /**
+     * Bake the static geometry below a node into batch nodes added
+     * to it.
+     *
+     * @param node Root of the sub tree to bake.
+     * @return The batch nodes, empty if nothing could be baked.
+     */
+    std::vector<StaticBatchNode*> StaticBatchTransformer::Transform(ISceneNode& node) {
+        std::vector<StaticBatchNode*> batches;
+        Clear();
+        SetTransform(Matrix<4,4,float>());
+
+        // Bake relative to the root, so its own transformation is
+        // not applied.
+        node.VisitSubNodes(*this);
+        if (skipped > 0)
+            logger.info << "StaticBatchTransformer: left " << skipped
+                        << " meshes unbaked" << logger.end;
+        if (baked.empty()) return batches;
+
+        for (unsigned int i = 0; i < baked.size(); ++i) {
+            baked[i]->GetParent()->RemoveNode(baked[i]);
+            delete baked[i];
+        }
+
+        // Material order of appearance, keeping the draw order of
+        // the materials within a batch.
+        std::map<Material*, unsigned int> order;
+        for (unsigned int i = 0; i < pieces.size(); ++i)
+            order.insert(std::make_pair(pieces[i]->mat.get(), order.size()));
+
+        // Cluster the pieces by the grid cell of their center.
+        typedef std::pair<int, std::pair<int, int> > Cell;
+        std::map<Cell, std::vector<std::pair<unsigned int, Piece*> > > cells;
+        for (unsigned int i = 0; i < pieces.size(); ++i) {
+            Piece* piece = pieces[i];
+            if (piece->indices.empty()) continue;
+            Cell cell(0, std::make_pair(0, 0));
+            if (cellSize > 0.0f) {
+                float lo[3], hi[3];
+                for (unsigned int k = 0; k < 3; ++k)
+                    lo[k] = hi[k] = piece->pos[k];
+                for (unsigned int v = 3; v < piece->pos.size(); v += 3)
+                    for (unsigned int k = 0; k < 3; ++k) {
+                        lo[k] = std::min(lo[k], piece->pos[v + k]);
+                        hi[k] = std::max(hi[k], piece->pos[v + k]);
+                    }
+                int c[3];
+                for (unsigned int k = 0; k < 3; ++k)
+                    c[k] = (int)floor((lo[k] + hi[k]) * 0.5f / cellSize);
+                cell = Cell(c[0], std::make_pair(c[1], c[2]));
+            }
+            cells[cell].push_back(std::make_pair(order[piece->mat.get()], piece));
+        }
+
+        // Fill batches from each cell, grouped by material.
+        std::vector<Piece*> batch;
+        unsigned int vertices = 0, meshes = 0;
+        for (std::map<Cell, std::vector<std::pair<unsigned int, Piece*> > >::iterator 
+                 itr = cells.begin(); itr != cells.end(); ++itr) {
+            std::vector<std::pair<unsigned int, Piece*> >& list = itr->second;
+            std::stable_sort(list.begin(), list.end(), PieceOrder());
+            batch.clear();
+            vertices = 0;
+            for (unsigned int i = 0; i < list.size(); ++i) {
+                Piece* piece = list[i].second;
+                unsigned int size = piece->pos.size() / 3;
+                if (!batch.empty() && vertices + size > maxVertices) {
+                    batches.push_back(Build(batch));
+                    batch.clear();
+                    vertices = 0;
+                }
+                batch.push_back(piece);
+                vertices += size;
+            }
+            if (!batch.empty()) batches.push_back(Build(batch));
+        }
+
+        for (unsigned int i = 0; i < batches.size(); ++i) {
+            node.AddNode(batches[i]);
+            meshes += batches[i]->GetMeshes().size();
+        }
+
+        logger.info << "StaticBatchTransformer: baked " << baked.size()
+                    << " nodes into " << batches.size() << " batches of "
+                    << meshes << " meshes" << logger.end;
+
+        Clear();
+        return batches;
+    }
+
+    /**
+     * Build a batch node from pieces sorted by material.
+     */
+    StaticBatchNode* StaticBatchTransformer::Build(const std::vector<Piece*>& batch) {
+        unsigned int size = 0, count = 0;
+        for (unsigned int i = 0; i < batch.size(); ++i) {
+            size += batch[i]->pos.size() / 3;
+            count += batch[i]->indices.size();
+        }
+
+        float* p = new float[size * 3];
+        float* n = new float[size * 3];
+        float* t = new float[size * 2];
+        float* c = new float[size * 4];
+        unsigned int* data = new unsigned int[count];
+
+        IDataBlockList tcs;
+        tcs.push_back(IDataBlockPtr(new DataBlock<2,float>(size, t)));
+        GeometrySetPtr geom(new GeometrySet(IDataBlockPtr(new DataBlock<3,float>(size, p)),
+                                            IDataBlockPtr(new DataBlock<3,float>(size, n)),
+                                            tcs,
+                                            IDataBlockPtr(new DataBlock<4,float>(size, c))));
+        IndicesPtr indices(new Indices(count, data));
+
+        std::vector<MeshPtr> meshes;
+        unsigned int base = 0, offset = 0, start = 0;
+        for (unsigned int i = 0; i < batch.size(); ++i) {
+            Piece* piece = batch[i];
+            p = std::copy(piece->pos.begin(), piece->pos.end(), p);
+            n = std::copy(piece->norm.begin(), piece->norm.end(), n);
+            t = std::copy(piece->texc.begin(), piece->texc.end(), t);
+            c = std::copy(piece->colr.begin(), piece->colr.end(), c);
+            for (unsigned int k = 0; k < piece->indices.size(); ++k)
+                data[offset++] = base + piece->indices[k];
+            base += piece->pos.size() / 3;
+
+            // One mesh per run of batch sharing a material.
+            if (i + 1 == batch.size() || batch[i + 1]->mat != piece->mat) {
+                meshes.push_back(MeshPtr(new Mesh(indices, Geometry::TRIANGLES, geom,
+                                                  piece->mat, start, offset - start)));
+                start = offset;
+            }
+        }
+
+        // Keep the bounds before the vertices may leave memory.
+        Renderers::OpenGL::Bounds bounds = Renderers::OpenGL::GeometryBounds::Compute
+            ((const float*)geom->GetVertices()->GetVoidDataPtr(), size, 3);
+
+        renderer.BindDataBlock(geom->GetVertices().get());
+        renderer.BindDataBlock(geom->GetNormals().get());
+        renderer.BindDataBlock(geom->GetColors().get());
+        renderer.BindDataBlock(tcs.front().get());
+        renderer.BindDataBlock(indices.get());
+
+        return new StaticBatchNode(meshes, bounds);
+    }
+
+    /**
+     * Set the transformation into the space of the root and its
+     * normal matrix, the cofactors of the upper 3x3 part.
+     */
+    void StaticBatchTransformer::SetTransform(Matrix<4,4,float> transform) {
+        this->transform = transform;
+        transform.ToArray(m);
+
+        float a[3][3];
+        for (unsigned int r = 0; r < 3; ++r)
+            for (unsigned int c = 0; c < 3; ++c)
+                a[r][c] = m[c * 4 + r];
+        for (unsigned int r = 0; r < 3; ++r)
+            for (unsigned int c = 0; c < 3; ++c)
+                nm[r * 3 + c] = 
+                    a[(r+1)%3][(c+1)%3] * a[(r+2)%3][(c+2)%3] -
+                    a[(r+1)%3][(c+2)%3] * a[(r+2)%3][(c+1)%3];
+
+        // Mirroring transformations flip the cofactors.
+        float det = a[0][0] * nm[0] + a[0][1] * nm[1] + a[0][2] * nm[2];
+        if (det < 0.0f)
+            for (unsigned int i = 0; i < 9; ++i) nm[i] = -nm[i];
+    }
+
+    /**
+     * Get the piece of the node being baked holding the geometry of
+     * a material.
+     */
+    StaticBatchTransformer::Piece& StaticBatchTransformer::GetPiece(MaterialPtr mat) {
+        Piece*& piece = current[mat.get()];
+        if (piece == NULL) {
+            piece = new Piece();
+            piece->mat = mat;
+            pieces.push_back(piece);
+        }
+        return *piece;
+    }
+
+    /**
+     * Mark a node as baked. Its pieces are complete.
+     */
+    void StaticBatchTransformer::EndNode(ISceneNode* node) {
+        baked.push_back(node);
+        current.clear();
+    }
+
+    void StaticBatchTransformer::AddVertex(Piece& piece,
+                                           const float* v, const float* n,
+                                           const float* t, const float* c,
+                                           unsigned int colors) {
+        std::vector<float>& pos = piece.pos;
+        std::vector<float>& norm = piece.norm;
+        std::vector<float>& texc = piece.texc;
+        std::vector<float>& colr = piece.colr;
+        pos.push_back(m[0] * v[0] + m[4] * v[1] + m[8]  * v[2] + m[12]);
+        pos.push_back(m[1] * v[0] + m[5] * v[1] + m[9]  * v[2] + m[13]);
+        pos.push_back(m[2] * v[0] + m[6] * v[1] + m[10] * v[2] + m[14]);
+
+        if (n == NULL) n = DEFAULT_NORMAL;
+        float tn[3];
+        for (unsigned int r = 0; r < 3; ++r)
+            tn[r] = nm[r * 3] * n[0] + nm[r * 3 + 1] * n[1] + nm[r * 3 + 2] * n[2];
+        float len = sqrt(tn[0] * tn[0] + tn[1] * tn[1] + tn[2] * tn[2]);
+        if (len > 0.0f) len = 1.0f / len;
+        norm.push_back(tn[0] * len);
+        norm.push_back(tn[1] * len);
+        norm.push_back(tn[2] * len);
+
+        if (t == NULL) t = DEFAULT_TEXCOORD;
+        texc.push_back(t[0]);
+        texc.push_back(t[1]);
+
+        if (c == NULL) {
+            c = DEFAULT_COLOR;
+            colors = 4;
+        }
+        colr.push_back(c[0]);
+        colr.push_back(c[1]);
+        colr.push_back(c[2]);
+        colr.push_back(colors > 3 ? c[3] : 1.0f);
+    }
+
+    /**
+     * Append the referenced vertices and the indices of a mesh.
+     *
+     * @return False if the mesh cannot be baked.
+     */
+    bool StaticBatchTransformer::Bake(MeshPtr mesh) {
+        if (mesh->GetType() != Geometry::TRIANGLES) return false;
+
+        GeometrySetPtr geom = mesh->GetGeometrySet();
+        IDataBlockPtr v = geom->GetVertices();
+        IDataBlockPtr n = geom->GetNormals();
+        IDataBlockPtr c = geom->GetColors();
+        IDataBlockList tcs = geom->GetTexCoords();
+        IDataBlockPtr t = tcs.empty() ? IDataBlockPtr() : tcs.front();
+        IndicesPtr indices = mesh->GetIndices();
+
+        // All data must still be in client memory, as floats. Meshes
+        // without normals or colors get the initial ones of OpenGL.
+        if (v == NULL || v->GetVoidDataPtr() == NULL || v->GetDimension() != 3 ||
+            v->GetType() != Types::FLOAT ||
+            indices == NULL || indices->GetData() == NULL)
+            return false;
+        if (n != NULL && (n->GetVoidDataPtr() == NULL || n->GetDimension() != 3 ||
+                          n->GetType() != Types::FLOAT))
+            return false;
+        if (c != NULL && (c->GetVoidDataPtr() == NULL || c->GetDimension() < 3 ||
+                          c->GetType() != Types::FLOAT))
+            return false;
+        if (tcs.size() > 1 || 
+            (t != NULL && (t->GetVoidDataPtr() == NULL || t->GetDimension() != 2 ||
+                           t->GetType() != Types::FLOAT)))
+            return false;
+
+        const float* vd = (const float*)v->GetVoidDataPtr();
+        const float* nd = n ? (const float*)n->GetVoidDataPtr() : NULL;
+        const float* cd = c ? (const float*)c->GetVoidDataPtr() : NULL;
+        const float* td = t ? (const float*)t->GetVoidDataPtr() : NULL;
+        const unsigned int cdim = c ? c->GetDimension() : 4;
+
+        // Copy only the vertices referenced by the drawing range.
+        std::vector<int> remap(v->GetSize(), -1);
+        Piece& piece = GetPiece(mesh->GetMaterial());
+        const unsigned int* index = indices->GetData() + mesh->GetIndexOffset();
+        for (unsigned int i = 0; i < mesh->GetDrawingRange(); ++i) {
+            unsigned int src = index[i];
+            if (remap[src] == -1) {
+                remap[src] = piece.pos.size() / 3;
+                AddVertex(piece, vd + src * 3, nd ? nd + src * 3 : NULL,
+                          td ? td + src * 2 : NULL,
+                          cd ? cd + src * cdim : NULL, cdim);
+            }
+            piece.indices.push_back(remap[src]);
+        }
+        return true;
+    }
+
+    void StaticBatchTransformer::VisitTransformationNode(TransformationNode* node) {
+        Matrix<4,4,float> old = transform;
+        SetTransform(node->GetTransformationMatrix() * old);
+        node->VisitSubNodes(*this);
+        SetTransform(old);
+    }
+
+    void StaticBatchTransformer::VisitMeshNode(MeshNode* node) {
+        // Meshes with children stay, their children may be baked.
+        if (node->GetNumberOfNodes() != 0) {
+            node->VisitSubNodes(*this);
+            return;
+        }
+        if (Bake(node->GetMesh())) EndNode(node);
+        else ++skipped;
+    }
+
+    void StaticBatchTransformer::VisitGeometryNode(GeometryNode* node) {
+        FaceSet* faces = node->GetFaceSet();
+        if (faces == NULL || node->GetNumberOfNodes() != 0) {
+            node->VisitSubNodes(*this);
+            return;
+        }
+        for (FaceList::iterator itr = faces->begin(); itr != faces->end(); ++itr) {
+            FacePtr f = *itr;
+            Piece& piece = GetPiece(f->mat);
+            for (unsigned int i = 0; i < 3; ++i) {
+                float v[3], n[3], t[2], c[4];
+                f->vert[i].ToArray(v);
+                f->norm[i].ToArray(n);
+                f->texc[i].ToArray(t);
+                f->colr[i].ToArray(c);
+                piece.indices.push_back(piece.pos.size() / 3);
+                AddVertex(piece, v, n, t, c, 4);
+            }
+        }
+        EndNode(node);
+    }
+
+    void StaticBatchTransformer::VisitVertexArrayNode(VertexArrayNode* node) {
+        if (node->GetNumberOfNodes() != 0) {
+            node->VisitSubNodes(*this);
+            return;
+        }
+        std::list<VertexArray*> arrays = node->GetVertexArrays();
+        for (std::list<VertexArray*>::iterator itr = arrays.begin(); 
+             itr != arrays.end(); ++itr) {
+            VertexArray* va = *itr;
+            const float* v = va->GetVertices();
+            const float* n = va->GetNormals();
+            const float* t = va->GetTexCoords();
+            const float* c = va->GetColors();
+            Piece& piece = GetPiece(va->mat);
+            const unsigned int count = va->GetNumFaces() * 3;
+            for (unsigned int i = 0; i < count; ++i) {
+                piece.indices.push_back(piece.pos.size() / 3);
+                AddVertex(piece, v + i * 3, n ? n + i * 3 : NULL,
+                          t ? t + i * 2 : NULL, c ? c + i * 4 : NULL, 4);
+            }
+        }
+        EndNode(node);
+    }
+
+    // Sub trees changing the render state are not baked.
+    void StaticBatchTransformer::VisitRenderStateNode(RenderStateNode* node) {}
+    void StaticBatchTransformer::VisitBlendingNode(BlendingNode* node) {}
+    void StaticBatchTransformer::VisitPostProcessNode(PostProcessNode* node) {}
+    void StaticBatchTransformer::VisitRenderNode(RenderNode* node) {}
+    void StaticBatchTransformer::VisitDisplayListNode(DisplayListNode* node) {}
+    void StaticBatchTransformer::VisitStaticBatchNode(StaticBatchNode* node) {}
+
+} // NS Scene
+} // NS OpenEngine
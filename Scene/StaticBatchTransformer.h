@@ -0,0 +1,119 @@
+// Static batch transformer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//---------------------------------------------------------------------
+
+#ifndef _STATIC_BATCH_TRANSFORMER_H_
+#define _STATIC_BATCH_TRANSFORMER_H_
+
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/StaticBatchNode.h>
+#include <Geometry/Material.h>
+#include <Math/Matrix.h>
+#include <map>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Renderers {
+        class IRenderer;
+    }
+    namespace Scene {
+
+using Renderers::IRenderer;
+using Geometry::Material;
+using Geometry::MaterialPtr;
+using Math::Matrix;
+
+/**
+ * Bakes the static geometry of a sub tree into StaticBatchNodes.
+ *
+ * Mesh, geometry and vertex array nodes below the root, reached
+ * through transformation nodes only, are transformed into the space
+ * of the root. The transformation nodes are assumed not to change.
+ * The geometry is merged into batch nodes, each with one geometry
+ * set and an index block grouped by material, so meshes sharing a
+ * material are drawn with one call per batch. The baked nodes are
+ * removed and the batch nodes are added to the root. The buffers
+ * are bound with the renderer, which must be initialized.
+ *
+ * The geometry is clustered by the grid cell holding its center, so
+ * every batch stays spatially compact and keeps tight bounds for
+ * culling. A batch is split when it would exceed the maximum number
+ * of vertices. A single mesh larger than the maximum gets a batch of
+ * its own.
+ *
+ * Sub trees of nodes changing the render state, such as render
+ * state, blending and post process nodes, are left untouched, as
+ * are geometry nodes with children, whose children may be baked,
+ * meshes whose data is no longer in client memory or not floats,
+ * meshes that are not triangle lists and meshes with more than one
+ * set of 2D texture coordinates. The number of meshes left is
+ * logged. Vertices without a normal or color get the initial normal
+ * and color of OpenGL. Within a batch, geometry sharing a material
+ * is drawn together, which matters only to blended geometry relying
+ * on its draw order.
+ *
+ * Replaces DisplayListTransformer, which depends on display lists.
+ *
+ * @class StaticBatchTransformer StaticBatchTransformer.h Scene/StaticBatchTransformer.h
+ */
+class StaticBatchTransformer : public ISceneNodeVisitor {
+ private:
+    // Geometry of one material from one baked node.
+    struct Piece {
+        MaterialPtr mat;
+        std::vector<float> pos, norm, texc, colr;
+        std::vector<unsigned int> indices;
+    };
+
+    IRenderer& renderer;
+    unsigned int maxVertices;
+    float cellSize;
+    Matrix<4,4,float> transform;
+    float m[16], nm[9];
+
+    std::vector<Piece*> pieces;
+    std::map<Material*, Piece*> current;
+    std::vector<ISceneNode*> baked;
+    // meshes that could not be baked.
+    unsigned int skipped;
+
+    void SetTransform(Matrix<4,4,float> transform);
+    Piece& GetPiece(MaterialPtr mat);
+    void EndNode(ISceneNode* node);
+    void AddVertex(Piece& piece, const float* v, const float* n,
+                   const float* t, const float* c, unsigned int colors);
+    bool Bake(Geometry::MeshPtr mesh);
+    StaticBatchNode* Build(const std::vector<Piece*>& batch);
+    void Clear();
+
+ public:
+    StaticBatchTransformer(IRenderer& renderer);
+    ~StaticBatchTransformer();
+
+    std::vector<StaticBatchNode*> Transform(ISceneNode& node);
+
+    void SetMaximumVertices(unsigned int vertices);
+    void SetCellSize(float size);
+
+    void VisitTransformationNode(TransformationNode* node);
+    void VisitMeshNode(MeshNode* node);
+    void VisitGeometryNode(GeometryNode* node);
+    void VisitVertexArrayNode(VertexArrayNode* node);
+
+    void VisitRenderStateNode(RenderStateNode* node);
+    void VisitBlendingNode(BlendingNode* node);
+    void VisitPostProcessNode(PostProcessNode* node);
+    void VisitRenderNode(RenderNode* node);
+    void VisitDisplayListNode(DisplayListNode* node);
+    void VisitStaticBatchNode(StaticBatchNode* node);
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _STATIC_BATCH_TRANSFORMER_H_
@@ -0,0 +1,236 @@
+// Texture array transformer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//---------------------------------------------------------------------
+
+#include <Scene/TextureArrayTransformer.h>
+
+#include <Renderers/OpenGL/Renderer.h>
+#include <Renderers/OpenGL/LightRenderer.h>
+#include <Resources/TextureArrayShader.h>
+#include <Resources/Texture3D.h>
+#include <Resources/DataBlock.h>
+#include <Geometry/Mesh.h>
+#include <Geometry/GeometrySet.h>
+#include <Geometry/Material.h>
+#include <Logging/Logger.h>
+
+#include <cstring>
+
+namespace OpenEngine {
+namespace Scene {
+
+    using namespace OpenEngine::Geometry;
+    using namespace OpenEngine::Resources;
+
+    bool TextureArrayTransformer::Key::operator<(const Key& o) const {
+        if (width != o.width) return width < o.width;
+        if (height != o.height) return height < o.height;
+        if (channels != o.channels) return channels < o.channels;
+        if (format != o.format) return format < o.format;
+        if (wrapping != o.wrapping) return wrapping < o.wrapping;
+        if (filtering != o.filtering) return filtering < o.filtering;
+        return mipmapped < o.mipmapped;
+    }
+
+    /**
+     * Construct a texture array transformer.
+     *
+     * @param renderer Initialized renderer used to load the arrays.
+     * @param lr Light renderer the array shaders follow.
+     */
+    TextureArrayTransformer::TextureArrayTransformer(Renderer& renderer,
+                                                     LightRenderer& lr)
+        : renderer(renderer)
+        , lr(lr)
+        , minLayers(2) {}
+
+    /**
+     * Destructor.
+     */
+    TextureArrayTransformer::~TextureArrayTransformer() {}
+
+    /**
+     * Pack the textures of the meshes in a tree into texture arrays.
+     *
+     * @param node Root node of a scene.
+     */
+    void TextureArrayTransformer::Transform(ISceneNode& node) {
+        if (!renderer.TextureArraySupport() || !Renderer::IsGLSLSupported()) {
+            logger.info << "TextureArrayTransformer: texture arrays are not supported" << logger.end;
+            return;
+        }
+        groups.clear();
+        users.clear();
+        node.Accept(*this);
+
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &maxLayers);
+        CHECK_FOR_GL_ERROR();
+        if (maxLayers < 1) maxLayers = 1;
+
+        std::map<Key, std::vector<ITexture2DPtr> >::iterator itr = groups.begin();
+        for (; itr != groups.end(); ++itr) {
+            std::vector<ITexture2DPtr>& textures = itr->second;
+            for (unsigned int first = 0; first < textures.size(); first += maxLayers) {
+                unsigned int last = first + maxLayers;
+                if (last > textures.size()) last = textures.size();
+                if (last - first < minLayers) continue;
+                Pack(std::vector<ITexture2DPtr>(textures.begin() + first,
+                                                textures.begin() + last));
+            }
+        }
+
+        // Return the textures in the state we got them.
+        std::map<ITexture2D*, MeshNodeList>::iterator u = users.begin();
+        for (; u != users.end(); ++u)
+            if (loaded.find(u->first) == loaded.end())
+                u->first->Unload();
+        groups.clear();
+        users.clear();
+        loaded.clear();
+    }
+
+    /**
+     * Collect the mesh if its texture can be put in an array.
+     *
+     * @param node Mesh node.
+     */
+    void TextureArrayTransformer::VisitMeshNode(MeshNode* node) {
+        MeshPtr mesh = node->GetMesh();
+        MaterialPtr mat = mesh ? mesh->GetMaterial() : MaterialPtr();
+        GeometrySetPtr geom = mesh ? mesh->GetGeometrySet() : GeometrySetPtr();
+        if (mat && geom && mat->shad == NULL &&
+            mat->Get2DTextures().size() == 1 &&
+            !geom->GetTexCoords().empty()) {
+            IDataBlockPtr tc = geom->GetTexCoords().front();
+            ITexture2DPtr tex = mat->Get2DTextures().begin()->second;
+            if (tex && tc->GetDimension() == 2 &&
+                tc->GetType() == Types::FLOAT &&
+                tc->GetVoidDataPtr() != NULL) {
+
+                MeshNodeList& u = users[tex.get()];
+                if (u.empty()) {
+                    if (tex->GetVoidDataPtr() != NULL)
+                        loaded.insert(tex.get());
+                    else
+                        tex->Load();
+                    if (tex->GetVoidDataPtr() != NULL &&
+                        tex->GetType() == Types::UBYTE &&
+                        tex->GetChannelSize() == 8) {
+                        Key k;
+                        k.width = tex->GetWidth();
+                        k.height = tex->GetHeight();
+                        k.channels = tex->GetChannels();
+                        k.format = tex->GetColorFormat();
+                        k.wrapping = tex->GetWrapping();
+                        k.filtering = tex->GetFiltering();
+                        k.mipmapped = tex->UseMipmapping();
+                        groups[k].push_back(tex);
+                    }
+                }
+                u.push_back(node);
+            }
+        }
+        node->VisitSubNodes(*this);
+    }
+
+    /**
+     * Pack a group of textures into an array and give the meshes
+     * using them the array shader.
+     */
+    void TextureArrayTransformer::Pack(const std::vector<ITexture2DPtr>& textures) {
+        ITexture2DPtr first = textures.front();
+        const unsigned int w = first->GetWidth(), h = first->GetHeight();
+        const unsigned int c = first->GetChannels();
+        const unsigned int slice = w * h * c;
+        const unsigned int count = textures.size();
+
+        unsigned char* data = new unsigned char[slice * count];
+        for (unsigned int i = 0; i < count; ++i)
+            memcpy(data + i * slice, textures[i]->GetVoidDataPtr(), slice);
+        ITexture3DPtr array(new Texture3D<unsigned char>(w, h, count, c, data));
+        array->SetColorFormat(first->GetColorFormat());
+        array->SetUseCase(ITexture3D::TEXTURE2D_ARRAY);
+        array->SetMipmapping(first->UseMipmapping());
+        array->SetWrapping(first->GetWrapping());
+        array->SetFiltering(first->GetFiltering());
+        renderer.LoadTexture(array);
+        arrays.push_back(array);
+
+        TextureArrayShader* shader = new TextureArrayShader(array, lr);
+        IShaderResourcePtr shad(shader);
+        shader->Load();
+        shaders.push_back(shad);
+
+        // Texture coordinates with the layer added, by source block.
+        std::map<IDataBlock*, IDataBlockPtr> layered;
+        for (unsigned int layer = 0; layer < count; ++layer) {
+            layered.clear();
+            MeshNodeList& nodes = users[textures[layer].get()];
+            for (unsigned int n = 0; n < nodes.size(); ++n) {
+                MeshNode* node = nodes[n];
+                MeshPtr mesh = node->GetMesh();
+                GeometrySetPtr geom = mesh->GetGeometrySet();
+                IDataBlockList tcs = geom->GetTexCoords();
+                IDataBlockPtr tc = tcs.front();
+
+                IDataBlockPtr& tc3 = layered[tc.get()];
+                if (!tc3) {
+                    const unsigned int size = tc->GetSize();
+                    const float* src = (const float*)tc->GetVoidDataPtr();
+                    float* dst = new float[size * 3];
+                    for (unsigned int i = 0; i < size; ++i) {
+                        dst[i * 3]     = src[i * 2];
+                        dst[i * 3 + 1] = src[i * 2 + 1];
+                        dst[i * 3 + 2] = layer;
+                    }
+                    tc3 = IDataBlockPtr(new DataBlock<3,float>(size, dst));
+                }
+                tcs.front() = tc3;
+                GeometrySetPtr ngeom(new GeometrySet(geom->GetVertices(),
+                                                     geom->GetNormals(),
+                                                     tcs,
+                                                     geom->GetColors()));
+
+                MaterialPtr old = mesh->GetMaterial();
+                MaterialPtr mat(new Material());
+                mat->diffuse = old->diffuse;
+                mat->ambient = old->ambient;
+                mat->specular = old->specular;
+                mat->emission = old->emission;
+                mat->shininess = old->shininess;
+                mat->shad = shad;
+
+                node->SetMesh(MeshPtr(new Mesh(mesh->GetIndices(),
+                                               mesh->GetType(),
+                                               ngeom, mat,
+                                               mesh->GetIndexOffset(),
+                                               mesh->GetDrawingRange())));
+            }
+        }
+        logger.info << "TextureArrayTransformer: packed " << count
+                    << " textures of " << w << "x" << h
+                    << " into one array" << logger.end;
+    }
+
+    /**
+     * Set the number of distinct textures needed to create an array.
+     */
+    void TextureArrayTransformer::SetMinimumLayers(unsigned int layers) {
+        minLayers = layers < 1 ? 1 : layers;
+    }
+
+    /**
+     * Get the number of arrays created.
+     */
+    unsigned int TextureArrayTransformer::GetArrayCount() {
+        return arrays.size();
+    }
+
+} // NS Scene
+} // NS OpenEngine
@@ -0,0 +1,90 @@
+// Texture array transformer.
+// -------------------------------------------------------------------
+// Copyright (C) 2010 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//---------------------------------------------------------------------
+
+#ifndef _TEXTURE_ARRAY_TRANSFORMER_H_
+#define _TEXTURE_ARRAY_TRANSFORMER_H_
+
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/ITexture3D.h>
+#include <Resources/IShaderResource.h>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace OpenEngine {
+    namespace Renderers {
+        namespace OpenGL {
+            class Renderer;
+            class LightRenderer;
+        }
+    }
+    namespace Scene {
+
+using Renderers::OpenGL::Renderer;
+using Renderers::OpenGL::LightRenderer;
+using Resources::ITexture2D;
+using Resources::ITexture2DPtr;
+using Resources::ITexture3DPtr;
+using Resources::IShaderResourcePtr;
+
+/**
+ * Packs the textures of meshes into 2D texture arrays.
+ *
+ * Meshes whose material has a single texture and no shader are
+ * grouped by the size, format and sampling of their texture. Each
+ * group with enough distinct textures is packed into one
+ * GL_TEXTURE_2D_ARRAY. The meshes of a group are given a material
+ * with a shared TextureArrayShader, and the layer of their texture
+ * is added to their texture coordinates as a third component. All
+ * meshes of a group then render with the same shader and texture
+ * bind.
+ *
+ * Requires GL_EXT_texture_array and shader support. The renderer
+ * must be initialized before transforming.
+ *
+ * @class TextureArrayTransformer TextureArrayTransformer.h Scene/TextureArrayTransformer.h
+ */
+class TextureArrayTransformer : public ISceneNodeVisitor {
+ private:
+    struct Key {
+        unsigned int width, height, channels;
+        int format, wrapping, filtering;
+        bool mipmapped;
+        bool operator<(const Key& o) const;
+    };
+    typedef std::vector<MeshNode*> MeshNodeList;
+
+    Renderer& renderer;
+    LightRenderer& lr;
+    unsigned int minLayers;
+    std::map<Key, std::vector<ITexture2DPtr> > groups;
+    std::map<ITexture2D*, MeshNodeList> users;
+    std::set<ITexture2D*> loaded;
+    std::vector<ITexture3DPtr> arrays;
+    std::vector<IShaderResourcePtr> shaders;
+
+    void Pack(const std::vector<ITexture2DPtr>& textures);
+
+ public:
+    TextureArrayTransformer(Renderer& renderer, LightRenderer& lr);
+    ~TextureArrayTransformer();
+
+    void Transform(ISceneNode& node);
+    void VisitMeshNode(MeshNode* node);
+
+    void SetMinimumLayers(unsigned int layers);
+    unsigned int GetArrayCount();
+};
+
+} // NS Scene
+} // NS OpenEngine
+
+#endif // _TEXTURE_ARRAY_TRANSFORMER_H_
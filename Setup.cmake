@@ -2,4 +2,5 @@ INCLUDE(${OE_CURRENT_EXTENSION_DIR}/SetupOpenGL.cmake)
 
 OE_ADD_SCENE_NODES(Extensions_OpenGLRenderer
   Scene/DisplayListNode
+  Scene/StaticBatchNode
 )
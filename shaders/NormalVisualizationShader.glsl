@@ -0,0 +1,5 @@
+# built-in normal, tangent and binormal visualization program
+
+vert: extensions/OpenGLRenderer/shaders/NormalVisualizationShader.glsl.vert
+geom: extensions/OpenGLRenderer/shaders/NormalVisualizationShader.glsl.geom
+frag: extensions/OpenGLRenderer/shaders/NormalVisualizationShader.glsl.frag
@@ -0,0 +1,17 @@
+// Passes the object space vertex and its vectors on to the
+// geometry shader, which expands them into lines.
+
+attribute vec3 tangent;
+attribute vec3 binormal;
+
+varying vec3 vNormal;
+varying vec3 vTangent;
+varying vec3 vBinormal;
+
+void main()
+{
+    gl_Position = gl_Vertex;
+    vNormal = gl_Normal;
+    vTangent = tangent;
+    vBinormal = binormal;
+}
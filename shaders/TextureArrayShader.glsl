@@ -0,0 +1,4 @@
+# built-in texture array shader program
+
+vert: extensions/OpenGLRenderer/shaders/TextureArrayShader.glsl.vert
+frag: extensions/OpenGLRenderer/shaders/TextureArrayShader.glsl.frag
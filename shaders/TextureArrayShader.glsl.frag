@@ -0,0 +1,9 @@
+#extension GL_EXT_texture_array : enable
+
+uniform sampler2DArray layers;
+varying vec4 color;
+
+void main (void)
+{
+    gl_FragColor = color * texture2DArray(layers, gl_TexCoord[0].stp);
+}
@@ -0,0 +1,50 @@
+// Per vertex lighting resembling the gl fixed function pipeline.
+// The layer of the texture array is passed in the third texture
+// coordinate.
+
+uniform float lighting;
+varying vec4 color;
+
+void main()
+{
+    gl_TexCoord[0] = gl_MultiTexCoord0;
+    gl_Position = ftransform();
+
+    if (lighting == 0.0) {
+        color = gl_Color;
+        return;
+    }
+
+    vec3 vert = (gl_ModelViewMatrix * gl_Vertex).xyz;
+    vec3 n = normalize(gl_NormalMatrix * gl_Normal);
+    vec3 e = normalize(-vert);
+    vec4 c = gl_FrontLightModelProduct.sceneColor;
+
+    for (int i = 0; i < NUM_LIGHTS; ++i) {
+        vec3 l;
+        float att = 1.0;
+        if (gl_LightSource[i].position.w == 0.0) { // if directional light
+            l = normalize(gl_LightSource[i].position.xyz);
+        }
+        else { // else assume positional light
+            vec3 lv = gl_LightSource[i].position.xyz - vert;
+            float dist = length(lv);
+            l = lv / dist;
+            att /=
+                gl_LightSource[i].constantAttenuation +
+                gl_LightSource[i].linearAttenuation * dist +
+                gl_LightSource[i].quadraticAttenuation * dist * dist;
+        }
+
+        float lambertTerm = max(dot(n, l), 0.0);
+        c += att * (gl_FrontLightProduct[i].ambient +
+                    gl_FrontLightProduct[i].diffuse * lambertTerm);
+        if (lambertTerm > 0.0) {
+            vec3 h = normalize(l + e);
+            c += att * gl_FrontLightProduct[i].specular *
+                pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess);
+        }
+    }
+    color = clamp(c, 0.0, 1.0);
+    color.a = gl_FrontMaterial.diffuse.a;
+}